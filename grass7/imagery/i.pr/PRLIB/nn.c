@@ -11,6 +11,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*maximum number of examples in a leaf of the kd-tree */
+#define NN_LEAF_SIZE 8
+
+static int build_node();
+static void select_median();
+static void search_node();
+static void push_neighbor();
+static void vote_neighbors();
+
 void compute_nn(NearestNeighbor * nn, int nsamples, int nvar, double **data,
 		int *data_class)
 
@@ -37,6 +46,244 @@ void compute_nn(NearestNeighbor * nn, int nsamples, int nvar, double **data,
 	}
 	nn->class[i] = data_class[i];
     }
+
+    build_nn_tree(nn);
+}
+
+
+void build_nn_tree(NearestNeighbor * nn)
+
+     /*
+        build the kd-tree over the examples of the nn model, used by
+        the predict_nn_* functions to find the nearest neighbors
+      */
+{
+    int i;
+
+    nn->order = (int *)G_calloc(nn->nsamples, sizeof(int));
+    for (i = 0; i < nn->nsamples; i++)
+	nn->order[i] = i;
+
+    nn->tree = (NNTreeNode *) G_calloc(2 * nn->nsamples + 1,
+				       sizeof(NNTreeNode));
+    nn->nnodes = 0;
+    build_node(nn, 0, nn->nsamples);
+}
+
+
+static int build_node(NearestNeighbor * nn, int start, int end)
+
+     /*
+        build the node containing the examples order[start..end-1]:
+        split them at the median of the variable with the largest range
+      */
+{
+    int node;
+    int i, j, mid;
+    double min, max, range, max_range;
+
+    node = nn->nnodes++;
+    nn->tree[node].start = start;
+    nn->tree[node].end = end;
+    nn->tree[node].var = -1;
+
+    if (end - start <= NN_LEAF_SIZE)
+	return node;
+
+    max_range = 0.0;
+    for (j = 0; j < nn->nvars; j++) {
+	min = max = nn->data[nn->order[start]][j];
+	for (i = start + 1; i < end; i++) {
+	    if (nn->data[nn->order[i]][j] < min)
+		min = nn->data[nn->order[i]][j];
+	    else if (nn->data[nn->order[i]][j] > max)
+		max = nn->data[nn->order[i]][j];
+	}
+	range = max - min;
+	if (range > max_range) {
+	    max_range = range;
+	    nn->tree[node].var = j;
+	}
+    }
+
+    /*all the examples are identical */
+    if (nn->tree[node].var < 0)
+	return node;
+
+    mid = (start + end) / 2;
+    select_median(nn, start, end, mid, nn->tree[node].var);
+    nn->tree[node].value = nn->data[nn->order[mid]][nn->tree[node].var];
+
+    nn->tree[node].left = build_node(nn, start, mid);
+    nn->tree[node].right = build_node(nn, mid, end);
+
+    return node;
+}
+
+
+static void select_median(NearestNeighbor * nn, int start, int end, int mid,
+			  int var)
+
+     /*
+        reorder order[start..end-1] so that the examples before mid
+        are <= the example at mid, and those after it are >= it
+        on variable var
+      */
+{
+    int i, j, tmp;
+    double pivot;
+
+    end--;
+    while (start < end) {
+	pivot = nn->data[nn->order[(start + end) / 2]][var];
+	i = start;
+	j = end;
+	while (i <= j) {
+	    while (nn->data[nn->order[i]][var] < pivot)
+		i++;
+	    while (nn->data[nn->order[j]][var] > pivot)
+		j--;
+	    if (i <= j) {
+		tmp = nn->order[i];
+		nn->order[i] = nn->order[j];
+		nn->order[j] = tmp;
+		i++;
+		j--;
+	    }
+	}
+	if (mid <= j)
+	    end = j;
+	else if (mid >= i)
+	    start = i;
+	else
+	    break;
+    }
+}
+
+
+void init_nn_query(NNQuery * q, int k, int nclasses)
+
+     /*
+        alloc the buffers for the search of k nearest neighbors,
+        they can be reused by any number of predictions
+        (but not concurrently)
+      */
+{
+    q->k = k;
+    q->n = 0;
+    q->dist = (double *)G_calloc(k, sizeof(double));
+    q->index = (int *)G_calloc(k, sizeof(int));
+    q->pres_class = (int *)G_calloc(nclasses, sizeof(int));
+}
+
+
+void free_nn_query(NNQuery * q)
+{
+    G_free(q->dist);
+    G_free(q->index);
+    G_free(q->pres_class);
+}
+
+
+static void push_neighbor(NNQuery * q, double dist, int index)
+
+     /*
+        add an example to the k nearest neighbors found so far,
+        kept in a max-heap (ties are broken by the index of the example)
+      */
+{
+    int i, parent, child;
+
+    if (q->n < q->k) {
+	i = q->n++;
+	while (i > 0) {
+	    parent = (i - 1) / 2;
+	    if (q->dist[parent] > dist ||
+		(q->dist[parent] == dist && q->index[parent] > index))
+		break;
+	    q->dist[i] = q->dist[parent];
+	    q->index[i] = q->index[parent];
+	    i = parent;
+	}
+	q->dist[i] = dist;
+	q->index[i] = index;
+	return;
+    }
+
+    if (dist > q->dist[0] || (dist == q->dist[0] && index > q->index[0]))
+	return;
+
+    /*replace the farthest neighbor */
+    i = 0;
+    while ((child = 2 * i + 1) < q->n) {
+	if (child + 1 < q->n &&
+	    (q->dist[child + 1] > q->dist[child] ||
+	     (q->dist[child + 1] == q->dist[child] &&
+	      q->index[child + 1] > q->index[child])))
+	    child++;
+	if (q->dist[child] < dist ||
+	    (q->dist[child] == dist && q->index[child] < index))
+	    break;
+	q->dist[i] = q->dist[child];
+	q->index[i] = q->index[child];
+	i = child;
+    }
+    q->dist[i] = dist;
+    q->index[i] = index;
+}
+
+
+static void search_node(NearestNeighbor * nn, int node, double *x,
+			NNQuery * q)
+
+     /*
+        search the k nearest neighbors of x within the node, visiting
+        first the child containing x and then the other one only if it
+        may contain an example closer than the farthest neighbor found
+      */
+{
+    NNTreeNode *t = &(nn->tree[node]);
+    double diff;
+    int i;
+
+    if (t->var < 0) {
+	for (i = t->start; i < t->end; i++)
+	    push_neighbor(q, squared_distance(x, nn->data[nn->order[i]],
+					      nn->nvars), nn->order[i]);
+	return;
+    }
+
+    diff = x[t->var] - t->value;
+    search_node(nn, diff <= 0 ? t->left : t->right, x, q);
+    if (q->n < q->k || diff * diff <= q->dist[0])
+	search_node(nn, diff <= 0 ? t->right : t->left, x, q);
+}
+
+
+static void vote_neighbors(NearestNeighbor * nn, double *x, int k,
+			   int nclasses, int *classes, NNQuery * q)
+
+     /*
+        find the k nearest neighbors of x and count them for each class
+      */
+{
+    int i, j;
+
+    q->k = k < nn->nsamples ? k : nn->nsamples;
+    q->n = 0;
+    search_node(nn, 0, x, q);
+
+    for (i = 0; i < nclasses; i++)
+	q->pres_class[i] = 0;
+
+    for (j = 0; j < q->n; j++) {
+	for (i = 0; i < nclasses; i++) {
+	    if (nn->class[q->index[j]] == classes[i]) {
+		q->pres_class[i] += 1;
+		break;
+	    }
+	}
+    }
 }
 
 
@@ -97,114 +344,53 @@ void write_nn(char *file, NearestNeighbor * nn, Features * features)
 
 
 int predict_nn_multiclass(NearestNeighbor * nn, double *x, int k,
-			  int nclasses, int *classes)
+			  int nclasses, int *classes, NNQuery * q)
 
      /* 
         multiclass problems: given a nn model, return the predicted class of a test point x 
         using k-nearest neighbor for the prediction. the array classes (of length nclasses)
-        shall contain all the possible classes to be predicted
+        shall contain all the possible classes to be predicted. q contains the
+        buffers for the search (see init_nn_query)
       */
 {
-    int i, j;
-    double *dist;
-    int *pres_class, *pred_class, *index;
+    int i;
     int max_class;
     int max;
 
-    dist = (double *)G_calloc(nn->nsamples, sizeof(double));
-    index = (int *)G_calloc(nn->nsamples, sizeof(int));
-    pred_class = (int *)G_calloc(k, sizeof(int));
-    pres_class = (int *)G_calloc(nclasses, sizeof(int));
-
-
-    for (i = 0; i < nn->nsamples; i++) {
-	dist[i] = squared_distance(x, nn->data[i], nn->nvars);
-    }
-
-    indexx_1(nn->nsamples, dist, index);
-
-    for (i = 0; i < k; i++) {
-	pred_class[i] = nn->class[index[i]];
-    }
-
-    for (j = 0; j < k; j++) {
-	for (i = 0; i < nclasses; i++) {
-	    if (pred_class[j] == classes[i]) {
-		pres_class[i] += 1;
-		break;
-	    }
-	}
-    }
-
+    vote_neighbors(nn, x, k, nclasses, classes, q);
 
     max = 0;
     max_class = 0;
     for (i = 0; i < nclasses; i++) {
-	if (pres_class[i] > max) {
-	    max = pres_class[i];
+	if (q->pres_class[i] > max) {
+	    max = q->pres_class[i];
 	    max_class = i;
 	}
     }
 
-    G_free(dist);
-    G_free(index);
-    G_free(pred_class);
-    G_free(pres_class);
-
     return classes[max_class];
 
 }
 
 
 double predict_nn_2class(NearestNeighbor * nn, double *x, int k, int nclasses,
-			 int *classes)
+			 int *classes, NNQuery * q)
 
      /* 
         2 class problems: given a nn model, return the majority of the class (with sign) 
         of a test point x using k-nearest neighbor for the prediction. 
         the array classes (of length nclasses)  shall contain all the possible 
-        classes to be predicted
+        classes to be predicted. q contains the buffers for the search
+        (see init_nn_query)
       */
 {
-    int i, j;
-    double *dist;
-    int *pres_class, *pred_class, *index;
+    vote_neighbors(nn, x, k, nclasses, classes, q);
 
-    dist = (double *)G_calloc(nn->nsamples, sizeof(double));
-    index = (int *)G_calloc(nn->nsamples, sizeof(int));
-    pred_class = (int *)G_calloc(k, sizeof(int));
-    pres_class = (int *)G_calloc(nclasses, sizeof(int));
-
-
-    for (i = 0; i < nn->nsamples; i++) {
-	dist[i] = squared_distance(x, nn->data[i], nn->nvars);
-    }
-
-    indexx_1(nn->nsamples, dist, index);
-
-    for (i = 0; i < k; i++) {
-	pred_class[i] = nn->class[index[i]];
-    }
-
-    for (j = 0; j < k; j++) {
-	for (i = 0; i < nclasses; i++) {
-	    if (pred_class[j] == classes[i]) {
-		pres_class[i] += 1;
-		break;
-	    }
-	}
-    }
-
-
-    G_free(dist);
-    G_free(index);
-    G_free(pred_class);
-
-    if (pres_class[0] > pres_class[1]) {
-	return (double)pres_class[0] / (double)(k * classes[0]);
+    if (q->pres_class[0] > q->pres_class[1]) {
+	return (double)q->pres_class[0] / (double)(k * classes[0]);
     }
     else {
-	return (double)pres_class[1] / (double)(k * classes[1]);
+	return (double)q->pres_class[1] / (double)(k * classes[1]);
     }
 
 }
@@ -227,6 +413,7 @@ void test_nn(NearestNeighbor * nn, Features * features, int k, char *file)
     double predD;
     double *error;
     double accuracy;
+    NNQuery q;
 
 
     fp = fopen(file, "w");
@@ -235,6 +422,8 @@ void test_nn(NearestNeighbor * nn, Features * features, int k, char *file)
 	G_fatal_error(tempbuf);
     }
 
+    init_nn_query(&q, k, features->nclasses);
+
     data_in_each_class = (int *)G_calloc(features->nclasses, sizeof(int));
     error = (double *)G_calloc(features->nclasses, sizeof(double));
 
@@ -247,7 +436,7 @@ void test_nn(NearestNeighbor * nn, Features * features, int k, char *file)
 		    if ((predD =
 			 predict_nn_2class(nn, features->value[i], k,
 					   features->nclasses,
-					   features->p_classes)) *
+					   features->p_classes, &q)) *
 			features->class[i] <= 0) {
 			error[j] += 1.0;
 			accuracy += 1.0;
@@ -258,7 +447,7 @@ void test_nn(NearestNeighbor * nn, Features * features, int k, char *file)
 		    if ((predI =
 			 predict_nn_multiclass(nn, features->value[i], k,
 					       features->nclasses,
-					       features->p_classes)) !=
+					       features->p_classes, &q)) !=
 			features->class[i]) {
 			error[j] += 1.0;
 			accuracy += 1.0;
@@ -303,4 +492,5 @@ void test_nn(NearestNeighbor * nn, Features * features, int k, char *file)
     fprintf(stdout, "\n");
     G_free(data_in_each_class);
     G_free(error);
+    free_nn_query(&q);
 }
@@ -424,4 +424,5 @@ static void read_nn(FILE * fp, NearestNeighbor ** nn)
 	sscanf(line, "%d", &((*nn)->class[i]));
     }
 
+    build_nn_tree(*nn);
 }
@@ -12,7 +12,14 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
+/*minimum number of examples for parallel kernel evaluations */
+#define SVM_PARALLEL_MIN 4096
+
+static void train_svm();
 static void svm_smo();
 static double learned_func_linear();
 static double learned_func_nonlinear();
@@ -22,12 +29,48 @@ static double dot_product_func();
 static int examineExample();
 static int takeStep();
 static int distance_from_span_sv();
+static void kernel_cache_init();
+static void kernel_cache_free();
+static double *kernel_row();
+static double cached_kernel();
 double dot_product();
 
+/*memory for the kernel rows cache (MB) */
+static int svm_cache_size = 100;
+
+void set_svm_kernel_cache(int megabytes)
+
+     /*
+        set the memory (in MB) for the cache of kernel rows used while
+        training a svm; concurrently trained svms share it
+      */
+{
+    svm_cache_size = megabytes;
+}
+
+
 void compute_svm(SupportVectorMachine * svm, int n, int d, double **x, int *y,
 		 int svm_kernel, double svm_kp, double svm_C, double svm_tol,
 		 double svm_eps, int svm_maxloops, int svm_verbose,
 		 double *svm_W)
+{
+    int i;
+
+    for (i = 0; i < 3; i++)
+	svm->rand_state[i] = (unsigned short)(drand48() * 65536.);
+
+    train_svm(svm, n, d, x, y, svm_kernel, svm_kp, svm_C, svm_tol, svm_eps,
+	      svm_maxloops, svm_verbose, svm_W);
+}
+
+static void train_svm(SupportVectorMachine * svm, int n, int d, double **x,
+		      int *y, int svm_kernel, double svm_kp, double svm_C,
+		      double svm_tol, double svm_eps, int svm_maxloops,
+		      int svm_verbose, double *svm_W)
+
+     /*
+        train the svm, the random generator state must be set
+      */
 {
     int i, j;
 
@@ -202,7 +245,10 @@ static void svm_smo(SupportVectorMachine * SVM)
     if (SVM->kernel_type == SVM_KERNEL_DIRECT) {
 	SVM->kernel_func = dot_product_func;
 	SVM->learned_func = learned_func_linear;
+	SVM->kernel_cache = NULL;
     }
+    else
+	kernel_cache_init(SVM);
 
     numChanged = 0;
     examineAll = 1;
@@ -230,6 +276,8 @@ static void svm_smo(SupportVectorMachine * SVM)
 	if (SVM->verbose == 1)
 	    fprintf(stderr, "%6d\b\b\b\b\b\b\b", nloops);
     }
+
+    kernel_cache_free(SVM);
 }
 
 
@@ -251,9 +299,21 @@ static double learned_func_nonlinear(int k, SupportVectorMachine * SVM)
     double s = 0.0;
     int i;
 
-    for (i = 0; i < SVM->end_support_i; i++)
-	if (SVM->alph[i] > 0)
-	    s += SVM->alph[i] * SVM->target[i] * SVM->kernel_func(i, k, SVM);
+    if (SVM->kernel_cache && SVM->kernel_cache->slot[k] >= 0) {
+	double *K = kernel_row(k, SVM);
+
+#pragma omp simd reduction(+:s)
+	for (i = 0; i < SVM->end_support_i; i++)
+	    s += SVM->alph[i] * SVM->target[i] * K[i];
+    }
+    else {
+#pragma omp parallel for schedule(static) reduction(+:s) \
+	if(SVM->end_support_i >= SVM_PARALLEL_MIN)
+	for (i = 0; i < SVM->end_support_i; i++)
+	    if (SVM->alph[i] > 0)
+		s += SVM->alph[i] * SVM->target[i] *
+		    SVM->kernel_func(i, k, SVM);
+    }
 
     s -= SVM->b;
 
@@ -278,10 +338,12 @@ static double rbf_kernel(int i1, int i2, SupportVectorMachine * SVM)
 static double dot_product_func(int i1, int i2, SupportVectorMachine * SVM)
 {
     double dot = 0.0;
+    double *x1 = SVM->dense_points[i1], *x2 = SVM->dense_points[i2];
     int i;
 
+#pragma omp simd reduction(+:dot)
     for (i = 0; i < SVM->d; i++)
-	dot += SVM->dense_points[i1][i] * SVM->dense_points[i2][i];
+	dot += x1[i] * x2[i];
 
     return dot;
 }
@@ -328,7 +390,7 @@ static int examineExample(int i1, SupportVectorMachine * SVM)
 	{
 	    int k0, k, i2;
 
-	    for (k0 = (int)(drand48() * SVM->end_support_i), k = k0;
+	    for (k0 = (int)(erand48(SVM->rand_state) * SVM->end_support_i), k = k0;
 		 k < SVM->end_support_i + k0; k++) {
 		i2 = k % SVM->end_support_i;
 		if (SVM->alph[i2] > 0 && SVM->alph[i2] < SVM->Cw[i2]) {
@@ -340,7 +402,7 @@ static int examineExample(int i1, SupportVectorMachine * SVM)
 	{
 	    int k0, k, i2;
 
-	    for (k0 = (int)(drand48() * SVM->end_support_i), k = k0;
+	    for (k0 = (int)(erand48(SVM->rand_state) * SVM->end_support_i), k = k0;
 		 k < SVM->end_support_i + k0; k++) {
 		i2 = k % SVM->end_support_i;
 		if (takeStep(i1, i2, SVM))
@@ -415,9 +477,9 @@ static int takeStep(int i1, int i2, SupportVectorMachine * SVM)
 	return 0;
 
     if (SVM->kernel_type != SVM_KERNEL_DIRECT) {
-	k11 = SVM->kernel_func(i1, i1, SVM);
-	k12 = SVM->kernel_func(i1, i2, SVM);
-	k22 = SVM->kernel_func(i2, i2, SVM);
+	k11 = cached_kernel(i1, i1, SVM);
+	k12 = cached_kernel(i1, i2, SVM);
+	k22 = cached_kernel(i2, i2, SVM);
     }
     else {
 	k11 = SVM->H[i1][i1];
@@ -518,12 +580,14 @@ static int takeStep(int i1, int i2, SupportVectorMachine * SVM)
 	t2 = y2 * (a2 - alph2);
 
 	if (SVM->kernel_type != SVM_KERNEL_DIRECT) {
+	    double *K1, *K2;
+
+	    K1 = kernel_row(i1, SVM);
+	    K2 = kernel_row(i2, SVM);
+#pragma omp parallel for simd schedule(static) \
+	if(SVM->end_support_i >= SVM_PARALLEL_MIN)
 	    for (i = 0; i < SVM->end_support_i; i++)
-		SVM->error_cache[i] +=
-		    t1 * SVM->kernel_func(i1, i,
-					  SVM) + t2 * SVM->kernel_func(i2, i,
-								       SVM) -
-		    SVM->delta_b;
+		SVM->error_cache[i] += t1 * K1[i] + t2 * K2[i] - SVM->delta_b;
 	}
 	else {
 	    for (i = 0; i < SVM->end_support_i; i++)
@@ -541,6 +605,125 @@ static int takeStep(int i1, int i2, SupportVectorMachine * SVM)
 
 }
 
+static void kernel_cache_init(SupportVectorMachine * SVM)
+
+     /*
+        allocate the LRU cache of kernel rows within the memory budget
+        (at least two rows, at most all of them)
+      */
+{
+    SVM_kernel_cache *cache;
+    double budget;
+    int i;
+
+    budget = svm_cache_size * 1048576.;
+#if defined(_OPENMP)
+    budget /= omp_get_num_threads();
+#endif
+
+    cache = (SVM_kernel_cache *) G_calloc(1, sizeof(SVM_kernel_cache));
+    cache->n = SVM->N;
+    cache->nrows = budget / (SVM->N * sizeof(double)) < SVM->N ?
+	(int)(budget / (SVM->N * sizeof(double))) : SVM->N;
+    if (cache->nrows < 2)
+	cache->nrows = SVM->N < 2 ? SVM->N : 2;
+
+    cache->rows = (double *)G_malloc((size_t) cache->nrows * cache->n *
+				     sizeof(double));
+    cache->slot = (int *)G_malloc(cache->n * sizeof(int));
+    cache->index = (int *)G_malloc(cache->nrows * sizeof(int));
+    cache->prev = (int *)G_malloc(cache->nrows * sizeof(int));
+    cache->next = (int *)G_malloc(cache->nrows * sizeof(int));
+
+    for (i = 0; i < cache->n; i++)
+	cache->slot[i] = -1;
+    for (i = 0; i < cache->nrows; i++) {
+	cache->index[i] = -1;
+	cache->prev[i] = i - 1;
+	cache->next[i] = i + 1 < cache->nrows ? i + 1 : -1;
+    }
+    cache->head = 0;
+    cache->tail = cache->nrows - 1;
+
+    SVM->kernel_cache = cache;
+}
+
+static void kernel_cache_free(SupportVectorMachine * SVM)
+{
+    SVM_kernel_cache *cache = SVM->kernel_cache;
+
+    if (!cache)
+	return;
+
+    G_free(cache->rows);
+    G_free(cache->slot);
+    G_free(cache->index);
+    G_free(cache->prev);
+    G_free(cache->next);
+    G_free(cache);
+    SVM->kernel_cache = NULL;
+}
+
+static double *kernel_row(int i, SupportVectorMachine * SVM)
+
+     /*
+        return the row of kernel values between example i and all the
+        examples, computing it in place of the least recently used row
+        if it is not cached
+      */
+{
+    SVM_kernel_cache *cache = SVM->kernel_cache;
+    double *row;
+    int s, j;
+
+    s = cache->slot[i];
+    if (s < 0) {
+	s = cache->tail;
+	if (cache->index[s] >= 0)
+	    cache->slot[cache->index[s]] = -1;
+	cache->index[s] = i;
+	cache->slot[i] = s;
+
+	row = cache->rows + (size_t) s *cache->n;
+
+#pragma omp parallel for schedule(static) if(cache->n >= SVM_PARALLEL_MIN)
+	for (j = 0; j < cache->n; j++)
+	    row[j] = SVM->kernel_func(i, j, SVM);
+    }
+
+    /* move the slot to the head of the LRU list */
+    if (s != cache->head) {
+	cache->next[cache->prev[s]] = cache->next[s];
+	if (cache->next[s] >= 0)
+	    cache->prev[cache->next[s]] = cache->prev[s];
+	else
+	    cache->tail = cache->prev[s];
+	cache->prev[s] = -1;
+	cache->next[s] = cache->head;
+	cache->prev[cache->head] = s;
+	cache->head = s;
+    }
+
+    return cache->rows + (size_t) s *cache->n;
+}
+
+static double cached_kernel(int i1, int i2, SupportVectorMachine * SVM)
+
+     /*
+        kernel value between examples i1 and i2, taken from a cached row
+        if any, computed otherwise (no row is computed for a single value)
+      */
+{
+    SVM_kernel_cache *cache = SVM->kernel_cache;
+
+    if (cache->slot[i1] >= 0)
+	return cache->rows[(size_t) cache->slot[i1] * cache->n + i2];
+    if (cache->slot[i2] >= 0)
+	return cache->rows[(size_t) cache->slot[i2] * cache->n + i1];
+
+    return SVM->kernel_func(i1, i2, SVM);
+}
+
 static int distance_from_span_sv(double **M, double *m, int n, double Const,
 				 double **H, double *h, int mH,
 				 double **K, double *k, int mK,
@@ -1137,6 +1320,7 @@ double predict_svm(SupportVectorMachine * svm, double *x)
 	for (i = 0; i < svm->N; i++) {
 	    if (svm->alph[i] > 0) {
 		K = 0.0;
+#pragma omp simd reduction(+:K)
 		for (j = 0; j < svm->d; j++)
 		    K += (svm->dense_points[i][j] -
 			  x[j]) * (svm->dense_points[i][j] - x[j]);
@@ -1197,13 +1381,18 @@ void compute_svm_bagging(BSupportVectorMachine * bsvm, int bagging,
 			 int *data_class, int svm_kernel, double kp, double C,
 			 double tol, double eps, int maxloops,
 			 int svm_verbose, double *svm_W)
+
+     /*
+        the bootstrap samples are extracted sequentially (to keep the
+        random sequence), then the svms are trained concurrently
+      */
 {
     int i, b;
     int *bsamples;
-    double **xdata_training;
-    int *xclasses_training;
+    double ***xdata_training;
+    int **xclasses_training;
     double *prob;
-    int nk;
+    int *nk;
     int *extracted;
     int index;
 
@@ -1222,8 +1411,9 @@ void compute_svm_bagging(BSupportVectorMachine * bsvm, int bagging,
     extracted = (int *)G_calloc(nsamples, sizeof(int));
     prob = (double *)G_calloc(nsamples, sizeof(double));
     bsamples = (int *)G_calloc(nsamples, sizeof(int));
-    xdata_training = (double **)G_calloc(nsamples, sizeof(double *));
-    xclasses_training = (int *)G_calloc(nsamples, sizeof(int));
+    nk = (int *)G_calloc(bsvm->nsvm, sizeof(int));
+    xdata_training = (double ***)G_calloc(bsvm->nsvm, sizeof(double **));
+    xclasses_training = (int **)G_calloc(bsvm->nsvm, sizeof(int *));
 
     for (i = 0; i < nsamples; i++) {
 	prob[i] = 1.0 / nsamples;
@@ -1237,32 +1427,45 @@ void compute_svm_bagging(BSupportVectorMachine * bsvm, int bagging,
 	for (i = 0; i < nsamples; i++) {
 	    extracted[bsamples[i]] = 1;
 	}
-	nk = 0;
+	nk[b] = 0;
 	for (i = 0; i < nsamples; i++) {
 	    if (extracted[i]) {
-		nk += 1;
+		nk[b] += 1;
 	    }
 	}
 
+	xdata_training[b] = (double **)G_calloc(nk[b], sizeof(double *));
+	xclasses_training[b] = (int *)G_calloc(nk[b], sizeof(int));
 	index = 0;
 	for (i = 0; i < nsamples; i++) {
 	    if (extracted[i]) {
-		xdata_training[index] = data[i];
-		xclasses_training[index++] = data_class[i];
+		xdata_training[b][index] = data[i];
+		xclasses_training[b][index++] = data_class[i];
 	    }
 	}
 
-	compute_svm(&(bsvm->svm[b]), nk, nvar, xdata_training,
-		    xclasses_training, svm_kernel, kp, C, tol,
-		    eps, maxloops, svm_verbose, svm_W);
+	for (i = 0; i < 3; i++)
+	    bsvm->svm[b].rand_state[i] =
+		(unsigned short)(drand48() * 65536.);
+    }
 
+#pragma omp parallel for schedule(dynamic)
+    for (b = 0; b < bsvm->nsvm; b++) {
+	train_svm(&(bsvm->svm[b]), nk[b], nvar, xdata_training[b],
+		  xclasses_training[b], svm_kernel, kp, C, tol,
+		  eps, maxloops, svm_verbose, svm_W);
     }
 
+    for (b = 0; b < bsvm->nsvm; b++) {
+	G_free(xdata_training[b]);
+	G_free(xclasses_training[b]);
+    }
     G_free(bsamples);
     G_free(xclasses_training);
     G_free(prob);
     G_free(extracted);
     G_free(xdata_training);
+    G_free(nk);
 }
 
 
@@ -1401,6 +1604,7 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
     double *prob;
     double e00, e01, e10, e11, prior0, prior1;
     int *error;
+    double *margin;
     double eps, totprob;
     double totbeta;
     int nk;
@@ -1427,6 +1631,7 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
     xdata_training = (double **)G_calloc(nsamples, sizeof(double *));
     xclasses_training = (int *)G_calloc(nsamples, sizeof(int));
     error = (int *)G_calloc(nsamples, sizeof(int));
+    margin = (double *)G_calloc(nsamples, sizeof(double));
 
     for (i = 0; i < nsamples; i++) {
 	prob[i] = 1.0 / nsamples;
@@ -1464,11 +1669,17 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
 		    xclasses_training, svm_kernel, kp, C, tol,
 		    svm_eps, maxloops, svm_verbose, svm_W);
 
+	/* each svm depends on the errors of the previous one, so only
+	   the predictions of the training data are computed concurrently */
+#pragma omp parallel for schedule(static)
+	for (i = 0; i < nsamples; i++) {
+	    margin[i] = predict_svm(&(bsvm->svm[b]), data[i]);
+	}
+
 	e00 = e01 = e10 = e11 = prior0 = prior1 = 0.0;
 	for (i = 0; i < nsamples; i++) {
 	    if (data_class[i] == classes[0]) {
-		if (predict_svm(&(bsvm->svm[b]), data[i]) * data_class[i] <=
-		    0.0) {
+		if (margin[i] * data_class[i] <= 0.0) {
 		    error[i] = TRUE;
 		    e01 += prob[i];
 		}
@@ -1479,8 +1690,7 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
 		prior0 += prob[i];
 	    }
 	    else {
-		if (predict_svm(&(bsvm->svm[b]), data[i]) * data_class[i] <=
-		    0.0) {
+		if (margin[i] * data_class[i] <= 0.0) {
 		    error[i] = TRUE;
 		    e10 += prob[i];
 		}
@@ -1546,6 +1756,7 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
     G_free(extracted);
     G_free(xdata_training);
     G_free(error);
+    G_free(margin);
 
 }
 
@@ -25,8 +25,21 @@
 #include <grass/glocale.h>
 #include "global.h"
 
+/*number of cells gathered into a block of output rows */
+#define BLOCK_CELLS 65536
+/*number of cells of a block processed together by a thread */
+#define CHUNK_CELLS 64
+
+typedef struct
+{
+    int first;			/*first input row of the block */
+    int nrows;			/*number of input rows of the block */
+    double ***rows;		/*for each layer, the input rows of the block */
+} RowBlock;
 
 int extract_array_with_null();
+void alloc_row_block();
+void read_row_block();
 
 int main(int argc, char *argv[])
 {
@@ -44,27 +57,28 @@ int main(int argc, char *argv[])
     char tmpbuf[500];
     char *mapset;
     struct Cell_head cellhd;
-    double ***matrix;
-    DCELL *rowbuf;
-    DCELL *tf;
+    RowBlock block[2];
+    int cur;
+    int nblock_rows, nout_rows, out_row;
+    int ncells, width;
+    double *X_data;
+    double **X;
+    int *cell_null;
+    DCELL **output_rows;
     int *fd;
-    int r, c, l;
+    int r, l;
     Features features;
     int i, j;
     int fdout;
     int *space_for_each_layer;
-    double *wind_vect;
-    double *X;
     int borderC, borderR, borderC_upper, dim;
-    double mean, sd;
-    int corrent_feature;
-    double *projected;
     int *compute_features;
+    int *normalize_layer;
+    int *raw_at, *mean_at, *variance_at, *pca_at, *pca_ncomp, *pca_slot;
+    int npca_layers;
+    int corrent_feature;
     DCELL *output_cell;
-    int set_null;
     int n_input_map;
-    int R, C;
-    int last_row;
 
     /* Define the different options */
 
@@ -177,26 +191,74 @@ int main(int argc, char *argv[])
 	}
     }
 
-    /*alloc memory */
-    matrix =
-	(double ***)G_calloc(features.training.nlayers, sizeof(double **));
-    for (l = 0; l < features.training.nlayers; l++) {
-	matrix[l] =
-	    (double **)G_calloc(features.training.rows, sizeof(double *));
-	for (r = 0; r < features.training.rows; r++) {
-	    matrix[l][r] = (double *)G_calloc(cellhd.cols, sizeof(double));
-	}
-    }
-    fd = (int *)G_calloc(features.training.nlayers, sizeof(int));
-    X = (double *)G_calloc(features.examples_dim, sizeof(double));
-
-    wind_vect = (double *)G_calloc(dim, sizeof(double));
+    /*locate the features of each layer within the feature vector */
+    normalize_layer = (int *)G_calloc(features.training.nlayers, sizeof(int));
+    raw_at = (int *)G_calloc(features.training.nlayers, sizeof(int));
+    mean_at = (int *)G_calloc(features.training.nlayers, sizeof(int));
+    variance_at = (int *)G_calloc(features.training.nlayers, sizeof(int));
+    pca_at = (int *)G_calloc(features.training.nlayers, sizeof(int));
+    pca_ncomp = (int *)G_calloc(features.training.nlayers, sizeof(int));
+    pca_slot = (int *)G_calloc(features.training.nlayers, sizeof(int));
 
     /* this make the program working, but... */
     features.npc = features.examples_dim;
 
-    projected = (double *)G_calloc(features.npc, sizeof(double));
+    corrent_feature = 0;
+    npca_layers = 0;
+    for (l = 0; l < features.training.nlayers; l++) {
+	raw_at[l] = mean_at[l] = variance_at[l] = pca_at[l] = pca_slot[l] =
+	    -1;
+	if (features.f_normalize[0]) {
+	    for (j = 2; j < 2 + features.f_normalize[1]; j++) {
+		if (features.f_normalize[j] == l) {
+		    normalize_layer[l] = TRUE;
+		    break;
+		}
+	    }
+	}
+	if (!compute_features[l]) {
+	    raw_at[l] = corrent_feature;
+	    corrent_feature += dim;
+	    continue;
+	}
+	if (features.f_mean[0]) {
+	    for (j = 2; j < 2 + features.f_mean[1]; j++) {
+		if (features.f_mean[j] == l) {
+		    mean_at[l] = corrent_feature;
+		    corrent_feature += 1;
+		    break;
+		}
+	    }
+	}
+	if (features.f_variance[0]) {
+	    for (j = 2; j < 2 + features.f_variance[1]; j++) {
+		if (features.f_variance[j] == l) {
+		    variance_at[l] = corrent_feature;
+		    corrent_feature += 1;
+		    break;
+		}
+	    }
+	}
+	if (features.f_pca[0]) {
+	    for (j = 2; j < 2 + features.f_pca[1]; j++) {
+		if (features.f_pca[j] == l) {
+		    /*at most npc components, as far as they fit the
+		       feature vector */
+		    pca_ncomp[l] = features.npc;
+		    if (pca_ncomp[l] > dim)
+			pca_ncomp[l] = dim;
+		    if (pca_ncomp[l] > features.examples_dim - corrent_feature)
+			pca_ncomp[l] = features.examples_dim - corrent_feature;
+		    pca_at[l] = corrent_feature;
+		    pca_slot[l] = npca_layers++;
+		    corrent_feature += pca_ncomp[l];
+		    break;
+		}
+	    }
+	}
+    }
 
+    fd = (int *)G_calloc(features.training.nlayers, sizeof(int));
     output_cell = Rast_allocate_d_buf();
 
     /*open the input maps */
@@ -234,199 +296,248 @@ int main(int argc, char *argv[])
     borderC = (features.training.cols - 1) / 2;
     borderC_upper = cellhd.cols - borderC;
     borderR = (features.training.rows - 1) / 2;
-    last_row = features.training.rows - 1;
-
-
-    /*read first rows */
-    for (r = 0; r < features.training.rows; r++) {
-	rowbuf =
-	    (DCELL *) G_calloc(features.training.nlayers * cellhd.cols,
-			       sizeof(DCELL));
-	tf = rowbuf;
-	for (l = 0; l < features.training.nlayers; l++) {
-	    Rast_get_d_row(fd[l], tf, r);
-	    for (c = 0; c < cellhd.cols; c++) {
-		if (Rast_is_d_null_value(tf))
-		    *tf = 0.0;
-		matrix[l][r][c] = *tf;
-		tf++;
-	    }
-	}
-	G_free(rowbuf);
+    width = borderC_upper - borderC;
+    if (width < 0)
+	width = 0;
+    nout_rows = cellhd.rows - features.training.rows + 1;
+    if (nout_rows < 0)
+	nout_rows = 0;
+
+    /*the output rows are computed in blocks of about BLOCK_CELLS cells */
+    nblock_rows = BLOCK_CELLS / (width > 0 ? width : 1);
+    if (nblock_rows < 1)
+	nblock_rows = 1;
+    if (nblock_rows > nout_rows)
+	nblock_rows = nout_rows > 0 ? nout_rows : 1;
+
+    /*alloc memory */
+    for (i = 0; i < 2; i++)
+	alloc_row_block(&block[i], features.training.nlayers,
+			nblock_rows + features.training.rows - 1,
+			cellhd.cols);
+    ncells = nblock_rows * width;
+    X_data = (double *)G_calloc((size_t) ncells * features.examples_dim,
+				sizeof(double));
+    X = (double **)G_calloc(ncells, sizeof(double *));
+    for (i = 0; i < ncells; i++)
+	X[i] = X_data + (size_t) i *features.examples_dim;
+    cell_null = (int *)G_calloc(ncells, sizeof(int));
+    output_rows = (DCELL **) G_calloc(nblock_rows, sizeof(DCELL *));
+    for (r = 0; r < nblock_rows; r++) {
+	output_rows[r] = Rast_allocate_d_buf();
+	Rast_set_d_null_value(output_rows[r], cellhd.cols);
     }
 
     /*write the first rows of the output map */
-    for (c = 1; c <= cellhd.cols; c++)
-	Rast_set_d_null_value(output_cell, c);
+    Rast_set_d_null_value(output_cell, cellhd.cols);
     for (r = 0; r < borderR; r++)
 	Rast_put_d_row(fdout, output_cell);
 
+    /*read the first block */
+    cur = 0;
+    if (nout_rows > 0)
+	read_row_block(&block[cur], NULL, fd, features.training.nlayers,
+		       cellhd.cols, 0,
+		       nblock_rows + features.training.rows - 1);
+
     /*computing... */
-    r = features.training.rows;
-
-    while (r <= cellhd.rows) {
-	for (c = borderC; c < borderC_upper; c++) {
-	    corrent_feature = 0;
-	    for (l = 0; l < features.training.nlayers; l++) {
-		set_null = extract_array_with_null(features.training.rows,
-						   features.training.cols,
-						   c, borderC, matrix[l],
-						   wind_vect);
-
-		if (set_null) {
-		    break;
+    for (out_row = 0; out_row < nout_rows; out_row += nblock_rows) {
+	int nrows = nblock_rows;
+	int next_row = out_row + nblock_rows;
+	int n = 0;
+
+	if (nrows > nout_rows - out_row)
+	    nrows = nout_rows - out_row;
+	ncells = nrows * width;
+
+#pragma omp parallel
+	{
+	    NNQuery nn_query;
+	    double *wind_vect;
+	    double ***pca_wind;
+	    double **pca_out;
+	    int p0, p, q, b, cc, ll, k;
+	    double mean, sd;
+
+	    /*one thread prefetches the next block, the others start
+	       classifying this one and are joined by it when done */
+#pragma omp single nowait
+	    {
+		if (next_row < nout_rows) {
+		    int nnext = nblock_rows;
+
+		    if (nnext > nout_rows - next_row)
+			nnext = nout_rows - next_row;
+		    read_row_block(&block[1 - cur], &block[cur], fd,
+				   features.training.nlayers, cellhd.cols,
+				   next_row,
+				   nnext + features.training.rows - 1);
 		}
-		else {
-		    mean = mean_of_double_array(wind_vect, dim);
-		    sd = sd_of_double_array_given_mean(wind_vect, dim, mean);
-
-		    if (features.f_normalize[0]) {
-			for (j = 2; j < 2 + features.f_normalize[1]; j++) {
-			    if (features.f_normalize[j] == l) {
-				for (i = 0; i < dim; i++) {
-				    wind_vect[i] = (wind_vect[i] - mean) / sd;
-				}
-				break;
-			    }
+	    }
+
+	    wind_vect = (double *)G_calloc(dim, sizeof(double));
+	    pca_wind = (double ***)G_calloc(npca_layers, sizeof(double **));
+	    for (k = 0; k < npca_layers; k++) {
+		pca_wind[k] = (double **)G_calloc(CHUNK_CELLS,
+						  sizeof(double *));
+		for (q = 0; q < CHUNK_CELLS; q++)
+		    pca_wind[k][q] = (double *)G_calloc(dim, sizeof(double));
+	    }
+	    pca_out = (double **)G_calloc(CHUNK_CELLS, sizeof(double *));
+	    if (model_type == NN_model)
+		init_nn_query(&nn_query, nn.k, features.nclasses);
+
+#pragma omp for schedule(dynamic)
+	    for (p0 = 0; p0 < ncells; p0 += CHUNK_CELLS) {
+		int np = ncells - p0 < CHUNK_CELLS ? ncells - p0 : CHUNK_CELLS;
+
+		/*gather the feature vectors of the chunk */
+		for (q = 0; q < np; q++) {
+		    p = p0 + q;
+		    b = p / width;
+		    cc = borderC + p % width;
+		    cell_null[p] = 0;
+		    for (ll = 0; ll < features.training.nlayers; ll++) {
+			double *w = pca_slot[ll] < 0 ? wind_vect :
+			    pca_wind[pca_slot[ll]][q];
+
+			if (extract_array_with_null(features.training.rows,
+						    features.training.cols,
+						    cc, borderC,
+						    block[cur].rows[ll] + b,
+						    w)) {
+			    cell_null[p] = 1;
+			    break;
 			}
+
+			mean = mean_of_double_array(w, dim);
+			sd = sd_of_double_array_given_mean(w, dim, mean);
+			if (normalize_layer[ll])
+			    for (k = 0; k < dim; k++)
+				w[k] = (w[k] - mean) / sd;
+
+			if (raw_at[ll] >= 0)
+			    for (k = 0; k < dim; k++)
+				X[p][raw_at[ll] + k] = w[k];
+			if (mean_at[ll] >= 0)
+			    X[p][mean_at[ll]] = mean;
+			if (variance_at[ll] >= 0)
+			    X[p][variance_at[ll]] = sd * sd;
 		    }
+		}
 
-		    if (!compute_features[l]) {
-			for (i = 0; i < dim; i++) {
-			    X[corrent_feature + i] = wind_vect[i];
-			}
-			corrent_feature += dim;
+		/*project the windows of the chunk on the principal
+		   components at once */
+		for (ll = 0; ll < features.training.nlayers; ll++) {
+		    if (pca_slot[ll] < 0)
+			continue;
+		    for (q = 0; q < np; q++)
+			pca_out[q] = X[p0 + q] + pca_at[ll];
+		    product_double_matrix_double_matrix(pca_wind[pca_slot[ll]],
+							features.pca[ll].eigmat,
+							np, dim, pca_ncomp[ll],
+							pca_out);
+		}
+
+		/*standardize and classify */
+		for (q = 0; q < np; q++) {
+		    double *x;
+
+		    p = p0 + q;
+		    x = X[p];
+		    b = p / width;
+		    cc = borderC + p % width;
+		    if (cell_null[p]) {
+			output_rows[b][cc] = 0.0;
+			continue;
 		    }
-		    else {
-			if (features.f_mean[0]) {
-			    for (j = 2; j < 2 + features.f_mean[1]; j++) {
-				if (features.f_mean[j] == l) {
-				    X[corrent_feature] = mean;
-				    corrent_feature += 1;
-				    break;
-				}
-			    }
+		    if (features.f_standardize[0]) {
+			for (k = 2; k < 2 + features.f_standardize[1]; k++) {
+			    x[features.f_standardize[k]] =
+				(x[features.f_standardize[k]] -
+				 features.mean[k - 2]) / features.sd[k - 2];
 			}
-			if (features.f_variance[0]) {
-			    for (j = 2; j < 2 + features.f_variance[1]; j++) {
-				if (features.f_variance[j] == l) {
-				    X[corrent_feature] = sd * sd;
-				    corrent_feature += 1;
-				    break;
-				}
-			    }
+		    }
+		    if (features.nclasses == 2) {
+			switch (model_type) {
+			case NN_model:
+			    output_rows[b][cc] =
+				predict_nn_2class(&nn, x, nn.k,
+						  features.nclasses,
+						  features.p_classes,
+						  &nn_query);
+			    break;
+			case GM_model:
+			    output_rows[b][cc] = predict_gm_2class(&gm, x);
+			    break;
+			case CT_model:
+			    output_rows[b][cc] = predict_tree_2class(&tree, x);
+			    break;
+			case SVM_model:
+			    output_rows[b][cc] = predict_svm(&svm, x);
+			    break;
+			case BCT_model:
+			    output_rows[b][cc] =
+				predict_btree_2class(&btree, x);
+			    break;
+			case BSVM_model:
+			    output_rows[b][cc] = predict_bsvm(&bsvm, x);
+			    break;
+			default:
+			    break;
 			}
-			if (features.f_pca[0]) {
-			    for (j = 2; j < 2 + features.f_pca[1]; j++) {
-				if (features.f_pca[j] == l) {
-				    product_double_vector_double_matrix
-					(features.pca[l].eigmat, wind_vect,
-					 dim, features.npc, projected);
-
-				    for (i = 0; i < features.npc; i++) {
-					X[corrent_feature + i] = projected[i];
-				    }
-				    corrent_feature += features.npc;
-				    break;
-				}
-			    }
+		    }
+		    else {
+			switch (model_type) {
+			case NN_model:
+			    output_rows[b][cc] =
+				predict_nn_multiclass(&nn, x, nn.k,
+						      features.nclasses,
+						      features.p_classes,
+						      &nn_query);
+			    break;
+			case GM_model:
+			    output_rows[b][cc] =
+				predict_gm_multiclass(&gm, x);
+			    break;
+			case CT_model:
+			    output_rows[b][cc] =
+				predict_tree_multiclass(&tree, x);
+			    break;
+			case BCT_model:
+			    output_rows[b][cc] =
+				predict_btree_multiclass(&btree, x,
+							 features.nclasses,
+							 features.p_classes);
+			    break;
+			default:
+			    break;
 			}
 		    }
 		}
 	    }
-	    if (set_null) {
-		output_cell[c] = 0.0;
-	    }
-	    else {
-		if (features.f_standardize[0]) {
-		    for (i = 2; i < 2 + features.f_standardize[1]; i++) {
-			X[features.f_standardize[i]] =
-			    (X[features.f_standardize[i]] -
-			     features.mean[i - 2]) / features.sd[i - 2];
-		    }
-		}
-		if (features.nclasses == 2) {
-		    switch (model_type) {
-		    case NN_model:
-			output_cell[c] =
-			    predict_nn_2class(&nn, X, nn.k, features.nclasses,
-					      features.p_classes);
-			break;
-		    case GM_model:
-			output_cell[c] = predict_gm_2class(&gm, X);
-			break;
-		    case CT_model:
-			output_cell[c] = predict_tree_2class(&tree, X);
-			break;
-		    case SVM_model:
-			output_cell[c] = predict_svm(&svm, X);
-			break;
-		    case BCT_model:
-			output_cell[c] = predict_btree_2class(&btree, X);
-			break;
-		    case BSVM_model:
-			output_cell[c] = predict_bsvm(&bsvm, X);
-			break;
-		    default:
-			break;
-		    }
-		}
-		else {
-		    switch (model_type) {
-		    case NN_model:
-			output_cell[c] =
-			    predict_nn_multiclass(&nn, X, nn.k,
-						  features.nclasses,
-						  features.p_classes);
-			break;
-		    case GM_model:
-			output_cell[c] = predict_gm_multiclass(&gm, X);
-			break;
-		    case CT_model:
-			output_cell[c] = predict_tree_multiclass(&tree, X);
-			break;
-		    case BCT_model:
-			output_cell[c] =
-			    predict_btree_multiclass(&btree, X,
-						     features.nclasses,
-						     features.p_classes);
-			break;
-		    default:
-			break;
-		    }
-		}
+
+	    if (model_type == NN_model)
+		free_nn_query(&nn_query);
+	    for (k = 0; k < npca_layers; k++) {
+		for (q = 0; q < CHUNK_CELLS; q++)
+		    G_free(pca_wind[k][q]);
+		G_free(pca_wind[k]);
 	    }
+	    G_free(pca_wind);
+	    G_free(pca_out);
+	    G_free(wind_vect);
 	}
-	Rast_put_d_row(fdout, output_cell);
-	percent(r, cellhd.rows, 1);
-
-	if (r < cellhd.rows) {
-	    for (l = 0; l < features.training.nlayers; l++) {
-		for (R = 0; R < last_row; R++) {
-		    for (C = 0; C < cellhd.cols; C++) {
-			matrix[l][R][C] = matrix[l][R + 1][C];
-		    }
-		}
-
-		rowbuf = (DCELL *) G_calloc(cellhd.cols, sizeof(DCELL));
-		tf = rowbuf;
 
-		Rast_get_d_row(fd[l], tf, r);
-		for (c = 0; c < cellhd.cols; c++) {
-		    if (Rast_is_d_null_value(tf))
-			*tf = 0.0;
-		    matrix[l][last_row][c] = *tf;
-		    tf++;
-		}
-		G_free(rowbuf);
-	    }
+	/*write the classified rows */
+	for (n = 0; n < nrows; n++) {
+	    Rast_put_d_row(fdout, output_rows[n]);
+	    percent(out_row + n + features.training.rows, cellhd.rows, 1);
 	}
-	r += 1;
+	cur = 1 - cur;
     }
 
     /*write the last rows of the output map */
-    for (c = 1; c <= cellhd.cols; c++)
-	Rast_set_d_null_value(output_cell, c);
     for (r = 0; r < borderR; r++)
 	Rast_put_d_row(fdout, output_cell);
 
@@ -456,3 +567,57 @@ int extract_array_with_null(int R, int C, int c, int bc, double **mat,
 	return 0;
     }
 }
+
+void alloc_row_block(RowBlock * block, int nlayers, int nrows, int cols)
+
+     /*
+        alloc the input rows of all the nlayers layers for a block 
+        of at most nrows rows
+      */
+{
+    int l, r;
+
+    block->first = 0;
+    block->nrows = 0;
+    block->rows = (double ***)G_calloc(nlayers, sizeof(double **));
+    for (l = 0; l < nlayers; l++) {
+	block->rows[l] = (double **)G_calloc(nrows, sizeof(double *));
+	for (r = 0; r < nrows; r++)
+	    block->rows[l][r] = (double *)G_calloc(cols, sizeof(double));
+    }
+}
+
+void read_row_block(RowBlock * block, RowBlock * prev, int *fd, int nlayers,
+		    int cols, int first, int nrows)
+
+     /*
+        read the rows first ... first + nrows - 1 of the nlayers maps
+        fd into block, null values being set to 0.0. The rows already
+        contained in the block prev (if not NULL) are copied from it
+      */
+{
+    int l, r, c;
+    int ncopied = 0;
+
+    if (prev && prev->nrows > 0 && first >= prev->first &&
+	first < prev->first + prev->nrows) {
+	ncopied = prev->first + prev->nrows - first;
+	if (ncopied > nrows)
+	    ncopied = nrows;
+    }
+
+    for (l = 0; l < nlayers; l++) {
+	for (r = 0; r < ncopied; r++)
+	    memcpy(block->rows[l][r],
+		   prev->rows[l][first - prev->first + r],
+		   cols * sizeof(double));
+	for (r = ncopied; r < nrows; r++) {
+	    Rast_get_d_row(fd[l], block->rows[l][r], first + r);
+	    for (c = 0; c < cols; c++)
+		if (Rast_is_d_null_value(&block->rows[l][r][c]))
+		    block->rows[l][r][c] = 0.0;
+	}
+    }
+    block->first = first;
+    block->nrows = nrows;
+}
@@ -56,6 +56,7 @@ int main(int argc, char **argv)
     struct Option *opt26;
     struct Option *opt27;
     struct Option *opt28;
+    struct Option *opt29;
     struct Flag *flag_g;
     struct Flag *flag_t;
     struct Flag *flag_s;
@@ -78,6 +79,7 @@ int main(int argc, char **argv)
     int svm_maxloops;
     int svm_kernel;
     int svm_verbose;
+    int svm_cache;
     double svm_cost;
     double *svm_W;
     int bagging, boosting, reg, reg_verbose;
@@ -320,6 +322,14 @@ int main(int argc, char **argv)
     opt22->options = "0,1";
     opt22->answer = "0";
 
+    opt29 = G_define_option();
+    opt29->key = "svm_cache";
+    opt29->type = TYPE_INTEGER;
+    opt29->required = NO;
+    opt29->description =
+	"For svm: memory (in MB) for the cache of kernel rows.";
+    opt29->answer = "100";
+
     opt17 = G_define_option();
     opt17->key = "nn_k";
     opt17->type = TYPE_INTEGER;
@@ -443,6 +453,12 @@ int main(int argc, char **argv)
 	}
 	sscanf(opt11->answer, "%d", &svm_l1o);
 	sscanf(opt22->answer, "%d", &svm_verbose);
+	sscanf(opt29->answer, "%d", &svm_cache);
+	if (svm_cache <= 0) {
+	    sprintf(tmpbuf, "kernel cache memory must be > 0\n");
+	    G_fatal_error(tmpbuf);
+	}
+	set_svm_kernel_cache(svm_cache);
     }
 
     sscanf(opt13->answer, "%d", &bagging);
@@ -35,6 +35,7 @@ int main(int argc, char *argv[])
     struct Option *opt2;
     int model_type;
     NearestNeighbor nn;
+    NNQuery nn_query;
     GaussianMixture gm;
     Tree tree;
     SupportVectorMachine svm;
@@ -114,6 +115,9 @@ int main(int argc, char *argv[])
     if (model_type == GM_model) {
 	compute_test_gm(&gm);
     }
+    if (model_type == NN_model) {
+	init_nn_query(&nn_query, nn.k, features.nclasses);
+    }
 
     /* load current region */
     G_get_window(&cellhd);
@@ -329,7 +333,7 @@ int main(int argc, char *argv[])
 		    case NN_model:
 			output_cell[r - borderR][c] =
 			    predict_nn_2class(&nn, X, nn.k, features.nclasses,
-					      features.p_classes);
+					      features.p_classes, &nn_query);
 			break;
 		    case GM_model:
 			output_cell[r - borderR][c] =
@@ -359,7 +363,7 @@ int main(int argc, char *argv[])
 			output_cell[r - borderR][c] =
 			    predict_nn_multiclass(&nn, X, nn.k,
 						  features.nclasses,
-						  features.p_classes);
+						  features.p_classes, &nn_query);
 			break;
 		    case GM_model:
 			output_cell[r - borderR][c] =
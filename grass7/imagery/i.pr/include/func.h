@@ -100,6 +100,9 @@ int read_model();
  */
 
 void compute_nn();
+void build_nn_tree();
+void init_nn_query();
+void free_nn_query();
 void write_nn();
 int predict_nn_multiclass();
 double predict_nn_2class();
@@ -109,6 +112,7 @@ void test_nn();
    svm.c
  */
 
+void set_svm_kernel_cache();
 void compute_svm();
 void estimate_cv_error();
 void write_svm();
@@ -142,6 +142,16 @@ typedef struct
     Features features;		/*the features used for the model development */
 } GaussianMixture;
 
+typedef struct
+{
+    int start;			/*first example of the node in the kd-tree order */
+    int end;			/*last example of the node (excluded) */
+    int var;			/*split variable, -1 for leaves */
+    double value;		/*split value */
+    int left;			/*node with the examples <= value */
+    int right;			/*node with the examples >= value */
+} NNTreeNode;
+
 typedef struct
 {
     int nsamples;		/*number of examples */
@@ -150,8 +160,20 @@ typedef struct
     int *class;			/*their classes */
     int k;
     Features features;		/*the features used for the model development */
+    int *order;			/*the examples in the kd-tree order */
+    NNTreeNode *tree;		/*kd-tree over the examples */
+    int nnodes;			/*number of nodes of the kd-tree */
 } NearestNeighbor;
 
+typedef struct
+{
+    int k;			/*number of neighbors to be found */
+    int n;			/*number of neighbors found */
+    double *dist;		/*squared distances of the neighbors (max-heap) */
+    int *index;			/*the neighbors */
+    int *pres_class;		/*number of neighbors of each class */
+} NNQuery;
+
 typedef struct
 {
     int d;
@@ -165,6 +187,19 @@ typedef struct
     double b;
 } SVM_direct_kernel;
 
+typedef struct
+{
+    int n;			/*length of the kernel rows */
+    int nrows;			/*number of cached rows */
+    double *rows;		/*cached kernel rows */
+    int *slot;			/*slot of each row, -1 if not cached */
+    int *index;			/*row cached in each slot, -1 if empty */
+    int *prev;			/*previous slot in the LRU list */
+    int *next;			/*next slot in the LRU list */
+    int head;			/*most recently used slot */
+    int tail;			/*least recently used slot */
+} SVM_kernel_cache;
+
 typedef struct
 {
     int N;			/*number of examples */
@@ -198,6 +233,8 @@ typedef struct
     int verbose;
     double cost;		/*sen/spe cost (only for single svm) */
     Features features;		/*the features used for the model development */
+    SVM_kernel_cache *kernel_cache;	/*kernel rows (only during the optimization) */
+    unsigned short rand_state[3];	/*random generator of the optimization */
 } SupportVectorMachine;
 
 
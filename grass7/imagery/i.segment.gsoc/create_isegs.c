@@ -167,55 +167,38 @@ int create_isegs(struct files *files, struct functions *functions)
 
 int region_growing(struct files *files, struct functions *functions)
 {
-    int row, col, t;
-    double threshold, Ri_similarity, Rk_similarity, tempsim;
+    int k, t, best, merged;
+    double threshold, similarity;
     int endflag;		/* =TRUE if there were no merges on that processing iteration */
-    int pathflag;		/* =TRUE if we didn't find mutual neighbors, and should continue with Rk */
-    struct pixels *Ri_head, *Rk_head, *Rin_head, *Rkn_head,
-	*current, *newpixel, *Ri_bestn;
-    int Ri_count, Rk_count;	/* number of pixels/cells in Ri and Rk */
-
-#ifdef VCLOSE
-    struct pixels *Rclose_head, *Rc_head, *Rc_tail, *Rcn_head;
-    int Rc_count;
-#endif
+    struct rag rag;		/* region adjacency graph of the current processing window */
+    struct rag_queue queue;	/* Ri with their most similar neighbor, most similar first */
+    struct rag_queue_item item;
 
 #ifdef PROFILE
     clock_t start, end;
-    clock_t merge_start, merge_end;
-    double merge_accum, merge_lap;
-    clock_t fn_start, fn_end;
-    double fn_accum, fn_lap;
     clock_t pass_start, pass_end;
 
-    merge_accum = fn_accum = 0;
     start = clock();
 #endif
-    /* files->token has the "link_head" for linkm: linked list memory allocation.
+    /* The segments and their neighbors are kept in a region adjacency graph,
+     * so neighbors are not searched pixel by pixel again after each merge.
      * 
-     * 4 linked lists of pixels:
-     * Ri = current focus segment
-     * Rk = Ri's most similar neighbor
-     * Rkn = Rk's neighbors
-     * Rin = Ri's neigbors
+     * Each pass queues every seed segment Ri with its most similar neighbor Rk.
+     * Taking the most similar pair first, Ri and Rk are mutually best
+     * neighbors.  After a merge, the new segment is queued again and
+     * queue items of merged segments are updated when they come up.
+     * With the limited flag, a segment can be merged only once per pass.
      * */
     if (files->bounds_map == NULL)
 	G_message(_("Running region growing algorithm, the percent completed is based on %d max iterations, but the process will end earlier if no further merges can be made."),
 		  functions->end_t);
 
     t = 1;
+    endflag = TRUE;
 
-    /*set linked list head pointers to null. */
-    Ri_head = NULL;
-    Rk_head = NULL;
-    Rin_head = NULL;
-    Rkn_head = NULL;
-    Ri_bestn = NULL;
-#ifdef VCLOSE
-    Rclose_head = NULL;
-    Rc_head = NULL;
-    Rcn_head = NULL;
-#endif
+    rag_create(&rag, files, functions);
+    queue.items = NULL;
+    queue.nitems = queue.aitems = 0;
 
     /* One paper mentioned gradually lowering the threshold at each iteration.
      * if this is implemented, move this assignment inside the do loop and make it a function of t. */
@@ -239,263 +222,78 @@ int region_growing(struct files *files, struct functions *functions)
 
 	endflag = TRUE;
 
-	/* Set candidate flag to true/1 for all pixels */
-	set_all_candidate_flags(files);
-
-	/*process candidate pixels for this iteration */
-
-	/*check each pixel, start the processing only if it is a candidate pixel */
-
-	for (row = files->minrow; row < files->maxrow; row++) {
-	    for (col = files->mincol; col < files->maxcol; col++) {
-
-		if (FLAG_GET(files->candidate_flag, row, col) &&
-		    FLAG_GET(files->seeds_flag, row, col)) {
-
-		    /*free memory for linked lists */
-		    my_dispose_list(files->token, &Ri_head);
-		    my_dispose_list(files->token, &Rk_head);
-		    my_dispose_list(files->token, &Rin_head);
-		    my_dispose_list(files->token, &Rkn_head);
-#ifdef VCLOSE
-		    my_dispose_list(files->token, &Rclose_head);
-#endif
-		    Rk_count = 0;
-
-		    /* First pixel in Ri is current row/col pixel.  
-		     * We may add more later if it is part of a segment */
-		    Ri_count = 1;
-		    newpixel = (struct pixels *)link_new(files->token);
-		    newpixel->next = NULL;
-		    newpixel->row = row;
-		    newpixel->col = col;
-		    Ri_head = newpixel;
-
-		    pathflag = TRUE;
-
-		    while (pathflag == TRUE) {	/*if don't find mutual neighbors on first try, will use Rk as next Ri. */
-			G_debug(4, "Next starting pixel: row, %d, col, %d",
-				Ri_head->row, Ri_head->col);
-
-			pathflag = FALSE;
-
-			/* find segment neighbors, if we don't already have them */
-			if (Rin_head == NULL) {
-#ifdef PROFILE
-			    fn_start = clock();
-#endif
-
-			    find_segment_neighbors
-				(&Ri_head, &Rin_head, &Ri_count, files,
-				 functions);
-#ifdef PROFILE
-			    fn_end = clock();
-			    fn_lap =
-				((double)(fn_end - fn_start)) /
-				CLOCKS_PER_SEC;
-			    fn_accum += fn_lap;
-			    fprintf(stdout, "fsn(Ri): %g\t", fn_lap);
-#endif
-			}
+	/* all segments are candidates, queue the seed segments */
+	queue.nitems = 0;
+	for (k = 0; k < rag.nnodes; k++) {
+	    rag.candidate[k] = TRUE;
+	    if (rag.nodes[k].parent != k || rag.nodes[k].id == 0)
+		continue;
 
-			if (Rin_head != NULL) {	/*found neighbors, find best neighbor then see if is mutually best neighbor */
-
-			    /* ********  find Ri's most similar neighbor  ******** */
-			    Ri_bestn = NULL;
-			    Ri_similarity = threshold + 1;	/* set current similarity to max value */
-			    Segment_get(&files->bands_seg, (void *)files->bands_val, Ri_head->row, Ri_head->col);	/* current segment values */
-
-			    /* for each of Ri's neighbors */
-			    for (current = Rin_head; current != NULL;
-				 current = current->next) {
-				tempsim = (*functions->calculate_similarity)
-				    (Ri_head, current, files, functions);
-
-#ifdef VCLOSE
-				/* if very close, will merge, but continue checking other neighbors */
-				if (tempsim <
-				    functions->very_close * threshold) {
-				    /* add to Rclose list */
-				    newpixel = (struct pixels *)
-					link_new(files->token);
-				    newpixel->next = Rclose_head;
-				    newpixel->row = current->row;
-				    newpixel->col = current->col;
-				    Rclose_head = newpixel;
-				}
-				/* If "sort of" close, merge only if it is the mutually most similar */
-				else
-#endif
-				if (tempsim < Ri_similarity) {
-				    Ri_similarity = tempsim;
-				    Ri_bestn = current;
-				}
-			    }	/* finished similiarity check for all neighbors */
-
-			    /* *** merge all the "very close" pixels/segments *** */
-			    /* doing this after checking all Rin, so we don't 
-			     * change the bands_val between similarity comparisons
-			     * ... but that leaves the possibility that we have 
-			     * the wrong best Neighbor after doing these merges... 
-			     * but it seems we can't put this merge after the Rk/Rkn 
-			     * portion of the loop, because we are changing the available neighbors
-			     * ...maybe this extra "very close" idea has to be 
-			     * done completely differently or dropped???  */
-#ifdef VCLOSE
-			    for (current = Rclose_head; current != NULL;
-				 current = current->next) {
-				my_dispose_list(files->token, &Rc_head);
-				my_dispose_list(files->token, &Rcn_head);
-
-				/* get membership of neighbor segment */
-				Rc_count = 1;
-				newpixel =
-				    (struct pixels *)link_new(files->token);
-				newpixel->next = NULL;
-				newpixel->row = current->row;
-				newpixel->col = current->col;
-				Rc_head = Rc_tail = newpixel;
-				find_segment_neighbors(&Rc_head, &Rcn_head, &Rc_count, files, functions);	/* just to get members, not looking at neighbors now */
-				merge_values(Ri_head, Rc_head, Ri_count,
-					     Rc_count, files);
-
-				/* Add Rc pixels to Ri */
-				Rc_tail->next = Ri_head;
-				Ri_head = Rc_head;
-
-				/*to consider, recurse?  Check all Rcn neighbors if they are very close? */
-
-				Rc_head = NULL;
-				my_dispose_list(files->token, &Rcn_head);
-			    }
-			    my_dispose_list(files->token, &Rclose_head);
-#endif
+	    best = rag_best(&rag, k, threshold, &similarity, files, functions);
+	    if (best >= 0)
+		rag_queue_push(&queue, similarity, k, rag.nodes[k].stamp,
+			       best, rag.nodes[best].stamp);
+	}
 
-			    /* check if we have a bestn that is valid to use to look at Rk */
-			    if (Ri_bestn != NULL) {
-				if ((functions->limited == TRUE) && !
-				    (FLAG_GET
-				     (files->candidate_flag,
-				      Ri_bestn->row, Ri_bestn->col))) {
-				    /* this check is important:
-				     * best neighbor is not a valid candidate, 
-				     * was already merged earlier in this time step */
-				    Ri_bestn = NULL;
-				}
-			    }
-			    if (Ri_bestn != NULL && Ri_similarity < threshold) {	/* small TODO: should this be < or <= for threshold? */
-				/* Rk starts from Ri's best neighbor */
-				if (Rk_head) {
-				    G_warning(_("Rk_head is not NULL!"));
-				    my_dispose_list(files->token, &Rk_head);
-				}
-				if (Rkn_head) {
-				    G_warning(_("Rkn_head is not NULL!"));
-				    my_dispose_list(files->token, &Rkn_head);
-				}
-				Rk_count = 1;
-				newpixel =
-				    (struct pixels *)link_new(files->token);
-				newpixel->next = NULL;
-				newpixel->row = Ri_bestn->row;
-				newpixel->col = Ri_bestn->col;
-				newpixel->count_shared =
-				    Ri_bestn->count_shared;
-				Rk_head = newpixel;
-
-				find_segment_neighbors(&Rk_head, &Rkn_head,
-						       &Rk_count, files,
-						       functions);
-
-				/* ********  find Rk's most similar neighbor  ******** */
-				Rk_similarity = Ri_similarity;	/*Ri gets first priority - ties won't change anything, so we'll accept Ri and Rk as mutually best neighbors */
-				Segment_get(&files->bands_seg, (void *)files->bands_val, Rk_head->row, Rk_head->col);	/* current segment values */
-
-				/* check similarity for each of Rk's neighbors */
-				for (current = Rkn_head; current != NULL;
-				     current = current->next) {
-				    tempsim =
-					functions->calculate_similarity
-					(Rk_head, current, files, functions);
-
-				    if (tempsim < Rk_similarity) {
-					Rk_similarity = tempsim;
-					break;	/* exit for Rk's neighbors loop here, we know that Ri and Rk aren't mutually best neighbors */
-				    }
-				}	/* have checked all of Rk's neighbors */
+	while (queue.nitems > 0) {
+	    item = rag_queue_pop(&queue);
 
-				if (Rk_similarity == Ri_similarity) {	/* mutually most similar neighbors */
+	    /* Ri was merged since, or checked already in this pass */
+	    k = item.node;
+	    if (rag.nodes[k].parent != k ||
+		rag.nodes[k].stamp != item.node_stamp || !rag.candidate[k])
+		continue;
 
-#ifdef PROFILE
-				    merge_start = clock();
-#endif
-				    merge_values(Ri_head, Rk_head, Ri_count,
-						 Rk_count, files);
-#ifdef PROFILE
-				    merge_end = clock();
-				    merge_lap =
-					((double)(merge_end - merge_start)) /
-					CLOCKS_PER_SEC;
-				    merge_accum += merge_lap;
-				    fprintf(stdout, "merge time: %g\n",
-					    merge_lap);
-#endif
-				    endflag = FALSE;	/* we've made at least one merge, so want another t iteration */
-				}
-				else {	/* they weren't mutually best neighbors */
-
-				    /* checked Ri once, didn't find a mutually best neighbor, 
-				     * so remove all members of Ri from candidate pixels for this iteration */
-				    set_candidate_flag(Ri_head, FALSE, files);
-
-				    if (FLAG_GET
-					(files->candidate_flag, Rk_head->row,
-					 Rk_head->col) &&
-					FLAG_GET(files->seeds_flag,
-						 Rk_head->row, Rk_head->col))
-					pathflag = TRUE;
-				}
-			    }	/* end if (Ri_bestn != NULL && Ri_similarity < threshold) */
-			    else {
-				/* no valid best neighbor for this Ri
-				 * exclude this Ri from further comparisons 
-				 * because we checked already Ri for a mutually best neighbor with all valid candidates
-				 * thus Ri can not be the mutually best neighbor later on during this pass
-				 * unfortunately this does happen sometimes */
-				set_candidate_flag(Ri_head, FALSE, files);
-			    }
+	    best = item.nbr;
+	    if (rag.nodes[best].parent != best ||
+		rag.nodes[best].stamp != item.nbr_stamp) {
+		/* Rk was merged with another segment */
+		if (functions->limited == TRUE) {
+		    /* this check is important:
+		     * best neighbor is not a valid candidate, 
+		     * was already merged earlier in this time step */
+		    rag.candidate[k] = FALSE;
+		}
+		else {
+		    best = rag_best(&rag, k, threshold, &similarity, files,
+				    functions);
+		    if (best >= 0)
+			rag_queue_push(&queue, similarity, k,
+				       rag.nodes[k].stamp, best,
+				       rag.nodes[best].stamp);
+		}
+		continue;
+	    }
 
-			}	/* end if(Rin_head != NULL) */
-			else {	/* Ri didn't have a neighbor */
-			    G_debug(4, "Segment had no neighbors");
-			    set_candidate_flag(Ri_head, FALSE, files);
-			}
+	    /* with one merge per pass, the most similar pair left is not
+	     * necessarily mutually best: check Rk's neighbors.
+	     * Ri gets first priority - ties won't change anything, so we'll
+	     * accept Ri and Rk as mutually best neighbors */
+	    if (functions->limited == TRUE &&
+		(!rag.candidate[best] ||
+		 rag_best(&rag, best, item.similarity, &similarity, files,
+			  functions) >= 0)) {
+		/* checked Ri once, didn't find a mutually best neighbor, 
+		 * so remove Ri from candidates for this iteration */
+		rag.candidate[k] = FALSE;
+		continue;
+	    }
 
-			if (pathflag) {	/*initialize Ri, Rin, using Rk as Ri and Rkn as Rin. */
-
-			    /* For the next iteration, lets start with Rk as the focus segment */
-			    if (functions->path == TRUE) {
-				Ri_count = Rk_count;
-				Rk_count = 0;
-				my_dispose_list(files->token, &Ri_head);
-				Ri_head = Rk_head;
-				Rk_head = NULL;
-				if (Rkn_head != NULL) {
-				    my_dispose_list(files->token, &Rin_head);
-				    Rin_head = Rkn_head;
-				    Rkn_head = NULL;
-				}
-				else
-				    my_dispose_list(files->token, &Rin_head);
-			    }
-			    else
-				pathflag = FALSE;
+	    merged = rag_merge(&rag, k, best, files);
+	    endflag = FALSE;	/* we've made at least one merge, so want another t iteration */
+
+	    if (functions->limited == TRUE)
+		rag.candidate[merged] = FALSE;
+	    else {
+		best = rag_best(&rag, merged, threshold, &similarity, files,
+				functions);
+		if (best >= 0)
+		    rag_queue_push(&queue, similarity, merged,
+				   rag.nodes[merged].stamp, best,
+				   rag.nodes[best].stamp);
+	    }
+	}
 
-			}
-		    }		/*end pathflag do loop */
-		}		/*end if pixel is candidate and seed pixel */
-	    }			/*next column */
-	}			/*next row */
 #ifdef PROFILE
 	pass_end = clock();
 	fprintf(stdout, "pass %d took: %g\n", t,
@@ -516,19 +314,6 @@ int region_growing(struct files *files, struct functions *functions)
 	G_message(_("Merging processes stopped due to reaching max iteration limit, more merges may be possible"));
 
 
-
-    /* ****************************************************************************************** */
-    /* speed enhancement: after < 3 (?) merges are made in one pass, switch processing modes.
-     * It seems a significant portion of the time is spent merging small pixels into the largest
-     * segments.  So consider allowing multiple merges after finding one large Ri.
-     * 
-     * Maybe related to this, and/or integrated into the first loops:  If a segment has only one neighbor
-     * go ahead and merge it if similarity is < threshold.
-     * 
-     * ****************************************************************************************** */
-
-
-
     /* ****************************************************************************************** */
     /* final pass, ignore threshold and force a merge for small segments with their best neighbor */
     /* ****************************************************************************************** */
@@ -540,116 +325,71 @@ int region_growing(struct files *files, struct functions *functions)
 			 * Something should be adjusted first */
 
 	if (files->bounds_map == NULL) {
-	    G_message
-		(_("Final iteration, forcing merges for small segments, percent complete based on rows."));
+	    G_message(_("Final iteration, forcing merges for small segments"));
+	}
+
+	/* queue all segments below the minimum size (including non-seed
+	 * pixels), most similar pairs are merged first */
+	queue.nitems = 0;
+	for (k = 0; k < rag.nnodes; k++) {
+	    if (rag.nodes[k].parent != k ||
+		rag.nodes[k].area >=
+		functions->min_segment_size)
+		continue;
+
+	    best = rag_best(&rag, k, DBL_MAX, &similarity, files, functions);
+	    if (best >= 0)
+		rag_queue_push(&queue, similarity, k, rag.nodes[k].stamp,
+			       best, rag.nodes[best].stamp);
+	    else if (files->bounds_map == NULL && rag.nodes[k].id > 0)
+		G_warning
+		    (_("no neighbors found, this means only one segment was created."));
+	}
+
+	while (queue.nitems > 0) {
+	    item = rag_queue_pop(&queue);
+
+	    k = item.node;
+	    if (rag.nodes[k].parent != k ||
+		rag.nodes[k].stamp != item.node_stamp)
+		continue;
+
+	    best = item.nbr;
+	    if (rag.nodes[best].parent != best ||
+		rag.nodes[best].stamp != item.nbr_stamp) {
+		best = rag_best(&rag, k, DBL_MAX, &similarity, files,
+				functions);
+		if (best >= 0)
+		    rag_queue_push(&queue, similarity, k, rag.nodes[k].stamp,
+				   best, rag.nodes[best].stamp);
+		continue;
+	    }
+
+	    merged = rag_merge(&rag, k, best, files);
+
+	    /* queue the merged segment again if the size is still too small */
+	    if (rag.nodes[merged].area < functions->min_segment_size) {
+		best = rag_best(&rag, merged, DBL_MAX, &similarity, files,
+				functions);
+		if (best >= 0)
+		    rag_queue_push(&queue, similarity, merged,
+				   rag.nodes[merged].stamp, best,
+				   rag.nodes[best].stamp);
+	    }
 	}
-	/* for the final forced merge, the candidate flag is just to keep track if we have confirmed if:
-	 *              a. the segment size is >= to the minimum allowed size  or
-	 *              b. we have merged it with its best neighbor
-	 */
-
-	set_all_candidate_flags(files);
-
-	for (row = files->minrow; row < files->maxrow; row++) {
-	    if (files->bounds_map == NULL)
-		G_percent(row, files->maxrow - 1, 1);
-	    for (col = files->mincol; col < files->maxcol; col++) {
-
-		if (FLAG_GET(files->candidate_flag, row, col)) {
-		    /*free memory for linked lists */
-		    my_dispose_list(files->token, &Ri_head);
-		    my_dispose_list(files->token, &Rk_head);
-		    my_dispose_list(files->token, &Rin_head);
-		    my_dispose_list(files->token, &Rkn_head);
-		    Rk_count = 0;
-
-		    /* First pixel in Ri is current row/col pixel.  We may add more later if it is part of a segment */
-		    Ri_count = 1;
-		    newpixel = (struct pixels *)link_new(files->token);
-		    newpixel->next = Ri_head;
-		    newpixel->row = row;
-		    newpixel->col = col;
-		    Ri_head = newpixel;
-
-		    G_debug(4, "Next starting pixel: row, %d, col, %d",
-			    Ri_head->row, Ri_head->col);
-
-		    /* find segment neighbors */
-		    find_segment_neighbors
-			(&Ri_head, &Rin_head, &Ri_count, files, functions);
-
-		    if (Rin_head != NULL) {	/*found neighbors */
-			if (Ri_count >= functions->min_segment_size)	/* don't force a merge */
-			    set_candidate_flag(Ri_head, FALSE, files);
-
-			else {	/* Merge with most similar neighbor */
-
-			    /* find Ri's most similar neighbor */
-			    Ri_bestn = NULL;
-			    Ri_similarity = DBL_MAX;	/* set current similarity to max value */
-			    Segment_get(&files->bands_seg, (void *)files->bands_val, Ri_head->row, Ri_head->col);	/* current segment values */
-
-			    /* for each of Ri's neighbors */
-			    for (current = Rin_head; current != NULL;
-				 current = current->next) {
-				tempsim = (*functions->calculate_similarity)
-				    (Ri_head, current, files, functions);
-
-				if (tempsim < Ri_similarity) {
-				    Ri_similarity = tempsim;
-				    Ri_bestn = current;
-				}
-			    }
-			    if (Ri_bestn != NULL) {
-
-				/* we'll have the neighbor pixel to start with. */
-				Rk_count = 1;
-				newpixel =
-				    (struct pixels *)link_new(files->token);
-				newpixel->next = NULL;
-				newpixel->row = Ri_bestn->row;
-				newpixel->col = Ri_bestn->col;
-				Rk_head = newpixel;
-
-				/* get the full pixel/cell membership list for Rk */
-				/* speed enhancement: a seperate function for this, since we don't need the neighbors */
-				find_segment_neighbors(&Rk_head, &Rkn_head,
-						       &Rk_count, files,
-						       functions);
-
-				merge_values(Ri_head, Rk_head, Ri_count,
-					     Rk_count, files);
-
-				/* merge_values sets Ri and Rk candidate flag to FALSE.  Put Rk back to TRUE if the size is too small. */
-				if (Ri_count + Rk_count <
-				    functions->min_segment_size)
-				    set_candidate_flag(Rk_head, TRUE, files);
-			    }	/* end if best neighbor != null */
-			    else
-				G_warning
-				    (_("No best neighbor found in final merge for small segment, this shouldn't happen!"));
-
-
-			}	/* end else - pixel count was below minimum allowed */
-		    }		/* end if neighbors found */
-		    else {	/* no neighbors were found */
-			if (files->bounds_map == NULL)
-			    G_warning
-				(_("no neighbors found, this means only one segment was created."));
-
-			set_candidate_flag(Ri_head, FALSE, files);
-		    }
-		}		/* end if pixel is candidate pixel */
-	    }			/* next column */
-	}			/* next row */
 	t++;			/* to count one more "iteration" */
     }				/* end if for force merge */
     else if (t > 2 && files->bounds_map == NULL)
 	G_verbose_message(_("Number of passes completed: %d"), t - 1);
+
+    /* save segment IDs and means of the merged segments */
+    rag_write(&rag, files);
+
+    G_free(queue.items);
+    rag_destroy(&rag);
+
 #ifdef PROFILE
     end = clock();
-    fprintf(stdout, "time spent merging: %g\n", merge_accum);
-    fprintf(stdout, "time spent finding neighbors: %g\n", fn_accum);
     fprintf(stdout, "total time: %g\n",
 	    ((double)(end - start) / CLOCKS_PER_SEC));
 #endif
@@ -928,13 +668,11 @@ int find_eight_pixel_neighbors(int p_row, int p_col,
     return TRUE;
 }
 
-    /* similarity / distance functions between two points based on their input raster values */
-    /* assumes first point values already saved in files->bands_seg */
-    /* speed enhancement: Segment_get was already done for a[] values in the main function.  
-     * Could remove a[] from these parameters, reducing number of parameters in 
-     * function call could provide a speed improvement. */
+    /* similarity / distance functions between two segments based on their band means */
+    /* a and b hold the values of the two segments in the same layout as files->bands_val,
+     * count_shared is the number of pixel neighbor pairs on their common border */
 
-double calculate_euclidean_similarity(struct pixels *a, struct pixels *b,
+double calculate_euclidean_similarity(double *a, double *b, int count_shared,
 				      struct files *files,
 				      struct functions *functions)
 {
@@ -942,15 +680,9 @@ double calculate_euclidean_similarity(struct pixels *a, struct pixels *b,
     double smooth, compact, shape, PL;
     int n;
 
-    /* get values for pixel b */
-    Segment_get(&files->bands_seg, (void *)files->second_val, b->row, b->col);
-
     /* euclidean distance, sum the square differences for each dimension */
     for (n = 0; n < files->nbands; n++) {
-	val =
-	    val + (files->bands_val[n] -
-		   files->second_val[n]) * (files->bands_val[n] -
-					    files->second_val[n]);
+	val = val + (a[n] - b[n]) * (a[n] - b[n]);
     }
 
     /* use squared distance, save the calculation time. 
@@ -965,31 +697,22 @@ double calculate_euclidean_similarity(struct pixels *a, struct pixels *b,
 	/*I assume the idea is to add to the similarity information about the 
 	 * shape of the new segment if the two candidates were to be merged. */
 
-	PL = files->bands_val[files->nbands + 1] +
-	    files->second_val[files->nbands + 1] - b->count_shared;
+	PL = a[files->nbands + 1] + b[files->nbands + 1] - count_shared;
 
 	/* compact = PL/sqrt(Npx) */
 
-	compact =
-	    PL / sqrt(files->bands_val[files->nbands] +
-		      files->second_val[files->nbands]);
+	compact = PL / sqrt(a[files->nbands] + b[files->nbands]);
 
 	/* smooth = PL/Pbbox */
 
 	smooth = PL /
 	    (2 *
-	     (max
-	      (files->bands_val[files->nbands + 2],
-	       files->second_val[files->nbands + 2])
-	      - min(files->bands_val[files->nbands + 3],
-		    files->second_val[files->nbands + 3]))
+	     (max(a[files->nbands + 2], b[files->nbands + 2])
+	      - min(a[files->nbands + 3], b[files->nbands + 3]))
 	     +
 	     2 *
-	     (max
-	      (files->bands_val[files->nbands + 4],
-	       files->second_val[files->nbands + 4])
-	      - min(files->bands_val[files->nbands + 5],
-		    files->second_val[files->nbands + 5])));
+	     (max(a[files->nbands + 4], b[files->nbands + 4])
+	      - min(a[files->nbands + 5], b[files->nbands + 5])));
 
 	shape =
 	    functions->smooth_weight * smooth + (1 - functions->smooth_weight)
@@ -1003,19 +726,16 @@ double calculate_euclidean_similarity(struct pixels *a, struct pixels *b,
 
 }
 
-double calculate_manhattan_similarity(struct pixels *a, struct pixels *b,
+double calculate_manhattan_similarity(double *a, double *b, int count_shared,
 				      struct files *files,
 				      struct functions *functions)
 {
     double val = 0;
     int n;
 
-    /* get values for pixel b */
-    Segment_get(&files->bands_seg, (void *)files->second_val, b->row, b->col);
-
     /* Manhattan distance, sum the absolute difference between values for each dimension */
     for (n = 0; n < files->nbands; n++) {
-	val += fabs(files->bands_val[n] - files->second_val[n]);	/* speed enhancement: is fabs() is the "fast" way for absolute value calculations? */
+	val += fabs(a[n] - b[n]);	/* speed enhancement: is fabs() is the "fast" way for absolute value calculations? */
     }
 
     return val;
@@ -1042,67 +762,6 @@ double calculate_manhattan_similarity(struct pixels *a, struct pixels *b,
      object, and Pbbox the perimeter of the bounding box of the object.
      */
 
-int merge_values(struct pixels *Ri_head, struct pixels *Rk_head,
-		 int Ri_count, int Rk_count, struct files *files)
-{
-    int n, Ri_iseg, Rk_iseg;
-    struct pixels *current;
-
-    /*get input values */
-    /*speed enhancement: Confirm if we can assume we already have 
-     * bands_val for Ri, so don't need to Segment_get() again?  
-     * note...current very_close implementation requires 
-     * getting this value again... */
-    Segment_get(&files->bands_seg, (void *)files->bands_val, Ri_head->row,
-		Ri_head->col);
-    Segment_get(&files->bands_seg, (void *)files->second_val,
-		Rk_head->row, Rk_head->col);
-
-    Segment_get(&files->iseg_seg, &Rk_iseg, Rk_head->row, Rk_head->col);
-    Segment_get(&files->iseg_seg, &Ri_iseg, Ri_head->row, Ri_head->col);
-
-    for (n = 0; n < files->nbands; n++) {
-	files->bands_val[n] =
-	    (files->bands_val[n] * Ri_count +
-	     files->second_val[n] * Rk_count) / (Ri_count + Rk_count);
-    }
-
-    /* update shape parameters */
-
-    files->bands_val[n] += files->second_val[n];	/* area */
-    files->bands_val[n + 1] = files->bands_val[n + 1] + files->second_val[n + 1] - 2 * Rk_head->count_shared;	/* Perimeter Length */
-    files->bands_val[n + 2] = max(files->bands_val[n + 2], files->second_val[n + 2]);	/*max col */
-    files->bands_val[n + 3] = min(files->bands_val[n + 3], files->second_val[n + 3]);	/*min col */
-    files->bands_val[n + 4] = max(files->bands_val[n + 4], files->second_val[n + 4]);	/*max row */
-    files->bands_val[n + 5] = min(files->bands_val[n + 5], files->second_val[n + 5]);	/*min row */
-
-    /* update segment number and candidate flag ==0 */
-#ifdef SIGNPOST
-    fprintf(stdout,
-	    "merging Ri (pixel count): %d (%d) with Rk (count): %d (%d).\n",
-	    Ri_iseg, Ri_count, Rk_iseg, Rk_count);
-#endif
-
-    /* for each member of Ri and Rk, write new average bands values and segment values */
-    for (current = Ri_head; current != NULL; current = current->next) {
-	Segment_put(&files->bands_seg, (void *)files->bands_val,
-		    current->row, current->col);
-	FLAG_UNSET(files->candidate_flag, current->row, current->col);	/*candidate pixel flag, only one merge allowed per t iteration */
-    }
-    for (current = Rk_head; current != NULL; current = current->next) {
-	Segment_put(&files->bands_seg, (void *)files->bands_val,
-		    current->row, current->col);
-	Segment_put(&files->iseg_seg, &Ri_iseg, current->row, current->col);
-	FLAG_UNSET(files->candidate_flag, current->row, current->col);
-    }
-
-    /* merged two segments, decrement count if Rk was an actual segment (not a non-seed pixel) */
-    if (Rk_iseg > 0)
-	files->nsegs--;
-
-    return TRUE;
-}
-
     /* calculates and stores the mean value for all pixels in a list, assuming they are all in the same segment */
 int merge_pixels(struct pixels *R_head, int borderPixels, struct files *files)
 {
@@ -1148,28 +807,6 @@ int merge_pixels(struct pixels *R_head, int borderPixels, struct files *files)
     return TRUE;
 }
 
-    /* besides setting flag, also increments how many pixels remain to be processed */
-int set_candidate_flag(struct pixels *head, int value, struct files *files)
-{
-    /* head is linked list of pixels, value is new value of flag */
-    struct pixels *current;
-
-    for (current = head; current != NULL; current = current->next) {
-
-
-	if (value == FALSE) {
-	    FLAG_UNSET(files->candidate_flag, current->row, current->col);
-	}
-	else if (value == TRUE) {
-	    FLAG_SET(files->candidate_flag, current->row, current->col);
-	}
-	else
-	    G_fatal_error
-		(_("programming bug, helper function called with invalid argument"));
-    }
-    return TRUE;
-}
-
     /* let memory manager know space is available again and reset head to NULL */
 int my_dispose_list(struct link_head *token, struct pixels **head)
 {
@@ -76,6 +76,49 @@ struct files
 
 };
 
+/* region adjacency graph, see rag.c */
+struct rag_edge
+{
+    int node;			/* neighbor node, might be merged already: use rag_find() */
+    int shared;			/* number of pixel neighbor pairs on the common border */
+};
+
+struct rag_node
+{
+    int parent;			/* union-find parent, the root node holds the segment */
+    int id;			/* segment ID, 0 for non-seed pixels */
+    int stamp;			/* changes with each merge, to detect outdated queue items */
+    int nedges, aedges;		/* aedges is 0 while the edges are in the initial edge block */
+    struct rag_edge *edges;
+    int area, perimeter;	/* shape values, exact also for large segments */
+    int max_col, min_col, max_row, min_row;	/* bounding box */
+};
+
+struct rag
+{
+    int wrows, wcols;		/* size of the processing window */
+    int nnodes, nvals;
+    struct rag_node *nodes;
+    float *vals;		/* band means of each node */
+    int *pix_node;		/* initial node of each pixel in the window, -1 for NULL, only while the graph is built */
+    struct rag_edge *edge_block;
+    int *pos;			/* scratch to combine edges, -1 for all nodes */
+    char *candidate;		/* node can still be merged in this pass (-l flag) */
+};
+
+struct rag_queue_item
+{
+    double similarity;
+    int node, node_stamp;	/* Ri */
+    int nbr, nbr_stamp;		/* its most similar neighbor */
+};
+
+struct rag_queue
+{
+    struct rag_queue_item *items;
+    int nitems, aitems;
+};
+
 struct functions
 {
     int method;			/* Segmentation method */
@@ -85,12 +128,12 @@ struct functions
     float radio_weight, smooth_weight;	/* radiometric (bands) vs. shape and smoothness vs. compactness */
     /* Some function pointers to set in parse_args() */
     int (*find_pixel_neighbors) (int, int, int[8][2], struct files *);	/*parameters: row, col, pixel_neighbors */
-    double (*calculate_similarity) (struct pixels *, struct pixels *, struct files *, struct functions *);	/*parameters: two pixels (each with row,col) to compare */
+    double (*calculate_similarity) (double *, double *, int, struct files *, struct functions *);	/*parameters: values of two segments to compare and their shared border */
 
     /* max number of iterations/passes */
     int end_t;
 
-    int path;			/* flag if we are using Rk as next Ri for non-mutually best neighbor. */
+    int path;			/* flag if we are using Rk as next Ri for non-mutually best neighbor (not used with the region adjacency graph). */
     int limited;		/* flag if we are limiting merges to one per pass */
     int estimate_threshold;	/* flag if we just want to estimate a suggested threshold value and exit. */
     int final_merge_only;	/* flag if we want to just run the final merge portion of the algorithm. */
@@ -130,20 +173,30 @@ int create_isegs(struct files *, struct functions *);
 int region_growing(struct files *, struct functions *);
 int find_segment_neighbors(struct pixels **, struct pixels **, int *,
 			   struct files *, struct functions *);
-int set_candidate_flag(struct pixels *, int, struct files *);
-int merge_values(struct pixels *, struct pixels *, int, int, struct files *);
 int merge_pixels(struct pixels *, int, struct files *);
 int find_four_pixel_neighbors(int, int, int[][2], struct files *);
 int find_eight_pixel_neighbors(int, int, int[8][2], struct files *);
-double calculate_euclidean_similarity(struct pixels *, struct pixels *,
+double calculate_euclidean_similarity(double *, double *, int,
 				      struct files *, struct functions *);
-double calculate_manhattan_similarity(struct pixels *, struct pixels *,
+double calculate_manhattan_similarity(double *, double *, int,
 				      struct files *, struct functions *);
 int my_dispose_list(struct link_head *, struct pixels **);
 int compare_ids(const void *, const void *);
 int compare_pixels(const void *, const void *);
 int set_all_candidate_flags(struct files *);
 
+/* rag.c */
+void rag_create(struct rag *, struct files *, struct functions *);
+void rag_destroy(struct rag *);
+int rag_find(struct rag *, int);
+int rag_edges(struct rag *, int);
+int rag_best(struct rag *, int, double, double *, struct files *,
+	     struct functions *);
+int rag_merge(struct rag *, int, int, struct files *);
+void rag_write(struct rag *, struct files *);
+void rag_queue_push(struct rag_queue *, double, int, int, int, int);
+struct rag_queue_item rag_queue_pop(struct rag_queue *);
+
 /* write_output.c */
 int write_output(struct files *);
 int close_files(struct files *);
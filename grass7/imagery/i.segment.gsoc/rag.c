@@ -0,0 +1,516 @@
+/* PURPOSE:      region adjacency graph of the segments in the processing window */
+
+/* Each segment is a node with its shape values, its running band means
+ * (single precision to save memory) and a list of neighbor segments with the number of pixel neighbor pairs
+ * on the common border.  Merged nodes are tracked with union-find, edges
+ * pointing to merged nodes are only resolved and combined when the list is
+ * used again.  While the graph exists, iseg_seg holds the initial node of
+ * each pixel instead of its segment ID. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include <grass/segment.h>	/* segmentation library */
+#include "iseg.h"
+
+#ifndef max
+#define max(a,b) ( ((a)>(b)) ? (a) : (b) )
+#endif
+#ifndef min
+#define min(a,b) ( ((a)<(b)) ? (a) : (b) )
+#endif
+
+/* node number of a pixel while building the graph, see rag_create() */
+#define NODE_CODE(k) (-(k) - 2)
+
+/* offsets of the pixel neighbors that come earlier in row major order:
+ * west, north, north west, north east */
+static const int back_row[4] = { 0, -1, -1, -1 };
+static const int back_col[4] = { -1, 0, -1, 1 };
+
+static int pix_find(int *parent, int p)
+{
+    while (parent[p] != p) {
+	parent[p] = parent[parent[p]];
+	p = parent[p];
+    }
+    return p;
+}
+
+/* pixel index of the earlier neighbor n of window pixel (row, col) or -1 */
+static int back_neighbor(struct rag *rag, int row, int col, int n)
+{
+    row += back_row[n];
+    col += back_col[n];
+
+    if (row < 0 || col < 0 || col >= rag->wcols)
+	return -1;
+    if (rag->pix_node[row * rag->wcols + col] == -1)
+	return -1;
+    return row * rag->wcols + col;
+}
+
+/* build the graph for all non-null pixels in the current processing window */
+void rag_create(struct rag *rag, struct files *files,
+		struct functions *functions)
+{
+    int row, col, n, p, q, k, nback, nedges;
+    int *id_row, *prev_id_row, *tmp_row;
+    float *vals;
+    struct rag_node *node;
+
+    G_verbose_message(_("Building region adjacency graph"));
+
+    /* the window is empty if all pixels are null */
+    rag->wrows = max(files->maxrow - files->minrow, 0);
+    rag->wcols = max(files->maxcol - files->mincol, 0);
+    rag->nvals = files->nbands;
+    nback = functions->num_pn == 8 ? 4 : 2;
+
+    rag->pix_node =
+	(int *)G_malloc(((size_t) rag->wrows * rag->wcols + 1) * sizeof(int));
+    id_row = (int *)G_malloc((rag->wcols + 1) * sizeof(int));
+    prev_id_row = (int *)G_malloc((rag->wcols + 1) * sizeof(int));
+
+    /* union contiguous pixels with the same segment ID (seeds or earlier
+     * merges), each non-seed pixel (ID 0) is a node on its own.
+     * The smaller pixel index is always the root, so parents come first
+     * in row major order. */
+    for (row = 0; row < rag->wrows; row++) {
+	for (col = 0; col < rag->wcols; col++) {
+	    p = row * rag->wcols + col;
+	    if (FLAG_GET(files->null_flag, row + files->minrow,
+			 col + files->mincol)) {
+		rag->pix_node[p] = -1;
+		continue;
+	    }
+	    rag->pix_node[p] = p;
+	    Segment_get(&files->iseg_seg, &id_row[col], row + files->minrow,
+			col + files->mincol);
+	    if (id_row[col] == 0)
+		continue;
+
+	    for (n = 0; n < nback; n++) {
+		int r1, r2;
+
+		if ((q = back_neighbor(rag, row, col, n)) < 0)
+		    continue;
+		if ((back_row[n] ? prev_id_row : id_row)[col + back_col[n]] !=
+		    id_row[col])
+		    continue;
+
+		r1 = pix_find(rag->pix_node, p);
+		r2 = pix_find(rag->pix_node, q);
+		if (r1 < r2)
+		    rag->pix_node[r2] = r1;
+		else if (r2 < r1)
+		    rag->pix_node[r1] = r2;
+	    }
+	}
+	tmp_row = prev_id_row;
+	prev_id_row = id_row;
+	id_row = tmp_row;
+    }
+
+    /* number the nodes, the parent of a pixel comes first and already
+     * holds the node of the root */
+    rag->nnodes = 0;
+    for (p = 0; p < rag->wrows * rag->wcols; p++) {
+	if (rag->pix_node[p] == -1)
+	    continue;
+	if (rag->pix_node[p] == p)
+	    rag->pix_node[p] = NODE_CODE(rag->nnodes++);
+	else
+	    rag->pix_node[p] = rag->pix_node[rag->pix_node[p]];
+    }
+    for (p = 0; p < rag->wrows * rag->wcols; p++) {
+	if (rag->pix_node[p] != -1)
+	    rag->pix_node[p] = NODE_CODE(rag->pix_node[p]);
+    }
+
+    rag->nodes =
+	(struct rag_node *)G_calloc(rag->nnodes > 0 ? rag->nnodes : 1,
+				    sizeof(struct rag_node));
+    rag->vals =
+	(float *)G_calloc((size_t) (rag->nnodes > 0 ? rag->nnodes : 1) *
+			  rag->nvals, sizeof(float));
+    rag->pos = (int *)G_malloc((rag->nnodes > 0 ? rag->nnodes : 1) *
+			       sizeof(int));
+    rag->candidate = (char *)G_malloc(rag->nnodes > 0 ? rag->nnodes : 1);
+
+    for (k = 0; k < rag->nnodes; k++) {
+	node = &rag->nodes[k];
+	node->parent = k;
+	node->max_col = node->max_row = -1;
+	node->min_col = files->ncols;
+	node->min_row = files->nrows;
+    }
+
+    /* average the band values and sum the shape parameters, count the pixel
+     * neighbor pairs between nodes.  The means are updated with each pixel
+     * to keep single precision exact for segments of equal pixel values. */
+    for (row = 0; row < rag->wrows; row++) {
+	for (col = 0; col < rag->wcols; col++) {
+	    p = row * rag->wcols + col;
+	    if ((k = rag->pix_node[p]) == -1)
+		continue;
+	    node = &rag->nodes[k];
+	    vals = rag->vals + (size_t) k *rag->nvals;
+
+	    Segment_get(&files->bands_seg, (void *)files->bands_val,
+			row + files->minrow, col + files->mincol);
+	    Segment_get(&files->iseg_seg, &node->id, row + files->minrow,
+			col + files->mincol);
+	    node->area++;
+	    for (n = 0; n < files->nbands; n++)
+		vals[n] += (files->bands_val[n] - vals[n]) / node->area;
+
+	    node->perimeter += 4;
+	    node->max_col = max(node->max_col, col + files->mincol);
+	    node->min_col = min(node->min_col, col + files->mincol);
+	    node->max_row = max(node->max_row, row + files->minrow);
+	    node->min_row = min(node->min_row, row + files->minrow);
+
+	    for (n = 0; n < nback; n++) {
+		int j;
+
+		if ((q = back_neighbor(rag, row, col, n)) < 0)
+		    continue;
+		j = rag->pix_node[q];
+		if (j == k)
+		    node->perimeter -= 2;
+		else {
+		    node->nedges++;
+		    rag->nodes[j].nedges++;
+		}
+	    }
+	}
+    }
+
+    /* one block for the initial edges, a node gets its own list with the
+     * first merge */
+    nedges = 0;
+    for (k = 0; k < rag->nnodes; k++)
+	nedges += rag->nodes[k].nedges;
+    rag->edge_block =
+	(struct rag_edge *)G_malloc((nedges > 0 ? nedges : 1) *
+				    sizeof(struct rag_edge));
+    nedges = 0;
+    for (k = 0; k < rag->nnodes; k++) {
+	node = &rag->nodes[k];
+	node->edges = rag->edge_block + nedges;
+	nedges += node->nedges;
+	node->nedges = 0;
+	rag->pos[k] = -1;
+    }
+
+    for (row = 0; row < rag->wrows; row++) {
+	for (col = 0; col < rag->wcols; col++) {
+	    p = row * rag->wcols + col;
+	    if ((k = rag->pix_node[p]) == -1)
+		continue;
+
+	    for (n = 0; n < nback; n++) {
+		int j;
+
+		if ((q = back_neighbor(rag, row, col, n)) < 0)
+		    continue;
+		j = rag->pix_node[q];
+		if (j == k)
+		    continue;
+
+		node = &rag->nodes[k];
+		node->edges[node->nedges].node = j;
+		node->edges[node->nedges++].shared = 1;
+		node = &rag->nodes[j];
+		node->edges[node->nedges].node = k;
+		node->edges[node->nedges++].shared = 1;
+	    }
+	}
+    }
+
+    /* the same neighbor is listed once for each pixel neighbor pair */
+    for (k = 0; k < rag->nnodes; k++)
+	rag_edges(rag, k);
+
+    /* keep the initial node of each pixel on disk, see rag_write() */
+    for (row = 0; row < rag->wrows; row++) {
+	for (col = 0; col < rag->wcols; col++) {
+	    p = row * rag->wcols + col;
+	    if (rag->pix_node[p] != -1)
+		Segment_put(&files->iseg_seg, &rag->pix_node[p],
+			    row + files->minrow, col + files->mincol);
+	}
+    }
+    G_free(rag->pix_node);
+    rag->pix_node = NULL;
+
+    G_free(id_row);
+    G_free(prev_id_row);
+}
+
+void rag_destroy(struct rag *rag)
+{
+    int k;
+
+    for (k = 0; k < rag->nnodes; k++) {
+	if (rag->nodes[k].aedges)
+	    G_free(rag->nodes[k].edges);
+    }
+    G_free(rag->nodes);
+    G_free(rag->vals);
+    G_free(rag->pos);
+    G_free(rag->candidate);
+    G_free(rag->edge_block);
+}
+
+/* copy the values of node k to the double precision buffer val,
+ * same layout as files->bands_val */
+static void rag_vals(struct rag *rag, int k, double *val)
+{
+    struct rag_node *node = &rag->nodes[k];
+    float *vals = rag->vals + (size_t) k * rag->nvals;
+    int n;
+
+    for (n = 0; n < rag->nvals; n++)
+	val[n] = vals[n];
+    val[n] = node->area;
+    val[n + 1] = node->perimeter;
+    val[n + 2] = node->max_col;
+    val[n + 3] = node->min_col;
+    val[n + 4] = node->max_row;
+    val[n + 5] = node->min_row;
+}
+
+/* root node of the segment node k belongs to */
+int rag_find(struct rag *rag, int k)
+{
+    struct rag_node *nodes = rag->nodes;
+
+    while (nodes[k].parent != k) {
+	nodes[k].parent = nodes[nodes[k].parent].parent;
+	k = nodes[k].parent;
+    }
+    return k;
+}
+
+/* bring the edges of root node k up to date: point them to root nodes,
+ * drop edges to k itself and combine edges to the same neighbor.
+ * Returns the number of shared pixel neighbor pairs of the dropped edges. */
+int rag_edges(struct rag *rag, int k)
+{
+    struct rag_node *node = &rag->nodes[k];
+    int i, j, m, self = 0;
+
+    for (i = m = 0; i < node->nedges; i++) {
+	j = rag_find(rag, node->edges[i].node);
+	if (j == k) {
+	    self += node->edges[i].shared;
+	    continue;
+	}
+	if (rag->pos[j] >= 0) {
+	    node->edges[rag->pos[j]].shared += node->edges[i].shared;
+	    continue;
+	}
+	rag->pos[j] = m;
+	node->edges[m].node = j;
+	node->edges[m++].shared = node->edges[i].shared;
+    }
+    node->nedges = m;
+
+    for (i = 0; i < m; i++)
+	rag->pos[node->edges[i].node] = -1;
+
+    return self;
+}
+
+/* most similar neighbor of root node k with a similarity below limit,
+ * -1 if there is none.  Edges between non-seed pixels are kept in the graph,
+ * so a seed learns about the neighbors of the pixels it absorbs, but two
+ * non-seed pixels are never merged with each other. */
+int rag_best(struct rag *rag, int k, double limit, double *similarity,
+	     struct files *files, struct functions *functions)
+{
+    struct rag_node *node = &rag->nodes[k];
+    int i, best = -1;
+    double tempsim;
+
+    rag_edges(rag, k);
+    rag_vals(rag, k, files->bands_val);
+
+    *similarity = limit;
+    for (i = 0; i < node->nedges; i++) {
+	if (node->id == 0 && rag->nodes[node->edges[i].node].id == 0)
+	    continue;
+	rag_vals(rag, node->edges[i].node, files->second_val);
+	tempsim =
+	    functions->calculate_similarity(files->bands_val,
+					    files->second_val,
+					    node->edges[i].shared, files,
+					    functions);
+	if (tempsim < *similarity) {
+	    *similarity = tempsim;
+	    best = node->edges[i].node;
+	}
+    }
+
+    return best;
+}
+
+/* merge root node k into root node i (Ri keeps its segment ID),
+ * returns the new root node */
+int rag_merge(struct rag *rag, int i, int k, struct files *files)
+{
+    struct rag_node *ri = &rag->nodes[i], *rk = &rag->nodes[k], *tmp;
+    float *ival = rag->vals + (size_t) i * rag->nvals;
+    float *kval = rag->vals + (size_t) k * rag->nvals;
+    float *tval;
+    int n, id, nedges;
+
+#ifdef SIGNPOST
+    fprintf(stdout,
+	    "merging Ri (pixel count): %d (%d) with Rk (count): %d (%d).\n",
+	    ri->id, ri->area, rk->id, rk->area);
+#endif
+
+    /* merged two segments, decrement count if both were actual segments
+     * (not non-seed pixels) */
+    if (ri->id > 0 && rk->id > 0)
+	files->nsegs--;
+    id = ri->id > 0 ? ri->id : rk->id;
+
+    /* keep the node with the longer edge list as root */
+    if (rk->nedges > ri->nedges) {
+	tmp = ri;
+	ri = rk;
+	rk = tmp;
+	tval = ival;
+	ival = kval;
+	kval = tval;
+	n = i;
+	i = k;
+	k = n;
+    }
+    ri->id = id;
+
+    for (n = 0; n < files->nbands; n++) {
+	ival[n] =
+	    ((double)ival[n] * ri->area + (double)kval[n] * rk->area) /
+	    ((double)ri->area + rk->area);
+    }
+
+    /* update shape parameters, the perimeter after the edges are combined */
+    ri->area += rk->area;
+    ri->perimeter += rk->perimeter;
+    ri->max_col = max(ri->max_col, rk->max_col);
+    ri->min_col = min(ri->min_col, rk->min_col);
+    ri->max_row = max(ri->max_row, rk->max_row);
+    ri->min_row = min(ri->min_row, rk->min_row);
+
+    /* append the edges of Rk */
+    nedges = ri->nedges + rk->nedges;
+    if (ri->aedges < nedges) {
+	struct rag_edge *edges;
+	int aedges = max(nedges, 2 * ri->aedges);
+
+	edges = (struct rag_edge *)G_malloc(aedges *
+					    sizeof(struct rag_edge));
+	memcpy(edges, ri->edges, ri->nedges * sizeof(struct rag_edge));
+	if (ri->aedges)
+	    G_free(ri->edges);
+	ri->edges = edges;
+	ri->aedges = aedges;
+    }
+    memcpy(ri->edges + ri->nedges, rk->edges,
+	   rk->nedges * sizeof(struct rag_edge));
+    ri->nedges = nedges;
+
+    if (rk->aedges)
+	G_free(rk->edges);
+    rk->edges = NULL;
+    rk->nedges = rk->aedges = 0;
+
+    rk->parent = i;
+    ri->stamp++;
+    rk->stamp++;
+
+    /* the common border is counted from both sides */
+    ri->perimeter -= rag_edges(rag, i);
+
+    return i;
+}
+
+/* write segment IDs and band means back to the segmentation files,
+ * replacing the initial nodes stored in iseg_seg by rag_create() */
+void rag_write(struct rag *rag, struct files *files)
+{
+    int row, col, k, last = -1;
+
+    for (row = 0; row < rag->wrows; row++) {
+	for (col = 0; col < rag->wcols; col++) {
+	    if (FLAG_GET(files->null_flag, row + files->minrow,
+			 col + files->mincol))
+		continue;
+	    Segment_get(&files->iseg_seg, &k, row + files->minrow,
+			col + files->mincol);
+	    k = rag_find(rag, k);
+	    if (k != last) {
+		rag_vals(rag, k, files->bands_val);
+		last = k;
+	    }
+	    Segment_put(&files->iseg_seg, &rag->nodes[k].id,
+			row + files->minrow, col + files->mincol);
+	    Segment_put(&files->bands_seg, (void *)files->bands_val,
+			row + files->minrow, col + files->mincol);
+	}
+    }
+}
+
+/* priority queue of merge candidates, smallest similarity first */
+void rag_queue_push(struct rag_queue *q, double similarity, int node,
+		    int node_stamp, int nbr, int nbr_stamp)
+{
+    int i, parent;
+
+    if (q->nitems == q->aitems) {
+	q->aitems = q->aitems ? 2 * q->aitems : 1024;
+	q->items = (struct rag_queue_item *)G_realloc(q->items,
+						      q->aitems *
+						      sizeof(struct
+							     rag_queue_item));
+    }
+    i = q->nitems++;
+    while (i > 0) {
+	parent = (i - 1) / 2;
+	if (q->items[parent].similarity <= similarity)
+	    break;
+	q->items[i] = q->items[parent];
+	i = parent;
+    }
+    q->items[i].similarity = similarity;
+    q->items[i].node = node;
+    q->items[i].node_stamp = node_stamp;
+    q->items[i].nbr = nbr;
+    q->items[i].nbr_stamp = nbr_stamp;
+}
+
+struct rag_queue_item rag_queue_pop(struct rag_queue *q)
+{
+    struct rag_queue_item top = q->items[0], last;
+    int i = 0, child;
+
+    last = q->items[--q->nitems];
+    while ((child = 2 * i + 1) < q->nitems) {
+	if (child + 1 < q->nitems &&
+	    q->items[child + 1].similarity < q->items[child].similarity)
+	    child++;
+	if (last.similarity <= q->items[child].similarity)
+	    break;
+	q->items[i] = q->items[child];
+	i = child;
+    }
+    q->items[i] = last;
+
+    return top;
+}
@@ -0,0 +1,87 @@
+"""
+Name:      i.segment.gsoc tests
+Purpose:   Tests region growing of i.segment.gsoc from starting seeds.
+
+Licence:   This program is free software under the GNU General Public
+           License (>=v2). Read the file COPYING that comes with GRASS
+           for details.
+"""
+
+from grass.gunittest.case import TestCase
+from grass.gunittest.main import test
+from grass.script.core import read_command
+
+band = """\
+north: 5
+south: 0
+east: 7
+west: 0
+rows: 5
+cols: 7
+10 10 10 10 100 100 100
+10 10 10 10 100 100 100
+10 10 10 10 100 100 100
+10 10 10 10 100 100 100
+10 10 10 10 100 100 100
+"""
+
+# one seed pixel at each side, the left seed has to grow three columns
+seeds = """\
+north: 5
+south: 0
+east: 7
+west: 0
+rows: 5
+cols: 7
+* * * * * * *
+* * * * * * *
+1 * * * * * 2
+* * * * * * *
+* * * * * * *
+"""
+
+
+class TestSegmentSeeds(TestCase):
+    band = 'test_segment_band'
+    group = 'test_segment_group'
+    seeds = 'test_segment_seeds'
+    output = 'test_segment_output'
+
+    @classmethod
+    def setUpClass(cls):
+        """Imports the band and the seeds and sets the region"""
+        cls.runModule('r.in.ascii', input='-', stdin_=band, output=cls.band)
+        cls.runModule('r.in.ascii', input='-', stdin_=seeds, output=cls.seeds,
+                      type='CELL')
+        cls.runModule('i.group', group=cls.group, input=cls.band)
+        cls.use_temp_region()
+        cls.runModule('g.region', raster=cls.band)
+
+    @classmethod
+    def tearDownClass(cls):
+        """Removes the imported maps, the group and the temporary region"""
+        cls.del_temp_region()
+        cls.runModule('g.remove', flags='f', type='raster',
+                      name=[cls.band, cls.seeds])
+        cls.runModule('g.remove', flags='f', type='group', name=cls.group)
+
+    def tearDown(self):
+        self.runModule('g.remove', flags='f', type='raster', name=self.output)
+
+    def test_seeds_grow(self):
+        """Seeds grow over all pixels of their similar area"""
+        self.assertModule('i.segment.gsoc', group=self.group,
+                          seeds=self.seeds, output=self.output,
+                          threshold=0.1, radioweight=1)
+        self.assertRasterExists(self.output)
+        stats = read_command('r.stats', flags='cn', input=self.output)
+        counts = {}
+        for line in stats.splitlines():
+            cat, count = line.split()
+            counts[int(cat)] = int(count)
+        self.assertNotIn(0, counts, msg="Pixels were not reached by a seed")
+        self.assertEqual(sorted(counts.values()), [15, 20])
+
+
+if __name__ == '__main__':
+    test()
@@ -44,6 +44,11 @@ int merge_small_clumps(struct cache *bands_seg, int nbands,
                        struct cache *k_seg, int nlabels,
                        int diag, int minsize);
 
+int assign_seeds_ram(struct cache *bands_seg, struct cache *dist_seg,
+                     struct cache *k_seg, int nbands, DCELL **kseedsb,
+		     double *kseedsx, double *kseedsy, double *maxdistspeck,
+		     int numk, int offset, double invwt);
+
 int main(int argc, char *argv[])
 {
     struct GModule *module;	/* GRASS module for parsing arguments */
@@ -76,7 +81,7 @@ int main(int argc, char *argv[])
     DCELL *pdata;
     double *dists;
     struct cache bands_seg, k_seg, nk_seg, dist_seg;
-    int schange;
+    int schange, in_ram;
 
     double xerrperstrip, yerrperstrip;
     int xstrips, ystrips, xoff, yoff, xerr, yerr;
@@ -489,6 +494,10 @@ int main(int argc, char *argv[])
     /* of compactness.										    */
     invwt = 0.1 * compactness / (offset * offset);
 
+    /* with everything in the memory cache, cells are assigned to seeds
+     * in parallel directly on the cache buffers */
+    in_ram = bands_seg.r != NULL && dist_seg.r != NULL && k_seg.r != NULL;
+
     G_message(_("Performing K-means segmentation..."));
     schange = 0;
     for (itr = 0; itr < n_iterations; itr++) {
@@ -496,59 +505,66 @@ int main(int argc, char *argv[])
 
 	schange = 0;
 
-	dists[0] = 0;
-	dists[1] = 1E+9;
-	for (row = 0; row < nrows; row++) {
-	    for (col = 0; col < ncols; col++) {
-		cache_put(&dist_seg, dists, row, col);
-	    }
+	if (in_ram) {
+	    assign_seeds_ram(&bands_seg, &dist_seg, &k_seg, nbands, kseedsb,
+	                     kseedsx, kseedsy, maxdistspeck, numk, offset,
+			     invwt);
 	}
+	else {
+	    dists[0] = 0;
+	    dists[1] = 1E+9;
+	    for (row = 0; row < nrows; row++) {
+		for (col = 0; col < ncols; col++) {
+		    cache_put(&dist_seg, dists, row, col);
+		}
+	    }
 
-	for (k = 0; k < numk; k++) {
-	    y1 = (int)MAX(0.0, kseedsy[k] - offset);
-	    y2 = (int)MIN(nrows - 1, kseedsy[k] + offset);
-	    x1 = (int)MAX(0.0, kseedsx[k] - offset);
-	    x2 = (int)MIN(ncols - 1, kseedsx[k] + offset);
+	    for (k = 0; k < numk; k++) {
+		y1 = (int)MAX(0.0, kseedsy[k] - offset);
+		y2 = (int)MIN(nrows - 1, kseedsy[k] + offset);
+		x1 = (int)MAX(0.0, kseedsx[k] - offset);
+		x2 = (int)MIN(ncols - 1, kseedsx[k] + offset);
 
-	    for (y = y1; y <= y2; y++) {
-		dy = y - kseedsy[k];
+		for (y = y1; y <= y2; y++) {
+		    dy = y - kseedsy[k];
 		
-		for (x = x1; x <= x2; x++) {
-		    cache_get(&bands_seg, pdata, y, x);
-		    if (Rast_is_d_null_value(pdata))
-			continue;
+		    for (x = x1; x <= x2; x++) {
+			cache_get(&bands_seg, pdata, y, x);
+			if (Rast_is_d_null_value(pdata))
+			    continue;
 
-		    cache_get(&dist_seg, dists, y, x);
-		    dist = 0.0;
-		    for (b = 0; b < nbands; b++) {
-			dist += (pdata[b] - kseedsb[k][b]) *
-			        (pdata[b] - kseedsb[k][b]);
-		    }
-		    dist /= nbands;
-
-		    dx = x - kseedsx[k];
-		    distxy = (dx * dx + dy * dy) / 2.0;
-
-		    /* ----------------------------------------------------------------------- */
-		    distsum = dist / maxdistspeck[k] + distxy * invwt;
-		    /* We use a slightly different formula than that of Achanta et al.:        */
-		    /* D^2 = (dc / m)^2 + c * (ds / S)^2				       */	
-		    /* This means that m and S are always determined within the code and c is  */
-		    /* a factor to weigh the relative importance between color similarity and  */
-		    /* spatial proximity. Thus user-determined compactness is always taken     */
-		    /* into account, even in SLIC0, and is independent of the number of bands. */
-		    /*------------------------------------------------------------------------ */
-		    if (distsum < dists[1]) {
-			dists[0] = dist;
-			dists[1] = distsum;
-
-			cache_put(&dist_seg, dists, y, x);
-			cache_put(&k_seg, &k, y, x);
-		    }
+			cache_get(&dist_seg, dists, y, x);
+			dist = 0.0;
+			for (b = 0; b < nbands; b++) {
+			    dist += (pdata[b] - kseedsb[k][b]) *
+				    (pdata[b] - kseedsb[k][b]);
+			}
+			dist /= nbands;
+
+			dx = x - kseedsx[k];
+			distxy = (dx * dx + dy * dy) / 2.0;
+
+			/* ----------------------------------------------------------------------- */
+			distsum = dist / maxdistspeck[k] + distxy * invwt;
+			/* We use a slightly different formula than that of Achanta et al.:        */
+			/* D^2 = (dc / m)^2 + c * (ds / S)^2				       */	
+			/* This means that m and S are always determined within the code and c is  */
+			/* a factor to weigh the relative importance between color similarity and  */
+			/* spatial proximity. Thus user-determined compactness is always taken     */
+			/* into account, even in SLIC0, and is independent of the number of bands. */
+			/*------------------------------------------------------------------------ */
+			if (distsum < dists[1]) {
+			    dists[0] = dist;
+			    dists[1] = distsum;
+
+			    cache_put(&dist_seg, dists, y, x);
+			    cache_put(&k_seg, &k, y, x);
+			}
 
-		}		/* for( x=x1 */
-	    }			/* for( y=y1 */
-	}			/* for (n=0 */
+		    }		/* for( x=x1 */
+		}			/* for( y=y1 */
+	    }			/* for (n=0 */
+	}
 
 	if (slic0) {
 	    /* adaptive m for SLIC zero */
@@ -958,3 +974,113 @@ int perturb_seeds(struct cache *bands_seg, int nbands, DCELL **kseedsb,
 
     return nperturbed;
 }
+
+/* rows of cells processed together by one thread in assign_seeds_ram() */
+#define TILE_ROWS 64
+
+/* assign each cell to the most similar seed with all data in the memory
+ * cache: bands are interleaved per cell, dists hold two doubles per cell
+ *
+ * Tiles of rows are processed in parallel, each tile only with the seeds
+ * whose search window overlaps it. A thread writes only to the cells of
+ * its own tile and visits the seeds in the same order as the disk cache
+ * version, thus the result does not depend on the number of threads. */
+int assign_seeds_ram(struct cache *bands_seg, struct cache *dist_seg,
+                     struct cache *k_seg, int nbands, DCELL **kseedsb,
+		     double *kseedsx, double *kseedsy, double *maxdistspeck,
+		     int numk, int offset, double invwt)
+{
+    int nrows = k_seg->rows, ncols = k_seg->cols;
+    int ntiles = (nrows + TILE_ROWS - 1) / TILE_ROWS;
+    int *tile_first, *tile_next, *tile_seeds;
+    int k, t;
+    DCELL *bands = (DCELL *)bands_seg->r;
+    double *dists = (double *)dist_seg->r;
+    int *klabels = (int *)k_seg->r;
+
+    /* list the seeds of each tile, in seed order */
+    tile_first = G_calloc(ntiles + 1, sizeof(int));
+    tile_next = G_malloc(sizeof(int) * ntiles);
+    for (k = 0; k < numk; k++) {
+	int y1 = (int)MAX(0.0, kseedsy[k] - offset);
+	int y2 = (int)MIN(nrows - 1, kseedsy[k] + offset);
+
+	for (t = y1 / TILE_ROWS; t <= y2 / TILE_ROWS; t++)
+	    tile_first[t + 1]++;
+    }
+    for (t = 0; t < ntiles; t++) {
+	tile_first[t + 1] += tile_first[t];
+	tile_next[t] = tile_first[t];
+    }
+    tile_seeds = G_malloc(sizeof(int) * (tile_first[ntiles] + 1));
+    for (k = 0; k < numk; k++) {
+	int y1 = (int)MAX(0.0, kseedsy[k] - offset);
+	int y2 = (int)MIN(nrows - 1, kseedsy[k] + offset);
+
+	for (t = y1 / TILE_ROWS; t <= y2 / TILE_ROWS; t++)
+	    tile_seeds[tile_next[t]++] = k;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (t = 0; t < ntiles; t++) {
+	int row1 = t * TILE_ROWS;
+	int row2 = MIN(nrows, row1 + TILE_ROWS) - 1;
+	int i, b, x, y, x1, y1, x2, y2;
+	size_t idx;
+
+	for (idx = (size_t)row1 * ncols; idx < (size_t)(row2 + 1) * ncols; idx++) {
+	    dists[2 * idx] = 0;
+	    dists[2 * idx + 1] = 1E+9;
+	}
+
+	for (i = tile_first[t]; i < tile_first[t + 1]; i++) {
+	    int kt = tile_seeds[i];
+	    DCELL *seedb = kseedsb[kt];
+
+	    y1 = (int)MAX(0.0, kseedsy[kt] - offset);
+	    y2 = (int)MIN(nrows - 1, kseedsy[kt] + offset);
+	    x1 = (int)MAX(0.0, kseedsx[kt] - offset);
+	    x2 = (int)MIN(ncols - 1, kseedsx[kt] + offset);
+	    y1 = MAX(y1, row1);
+	    y2 = MIN(y2, row2);
+
+	    for (y = y1; y <= y2; y++) {
+		double dy = y - kseedsy[kt];
+
+		for (x = x1; x <= x2; x++) {
+		    DCELL *pdata;
+		    double dist, distxy, dx, distsum;
+
+		    idx = (size_t)y * ncols + x;
+		    pdata = bands + idx * nbands;
+		    if (Rast_is_d_null_value(pdata))
+			continue;
+
+		    dist = 0.0;
+#pragma omp simd reduction(+:dist)
+		    for (b = 0; b < nbands; b++) {
+			dist += (pdata[b] - seedb[b]) * (pdata[b] - seedb[b]);
+		    }
+		    dist /= nbands;
+
+		    dx = x - kseedsx[kt];
+		    distxy = (dx * dx + dy * dy) / 2.0;
+
+		    /* same formula as in main() */
+		    distsum = dist / maxdistspeck[kt] + distxy * invwt;
+		    if (distsum < dists[2 * idx + 1]) {
+			dists[2 * idx] = dist;
+			dists[2 * idx + 1] = distsum;
+			klabels[idx] = kt;
+		    }
+		}
+	    }
+	}
+    }
+
+    G_free(tile_first);
+    G_free(tile_next);
+    G_free(tile_seeds);
+
+    return 1;
+}
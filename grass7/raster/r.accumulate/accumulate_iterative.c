@@ -1,178 +1,169 @@
 #include <grass/glocale.h>
 #include "global.h"
 
-struct neighbor
-{
-    int row;
-    int col;
-    char done;
-    char parent;
-};
-
-struct neighbor_stack
-{
-    struct neighbor *up;
-    int n;
-    int nalloc;
-};
+/* done[row][col] is used for the number of upstream cells that are not
+ * accumulated yet; cells without any upstream cells are marked as sources
+ * because they are never counted down and can be told apart from cells that
+ * are counted down to 0 by other threads */
+#define SOURCE 0x10
 
 static int nrows, ncols;
 
-static void trace_up(struct cell_map *, struct raster_map *,
-                     struct raster_map *, char **, char, int, int);
-static void find_up(struct cell_map *, struct raster_map *,
-                    struct raster_map *, char **, char, int, int,
-                    struct neighbor *, int *);
-static char is_incomplete(struct cell_map *, int, int);
-static void init_up_stack(struct neighbor_stack *);
-static void free_up_stack(struct neighbor_stack *);
-static void push_up(struct neighbor_stack *, struct neighbor *);
-static struct neighbor pop_up(struct neighbor_stack *);
-static struct neighbor *get_up(struct neighbor_stack *, int);
+/* row and col offsets of the downstream cell for each direction */
+static int next_row[9] = { 0, -1, -1, -1, 0, 1, 1, 1, 0 };
+static int next_col[9] = { 0, 1, 0, -1, -1, -1, 0, 1, 1 };
+
+static int count_up(struct cell_map *, int, int);
+static int find_down(struct cell_map *, int, int, int *, int *);
+static void accumulate_cell(struct cell_map *, struct raster_map *,
+                            struct raster_map *, char, int, int);
 
 void accumulate_iterative(struct cell_map *dir_buf,
                           struct raster_map *weight_buf,
                           struct raster_map *accum_buf, char **done, char neg,
                           char null)
 {
-    int row, col;
+    int row, col, nrows_done = 0, nloops = 0;
 
     nrows = dir_buf->nrows;
     ncols = dir_buf->ncols;
 
-    G_message(_("Accumulating flows iteratively..."));
+    /* count upstream cells (in-degrees) of all cells */
+    G_message(_("Counting upstream cells..."));
+#pragma omp parallel for schedule(static) private(col)
     for (row = 0; row < nrows; row++) {
-        G_percent(row, nrows, 1);
-        for (col = 0; col < ncols; col++)
-            if (dir_buf->c[row][col])
-                trace_up(dir_buf, weight_buf, accum_buf, done, neg, row, col);
-            else if (null)
-                set_null(accum_buf, row, col);
+        for (col = 0; col < ncols; col++) {
+            if (dir_buf->c[row][col]) {
+                int nup = count_up(dir_buf, row, col);
+
+                done[row][col] = nup ? nup : SOURCE;
+            }
+            else
+                done[row][col] = 0;
+        }
     }
-    G_percent(1, 1, 1);
-}
 
-static void trace_up(struct cell_map *dir_buf, struct raster_map *weight_buf,
-                     struct raster_map *accum_buf, char **done, char neg,
-                     int row, int col)
-{
-    int i, nup;
-    struct neighbor cur, up[8];
-    struct neighbor_stack up_stack;
-
-    /* if the current cell is outside the computational region or already
-     * processed, stop tracing */
-    if (row < 0 || row >= nrows || col < 0 || col >= ncols || done[row][col])
-        return;
-
-    find_up(dir_buf, weight_buf, accum_buf, done, neg, row, col, up, &nup);
-
-    /* if no upstream neighbors are found, stop tracing */
-    if (!nup)
-        return;
-
-    init_up_stack(&up_stack);
-
-    cur.row = row;
-    cur.col = col;
-    cur.done = cur.parent = 0;
-    push_up(&up_stack, &cur);
-
-    /* push upstream cells */
-    for (i = 0; i < nup; i++)
-        push_up(&up_stack, &up[i]);
-
-    do {
-        /* pop one upstream cell */
-        struct neighbor *cur_up = get_up(&up_stack, 0);
-
-        /* only if the current cell is not process */
-        if (!cur_up->done) {
-            /* find its upstream cells */
-            find_up(dir_buf, weight_buf, accum_buf, done, neg, cur_up->row,
-                    cur_up->col, up, &nup);
-
-            /* if there are upstream cells */
-            if (nup) {
-                /* push them */
-                for (i = 0; i < nup; i++)
-                    push_up(&up_stack, &up[i]);
-                /* move to the next cell in the stack without tracing down */
+    /* start from source cells and walk downstream as far as all upstream
+     * cells are accumulated; every cell is accumulated exactly once by the
+     * thread that counted its last upstream cell down */
+    G_message(_("Accumulating flows iteratively..."));
+#pragma omp parallel for schedule(dynamic) private(col)
+    for (row = 0; row < nrows; row++) {
+        for (col = 0; col < ncols; col++) {
+            int cur_row, cur_col, down_row, down_col;
+
+            if (!dir_buf->c[row][col]) {
+                if (null)
+                    set_null(accum_buf, row, col);
+                continue;
+            }
+            if (done[row][col] != SOURCE)
                 continue;
+
+            cur_row = row;
+            cur_col = col;
+            accumulate_cell(dir_buf, weight_buf, accum_buf, neg, cur_row,
+                            cur_col);
+
+            while (find_down(dir_buf, cur_row, cur_col, &down_row, &down_col)) {
+                char nleft;
+
+                /* make the accumulation of the current cell visible to the
+                 * thread that will accumulate the downstream cell */
+#pragma omp flush
+#pragma omp atomic capture
+                nleft = --done[down_row][down_col];
+
+                /* other upstream cells are not accumulated yet */
+                if (nleft)
+                    break;
+
+#pragma omp flush
+                cur_row = down_row;
+                cur_col = down_col;
+                accumulate_cell(dir_buf, weight_buf, accum_buf, neg, cur_row,
+                                cur_col);
             }
         }
+#pragma omp critical (progress)
+        G_percent(nrows_done++, nrows, 1);
+    }
+    G_percent(1, 1, 1);
 
-        /* trace down */
-        if (cur_up->parent) {
-            char incomplete = cur_up->done == 2;
-            char last_child = cur_up->parent == 1;
-            double accum = get(accum_buf, cur_up->row, cur_up->col);
-
-            /* for negative accumulation */
-            if (neg) {
-                /* always return its absolute value */
-                if (accum < 0)
-                    accum = -accum;
-
-                /* set the incomplete flag if the cell is on edges */
-                if (!incomplete)
-                    incomplete =
-                        is_incomplete(dir_buf, cur_up->row, cur_up->col);
+    /* cells in or downstream of flow loops can never be accumulated */
+    for (row = 0; row < nrows; row++) {
+        for (col = 0; col < ncols; col++) {
+            if (dir_buf->c[row][col] && done[row][col] &&
+                done[row][col] != SOURCE) {
+                set_null(accum_buf, row, col);
+                nloops++;
             }
+        }
+    }
+    if (nloops)
+        G_warning(n_("%d cell in or downstream of flow loops not accumulated",
+                     "%d cells in or downstream of flow loops not accumulated",
+                     nloops), nloops);
+}
 
-            /* retrieve the parent cell */
-            cur_up = get_up(&up_stack, cur_up->parent);
+/* count neighbor cells that flow into the current cell with no flow loop */
+static int count_up(struct cell_map *dir_buf, int row, int col)
+{
+    int i, j, nup = 0;
 
-            /* set the incomplete flag if negative accumulation is requested
-             * and the cell is on edges */
-            if (neg && !incomplete)
-                incomplete = cur_up->done == 2 ||
-                    is_incomplete(dir_buf, cur_up->row, cur_up->col);
+    for (i = -1; i <= 1; i++) {
+        if (row + i < 0 || row + i >= nrows)
+            continue;
 
-            if (cur_up->done) {
-                double a = get(accum_buf, cur_up->row, cur_up->col);
+        for (j = -1; j <= 1; j++) {
+            if ((i == 0 && j == 0) || col + j < 0 || col + j >= ncols)
+                continue;
 
-                accum += neg && a < 0 ? -a : a;
-            }
-            else
-                /* if a weight map is specified (no negative accumulation is
-                 * implied), use the weight value at the current cell;
-                 * otherwise use 1 */
-                accum +=
-                    weight_buf->map.v ? get(weight_buf, cur_up->row,
-                                            cur_up->col) : 1.0;
-
-            /* if negative accumulation is desired and the current cell is
-             * incomplete, use a negative cell count without weighting;
-             * otherwise use accumulation as is (cell count or weighted
-             * accumulation, which can be negative) */
-            set(accum_buf, cur_up->row, cur_up->col,
-                incomplete ? -accum : accum);
-
-            /* the current cell is done; 1 for no likely underestimates and 2
-             * for likely underestimates */
-            if (cur_up->done != 2)
-                cur_up->done = 1 + incomplete;
-
-            if (last_child)
-                done[cur_up->row][cur_up->col] = cur_up->done;
+            if (dir_buf->c[row + i][col + j] == dir_checks[i + 1][j + 1][0] &&
+                dir_buf->c[row][col] != dir_checks[i + 1][j + 1][1])
+                nup++;
         }
+    }
 
-        /* discard the top cell from the stack */
-        pop_up(&up_stack);
-    } while (up_stack.n);
+    return nup;
+}
 
-    free_up_stack(&up_stack);
+/* find the downstream cell that counts the current cell as its upstream
+ * cell; return 0 if there is none */
+static int find_down(struct cell_map *dir_buf, int row, int col,
+                     int *down_row, int *down_col)
+{
+    int dir = dir_buf->c[row][col];
+    int down_dir;
+
+    *down_row = row + next_row[dir];
+    *down_col = col + next_col[dir];
+
+    /* if the downstream cell is outside the computational region or null, no
+     * downstream accumulation */
+    if (*down_row < 0 || *down_row >= nrows || *down_col < 0 ||
+        *down_col >= ncols || !(down_dir = dir_buf->c[*down_row][*down_col]))
+        return 0;
+
+    /* if the downstream cell flows back into the current cell, it is a flow
+     * loop */
+    return next_row[down_dir] != -next_row[dir] ||
+        next_col[down_dir] != -next_col[dir];
 }
 
-static void find_up(struct cell_map *dir_buf, struct raster_map *weight_buf,
-                    struct raster_map *accum_buf, char **done, char neg,
-                    int row, int col, struct neighbor *up, int *nup)
+/* accumulate the current cell after all its upstream cells are accumulated */
+static void accumulate_cell(struct cell_map *dir_buf,
+                            struct raster_map *weight_buf,
+                            struct raster_map *accum_buf, char neg, int row,
+                            int col)
 {
     int i, j;
     char incomplete = 0;
 
-    *nup = 0;
+    /* if a weight map is specified (no negative accumulation is implied), use
+     * the weight value at the current cell; otherwise use 1 */
+    double accum = weight_buf->map.v ? get(weight_buf, row, col) : 1.0;
+
     for (i = -1; i <= 1; i++) {
         /* if a neighbor cell is outside the computational region, its
          * downstream accumulation is incomplete */
@@ -195,114 +186,26 @@ static void find_up(struct cell_map *dir_buf, struct raster_map *weight_buf,
             }
 
             /* if a neighbor cell flows into the current cell with no flow
-             * loop, store its row and col in the up array */
+             * loop, add its accumulation */
             if (dir_buf->c[row + i][col + j] == dir_checks[i + 1][j + 1][0] &&
                 dir_buf->c[row][col] != dir_checks[i + 1][j + 1][1]) {
-                up[*nup].row = row + i;
-                up[*nup].col = col + j;
-                up[*nup].done = done[row + i][col + j];
-                /* XXX: tempted to merge these two lines into
-                 * up[*nup].parent = ++(*nup);
-                 * ? don't because its behavior is undefined (-Wsequence-point
-                 * GCC(1)); you don't want to have on both sides of an
-                 * assignment the same variable that pre-/post-increments */
-                up[*nup].parent = *nup + 1;
-                (*nup)++;
-            }
-        }
-    }
-
-    /* if no upstream cells are found */
-    if (!*nup) {
-        /* if a weight map is specified (no negative accumulation is implied),
-         * use the weight value at the current cell; otherwise use 1 */
-        double accum = weight_buf->map.v ? get(weight_buf, row, col) : 1.0;
-
-        /* if negative accumulation is desired and the current cell is
-         * incomplete, use a negative cell count without weighting; otherwise
-         * use accumulation as is (cell count or weighted accumulation, which
-         * can be negative) */
-        set(accum_buf, row, col, incomplete ? -accum : accum);
-
-        /* the current cell is done; 1 for no likely underestimates and 2 for
-         * likely underestimates (only when requested) */
-        done[row][col] = 1 + incomplete;
-    }
-}
-
-static char is_incomplete(struct cell_map *dir_buf, int row, int col)
-{
-    char incomplete = 0;
-
-    if (row == 0 || row == nrows - 1 || col == 0 || col == ncols - 1)
-        incomplete = 1;
-    else {
-        int i, j;
+                double up_accum = get(accum_buf, row + i, col + j);
 
-        for (i = -1; i <= 1 && !incomplete; i++) {
-            if (row + i < 0 || row + i >= nrows)
-                continue;
-            for (j = -1; j <= 1 && !incomplete; j++) {
-                if ((i == 0 && j == 0) || col + j < 0 || col + j >= ncols)
-                    continue;
-                if (!dir_buf->c[row + i][col + j])
+                /* for negative accumulation, a negative upstream cell count
+                 * means the upstream cell is incomplete, so is the current
+                 * cell */
+                if (neg && up_accum < 0) {
+                    up_accum = -up_accum;
                     incomplete = 1;
-            }
-        }
-    }
-
-    return incomplete;
-}
+                }
 
-static void init_up_stack(struct neighbor_stack *up_stack)
-{
-    up_stack->nalloc = up_stack->n = 0;
-    up_stack->up = NULL;
-}
-
-static void free_up_stack(struct neighbor_stack *up_stack)
-{
-    if (up_stack->up)
-        G_free(up_stack->up);
-    init_up_stack(up_stack);
-}
-
-static void push_up(struct neighbor_stack *up_stack, struct neighbor *up)
-{
-    if (up_stack->n == up_stack->nalloc) {
-        up_stack->nalloc += REALLOC_INCREMENT;
-        up_stack->up =
-            (struct neighbor *)G_realloc(up_stack->up,
-                                         up_stack->nalloc *
-                                         sizeof(struct neighbor));
-    }
-    up_stack->up[up_stack->n++] = *up;
-}
-
-static struct neighbor pop_up(struct neighbor_stack *up_stack)
-{
-    struct neighbor up;
-
-    if (up_stack->n > 0) {
-        up = up_stack->up[--up_stack->n];
-        if (up_stack->n == up_stack->nalloc - REALLOC_INCREMENT) {
-            up_stack->nalloc -= REALLOC_INCREMENT;
-            up_stack->up =
-                (struct neighbor *)G_realloc(up_stack->up,
-                                             up_stack->nalloc *
-                                             sizeof(struct neighbor));
+                accum += up_accum;
+            }
         }
     }
 
-    return up;
-}
-
-static struct neighbor *get_up(struct neighbor_stack *up_stack, int back)
-{
-    struct neighbor *up = NULL;
-
-    if (up_stack->n > back)
-        up = &up_stack->up[up_stack->n - 1 - back];
-
-    return up;
+    /* if negative accumulation is desired and the current cell is incomplete,
+     * use a negative cell count without weighting; otherwise use accumulation
+     * as is (cell count or weighted accumulation, which can be negative) */
+    set(accum_buf, row, col, incomplete ? -accum : accum);
 }
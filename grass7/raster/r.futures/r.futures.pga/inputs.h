@@ -80,16 +80,31 @@ struct UndevelopedCell
 
     size_t id;
     float probability;
-    float cumulative_probability;
-    bool tried;
+    // step (counted from 1) in which the cell was last tried as a seed
+    int tried;
+    // probability needs to be recomputed
+    bool changed;
 };
 
 struct Undeveloped
 {
     int max_subregions;
     size_t *max;
+    // number of cells which are still undeveloped
     size_t *num;
+    // number of cells in array, including the ones developed later
+    size_t *size;
     struct UndevelopedCell **cells;
+    // Fenwick tree of seed weights of cells for each subregion
+    double **tree;
+    // seeds are weighted by probability (otherwise uniform)
+    bool weighted;
+    // index of each undeveloped cell (by id) in its subregion, -1 otherwise
+    int *position;
+    // cells developed during the current step
+    size_t *developed;
+    size_t num_developed;
+    size_t max_developed;
 };
 
 
@@ -5,6 +5,8 @@
 
    Derived from the Key_Value (lib/gis/key_value1.c) functions in GRASS
    GIS library which handled char*-char* pairs.
+   Keys are found using a hash table with linear probing,
+   items are stored in the order in which they were added.
 
    (C) 2016 by Vaclav Petras and the GRASS Development Team
 
@@ -19,6 +21,44 @@
 
 #include "keyvalue.h"
 
+/*!
+   \brief Get first slot for a key in a table of given size (power of 2)
+ */
+static int slot_for_key(int key, int table_size)
+{
+    unsigned int h = (unsigned int) key;
+
+    /* Fibonacci hashing spreads consecutive keys */
+    h *= 2654435769u;
+    return (h ^ (h >> 16)) & (table_size - 1);
+}
+
+/*!
+   \brief Find slot with the key or the empty slot where it belongs
+ */
+static int find_slot(const struct KeyValueIntInt *kv, int key)
+{
+    int slot = slot_for_key(key, kv->table_size);
+
+    while (kv->table[slot] && kv->key[kv->table[slot] - 1] != key)
+        slot = (slot + 1) & (kv->table_size - 1);
+    return slot;
+}
+
+/*!
+   \brief Double the size of hash table and put all items to it again
+ */
+static void grow_table(struct KeyValueIntInt *kv)
+{
+    int n;
+
+    kv->table_size = kv->table_size > 0 ? 2 * kv->table_size : 16;
+    kv->table = (int *) G_realloc(kv->table, kv->table_size * sizeof(int));
+    G_zero(kv->table, kv->table_size * sizeof(int));
+    for (n = 0; n < kv->nitems; n++)
+        kv->table[find_slot(kv, kv->key[n])] = n + 1;
+}
+
 /*!
    \brief Allocate and initialize KeyValueIntInt structure
 
@@ -42,10 +82,13 @@ struct KeyValueIntInt *KeyValueIntInt_create()
 void KeyValueIntInt_set(struct KeyValueIntInt *kv, int key, int value)
 {
     int n;
+    int slot;
 
-    for (n = 0; n < kv->nitems; n++)
-        if (key == kv->key[n])
-            break;
+    /* keep the table at most half full */
+    if (2 * (kv->nitems + 1) > kv->table_size)
+        grow_table(kv);
+    slot = find_slot(kv, key);
+    n = kv->table[slot] ? kv->table[slot] - 1 : kv->nitems;
 
     if (n == kv->nitems) {
         if (n >= kv->nalloc) {
@@ -64,6 +107,7 @@ void KeyValueIntInt_set(struct KeyValueIntInt *kv, int key, int value)
         kv->key[n] = key;
         kv->value[n] = value;
         kv->nitems++;
+        kv->table[slot] = n + 1;
         return;
     }
 
@@ -84,14 +128,14 @@ int KeyValueIntInt_find(const struct KeyValueIntInt *kv, int key, int *value)
 {
     int n;
 
-    if (!kv)
+    if (!kv || kv->nitems == 0)
         return FALSE;
 
-    for (n = 0; n < kv->nitems; n++)
-        if (key == kv->key[n]) {
-            *value = kv->value[n];
-            return TRUE;
-        }
+    n = kv->table[find_slot(kv, key)];
+    if (n) {
+        *value = kv->value[n - 1];
+        return TRUE;
+    }
 
     return FALSE;
 }
@@ -108,6 +152,7 @@ void KeyValueIntInt_free(struct KeyValueIntInt *kv)
 
     G_free(kv->key);
     G_free(kv->value);
+    G_free(kv->table);
     kv->nitems = 0;                /* just for safe measure */
     kv->nalloc = 0;
     G_free(kv);
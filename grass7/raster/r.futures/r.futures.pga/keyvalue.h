@@ -7,6 +7,9 @@ struct KeyValueIntInt
     int nalloc;
     int *key;
     int *value;
+    /* open addressing hash table with index + 1 of items (0 is empty) */
+    int *table;
+    int table_size;
 };
 
 struct KeyValueIntInt *KeyValueIntInt_create();
@@ -50,6 +50,9 @@
 #include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <grass/gis.h>
 #include <grass/raster.h>
@@ -62,15 +65,24 @@
 #include "patch.h"
 #include "devpressure.h"
 #include "simulation.h"
+#include "utils.h"
 
 
-struct Undeveloped *initialize_undeveloped(int num_subregions)
+struct Undeveloped *initialize_undeveloped(int num_subregions, bool weighted)
 {
     struct Undeveloped *undev = (struct Undeveloped *) G_malloc(sizeof(struct Undeveloped));
     undev->max_subregions = num_subregions;
     undev->max = (size_t *) G_malloc(undev->max_subregions * sizeof(size_t));
     undev->num = (size_t *) G_calloc(undev->max_subregions, sizeof(size_t));
+    undev->size = (size_t *) G_calloc(undev->max_subregions, sizeof(size_t));
     undev->cells = (struct UndevelopedCell **) G_malloc(undev->max_subregions * sizeof(struct UndevelopedCell *));
+    undev->tree = (double **) G_calloc(undev->max_subregions, sizeof(double *));
+    undev->weighted = weighted;
+    /* filled in the first step */
+    undev->position = NULL;
+    undev->developed = NULL;
+    undev->num_developed = 0;
+    undev->max_developed = 0;
     for (int i = 0; i < undev->max_subregions; i++){
         undev->max[i] = (Rast_window_rows() * Rast_window_cols()) / num_subregions;
         undev->cells[i] = (struct UndevelopedCell *) G_malloc(undev->max[i] * sizeof(struct UndevelopedCell));
@@ -78,13 +90,228 @@ struct Undeveloped *initialize_undeveloped(int num_subregions)
     return undev;
 }
 
+/*!
+ * \brief Copy undeveloped cells with computed probabilities
+ *
+ * Cells developed during the last step are not copied.
+ *
+ * \param undev undeveloped cells
+ * \return new copy
+ */
+static struct Undeveloped *copy_undeveloped(const struct Undeveloped *undev)
+{
+    size_t ncells = (size_t) Rast_window_rows() * Rast_window_cols();
+    size_t n = undev->max_subregions * sizeof(size_t);
+    struct Undeveloped *copy = (struct Undeveloped *) G_malloc(sizeof(struct Undeveloped));
+
+    *copy = *undev;
+    copy->max = (size_t *) G_malloc(n);
+    copy->num = (size_t *) G_malloc(n);
+    copy->size = (size_t *) G_malloc(n);
+    memcpy(copy->max, undev->max, n);
+    memcpy(copy->num, undev->num, n);
+    memcpy(copy->size, undev->size, n);
+    copy->cells = (struct UndevelopedCell **) G_malloc(undev->max_subregions * sizeof(struct UndevelopedCell *));
+    copy->tree = (double **) G_malloc(undev->max_subregions * sizeof(double *));
+    for (int i = 0; i < undev->max_subregions; i++){
+        copy->cells[i] = (struct UndevelopedCell *) G_malloc(undev->max[i] * sizeof(struct UndevelopedCell));
+        memcpy(copy->cells[i], undev->cells[i], undev->size[i] * sizeof(struct UndevelopedCell));
+        copy->tree[i] = (double *) G_malloc((undev->size[i] + 1) * sizeof(double));
+        memcpy(copy->tree[i], undev->tree[i], (undev->size[i] + 1) * sizeof(double));
+    }
+    copy->position = (int *) G_malloc(ncells * sizeof(int));
+    memcpy(copy->position, undev->position, ncells * sizeof(int));
+    copy->developed = NULL;
+    copy->num_developed = 0;
+    copy->max_developed = 0;
+    return copy;
+}
+
+static void free_undeveloped(struct Undeveloped *undev)
+{
+    G_free(undev->num);
+    G_free(undev->max);
+    G_free(undev->size);
+    for (int i = 0; i < undev->max_subregions; i++) {
+        G_free(undev->cells[i]);
+        G_free(undev->tree[i]);
+    }
+    G_free(undev->cells);
+    G_free(undev->tree);
+    G_free(undev->position);
+    G_free(undev->developed);
+    G_free(undev);
+}
+
+/*!
+ * \brief Copy segment to a new temporary segment
+ * \param[out] copy new segment
+ * \param segment segment to copy
+ * \param segment_info segment parameters
+ * \param size cell size
+ */
+static void copy_segment(SEGMENT *copy, SEGMENT *segment,
+                         struct SegmentMemory segment_info, int size)
+{
+    int row, rows, cols;
+    void *buffer;
+
+    rows = Rast_window_rows();
+    cols = Rast_window_cols();
+    if (Segment_open(copy, G_tempfile(), rows, cols, segment_info.rows,
+                     segment_info.cols, size, segment_info.in_memory) != 1)
+        G_fatal_error(_("Cannot create temporary file with segments of a raster map"));
+    buffer = G_malloc((size_t) cols * size);
+    Segment_flush(segment);
+    for (row = 0; row < rows; row++) {
+        Segment_get_row(segment, buffer, row);
+        Segment_put_row(copy, buffer, row);
+    }
+    Segment_flush(copy);
+    G_free(buffer);
+}
+
+/*!
+ * \brief Copy all segments, so that a simulation can run independently
+ *
+ * Also the segments which are only read during the simulation are copied
+ * because Segment_get() is not a pure read: it pages the segment in and
+ * updates the page cache and its bookkeeping in the SEGMENT structure.
+ * Threads can't share one SEGMENT without a lock around every access.
+ *
+ * \param[out] copy new segments
+ * \param segments segments to copy
+ * \param segment_info segment parameters
+ */
+static void copy_segments(struct Segments *copy, struct Segments *segments,
+                          struct SegmentMemory segment_info)
+{
+    copy->use_weight = segments->use_weight;
+    copy->use_potential_subregions = segments->use_potential_subregions;
+    copy_segment(&copy->developed, &segments->developed, segment_info,
+                 Rast_cell_size(CELL_TYPE));
+    copy_segment(&copy->subregions, &segments->subregions, segment_info,
+                 Rast_cell_size(CELL_TYPE));
+    copy_segment(&copy->devpressure, &segments->devpressure, segment_info,
+                 Rast_cell_size(FCELL_TYPE));
+    copy_segment(&copy->aggregated_predictor, &segments->aggregated_predictor,
+                 segment_info, Rast_cell_size(FCELL_TYPE));
+    copy_segment(&copy->probability, &segments->probability, segment_info,
+                 Rast_cell_size(FCELL_TYPE));
+    if (segments->use_weight)
+        copy_segment(&copy->weight, &segments->weight, segment_info,
+                     Rast_cell_size(FCELL_TYPE));
+    if (segments->use_potential_subregions)
+        copy_segment(&copy->potential_subregions, &segments->potential_subregions,
+                     segment_info, Rast_cell_size(CELL_TYPE));
+}
+
+static void close_segments(struct Segments *segments)
+{
+    Segment_close(&segments->developed);
+    Segment_close(&segments->subregions);
+    Segment_close(&segments->devpressure);
+    Segment_close(&segments->probability);
+    Segment_close(&segments->aggregated_predictor);
+    if (segments->use_weight)
+        Segment_close(&segments->weight);
+    if (segments->use_potential_subregions)
+        Segment_close(&segments->potential_subregions);
+}
+
+/*!
+ * \brief Run all steps of one simulation and write its outputs
+ *
+ * Random numbers are taken from the generator of the current thread,
+ * which needs to be seeded before.
+ *
+ * \param output name of output raster map
+ * \param output_series basename of output raster maps for each step or NULL
+ * \param[out] shortages subregions and steps without enough undeveloped cells
+ */
+static void simulate(struct Undeveloped *undev_cells, struct Segments *segments,
+                     struct Demand *demand_info, struct Potential *potential_info,
+                     struct PatchSizes *patch_sizes, struct PatchInfo *patch_info,
+                     struct DevPressure *devpressure_info,
+                     enum seed_search search_alg,
+                     struct KeyValueIntInt *reverse_region_map, int num_steps,
+                     const char *output, const char *output_series,
+                     struct Shortages *shortages)
+{
+    int step;
+    int region;
+    int *patch_overflow;
+    char *name_step;
+    bool overgrow;
+
+    patch_overflow = G_calloc(undev_cells->max_subregions, sizeof(int));
+    overgrow = true;
+    for (step = 0; step < num_steps; step++) {
+        recompute_probabilities(undev_cells, segments, potential_info,
+                                devpressure_info);
+        if (step == num_steps - 1)
+            overgrow = false;
+        for (region = 0; region < undev_cells->max_subregions; region++) {
+            compute_step(undev_cells, demand_info, search_alg, segments,
+                         patch_sizes, patch_info, devpressure_info, patch_overflow,
+                         step, region, reverse_region_map, overgrow,
+                         shortages);
+        }
+        /* export developed for that step */
+        if (output_series) {
+            name_step = name_for_step(output_series, step, num_steps);
+            #pragma omp critical (output)
+            output_developed_step(&segments->developed, name_step,
+                                  demand_info->years[step], -1, num_steps, true, true);
+            G_free(name_step);
+        }
+    }
+
+    /* write */
+    #pragma omp critical (output)
+    output_developed_step(&segments->developed, output,
+                          demand_info->years[0], demand_info->years[step-1],
+                          num_steps, false, false);
+    G_free(patch_overflow);
+}
+
+
+/*!
+ * \brief Warn about subregions without enough undeveloped cells and free the list
+ *
+ * \param run run number (counted from 1) or 0 for a single run
+ */
+static void report_shortages(struct Shortages *shortages, int run)
+{
+    int i;
+    struct Shortage *item;
+
+    for (i = 0; i < shortages->num; i++) {
+        item = &shortages->items[i];
+        if (run > 0)
+            G_warning(_("Run %d: not enough undeveloped cells in region %d"
+                        " in step %d (requested: %d, available: %ld)."
+                        " Converting all available."),
+                      run, item->region_id, item->step + 1, item->requested,
+                      (long) item->available);
+        else
+            G_warning(_("Not enough undeveloped cells in region %d"
+                        " in step %d (requested: %d, available: %ld)."
+                        " Converting all available."),
+                      item->region_id, item->step + 1, item->requested,
+                      (long) item->available);
+    }
+    G_free(shortages->items);
+    shortages->items = NULL;
+    shortages->num = shortages->max = 0;
+}
 
 static int manage_memory(struct SegmentMemory *memory, struct Segments *segments,
-                         float input_memory)
+                         float input_memory, int num_copies)
 {
     int nseg, nseg_total;
     int cols, rows;
-    int undev_size;
+    size_t undev_size;
     size_t size;
     size_t estimate;
 
@@ -92,8 +319,12 @@ static int manage_memory(struct SegmentMemory *memory, struct Segments *segments
     memory->cols = 64;
     rows = Rast_window_rows();
     cols = Rast_window_cols();
+    /* memory is split between simulations running at the same time */
+    if (input_memory > 0)
+        input_memory /= num_copies;
 
-    undev_size = (sizeof(size_t) + sizeof(float) * 2 + sizeof(bool)) * rows * cols;
+    /* cells, trees and positions of cells */
+    undev_size = (sizeof(struct UndevelopedCell) + sizeof(double) + sizeof(int)) * rows * cols;
     estimate = undev_size;
 
     if (input_memory > 0 && undev_size > 1e9 * input_memory)
@@ -137,7 +368,8 @@ int main(int argc, char **argv)
                 *potentialFile, *numNeighbors, *discountFactor, *seedSearch,
                 *patchMean, *patchRange,
                 *incentivePower, *potentialWeight,
-                *demandFile, *separator, *patchFile, *numSteps, *output, *outputSeries, *seed, *memory;
+                *demandFile, *separator, *patchFile, *numSteps, *output, *outputSeries, *seed, *memory,
+                *repeat, *nprocs;
 
     } opt;
 
@@ -150,8 +382,9 @@ int main(int argc, char **argv)
     int num_predictors;
     int num_steps;
     int nseg;
-    int region;
-    int step;
+    int run;
+    int repeat;
+    int nprocs;
     float memory;
     double discount_factor;
     float exponent;
@@ -161,6 +394,8 @@ int main(int argc, char **argv)
     struct KeyValueIntInt *reverse_region_map;
     struct KeyValueIntInt *potential_region_map;
     struct Undeveloped *undev_cells;
+    struct Shortages shortages = {NULL, 0, 0};
+    struct Shortages *run_shortages;
     struct Demand demand_info;
     struct Potential potential_info;
     struct SegmentMemory segment_info;
@@ -168,9 +403,6 @@ int main(int argc, char **argv)
     struct PatchInfo patch_info;
     struct DevPressure devpressure_info;
     struct Segments segments;
-    int *patch_overflow;
-    char *name_step;
-    bool overgrow;
 
     G_gisinit(argv[0]);
 
@@ -398,6 +630,27 @@ int main(int argc, char **argv)
     opt.memory->required = NO;
     opt.memory->description = _("Memory in GB");
 
+    opt.repeat = G_define_option();
+    opt.repeat->key = "repeat";
+    opt.repeat->type = TYPE_INTEGER;
+    opt.repeat->required = NO;
+    opt.repeat->answer = "1";
+    opt.repeat->options = "1-";
+    opt.repeat->label = _("Number of stochastic runs of the simulation");
+    opt.repeat->description =
+            _("With more than one run, suffix _run and number of the run"
+              " is appended to output names and the random seed is increased"
+              " by one for each run");
+    opt.repeat->guisection = _("Random numbers");
+
+    opt.nprocs = G_define_option();
+    opt.nprocs->key = "nprocs";
+    opt.nprocs->type = TYPE_INTEGER;
+    opt.nprocs->required = NO;
+    opt.nprocs->answer = "1";
+    opt.nprocs->options = "1-";
+    opt.nprocs->description = _("Number of runs computed in parallel");
+
     // TODO: add mutually exclusive?
     // TODO: add flags or options to control values in series and final rasters
 
@@ -420,6 +673,17 @@ int main(int argc, char **argv)
         G_message("Read random seed from %s option: %ld",
                   opt.seed->key, seed_value);
     }
+    repeat = atoi(opt.repeat->answer);
+    nprocs = atoi(opt.nprocs->answer);
+    if (nprocs > repeat)
+        nprocs = repeat;
+#ifdef _OPENMP
+    omp_set_num_threads(nprocs);
+#else
+    if (nprocs > 1)
+        G_warning(_("Module was compiled without OpenMP, runs will be computed serially"));
+    nprocs = 1;
+#endif
 
     devpressure_info.scaling_factor = atof(opt.scalingFactor->answer);
     devpressure_info.gamma = atof(opt.gamma->answer);
@@ -465,7 +729,9 @@ int main(int argc, char **argv)
     memory = -1;
     if (opt.memory->answer)
         memory = atof(opt.memory->answer);
-    nseg = manage_memory(&segment_info, &segments, memory);
+    /* runs copy the segments, the original ones are kept */
+    nseg = manage_memory(&segment_info, &segments, memory,
+                         repeat > 1 ? nprocs + 1 : 1);
     segment_info.in_memory = nseg;
 
     potential_info.incentive_transform_size = 0;
@@ -523,47 +789,64 @@ int main(int argc, char **argv)
     patch_sizes.filename = opt.patchFile->answer;
     read_patch_sizes(&patch_sizes, region_map, discount_factor);
 
-    undev_cells = initialize_undeveloped(region_map->nitems);
-    patch_overflow = G_calloc(region_map->nitems, sizeof(int));
+    undev_cells = initialize_undeveloped(region_map->nitems, search_alg == PROBABILITY);
     /* here do the modeling */
-    overgrow = true;
     G_verbose_message("Starting simulation...");
-    for (step = 0; step < num_steps; step++) {
-        recompute_probabilities(undev_cells, &segments, &potential_info);
-        if (step == num_steps - 1)
-            overgrow = false;
-        for (region = 0; region < region_map->nitems; region++) {
-            compute_step(undev_cells, &demand_info, search_alg, &segments,
-                         &patch_sizes, &patch_info, &devpressure_info, patch_overflow,
-                         step, region, reverse_region_map, overgrow);
-        }
-        /* export developed for that step */
-        if (opt.outputSeries->answer) {
-            name_step = name_for_step(opt.outputSeries->answer, step, num_steps);
-            output_developed_step(&segments.developed, name_step,
-                                  demand_info.years[step], -1, num_steps, true, true);
+    if (repeat == 1) {
+        thread_srand48(seed_value);
+        simulate(undev_cells, &segments, &demand_info, &potential_info,
+                 &patch_sizes, &patch_info, &devpressure_info, search_alg,
+                 reverse_region_map, num_steps,
+                 opt.output->answer, opt.outputSeries->answer, &shortages);
+        report_shortages(&shortages, 0);
+    }
+    else {
+        /* initial probabilities are computed once and copied to each run */
+        recompute_probabilities(undev_cells, &segments, &potential_info,
+                                &devpressure_info);
+        /* messages are issued only by the main thread outside of the runs */
+        run_shortages = G_calloc(repeat, sizeof(struct Shortages));
+        G_verbose_message(_("Running %d simulations, %d at a time"),
+                          repeat, nprocs);
+        #pragma omp parallel for schedule(dynamic)
+        for (run = 0; run < repeat; run++) {
+            struct Undeveloped *run_undev_cells;
+            struct Segments run_segments;
+            char *run_output;
+            char *run_output_series = NULL;
+
+            /* segment library and temporary files are not thread-safe */
+            #pragma omp critical (segments)
+            {
+                run_undev_cells = copy_undeveloped(undev_cells);
+                copy_segments(&run_segments, &segments, segment_info);
+            }
+            G_asprintf(&run_output, "%s_run%d", opt.output->answer, run + 1);
+            if (opt.outputSeries->answer)
+                G_asprintf(&run_output_series, "%s_run%d",
+                           opt.outputSeries->answer, run + 1);
+            thread_srand48(seed_value + run);
+            simulate(run_undev_cells, &run_segments, &demand_info, &potential_info,
+                     &patch_sizes, &patch_info, &devpressure_info, search_alg,
+                     reverse_region_map, num_steps,
+                     run_output, run_output_series, &run_shortages[run]);
+            #pragma omp critical (segments)
+            close_segments(&run_segments);
+            free_undeveloped(run_undev_cells);
+            G_free(run_output);
+            G_free(run_output_series);
         }
+        for (run = 0; run < repeat; run++)
+            report_shortages(&run_shortages[run], run + 1);
+        G_free(run_shortages);
     }
 
-    /* write */
-    output_developed_step(&segments.developed, opt.output->answer,
-                          demand_info.years[0], demand_info.years[step-1],
-                          num_steps, false, false);
-
     /* close segments and free memory */
-    Segment_close(&segments.developed);
-    Segment_close(&segments.subregions);
-    Segment_close(&segments.devpressure);
-    Segment_close(&segments.probability);
-    Segment_close(&segments.aggregated_predictor);
-    if (opt.potentialWeight->answer) {
-        Segment_close(&segments.weight);
-    }
-    if (opt.potentialSubregions->answer)
-        Segment_close(&segments.potential_subregions);
+    close_segments(&segments);
 
     KeyValueIntInt_free(region_map);
     KeyValueIntInt_free(reverse_region_map);
+    KeyValueIntInt_free(potential_region_map);
     if (demand_info.table) {
         for (int i = 0; i < demand_info.max_subregions; i++)
             G_free(demand_info.table[i]);
@@ -582,17 +865,10 @@ int main(int argc, char **argv)
     G_free(devpressure_info.matrix);
     if (potential_info.incentive_transform_size > 0)
         G_free(potential_info.incentive_transform);
-    if (undev_cells) {
-        G_free(undev_cells->num);
-        G_free(undev_cells->max);
-        for (int i = 0; i < undev_cells->max_subregions; i++)
-            G_free(undev_cells->cells[i]);
-        G_free(undev_cells->cells);
-        G_free(undev_cells);
-    }
+    if (undev_cells)
+        free_undeveloped(undev_cells);
 
     G_free(patch_sizes.patch_sizes);
-    G_free(patch_overflow);
 
     return EXIT_SUCCESS;
 }
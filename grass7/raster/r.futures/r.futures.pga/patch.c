@@ -54,7 +54,7 @@ static float get_alpha(struct PatchInfo *patch_info)
     float alpha;
     
     alpha = (patch_info->compactness_mean) - (patch_info->compactness_range) * 0.5;
-    alpha += G_drand48() * patch_info->compactness_range;
+    alpha += thread_drand48() * patch_info->compactness_range;
     return alpha;
 }
 
@@ -69,7 +69,7 @@ int get_patch_size(struct PatchSizes *patch_sizes, int region)
 {
     if (patch_sizes->single_column)
         region = 0;
-    return patch_sizes->patch_sizes[region][(int)(G_drand48() * patch_sizes->patch_count[region])];
+    return patch_sizes->patch_sizes[region][(int)(thread_drand48() * patch_sizes->patch_count[region])];
 }
 /*!
  * \brief Decides if to add a cell to a candidate list for patch growing
@@ -231,7 +231,7 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
         i = 0;
         while (1) {
             /* challenge the candidate */
-            r = G_drand48();
+            r = thread_drand48();
             p = candidates.candidates[i].potential;
             if (r < p || force) {
                 /* update list of added IDs */
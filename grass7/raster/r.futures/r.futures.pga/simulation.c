@@ -27,13 +27,91 @@
 #include "simulation.h"
 #include "output.h"
 
+/*!
+ * \brief Build Fenwick tree from weights of cells
+ *
+ * Tree has n + 1 items, item 0 is not used. Weight of a cell
+ * is its probability or 1 when seeds are picked uniformly.
+ *
+ * \param[out] tree tree
+ * \param[in] cells array of cells
+ * \param[in] n number of cells
+ * \param[in] weighted use probability as weight
+ */
+static void build_tree(double *tree, const struct UndevelopedCell *cells,
+                       size_t n, bool weighted)
+{
+    size_t i, parent;
+
+    tree[0] = 0;
+    for (i = 1; i <= n; i++)
+        tree[i] = weighted ? cells[i - 1].probability : 1;
+    for (i = 1; i <= n; i++) {
+        parent = i + (i & (~i + 1));
+        if (parent <= n)
+            tree[parent] += tree[i];
+    }
+}
+
+/*!
+ * \brief Add value to weight of a cell
+ * \param tree tree
+ * \param n number of cells
+ * \param idx index of cell in array
+ * \param value value to add
+ */
+static void add_to_tree(double *tree, size_t n, size_t idx, double value)
+{
+    size_t i;
+
+    for (i = idx + 1; i <= n; i += i & (~i + 1))
+        tree[i] += value;
+}
+
+/*!
+ * \brief Sum of weights of all cells
+ */
+static double tree_sum(const double *tree, size_t n)
+{
+    size_t i;
+    double sum = 0;
+
+    for (i = n; i > 0; i -= i & (~i + 1))
+        sum += tree[i];
+    return sum;
+}
+
+/*!
+ * \brief Find first cell for which the sum of weights up to and including
+ * the cell is greater than value.
+ *
+ * \return index of cell in array, n if value is not smaller than total sum
+ */
+static size_t find_in_tree(const double *tree, size_t n, double value)
+{
+    size_t pos = 0;
+    size_t step = 1;
+
+    while (step <= n / 2)
+        step *= 2;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= n && tree[pos + step] <= value) {
+            pos += step;
+            value -= tree[pos];
+        }
+    }
+    return pos;
+}
+
 /*!
  * \brief Find a seed cell based on cumulative probability.
  *
  * Cumulative probability increases chances to pick cells
  * with higher probability, because the intervals are longer
  * and therefore more likely to be picked by a random number
- * from uniform distribution.
+ * from uniform distribution. The intervals are searched in
+ * a Fenwick tree of probabilities, so developed cells
+ * (with zero weight) are never picked.
  *
  * \param[in] undev_cells array of undeveloped cells
  * \param[in] region region index
@@ -41,48 +119,43 @@
  */
 int find_probable_seed(struct Undeveloped *undev_cells, int region)
 {
-    int first, last, middle;
+    size_t n, idx;
     double p;
 
-    p = G_drand48();
-    // bisect
-    first = 0;
-    last = undev_cells->num[region] - 1;
-    middle = (first + last) / 2;
-    if (p <= undev_cells->cells[region][first].cumulative_probability)
-        return 0;
-    if (p >= undev_cells->cells[region][last].cumulative_probability)
-        return last;
-    while (first <= last) {
-        if (undev_cells->cells[region][middle].cumulative_probability < p)
-            first = middle + 1;
-        else if (undev_cells->cells[region][middle - 1].cumulative_probability < p &&
-                 undev_cells->cells[region][middle].cumulative_probability >= p) {
-            return middle;
-        }
-        else
-            last = middle - 1;
-        middle = (first + last)/2;
-    }
-    // TODO: returning at least something but should be something more meaningful
-    return 0;
+    n = undev_cells->size[region];
+    p = thread_drand48() * tree_sum(undev_cells->tree[region], n);
+    idx = find_in_tree(undev_cells->tree[region], n, p);
+    /* rounding in the tree, take the last undeveloped cell */
+    while (idx > 0 && (idx >= n ||
+                       undev_cells->position[undev_cells->cells[region][idx].id] < 0))
+        idx--;
+    return idx;
 }
 
 /*!
  * \brief Get seed for growing a patch.
+ *
+ * With RANDOM method, all undeveloped cells have weight 1 in the tree,
+ * so the k-th undeveloped cell is found in the tree.
+ *
  * \param[in] undev_cells array for undeveloped cells
  * \param[in] region_idx region index
  * \param[in] method method to pick seed (RANDOM, PROBABILITY)
  * \param[out] row row
  * \param[out] col column
- * \return index in undev_cells (not id of a cell)
+ * \return index in undev_cells (not id of a cell),
+ * -1 if there is no undeveloped cell left in the region
  */
 int get_seed(struct Undeveloped *undev_cells, int region_idx, enum seed_search method,
               int *row, int *col)
 {
-    int i, id;
+    int i;
+    size_t id;
+    if (undev_cells->num[region_idx] == 0)
+        return -1;
     if (method == RANDOM)
-        i = (int)(G_drand48() * undev_cells->num[region_idx]);
+        i = find_in_tree(undev_cells->tree[region_idx], undev_cells->size[region_idx],
+                         (int)(thread_drand48() * undev_cells->num[region_idx]));
     else
         i = find_probable_seed(undev_cells, region_idx);
     id = undev_cells->cells[region_idx][i].id;
@@ -145,38 +218,40 @@ double get_develop_probability_xy(struct Segments *segments,
 }
 
 /*!
- * \brief Recompute development probabilities.
+ * \brief Find all undeveloped cells and compute their probabilities.
  *
- * Compute probabilities for each cell and update
- * probability segment and undev_cells.
- * Also recompute cumulative probability
+ * Fills undev_cells, the position of cells and the trees
+ * and updates probability segment.
  *
  * \param undeveloped_cells array of undeveloped cells
  * \param segments segments
  * \param potential_info potential parameters
  */
-void recompute_probabilities(struct Undeveloped *undeveloped_cells,
-                             struct Segments *segments,
-                             struct Potential *potential_info)
+static void initialize_probabilities(struct Undeveloped *undeveloped_cells,
+                                     struct Segments *segments,
+                                     struct Potential *potential_info)
 {
     int row, col, cols, rows;
-    int id, i, idx, new_size;
+    int idx, new_size;
+    size_t id;
     int region_idx;
     CELL developed;
     CELL region;
     FCELL *values;
     float probability;
-    float sum;
-    
+
     cols = Rast_window_cols();
     rows = Rast_window_rows();
     values = G_malloc(potential_info->max_predictors * sizeof(FCELL *));
-    
+    undeveloped_cells->position = G_malloc((size_t) rows * cols * sizeof(int));
+
     for (region_idx = 0; region_idx < undeveloped_cells->max_subregions; region_idx++) {
         undeveloped_cells->num[region_idx] = 0;
     }
     for (row = 0; row < rows; row++) {
         for (col = 0; col < cols; col++) {
+            id = get_idx_from_xy(row, col, cols);
+            undeveloped_cells->position[id] = -1;
             Segment_get(&segments->developed, (void *)&developed, row, col);
             if (Rast_is_null_value(&developed, CELL_TYPE))
                 continue;
@@ -192,10 +267,11 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
                                                              new_size * sizeof(struct UndevelopedCell));
                 undeveloped_cells->max[region] = new_size;
             }
-            id = get_idx_from_xy(row, col, cols);
             idx = undeveloped_cells->num[region];
             undeveloped_cells->cells[region][idx].id = id;
             undeveloped_cells->cells[region][idx].tried = 0;
+            undeveloped_cells->cells[region][idx].changed = false;
+            undeveloped_cells->position[id] = idx;
             /* get probability and update undevs and segment*/
             probability = get_develop_probability_xy(segments, values,
                                                      potential_info, region, row, col);
@@ -208,21 +284,122 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
     }
     Segment_flush(&segments->probability);
 
-    i = 0;
     for (region_idx = 0; region_idx < undeveloped_cells->max_subregions; region_idx++) {
-        probability = undeveloped_cells->cells[region_idx][0].probability;
-        undeveloped_cells->cells[region_idx][0].cumulative_probability = probability;
-        for (i = 1; i < undeveloped_cells->num[region_idx]; i++) {
-            probability = undeveloped_cells->cells[region_idx][i].probability;
-            undeveloped_cells->cells[region_idx][i].cumulative_probability = 
-                    undeveloped_cells->cells[region_idx][i - 1].cumulative_probability + probability;
-        }
-        sum = undeveloped_cells->cells[region_idx][i - 1].cumulative_probability;
-        for (i = 0; i < undeveloped_cells->num[region_idx]; i++) {
-            undeveloped_cells->cells[region_idx][i].cumulative_probability /= sum;
+        undeveloped_cells->size[region_idx] = undeveloped_cells->num[region_idx];
+        undeveloped_cells->tree[region_idx] =
+                G_malloc((undeveloped_cells->size[region_idx] + 1) * sizeof(double));
+        build_tree(undeveloped_cells->tree[region_idx],
+                   undeveloped_cells->cells[region_idx],
+                   undeveloped_cells->size[region_idx],
+                   undeveloped_cells->weighted);
+    }
+    G_free(values);
+}
+
+/*!
+ * \brief Recompute development probabilities.
+ *
+ * In the first step, compute probabilities for each cell and
+ * update probability segment and undev_cells.
+ * In the next steps, remove cells developed in the last step
+ * from the trees and recompute probabilities only for the cells
+ * in neighborhood of these cells, since only their development
+ * pressure changed.
+ *
+ * \param undeveloped_cells array of undeveloped cells
+ * \param segments segments
+ * \param potential_info potential parameters
+ * \param devpressure_info development pressure parameters
+ */
+void recompute_probabilities(struct Undeveloped *undeveloped_cells,
+                             struct Segments *segments,
+                             struct Potential *potential_info,
+                             struct DevPressure *devpressure_info)
+{
+    int row, col, cols, rows;
+    int i, j, mi, mj, idx;
+    size_t k, id, num_changed;
+    size_t *changed;
+    CELL region;
+    FCELL *values;
+    float probability;
+    struct UndevelopedCell *cell;
+
+    if (!undeveloped_cells->position) {
+        initialize_probabilities(undeveloped_cells, segments, potential_info);
+        return;
+    }
+
+    cols = Rast_window_cols();
+    rows = Rast_window_rows();
+
+    /* remove developed cells */
+    for (k = 0; k < undeveloped_cells->num_developed; k++) {
+        id = undeveloped_cells->developed[k];
+        idx = undeveloped_cells->position[id];
+        if (idx < 0)
+            continue;
+        get_xy_from_idx(id, cols, &row, &col);
+        Segment_get(&segments->subregions, (void *)&region, row, col);
+        cell = &undeveloped_cells->cells[region][idx];
+        add_to_tree(undeveloped_cells->tree[region], undeveloped_cells->size[region], idx,
+                    undeveloped_cells->weighted ? -cell->probability : -1);
+        undeveloped_cells->position[id] = -1;
+        undeveloped_cells->num[region]--;
+    }
+
+    /* collect undeveloped cells with changed development pressure */
+    num_changed = 0;
+    changed = NULL;
+    for (k = 0; k < undeveloped_cells->num_developed; k++) {
+        get_xy_from_idx(undeveloped_cells->developed[k], cols, &row, &col);
+        for (i = row - devpressure_info->neighborhood; i <= row + devpressure_info->neighborhood; i++) {
+            for (j = col - devpressure_info->neighborhood; j <= col + devpressure_info->neighborhood; j++) {
+                if (i < 0 || j < 0 || i >= rows || j >= cols)
+                    continue;
+                mi = devpressure_info->neighborhood - (row - i);
+                mj = devpressure_info->neighborhood - (col - j);
+                if (!(devpressure_info->matrix[mi][mj] > 0))
+                    continue;
+                id = get_idx_from_xy(i, j, cols);
+                idx = undeveloped_cells->position[id];
+                if (idx < 0)
+                    continue;
+                Segment_get(&segments->subregions, (void *)&region, i, j);
+                cell = &undeveloped_cells->cells[region][idx];
+                if (cell->changed)
+                    continue;
+                cell->changed = true;
+                if (num_changed % 1024 == 0)
+                    changed = G_realloc(changed, (num_changed + 1024) * sizeof(size_t));
+                changed[num_changed++] = id;
+            }
         }
     }
+    undeveloped_cells->num_developed = 0;
+
+    /* update their probabilities in segment and tree */
+    values = G_malloc(potential_info->max_predictors * sizeof(FCELL *));
+    for (k = 0; k < num_changed; k++) {
+        id = changed[k];
+        get_xy_from_idx(id, cols, &row, &col);
+        Segment_get(&segments->subregions, (void *)&region, row, col);
+        idx = undeveloped_cells->position[id];
+        cell = &undeveloped_cells->cells[region][idx];
+        probability = get_develop_probability_xy(segments, values,
+                                                 potential_info, region, row, col);
+        Segment_put(&segments->probability, (void *)&probability, row, col);
+        if (undeveloped_cells->weighted)
+            add_to_tree(undeveloped_cells->tree[region], undeveloped_cells->size[region],
+                        idx, (double) probability - cell->probability);
+        cell->probability = probability;
+        cell->changed = false;
+    }
+    Segment_flush(&segments->probability);
+    G_free(values);
+    G_free(changed);
 }
+
 /*!
  * \brief Compute step of the simulation
  *
@@ -243,6 +420,7 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
  * \param step step number
  * \param region region index
  * \param overgrow allow patches to grow bigger than demand allows
+ * \param[out] shortages appended when there are not enough undeveloped cells
  */
 void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
                   enum seed_search search_alg,
@@ -250,7 +428,7 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
                   struct PatchSizes *patch_sizes, struct PatchInfo *patch_info,
                   struct DevPressure *devpressure_info, int *patch_overflow,
                   int step, int region, struct KeyValueIntInt *reverse_region_map,
-                  bool overgrow)
+                  bool overgrow, struct Shortages *shortages)
 {
     int i, idx;
     int region_id;
@@ -289,10 +467,18 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
     }
 
     if (n_to_convert > undev_cells->num[region]) {
+        /* the warning is issued by the caller, possibly outside of threads */
         KeyValueIntInt_find(reverse_region_map, region, &region_id);
-        G_warning("Not enough undeveloped cells in region %d (requested: %d,"
-                  " available: %ld). Converting all available.",
-                  region_id, n_to_convert, undev_cells->num[region]);
+        if (shortages->num >= shortages->max) {
+            shortages->max = shortages->max ? 2 * shortages->max : 16;
+            shortages->items = G_realloc(shortages->items,
+                                         shortages->max * sizeof(struct Shortage));
+        }
+        shortages->items[shortages->num].step = step;
+        shortages->items[shortages->num].region_id = region_id;
+        shortages->items[shortages->num].requested = n_to_convert;
+        shortages->items[shortages->num].available = undev_cells->num[region];
+        shortages->num++;
         n_to_convert = undev_cells->num[region];
         force_convert_all = true;
     }
@@ -304,13 +490,16 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
 
         /* get seed's row, col and index in undev cells array */
         idx = get_seed(undev_cells, region, search_alg, &seed_row, &seed_col);
+        /* no undeveloped cell left in the region */
+        if (idx < 0)
+            break;
         /* skip if seed was already tried unless we switched of this check because we can't get any seed */
-        if (!allow_already_tried_ones && undev_cells->cells[region][idx].tried) {
+        if (!allow_already_tried_ones && undev_cells->cells[region][idx].tried == step + 1) {
             unsuccessful_tries++;
             continue;
         }
         /* mark as tried */
-        undev_cells->cells[region][idx].tried = 1;
+        undev_cells->cells[region][idx].tried = step + 1;
         /* see if seed was already developed during this time step */
         Segment_get(&segments->developed, (void *)&developed, seed_row, seed_col);
         if (developed != -1) {
@@ -320,7 +509,7 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
         /* get probability */
         Segment_get(&segments->probability, (void *)&prob, seed_row, seed_col);
         /* challenge probability unless we need to convert all */
-        if(force_convert_all || G_drand48() < prob) {
+        if(force_convert_all || thread_drand48() < prob) {
             /* ger random patch size */
             patch_size = get_patch_size(patch_sizes, region);
             /* last year: we shouldn't grow bigger patches than we have space for */
@@ -338,6 +527,14 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
                 get_xy_from_idx(added_ids[i], Rast_window_cols(), &row, &col);
                 update_development_pressure_precomputed(row, col, segments, devpressure_info);
             }
+            /* remember them for updating probabilities in the next step */
+            if (undev_cells->num_developed + found > undev_cells->max_developed) {
+                undev_cells->max_developed = 2 * (undev_cells->num_developed + found);
+                undev_cells->developed = G_realloc(undev_cells->developed,
+                                                   undev_cells->max_developed * sizeof(size_t));
+            }
+            for (i = 0; i < found; i++)
+                undev_cells->developed[undev_cells->num_developed++] = added_ids[i];
             Segment_flush(&segments->devpressure);
             n_done += found;
         }
@@ -5,9 +5,27 @@
 
 #include "inputs.h"
 #include "patch.h"
+#include "devpressure.h"
 
 enum seed_search {RANDOM, PROBABILITY};
 
+/* subregion and step without enough undeveloped cells for the demand */
+struct Shortage
+{
+    int step;
+    int region_id;
+    int requested;
+    size_t available;
+};
+
+/* shortages collected during a simulation, reported after it */
+struct Shortages
+{
+    struct Shortage *items;
+    int num;
+    int max;
+};
+
 int find_probable_seed(struct Undeveloped *undev_cells, int region);
 int get_seed(struct Undeveloped *undev_cells, int region_idx, enum seed_search method,
               int *row, int *col);
@@ -17,13 +35,14 @@ double get_develop_probability_xy(struct Segments *segments,
                                   int region_index, int row, int col);
 void recompute_probabilities(struct Undeveloped *undeveloped_cells,
                              struct Segments *segments,
-                             struct Potential *potential_info);
+                             struct Potential *potential_info,
+                             struct DevPressure *devpressure_info);
 void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
                   enum seed_search search_alg,
                   struct Segments *segments,
                   struct PatchSizes *patch_sizes, struct PatchInfo *patch_info,
                   struct DevPressure *devpressure_info, int *patch_overflow,
                   int step, int region, struct KeyValueIntInt *reverse_region_map,
-                  bool overgrow);
+                  bool overgrow, struct Shortages *shortages);
 
 #endif // FUTURES_SIMULATION_H
@@ -14,6 +14,12 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include "utils.h"
+
+/* state of random number generator of each thread */
+static unsigned long long random_state = 0x330E;
+#pragma omp threadprivate(random_state)
+
 /*!
  * \brief Computes euclidean distance in cells (not meters)
  * \param[in] row1 row1
@@ -50,3 +56,27 @@ void get_xy_from_idx(size_t idx, int cols, int *row, int *col)
     *col = idx % cols;
     *row = (idx - *col) / cols;
 }
+
+/*!
+ * \brief Seed random number generator of the current thread
+ *
+ * The generator gives the same sequence as G_drand48()
+ * seeded with G_srand48() with the same seed.
+ *
+ * \param seed seed
+ */
+void thread_srand48(long seed)
+{
+    random_state = ((unsigned long long) (unsigned int) seed << 16) | 0x330E;
+}
+
+/*!
+ * \brief Get random number in [0, 1) from the generator of the current thread
+ * \return random number
+ */
+double thread_drand48(void)
+{
+    random_state = (0x5DEECE66DULL * random_state + 0xB) & 0xFFFFFFFFFFFFULL;
+    return random_state / 281474976710656.0;
+}
+
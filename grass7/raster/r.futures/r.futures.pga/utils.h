@@ -6,4 +6,6 @@
 double get_distance(int row1, int col1, int row2, int col2);
 size_t get_idx_from_xy(int row, int col, int cols);
 void get_xy_from_idx(size_t idx, int cols, int *row, int *col);
+void thread_srand48(long seed);
+double thread_drand48(void);
 #endif // FUTURES_UTILS_H
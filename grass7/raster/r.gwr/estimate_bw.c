@@ -8,7 +8,11 @@
 #include <grass/gis.h>
 #include <grass/glocale.h>
 #include <grass/raster.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include "local_proto.h"
+#include "gwr.h"
 
 #ifndef USE_RAND
 
@@ -47,205 +51,487 @@ void init_rand(void)
 
 #endif
 
-/* estimate bandwidth
- * start with a small bandwidth */
-
-int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
-        DCELL *est, int bw)
+/* cell sampled for bandwidth estimation */
+struct sample
 {
-    int i;
-    int r, c;
-    struct rb *xbuf1, *xbuf2, *xbuf3, ybuf1, ybuf2, ybuf3;
-    int prevbw, nextbw, newbw, lastbw, bestbw, bwhi;
-    int bwmin, bwmax;
-    int n1, n2, n3;
-    double f11, f12, f2;
-    double ss1, ss2, ss3, ssmin;
-    double **w1, **w2, **w3;
-    DCELL *ybuf, yval;
-    DCELL est1, est2, est3;
-    int nr, nc, nrt, nct, count, gwrfailed, step, havemin;
-
-    ybuf = Rast_allocate_d_buf();
-    
-    G_message(_("Estimating optimal bandwidth..."));
+    int row, col;
+    DCELL y;
+};
 
-    /* count non-NULL cells of the dependent variable */
-    nc = 0;
-    for (r = 0; r < nrows; r++) {
+/* sampled cells and their neighbourhoods */
+struct bw_eval
+{
+    int *inx, ninx, iny, nrows, ncols;
+    struct sample *smp;		/* samples in raster order */
+    int nsmp;
+    size_t max_cells;		/* memory limit for windows in cells */
+    int gbw;			/* bandwidth of gathered windows, 0 if none */
+    int gfirst, gnum;		/* first and number of gathered samples */
+    DCELL *win;			/* window of each map for each gathered sample */
+    int nmemo;			/* bandwidths evaluated so far */
+    int *memo_bw, *memo_ok;
+    double *memo_ss;
+};
+
+/* size of gathered window of one sample in cells */
+static size_t window_cells(struct bw_eval *ev, int bw)
+{
+    return (size_t)(ev->ninx + 1) * (2 * bw + 1) * (2 * bw + 1);
+}
 
-	Rast_get_d_row(iny, ybuf, r);
+/* choose cells with all values not NULL by selection sampling */
+static void sample_cells(struct bw_eval *ev, int nr)
+{
+    int r, c, i, nc, nct, nrt;
+    DCELL **xrow, *yrow;
 
-	for (c = 0; c < ncols; c++) {
-	    yval = ybuf[c];
+    xrow = G_malloc(ev->ninx * sizeof(DCELL *));
+    for (i = 0; i < ev->ninx; i++)
+	xrow[i] = Rast_allocate_d_buf();
+    yrow = Rast_allocate_d_buf();
 
-	    if (!Rast_is_d_null_value(&yval))
+    /* count valid cells */
+    nc = 0;
+    for (r = 0; r < ev->nrows; r++) {
+	G_percent(r, ev->nrows, 4);
+	Rast_get_d_row(ev->iny, yrow, r);
+	for (i = 0; i < ev->ninx; i++)
+	    Rast_get_d_row(ev->inx[i], xrow[i], r);
+	for (c = 0; c < ev->ncols; c++) {
+	    if (Rast_is_d_null_value(&yrow[c]))
+		continue;
+	    for (i = 0; i < ev->ninx; i++) {
+		if (Rast_is_d_null_value(&xrow[i][c]))
+		    break;
+	    }
+	    if (i == ev->ninx)
 		nc++;
 	}
     }
+    G_percent(ev->nrows, ev->nrows, 4);
     if (nc == 0)
-	G_fatal_error(_("No non-NULL cells in input map"));
+	G_fatal_error(_("No non-NULL cells in input maps"));
 
     /* number of cells to use for bandwidth estimation */
-    nr = 10000;
     if (nr > nc)
 	nr = nc;
 
-    if (bw < 2) {
-	G_warning(_("Initial bandwidth must be > 1"));
-	bw = 2;
+    ev->smp = G_malloc(nr * sizeof(struct sample));
+    ev->nsmp = 0;
+    nrt = nr;
+    nct = nc;
+    init_rand();
+    for (r = 0; r < ev->nrows && nrt > 0; r++) {
+	Rast_get_d_row(ev->iny, yrow, r);
+	for (i = 0; i < ev->ninx; i++)
+	    Rast_get_d_row(ev->inx[i], xrow[i], r);
+	for (c = 0; c < ev->ncols; c++) {
+	    if (Rast_is_d_null_value(&yrow[c]))
+		continue;
+	    for (i = 0; i < ev->ninx; i++) {
+		if (Rast_is_d_null_value(&xrow[i][c]))
+		    break;
+	    }
+	    if (i < ev->ninx)
+		continue;
+
+	    if (make_rand() % nct < nrt) {
+		ev->smp[ev->nsmp].row = r;
+		ev->smp[ev->nsmp].col = c;
+		ev->smp[ev->nsmp].y = yrow[c];
+		ev->nsmp++;
+		nrt--;
+	    }
+	    nct--;
+	}
     }
+    G_verbose_message(_("%d cells sampled for bandwidth estimation"), ev->nsmp);
 
-    bwmin = 1;
-    bwmax = sqrt((double) nrows * nrows + (double) ncols * ncols);
+    for (i = 0; i < ev->ninx; i++)
+	G_free(xrow[i]);
+    G_free(xrow);
+    G_free(yrow);
+}
 
-    init_rand();
+/* leave-one-out squared errors of the gathered samples
+ * for all candidate bandwidths, samples are processed in parallel */
+static void eval_gathered(struct bw_eval *ev, int *bws, int ncand,
+                          struct gwr_ws ***ws, double *ss, int *ok)
+{
+    int s, k;
+    int gsize = 2 * ev->gbw + 1;
+    double *err;
 
-    xbuf1 = G_malloc(ninx * sizeof(struct rb));
-    xbuf2 = G_malloc(ninx * sizeof(struct rb));
-    xbuf3 = G_malloc(ninx * sizeof(struct rb));
+    err = G_malloc((size_t)ev->gnum * ncand * sizeof(double));
 
-    lastbw = bestbw = bw;
-    ssmin = 1.0 / 0.0;
-    bwhi = 0;
-    step = 2;
-    havemin = 0;
-    while (1) {
+#pragma omp parallel private(k)
+    {
+	struct rb *xb, yb;
+	DCELL *est;
+	int i, r, tid = 0;
 
-	if (bw > bwmax)
-	    break;
-	
-	if (bwhi < bw)
-	    bwhi = bw;
+#if defined(_OPENMP)
+	tid = omp_get_thread_num();
+#endif
+	xb = G_malloc(ev->ninx * sizeof(struct rb));
+	for (i = 0; i < ev->ninx; i++)
+	    xb[i].buf = G_malloc(gsize * sizeof(DCELL *));
+	yb.buf = G_malloc(gsize * sizeof(DCELL *));
+	est = G_malloc((ev->ninx + 1) * sizeof(DCELL));
+
+#pragma omp for schedule(dynamic, 16)
+	for (s = 0; s < ev->gnum; s++) {
+	    DCELL *win = ev->win + (size_t)s * window_cells(ev, ev->gbw);
+	    DCELL y = ev->smp[ev->gfirst + s].y;
+
+	    for (k = 0; k < ncand; k++) {
+		int off = ev->gbw - bws[k];
+
+		/* rows of the window around the sample for this bandwidth */
+		for (r = 0; r < 2 * bws[k] + 1; r++) {
+		    for (i = 0; i < ev->ninx; i++)
+			xb[i].buf[r] = win + ((size_t)i * gsize + off + r) * gsize;
+		    yb.buf[r] = win + ((size_t)ev->ninx * gsize + off + r) * gsize;
+		}
+		/* the window never slides here */
+		yb.row = ev->gfirst + s;
 
-	prevbw = bw - step;
-	nextbw = bw + step;
+		if (gwr(ws[tid][k], xb, &yb, off, est, NULL))
+		    err[(size_t)s * ncand + k] = (est[0] - y) * (est[0] - y);
+		else
+		    Rast_set_d_null_value(&err[(size_t)s * ncand + k], 1);
+	    }
+	}
 
-	G_message(_("Testing bandwidth %d"), bw);
+	for (i = 0; i < ev->ninx; i++)
+	    G_free(xb[i].buf);
+	G_free(xb);
+	G_free(yb.buf);
+	G_free(est);
+    }
 
-	for (i = 0; i < ninx; i++) {
-	    allocate_bufs(&(xbuf1[i]), ncols, prevbw, inx[i]);
-	    allocate_bufs(&(xbuf2[i]), ncols, bw, inx[i]);
-	    allocate_bufs(&(xbuf3[i]), ncols, nextbw, inx[i]);
+    /* sum in the order of samples */
+    for (s = 0; s < ev->gnum; s++) {
+	for (k = 0; k < ncand; k++) {
+	    if (Rast_is_d_null_value(&err[(size_t)s * ncand + k]))
+		ok[k] = 0;
+	    else
+		ss[k] += err[(size_t)s * ncand + k];
 	}
-	allocate_bufs(&ybuf1, ncols, prevbw, iny);
-	allocate_bufs(&ybuf2, ncols, bw, iny);
-	allocate_bufs(&ybuf3, ncols, nextbw, iny);
-
-	/* initialize the raster buffers with 'bw' rows */
-	for (r = 0; r < prevbw; r++) {
-	    for (i = 0; i < ninx; i++)
-		readrast(&(xbuf1[i]), nrows, ncols);
-	    readrast(&ybuf1, nrows, ncols);
+    }
+    G_free(err);
+}
+
+/* read the rasters once and gather the windows of the samples
+ * for bandwidth gbw, evaluating all candidates whenever the memory
+ * for windows is full
+ * the windows are kept if all samples fit into memory */
+static void eval_pass(struct bw_eval *ev, int gbw, int *bws, int ncand,
+                      struct gwr_ws ***ws, double *ss, int *ok)
+{
+    struct rb *xbuf, ybuf;
+    int i, r, c, s, gsize, chunk;
+    size_t wcells;
+
+    G_percent(0, ev->nrows, 4);
+    gsize = 2 * gbw + 1;
+    wcells = window_cells(ev, gbw);
+    chunk = ev->max_cells / wcells;
+    if (chunk < 1)
+	chunk = 1;
+    if (chunk > ev->nsmp)
+	chunk = ev->nsmp;
+
+    if (ev->win)
+	G_free(ev->win);
+    ev->win = G_malloc(chunk * wcells * sizeof(DCELL));
+    ev->gbw = gbw;
+    ev->gfirst = 0;
+    ev->gnum = 0;
+
+    xbuf = G_malloc(ev->ninx * sizeof(struct rb));
+    for (i = 0; i < ev->ninx; i++)
+	allocate_bufs(&(xbuf[i]), ev->ncols, gbw, ev->inx[i]);
+    allocate_bufs(&ybuf, ev->ncols, gbw, ev->iny);
+
+    /* initialize the raster buffers with 'bw' rows */
+    for (r = 0; r < gbw; r++) {
+	for (i = 0; i < ev->ninx; i++)
+	    readrast(&(xbuf[i]), ev->nrows, ev->ncols);
+	readrast(&ybuf, ev->nrows, ev->ncols);
+    }
+
+    s = 0;
+    for (r = 0; r < ev->nrows && s < ev->nsmp; r++) {
+	G_percent(r, ev->nrows, 4);
+	for (i = 0; i < ev->ninx; i++)
+	    readrast(&(xbuf[i]), ev->nrows, ev->ncols);
+	readrast(&ybuf, ev->nrows, ev->ncols);
+
+	for (; s < ev->nsmp && ev->smp[s].row == r; s++) {
+	    DCELL *win;
+	    int wr;
+
+	    if (ev->gnum == chunk) {
+		eval_gathered(ev, bws, ncand, ws, ss, ok);
+		ev->gfirst += ev->gnum;
+		ev->gnum = 0;
+	    }
+	    win = ev->win + (size_t)ev->gnum * wcells;
+	    c = ev->smp[s].col;
+	    for (wr = 0; wr < gsize; wr++) {
+		for (i = 0; i < ev->ninx; i++)
+		    memcpy(win + ((size_t)i * gsize + wr) * gsize,
+		           xbuf[i].buf[wr] + c, gsize * sizeof(DCELL));
+		memcpy(win + ((size_t)ev->ninx * gsize + wr) * gsize,
+		       ybuf.buf[wr] + c, gsize * sizeof(DCELL));
+	    }
+	    ev->gnum++;
 	}
-	for (r = 0; r < bw; r++) {
-	    for (i = 0; i < ninx; i++)
-		readrast(&(xbuf2[i]), nrows, ncols);
-	    readrast(&ybuf2, nrows, ncols);
+    }
+    G_percent(ev->nrows, ev->nrows, 4);
+    if (ev->gnum > 0)
+	eval_gathered(ev, bws, ncand, ws, ss, ok);
+
+    /* keep the windows only if all samples are there */
+    if (ev->gfirst > 0) {
+	G_free(ev->win);
+	ev->win = NULL;
+	ev->gbw = 0;
+    }
+
+    for (i = 0; i < ev->ninx; i++)
+	release_bufs(&(xbuf[i]));
+    release_bufs(&ybuf);
+    G_free(xbuf);
+}
+
+/* mean leave-one-out squared error for each bandwidth
+ * all new candidates are evaluated together in one pass
+ * returns 0 for bandwidths where GWR failed for any sample */
+static void evaluate(struct bw_eval *ev, int *bws, int nbws, double *ss,
+                     int *ok)
+{
+    int i, j, t, nthreads, ncand, maxbw;
+    int *cand;
+    double *css, ***wts;
+    int *cok;
+    struct gwr_ws ***ws;
+
+    cand = G_malloc(nbws * sizeof(int));
+    ncand = 0;
+    maxbw = 0;
+    for (i = 0; i < nbws; i++) {
+	if (bws[i] < 1)
+	    continue;
+	for (j = 0; j < ev->nmemo; j++) {
+	    if (ev->memo_bw[j] == bws[i])
+		break;
 	}
-	for (r = 0; r < nextbw; r++) {
-	    for (i = 0; i < ninx; i++)
-		readrast(&(xbuf3[i]), nrows, ncols);
-	    readrast(&ybuf3, nrows, ncols);
+	if (j < ev->nmemo)
+	    continue;
+	for (j = 0; j < ncand; j++) {
+	    if (cand[j] == bws[i])
+		break;
 	}
+	if (j < ncand)
+	    continue;
+	cand[ncand++] = bws[i];
+	if (maxbw < bws[i])
+	    maxbw = bws[i];
+    }
 
-	w1 = calc_weights(prevbw);
-	w2 = calc_weights(bw);
-	w3 = calc_weights(nextbw);
-	/* leave one out: the center cell */
-	w1[prevbw][prevbw] = 0.;
-	w2[bw][bw] = 0.;
-	w3[nextbw][nextbw] = 0.;
+    if (ncand > 0) {
+	for (i = 0; i < ncand; i++)
+	    G_message(_("Testing bandwidth %d"), cand[i]);
 
-	ss1 = ss2 = ss3 = 0;
-	n1 = n2 = n3 = 0;
-	
-	nrt = nr;
-	nct = nc;
-	count = 0;
+	nthreads = 1;
+#if defined(_OPENMP)
+	nthreads = omp_get_max_threads();
+#endif
+	/* weights without the center cell: leave one out */
+	wts = G_malloc(ncand * sizeof(double **));
+	for (j = 0; j < ncand; j++) {
+	    wts[j] = calc_weights(cand[j]);
+	    wts[j][cand[j]][cand[j]] = 0.;
+	}
+	ws = G_malloc(nthreads * sizeof(struct gwr_ws **));
+	for (t = 0; t < nthreads; t++) {
+	    ws[t] = G_malloc(ncand * sizeof(struct gwr_ws *));
+	    for (j = 0; j < ncand; j++)
+		ws[t][j] = gwr_ws_create(ev->ninx, cand[j], wts[j]);
+	}
 
-	for (r = 0; r < nrows; r++) {
-	    G_percent(r, nrows, 4);
+	css = G_calloc(ncand, sizeof(double));
+	cok = G_malloc(ncand * sizeof(int));
+	for (j = 0; j < ncand; j++)
+	    cok[j] = 1;
+
+	if (ev->win && ev->gbw >= maxbw && ev->gnum == ev->nsmp)
+	    eval_gathered(ev, cand, ncand, ws, css, cok);
+	else
+	    eval_pass(ev, maxbw, cand, ncand, ws, css, cok);
+
+	ev->memo_bw = G_realloc(ev->memo_bw, (ev->nmemo + ncand) * sizeof(int));
+	ev->memo_ok = G_realloc(ev->memo_ok, (ev->nmemo + ncand) * sizeof(int));
+	ev->memo_ss = G_realloc(ev->memo_ss, (ev->nmemo + ncand) * sizeof(double));
+	for (j = 0; j < ncand; j++) {
+	    ev->memo_bw[ev->nmemo] = cand[j];
+	    ev->memo_ok[ev->nmemo] = cok[j];
+	    ev->memo_ss[ev->nmemo] = css[j] / ev->nsmp;
+	    G_debug(1, "bw %d: ss %g%s", cand[j], css[j] / ev->nsmp,
+	            cok[j] ? "" : " (failed)");
+	    ev->nmemo++;
+	}
 
-	    for (i = 0; i < ninx; i++) {
-		readrast(&(xbuf1[i]), nrows, ncols);
-		readrast(&(xbuf2[i]), nrows, ncols);
-		readrast(&(xbuf3[i]), nrows, ncols);
+	for (t = 0; t < nthreads; t++) {
+	    for (j = 0; j < ncand; j++)
+		gwr_ws_free(ws[t][j]);
+	    G_free(ws[t]);
+	}
+	G_free(ws);
+	for (j = 0; j < ncand; j++) {
+	    G_free(wts[j][0]);
+	    G_free(wts[j]);
+	}
+	G_free(wts);
+	G_free(css);
+	G_free(cok);
+    }
+    G_free(cand);
+
+    for (i = 0; i < nbws; i++) {
+	ok[i] = 0;
+	ss[i] = 1.0 / 0.0;
+	for (j = 0; j < ev->nmemo; j++) {
+	    if (ev->memo_bw[j] == bws[i]) {
+		ok[i] = ev->memo_ok[j];
+		if (ok[i])
+		    ss[i] = ev->memo_ss[j];
+		break;
 	    }
-	    readrast(&ybuf1, nrows, ncols);
-	    readrast(&ybuf2, nrows, ncols);
-	    readrast(&ybuf3, nrows, ncols);
+	}
+    }
+}
 
-	    for (c = 0; c < ncols; c++) {
-		yval = ybuf2.buf[bw][c + bw];
+/* golden section search for the bandwidth with the smallest error
+ * the interval is first extended by doubling the bandwidth until
+ * the error increases */
+static int golden_search(struct bw_eval *ev, int bw, int bwmin, int bwmax,
+                         int *havemin)
+{
+    const double phi = (sqrt(5.) - 1) / 2;
+    int lo, hi, x[2], ok[4], bws[4], i, n, bestbw;
+    double f[4], ssmin;
+
+    /* bracket the minimum */
+    lo = bwmin;
+    bws[0] = bw;
+    bws[1] = 2 * bw;
+    if (bws[1] > bwmax)
+	bws[1] = bwmax;
+    evaluate(ev, bws, 2, f, ok);
+    while (f[1] < f[0] && bws[1] < bwmax) {
+	lo = bws[0];
+	bws[0] = bws[1];
+	f[0] = f[1];
+	bws[1] = 2 * bws[1];
+	if (bws[1] > bwmax)
+	    bws[1] = bwmax;
+	evaluate(ev, &bws[1], 1, &f[1], &ok[1]);
+    }
+    hi = bws[1];
+    *havemin = f[1] >= f[0];
+
+    /* shrink the interval [lo, hi] */
+    x[0] = hi - (int)(phi * (hi - lo) + 0.5);
+    x[1] = lo + (int)(phi * (hi - lo) + 0.5);
+    evaluate(ev, x, 2, f, ok);
+    while (hi - lo > 3) {
+	G_debug(1, "golden section: [%d, %d]", lo, hi);
+	if (f[0] < f[1]) {
+	    hi = x[1];
+	    x[1] = x[0];
+	    f[1] = f[0];
+	    x[0] = hi - (int)(phi * (hi - lo) + 0.5);
+	    if (x[0] >= x[1])
+		x[0] = x[1] - 1;
+	    evaluate(ev, &x[0], 1, &f[0], &ok[0]);
+	}
+	else {
+	    lo = x[0];
+	    x[0] = x[1];
+	    f[0] = f[1];
+	    x[1] = lo + (int)(phi * (hi - lo) + 0.5);
+	    if (x[1] <= x[0])
+		x[1] = x[0] + 1;
+	    evaluate(ev, &x[1], 1, &f[1], &ok[1]);
+	}
+    }
 
-		if (Rast_is_d_null_value(&yval))
-		    continue;
-		
-		gwrfailed = 0;
+    /* check the remaining bandwidths */
+    n = 0;
+    for (i = lo; i <= hi; i++)
+	bws[n++] = i;
+    evaluate(ev, bws, n, f, ok);
+    bestbw = bws[0];
+    ssmin = f[0];
+    for (i = 1; i < n; i++) {
+	if (f[i] < ssmin) {
+	    ssmin = f[i];
+	    bestbw = bws[i];
+	}
+    }
+    if (!(ssmin < 1.0 / 0.0))
+	*havemin = 0;
 
-		if (make_rand() % nct < nrt) {
+    return bestbw;
+}
 
-		    if (gwr(xbuf1, ninx, &ybuf1, c, prevbw, w1, est, NULL)) {
-			est1 = est[0];
-		    }
-		    else {
-			gwrfailed = 1;
-		    }
-		    if (gwr(xbuf2, ninx, &ybuf2, c, bw, w2, est, NULL)) {
-			est2 = est[0];
-		    }
-		    else {
-			gwrfailed = 1;
-		    }
-		    if (gwr(xbuf3, ninx, &ybuf3, c, nextbw, w3, est, NULL)) {
-			est3 = est[0];
-		    }
-		    else {
-			gwrfailed = 1;
-		    }
-		    if (!gwrfailed) {
-			ss1 += (est1 - yval) * (est1 - yval);
-			n1++;
-			ss2 += (est2 - yval) * (est2 - yval);
-			n2++;
-			ss3 += (est3 - yval) * (est3 - yval);
-			n3++;
-
-			nrt--;
-		    }
-		    count++;
-		}
-		nct--;
-	    }
-	}
-	G_percent(nrows, nrows, 4);
+/* search for the bandwidth with the smallest error
+ * using gradients of the error of three bandwidths */
+static int gradient_search(struct bw_eval *ev, int bw, int *bwminp,
+                           int bwmax, int *havemin)
+{
+    int prevbw, nextbw, newbw, lastbw, bestbw, bwhi;
+    int bwmin;
+    int bws[3], ok[3];
+    double f11, f12, f2;
+    double ss[3], ss1, ss2, ss3, ssmin;
+    int step;
+
+    bwmin = *bwminp;
+    lastbw = bestbw = bw;
+    ssmin = 1.0 / 0.0;
+    bwhi = 0;
+    step = 2;
+    *havemin = 0;
+    while (1) {
+
+	if (bw > bwmax)
+	    break;
 	
-	for (i = 0; i < ninx; i++) {
-	    release_bufs(&(xbuf1[i]));
-	    release_bufs(&(xbuf2[i]));
-	    release_bufs(&(xbuf3[i]));
-	}
-	release_bufs(&ybuf1);
-	release_bufs(&ybuf2);
-	release_bufs(&ybuf3);
+	if (bwhi < bw)
+	    bwhi = bw;
+
+	prevbw = bw - step;
+	nextbw = bw + step;
 
-	G_debug(3, "count: %d", count);
+	bws[0] = prevbw;
+	bws[1] = bw;
+	bws[2] = nextbw;
+	evaluate(ev, bws, 3, ss, ok);
 
-	if (n1 < count || n2 < count || n3 < count) {
+	if (!ok[0] || !ok[1] || !ok[2]) {
 	    G_debug(1, "increasing bwmin to %d", bw + 1);
 	    bwmin = bw + 1;
 	    bw += step + 1;
-	    ss1 = 3;
-	    ss2 = 2;
-	    ss3 = 1;
-	    n1 = n2 = n3 = 1;
 	    continue;
 	}
 
-	ss1 /= n1;
-	ss2 /= n2;
-	ss3 /= n3;
+	ss1 = ss[0];
+	ss2 = ss[1];
+	ss3 = ss[2];
 
 	G_debug(1, "ss1: %g", ss1);
 	G_debug(1, "ss2: %g", ss2);
@@ -264,13 +550,6 @@ int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
 	f12 = ss3 - ss2;
 	/* gradient of gradient */
 	f2 = f12 - f11;
-	
-	G_free(w1[0]);
-	G_free(w2[0]);
-	G_free(w3[0]);
-	G_free(w1);
-	G_free(w2);
-	G_free(w3);
 
 /* deactivate to get sum of squares for (newbw = bw; newbw > 1; newbw--) */
 #if 1
@@ -278,7 +557,7 @@ int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
 
 	if (ss2 < ss1 && ss2 < ss3) {
 	    /* local minimum */
-	    havemin = 1;
+	    *havemin = 1;
 
 	    if (lastbw > bw)
 		newbw = bw - 2;
@@ -410,6 +689,62 @@ int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
 	bw = newbw;
     }
 
+    *bwminp = bwmin;
+
+    return bw;
+}
+
+/* estimate bandwidth
+ * start with a small bandwidth
+ * 
+ * all bandwidths are compared on the same sample of cells,
+ * the windows of the sampled cells are read once for all bandwidths
+ * tested together and kept in memory if they fit into mem_mb */
+
+int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
+        int bw, int golden, int mem_mb)
+{
+    struct bw_eval ev;
+    int bwmin, bwmax;
+    int havemin;
+
+    G_message(_("Estimating optimal bandwidth..."));
+
+    if (bw < 2) {
+	G_warning(_("Initial bandwidth must be > 1"));
+	bw = 2;
+    }
+
+    bwmin = 1;
+    bwmax = sqrt((double) nrows * nrows + (double) ncols * ncols);
+
+    ev.inx = inx;
+    ev.ninx = ninx;
+    ev.iny = iny;
+    ev.nrows = nrows;
+    ev.ncols = ncols;
+    ev.max_cells = mem_mb * 1024.0 * 1024.0 / sizeof(DCELL);
+    ev.gbw = ev.gfirst = ev.gnum = 0;
+    ev.win = NULL;
+    ev.nmemo = 0;
+    ev.memo_bw = ev.memo_ok = NULL;
+    ev.memo_ss = NULL;
+
+    /* number of cells to use for bandwidth estimation */
+    sample_cells(&ev, 10000);
+
+    if (golden)
+	bw = golden_search(&ev, bw, bwmin, bwmax, &havemin);
+    else
+	bw = gradient_search(&ev, bw, &bwmin, bwmax, &havemin);
+
+    if (ev.win)
+	G_free(ev.win);
+    G_free(ev.smp);
+    G_free(ev.memo_bw);
+    G_free(ev.memo_ok);
+    G_free(ev.memo_ss);
+
     if (bw < bwmin)
 	bw = bwmin;
     if (bw > bwmax)
@@ -84,138 +84,242 @@ int solvemat(struct MATRIX *m, double a[], double B[])
 }
 
 
-int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc, 
-        int bw, double **w, DCELL *est, double **B0)
+/* number of weighted sums: upper half of X'WX and X'Wy */
+#define NSUMS(ninx) (((ninx) + 1) * ((ninx) + 2) / 2 + (ninx) + 1)
+
+/* create workspace for gwr() with the weights of the kernel
+ * each thread needs its own workspace */
+struct gwr_ws *gwr_ws_create(int ninx, int bw, double **w)
 {
-    int r, c;
-    int i, j, k;
-    int nsize;
-    static DCELL *xval = NULL;
-    DCELL yval;
-    int count, isnull, solved;
-    /* OLS */
-    static double **a = NULL;
-    static double **B = NULL;
-    static struct MATRIX *m_all = NULL;
+    struct gwr_ws *ws;
     struct MATRIX *m;
+    int nsize, r, c, i, k, h;
 
-    if (!xval) {
-	xval = G_malloc((ninx + 1) * sizeof(DCELL));
-	xval[0] = 1.;
-    }
-
-    if (!m_all) {
-	m_all = (struct MATRIX *)G_malloc((ninx + 1) * sizeof(struct MATRIX));
-	a = (double **)G_malloc((ninx + 1) * sizeof(double *));
-	B = (double **)G_malloc((ninx + 1) * sizeof(double *));
-
-	m = &(m_all[0]);
-	m->n = ninx + 1;
-	m->v = (double **)G_malloc(m->n * sizeof(double));
-	m->v[0] = (double *)G_malloc(m->n * m->n * sizeof(double));
-	for (i = 1; i < m->n; i++) {
-	    m->v[i] = m->v[i - 1] + m->n;
-	}
+    ws = G_malloc(sizeof(struct gwr_ws));
+    ws->ninx = ninx;
+    ws->bw = bw;
+    ws->w = w;
+    nsize = bw * 2 + 1;
 
-	a[0] = (double *)G_malloc(m->n * sizeof(double));
-	B[0] = (double *)G_malloc(m->n * sizeof(double));
-	
-	for (k = 1; k <= ninx; k++) {
-	    m = &(m_all[k]);
-	    m->n = ninx;
-	    m->v = (double **)G_malloc(m->n * sizeof(double*));
-	    m->v[0] = (double *)G_malloc(m->n * m->n * sizeof(double));
-	    for (i = 1; i < m->n; i++) {
-		m->v[i] = m->v[i - 1] + m->n;
+    /* the window can slide along a row if the kernel has the same
+     * weight for all cells with weight > 0 and these cells are
+     * contiguous in each row of the kernel */
+    ws->halfwidth = G_malloc(nsize * sizeof(int));
+    ws->wu = 0;
+    for (r = 0; r < nsize; r++) {
+	h = -1;
+	for (c = bw; c < nsize && w[r][c] != 0; c++)
+	    h = c - bw;
+	ws->halfwidth[r] = h;
+	for (c = 0; c < nsize; c++) {
+	    int inside = c >= bw - h && c <= bw + h;
+
+	    if (inside != (w[r][c] != 0))
+		break;
+	    if (inside) {
+		if (ws->wu == 0)
+		    ws->wu = w[r][c];
+		else if (w[r][c] != ws->wu)
+		    break;
 	    }
-	    a[k] = (double *)G_malloc(m->n * sizeof(double));
-	    B[k] = (double *)G_malloc(m->n * sizeof(double));
 	}
+	if (c < nsize)
+	    break;
     }
+    if (r < nsize || ws->wu == 0) {
+	G_free(ws->halfwidth);
+	ws->halfwidth = NULL;
+    }
+
+    ws->xval = G_malloc((ninx + 1) * sizeof(DCELL));
+    ws->xval[0] = 1.;
+    ws->sums = G_malloc(NSUMS(ninx) * sizeof(double));
+    ws->row = -1;
+    ws->cc = -1;
+    ws->nslides = 0;
+
+    ws->m_all = (struct MATRIX *)G_malloc((ninx + 1) * sizeof(struct MATRIX));
+    ws->a = (double **)G_malloc((ninx + 1) * sizeof(double *));
+    ws->B = (double **)G_malloc((ninx + 1) * sizeof(double *));
 
     for (k = 0; k <= ninx; k++) {
-	m = &(m_all[k]);
-	for (i = 0; i < m->n; i++) {
-	    for (j = i; j < m->n; j++)
-		M(m, i, j) = 0.0;
-	    a[k][i] = 0.0;
-	    B[k][i] = 0.0;
+	m = &(ws->m_all[k]);
+	m->n = k == 0 ? ninx + 1 : ninx;
+	m->v = (double **)G_malloc(m->n * sizeof(double *));
+	m->v[0] = (double *)G_malloc(m->n * m->n * sizeof(double));
+	for (i = 1; i < m->n; i++) {
+	    m->v[i] = m->v[i - 1] + m->n;
 	}
+	ws->a[k] = (double *)G_malloc(m->n * sizeof(double));
+	ws->B[k] = (double *)G_malloc(m->n * sizeof(double));
     }
 
-    Rast_set_d_null_value(est, ninx + 1);
-    if (B0)
-	*B0 = NULL;
-    
-    nsize = bw * 2 + 1;
-
-    /* first pass: collect values */
-    count = 0;
-    for (r = 0; r < nsize; r++) {
-
-	for (c = 0; c < nsize; c++) {
+    return ws;
+}
 
-	    if (w[r][c] == 0)
-		continue;
+void gwr_ws_free(struct gwr_ws *ws)
+{
+    int k;
+    double *v0;
 
-	    isnull = 0;
-	    for (i = 0; i < ninx; i++) {
-		xval[i + 1] = xbuf[i].buf[r][c + cc];
-		if (Rast_is_d_null_value(&(xval[i + 1]))) {
-		    isnull = 1;
-		    break;
-		}
-	    }
-	    if (isnull)
-		continue;
+    for (k = 0; k <= ws->ninx; k++) {
+	struct MATRIX *m = &(ws->m_all[k]);
+	int i;
 
-	    yval = ybuf->buf[r][c + cc];
-	    if (Rast_is_d_null_value(&yval))
-		continue;
+	/* rows may have been swapped by solvemat() */
+	v0 = m->v[0];
+	for (i = 1; i < m->n; i++) {
+	    if (m->v[i] < v0)
+		v0 = m->v[i];
+	}
+	G_free(v0);
+	G_free(m->v);
+	G_free(ws->a[k]);
+	G_free(ws->B[k]);
+    }
+    G_free(ws->m_all);
+    G_free(ws->a);
+    G_free(ws->B);
+    G_free(ws->xval);
+    G_free(ws->sums);
+    if (ws->halfwidth)
+	G_free(ws->halfwidth);
+    G_free(ws);
+}
 
-	    for (i = 0; i <= ninx; i++) {
-		double val1 = xval[i];
+/* add weighted products of one cell of the buffers to the sums
+ * and dcount to the number of cells (-1 to remove the cell again)
+ * cells with NULL in any map are skipped */
+static void add_cell(struct gwr_ws *ws, struct rb *xbuf, struct rb *ybuf,
+                     int r, int c, double w, int dcount)
+{
+    int i, j, n, ninx;
+    DCELL yval, *xval;
 
-		for (j = i; j <= ninx; j++) {
-		    double val2 = xval[j];
+    ninx = ws->ninx;
+    xval = ws->xval;
+    for (i = 0; i < ninx; i++) {
+	xval[i + 1] = xbuf[i].buf[r][c];
+	if (Rast_is_d_null_value(&(xval[i + 1])))
+	    return;
+    }
+    yval = ybuf->buf[r][c];
+    if (Rast_is_d_null_value(&yval))
+	return;
 
-		    m = &(m_all[0]);
-		    M(m, i, j) += val1 * val2 * w[r][c];
+    n = 0;
+    for (i = 0; i <= ninx; i++) {
+	double val1 = xval[i];
 
-		    /* linear model without predictor k */
-		    for (k = 1; k <= ninx; k++) {
-			if (k != i && k != j) {
-			    int i2 = k > i ? i : i - 1;
-			    int j2 = k > j ? j : j - 1;
+	for (j = i; j <= ninx; j++)
+	    ws->sums[n++] += val1 * xval[j] * w;
+    }
+    for (i = 0; i <= ninx; i++)
+	ws->sums[n++] += yval * xval[i] * w;
+    ws->count += dcount;
+}
 
-			    m = &(m_all[k]);
-			    M(m, i2, j2) += val1 * val2 * w[r][c];
-			}
-		    }
-		}
+/* geographically weighted regression:
+ * estimate coefficients for given cell
+ * 
+ * The weighted sums of the window are computed from scratch,
+ * or, for kernels with the same weight for all cells, updated
+ * by moving the window along the current row */
+
+int gwr(struct gwr_ws *ws, struct rb *xbuf, struct rb *ybuf, int cc, 
+        DCELL *est, double **B0)
+{
+    int r, c;
+    int i, j, k, n;
+    int ninx, bw, nsize;
+    DCELL *xval;
+    int isnull, solved;
+    double **a, **B, **w;
+    struct MATRIX *m, *m0;
+
+    ninx = ws->ninx;
+    bw = ws->bw;
+    w = ws->w;
+    xval = ws->xval;
+    a = ws->a;
+    B = ws->B;
+    nsize = bw * 2 + 1;
 
-		a[0][i] += yval * val1 * w[r][c];
-		for (k = 1; k <= ninx; k++) {
-		    if (k != i) {
-			int i2 = k > i ? i : i - 1;
+    Rast_set_d_null_value(est, ninx + 1);
+    if (B0)
+	*B0 = NULL;
 
-			a[k][i2] += yval * val1 * w[r][c];
-		    }
-		}
+    /* buffers are rotated when a new row is read */
+    if (ws->halfwidth && ws->row == ybuf->row && ws->cc < cc &&
+        cc - ws->cc < bw && ws->nslides < nsize) {
+	/* move the window: remove the first column, add the next one */
+	for (; ws->cc < cc; ws->cc++) {
+	    for (r = 0; r < nsize; r++) {
+		if (ws->halfwidth[r] < 0)
+		    continue;
+		add_cell(ws, xbuf, ybuf, r, ws->cc + bw - ws->halfwidth[r],
+		         -ws->wu, -1);
+		add_cell(ws, xbuf, ybuf, r, ws->cc + 1 + bw + ws->halfwidth[r],
+		         ws->wu, 1);
 	    }
-	    count++;
+	    ws->nslides++;
 	}
     }
+    else {
+	/* first pass: collect values */
+	for (n = 0; n < NSUMS(ninx); n++)
+	    ws->sums[n] = 0.0;
+	ws->count = 0;
+	for (r = 0; r < nsize; r++) {
+	    for (c = 0; c < nsize; c++) {
+		if (w[r][c] == 0)
+		    continue;
+		add_cell(ws, xbuf, ybuf, r, c + cc, w[r][c], 1);
+	    }
+	}
+	ws->row = ybuf->row;
+	ws->cc = cc;
+	/* sliding accumulates rounding errors, start again after a while */
+	ws->nslides = 0;
+    }
 
-    if (count < ninx + 1) {
+    if (ws->count < ninx + 1) {
 	G_verbose_message(_("Unable to determine coefficients. Consider increasing the bandwidth."));
 	return 0;
     }
 
+    /* OLS for all predictors */
+    m0 = &(ws->m_all[0]);
+    n = 0;
+    for (i = 0; i <= ninx; i++) {
+	for (j = i; j <= ninx; j++)
+	    M(m0, i, j) = ws->sums[n++];
+    }
+    for (i = 0; i <= ninx; i++)
+	a[0][i] = ws->sums[n++];
+
+    /* linear model without predictor k: drop row and column k */
+    for (k = 1; k <= ninx; k++) {
+	m = &(ws->m_all[k]);
+	for (i = 0; i <= ninx; i++) {
+	    int i2 = k > i ? i : i - 1;
+
+	    if (i == k)
+		continue;
+	    for (j = i; j <= ninx; j++) {
+		int j2 = k > j ? j : j - 1;
+
+		if (j != k)
+		    M(m, i2, j2) = M(m0, i, j);
+	    }
+	    a[k][i2] = a[0][i];
+	}
+    }
+
     /* estimate coefficients */
     solved = ninx + 1;
     for (k = 0; k <= ninx; k++) {
-	m = &(m_all[k]);
+	m = &(ws->m_all[k]);
 
 	/* TRANSPOSE VALUES IN UPPER HALF OF M TO OTHER HALF */
 	for (i = 1; i < m->n; i++)
@@ -223,11 +327,6 @@ int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc,
 		M(m, i, j) = M(m, j, i);
 
 	if (!solvemat(m, a[k], B[k])) {
-	    /*
-	    for (i = 0; i <= ninx; i++) {
-		fprintf(stdout, "b%d=0.0\n", i);
-	    }
-	    */
 	    G_debug(1, "Solving matrix %d failed", k);
 	    solved--;
 	}
@@ -269,5 +368,5 @@ int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc,
     if (B0)
 	*B0 = B[0];
 
-    return count;
+    return ws->count;
 }
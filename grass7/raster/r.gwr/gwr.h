@@ -6,5 +6,23 @@ struct MATRIX
 
 #define M(m,row,col) (m)->v[(row)][(col)]
 
+/* workspace of gwr(), one for each thread */
+struct gwr_ws
+{
+    int ninx;			/* number of predictors */
+    int bw;			/* bandwidth */
+    double **w;			/* weights of the kernel */
+    int *halfwidth;		/* half width of each kernel row (-1 if empty)
+				 * if all weights > 0 are the same, else NULL */
+    double wu;			/* the weight if halfwidth is not NULL */
+    DCELL *xval;
+    double *sums;		/* weighted sums of the current window */
+    int count;			/* number of cells in the current window */
+    int row, cc;		/* position of the current window */
+    int nslides;		/* number of moves since last full sum */
+    double **a, **B;
+    struct MATRIX *m_all;
+};
+
 
 int solvemat(struct MATRIX *m, double a[], double B[]);
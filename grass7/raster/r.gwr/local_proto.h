@@ -8,11 +8,15 @@ extern double (*w_fn) (double, double);
 
 double **calc_weights(int bw);
 
-int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc,
-        int bw, double **w, DCELL *est, double **B0);
+struct gwr_ws;
+
+struct gwr_ws *gwr_ws_create(int ninx, int bw, double **w);
+void gwr_ws_free(struct gwr_ws *ws);
+int gwr(struct gwr_ws *ws, struct rb *xbuf, struct rb *ybuf, int cc,
+        DCELL *est, double **B0);
 
 int gwra(SEGMENT *in_seg, FLAG *yflag, int ninx, int rr, int cc,
         int npnts, DCELL *est, double **B0);
 
 int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
-         DCELL *est, int bw);
+         int bw, int golden, int mem_mb);
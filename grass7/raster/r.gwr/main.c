@@ -25,6 +25,9 @@
 #include <grass/gis.h>
 #include <grass/glocale.h>
 #include <grass/raster.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include "local_proto.h"
 
 
@@ -36,11 +39,14 @@ int main(int argc, char *argv[])
     double yres;
     double *B, *Bmin, *Bmax, *Bsum, *Bsumsq, *Bmean, Bstddev;
     int bcount;
-    DCELL *yest;
+    DCELL *est, *cell_y, *cell_est;
+    double *cell_B;
+    int *cell_ok, cc, nthreads;
+    struct gwr_ws **ws;
     double sumY, meanY;
     double SStot, SSerr, SSreg, *SSerr_without;
     double Rsq, Rsqadj, SE, F, t, AIC, AICc, BIC;
-    DCELL *mapx_val, mapy_val, *mapy_buf, *mapres_buf, *mapest_buf;
+    DCELL mapy_val, *mapy_buf, *mapres_buf, *mapest_buf;
     CELL *mask_buf;
     struct rb *xbuf, ybuf;
     SEGMENT in_seg;
@@ -58,7 +64,8 @@ int main(int argc, char *argv[])
     char *name;
     struct Option *input_mapx, *input_mapy, *mask_opt,
                   *output_res, *output_est, *output_b, *output_opt,
-		  *kernel_opt, *vf_opt, *bw_opt, *pnts_opt, *mem_opt;
+		  *kernel_opt, *vf_opt, *bw_opt, *pnts_opt, *mem_opt,
+		  *search_opt;
     struct Flag *shell_style, *estimate;
     struct Cell_head region;
     struct GModule *module;
@@ -112,7 +119,7 @@ int main(int argc, char *argv[])
     kernel_opt = G_define_option();
     kernel_opt->key = "kernel";
     kernel_opt->type = TYPE_STRING;
-    kernel_opt->options = "gauss,epanechnikov,bisquare,tricubic";
+    kernel_opt->options = "gauss,epanechnikov,bisquare,tricubic,uniform";
     kernel_opt->answer = "gauss";
     kernel_opt->required = NO;
     kernel_opt->description =
@@ -148,7 +155,16 @@ int main(int argc, char *argv[])
     mem_opt->type = TYPE_INTEGER;
     mem_opt->required = NO;
     mem_opt->answer = "300";
-    mem_opt->description = _("Memory in MB for adaptive bandwidth");
+    mem_opt->description = _("Memory in MB for adaptive bandwidth and bandwidth estimation");
+
+    search_opt = G_define_option();
+    search_opt->key = "search";
+    search_opt->type = TYPE_STRING;
+    search_opt->options = "gradient,golden";
+    search_opt->answer = "gradient";
+    search_opt->required = NO;
+    search_opt->description =
+	(_("Method to search for the optimal bandwidth with the -e flag"));
 
     shell_style = G_define_flag();
     shell_style->key = 'g';
@@ -179,8 +195,6 @@ int main(int argc, char *argv[])
     /* allocate memory for x maps */
     mapx_fd = (int *)G_malloc(n_predictors * sizeof(int));
     SSerr_without = (double *)G_malloc(n_predictors * sizeof(double));
-    mapx_val = (DCELL *)G_malloc((n_predictors + 1) * sizeof(DCELL));
-    yest = G_malloc(sizeof(DCELL) * (n_predictors + 1));
 
     bw = atoi(bw_opt->answer);
     if (bw < 2)
@@ -209,8 +223,11 @@ int main(int argc, char *argv[])
     meanY = sumY = 0.0;
 
     if (estimate->answer) {
+	mem_mb = atoi(mem_opt->answer);
+	if (mem_mb < 10)
+	    mem_mb = 10;
 	bw = estimate_bandwidth(mapx_fd, n_predictors, mapy_fd, rows, cols,
-				yest, bw);
+				bw, strcmp(search_opt->answer, "golden") == 0, mem_mb);
 	if (shell_style->answer)
 	    fprintf(stdout, "estimate=%d\n", bw);
 	else
@@ -285,7 +302,6 @@ int main(int argc, char *argv[])
     /* gwr for each cell: get estimate */
 
     count = 0;
-    mapx_val[0] = 1.0;
     SStot = SSerr = SSreg = 0.0;
     for (i = 0; i < n_predictors; i++) {
 	SSerr_without[i] = 0.0;
@@ -395,6 +411,21 @@ int main(int argc, char *argv[])
 	}
     }
 
+    /* results for each cell of the current row */
+    cell_ok = G_malloc(cols * sizeof(int));
+    cell_y = G_malloc(cols * sizeof(DCELL));
+    cell_est = G_malloc((size_t)cols * (n_predictors + 1) * sizeof(DCELL));
+    cell_B = G_malloc((size_t)cols * (n_predictors + 1) * sizeof(double));
+
+    nthreads = 1;
+#if defined(_OPENMP)
+    if (npnts == 0)
+	nthreads = omp_get_max_threads();
+#endif
+    ws = G_malloc(nthreads * sizeof(struct gwr_ws *));
+    for (i = 0; i < nthreads; i++)
+	ws[i] = npnts == 0 ? gwr_ws_create(n_predictors, bw, weights) : NULL;
+
     G_message(_("Geographically weighted regression..."));
     for (r = 0; r < rows; r++) {
 	G_percent(r, rows, 2);
@@ -421,45 +452,70 @@ int main(int argc, char *argv[])
 	    }
 	}
 
-	for (c = 0; c < cols; c++) {
-	    int isnull = 0;
-	    
+	/* estimate coefficients for the cells of the row,
+	 * each thread gets a contiguous block of columns
+	 * the adaptive bandwidth reads from a segment and runs serially */
+#pragma omp parallel for schedule(static) num_threads(nthreads) private(i)
+	for (cc = 0; cc < (int)cols; cc++) {
+	    DCELL *xval, *est;
+	    double *Bc;
+	    int isnull = 0, tid = 0;
+
+#if defined(_OPENMP)
+	    tid = omp_get_thread_num();
+#endif
+	    cell_ok[cc] = 0;
+	    est = &cell_est[(size_t)cc * (n_predictors + 1)];
+
 	    if (mask_buf) {
-		if (Rast_is_c_null_value(&mask_buf[c]) || mask_buf[c] == 0)
+		if (Rast_is_c_null_value(&mask_buf[cc]) || mask_buf[cc] == 0)
 		    continue;
 	    }
 
 	    if (npnts == 0) {
 		for (i = 0; i < n_predictors; i++) {
-		    mapx_val[i + 1] = xbuf[i].buf[bw][c + bw];
-		    if (Rast_is_d_null_value(&(mapx_val[i + 1]))) {
+		    xval = &xbuf[i].buf[bw][cc + bw];
+		    if (Rast_is_d_null_value(xval)) {
 			isnull = 1;
 			break;
 		    }
 		}
-		mapy_val = ybuf.buf[bw][c + bw];
+		cell_y[cc] = ybuf.buf[bw][cc + bw];
 	    }
 	    else {
-		Segment_get(&in_seg, (void *)seg_val, r, c);
+		Segment_get(&in_seg, (void *)seg_val, r, cc);
 		if (Rast_is_d_null_value(&(seg_val[0]))) {
 		    isnull = 1;
 		}
-		mapy_val = seg_val[n_predictors];
+		cell_y[cc] = seg_val[n_predictors];
 	    }
 
 	    if (isnull)
 		continue;
 
 	    if (npnts == 0) {
-		if (!gwr(xbuf, n_predictors, &ybuf, c, bw, weights, yest, &B)) {
+		if (!gwr(ws[tid], xbuf, &ybuf, cc, est, &Bc)) {
 		    continue;
 		}
 	    }
 	    else {
-		if (!gwra(&in_seg, null_flag, n_predictors, r, c, npnts, yest, &B)) {
+		if (!gwra(&in_seg, null_flag, n_predictors, r, cc, npnts, est, &Bc)) {
 		    continue;
 		}
 	    }
+	    memcpy(&cell_B[(size_t)cc * (n_predictors + 1)], Bc,
+		   (n_predictors + 1) * sizeof(double));
+	    cell_ok[cc] = 1;
+	}
+
+	/* statistics in the order of cells */
+	for (c = 0; c < cols; c++) {
+	    if (!cell_ok[c])
+		continue;
+
+	    B = &cell_B[(size_t)c * (n_predictors + 1)];
+	    est = &cell_est[(size_t)c * (n_predictors + 1)];
+	    mapy_val = cell_y[c];
 	    
 	    /* coefficient stats */
 	    for (i = 0; i <= n_predictors; i++) {
@@ -480,24 +536,24 @@ int main(int argc, char *argv[])
 
 	    /* set estimate */
 	    if (mapest_buf)
-		mapest_buf[c] = yest[0];
+		mapest_buf[c] = est[0];
 
 	    if (Rast_is_d_null_value(&mapy_val))
 		continue;
 
 	    /* set residual */
-	    yres = mapy_val - yest[0];
+	    yres = mapy_val - est[0];
 	    if (mapres_buf)
 		mapres_buf[c] = yres;
 
 	    SStot += (mapy_val - meanY) * (mapy_val - meanY);
-	    SSreg += (yest[0] - meanY) * (yest[0] - meanY);
+	    SSreg += (est[0] - meanY) * (est[0] - meanY);
 	    SSerr += yres * yres;
 
 	    for (k = 1; k <= n_predictors; k++) {
 
 		/* linear model without predictor k */
-		yres = mapy_val - yest[k];
+		yres = mapy_val - est[k];
 
 		/* linear model without predictor k */
 		SSerr_without[k - 1] += yres * yres;
@@ -642,6 +698,16 @@ int main(int argc, char *argv[])
     if (npnts > 0)
 	Segment_close(&in_seg);
 
+    for (i = 0; i < nthreads; i++) {
+	if (ws[i])
+	    gwr_ws_free(ws[i]);
+    }
+    G_free(ws);
+    G_free(cell_ok);
+    G_free(cell_y);
+    G_free(cell_est);
+    G_free(cell_B);
+
     if (mapres_fd > -1) {
 	struct History history;
 
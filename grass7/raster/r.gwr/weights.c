@@ -81,6 +81,21 @@ double gauss(double d2, double bw)
     return w;
 }
 
+double uniform(double d2, double bw)
+{
+    double bw2, w;
+
+    bw2 = bw * bw;
+
+    w = 0;
+
+    if (d2 <= bw2) {
+	w = 1;
+    }
+
+    return w;
+}
+
 /* set weighing kernel function and variance factor */
 void set_wfn(char *name, int vfu)
 {
@@ -94,6 +109,8 @@ void set_wfn(char *name, int vfu)
 	w_fn = bisquare;
     else if (*name == 't')
 	w_fn = tricubic;
+    else if (*name == 'u')
+	w_fn = uniform;
     else
 	G_fatal_error(_("Invalid kernel option '%s'"), name);
 }
@@ -36,6 +36,7 @@ extern "C" {
 
 #include <map>
 #include <tuple>
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <memory>
@@ -47,6 +48,10 @@ extern "C" {
 
 #include <sys/stat.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using std::string;
 using std::cout;
 using std::cerr;
@@ -95,21 +100,94 @@ string generate_name(const string& basename, const Date& date)
     return name;
 }
 
-void write_average_area(const std::vector<Img>& infected, const char* raster_name,
-                        double ew_res, double ns_res)
+void write_average_area(double avg, const char* raster_name)
 {
     struct History hist;
-    double avg = 0;
-    for (unsigned i = 0; i < infected.size(); i++) {
-        avg += area_of_infected(infected[i], ew_res, ns_res);
-    }
-    avg /= infected.size();
     string avg_string = "Average infected area: " + std::to_string(avg);
     Rast_read_history(raster_name, "", &hist);
     Rast_set_history(&hist, HIST_KEYWRD, avg_string.c_str());
     Rast_write_history(raster_name, &hist);
 }
 
+/** Statistics of infected hosts accumulated over multiple runs
+ *
+ * Runs are added one by one, so the rasters of individual runs don't
+ * need to be kept in memory until all runs are finished.
+ * Only the rasters needed for the requested statistics are allocated.
+ * The number of runs with infection in a cell is a count, so it is
+ * stored as an integer raster.
+ */
+class RunsAggregate
+{
+public:
+    RunsAggregate(int rows, int cols, bool average, bool stddev, bool probability)
+    {
+        if (average || stddev)
+            sum_ = DImg(rows, cols, 0);
+        if (stddev)
+            sum_of_squares_ = DImg(rows, cols, 0);
+        if (probability)
+            occurrences_ = Img(rows, cols, 0);
+    }
+
+    /** Add infected hosts from one run */
+    void add(const Img& infected, double ew_res, double ns_res)
+    {
+        if (sum_.data())
+            sum_ += infected;
+        if (sum_of_squares_.data()) {
+            for (int i = 0; i < infected.rows(); i++)
+                for (int j = 0; j < infected.cols(); j++)
+                    sum_of_squares_(i, j) += double(infected(i, j)) * infected(i, j);
+        }
+        if (occurrences_.data()) {
+            for (int i = 0; i < infected.rows(); i++)
+                for (int j = 0; j < infected.cols(); j++)
+                    if (infected(i, j) > 0)
+                        occurrences_(i, j) += 1;
+        }
+        area_ += area_of_infected(infected, ew_res, ns_res);
+        ++runs_;
+    }
+
+    DImg average() const
+    {
+        return sum_ / runs_;
+    }
+
+    /** Population standard deviation computed from the sums */
+    DImg stddev() const
+    {
+        DImg average = sum_ / runs_;
+        DImg stddev = sum_of_squares_ / runs_ - average * average;
+        // avoid negative values caused by rounding
+        stddev.for_each([](Float& a){a = std::sqrt(std::max(a, 0.));});
+        return stddev;
+    }
+
+    /** Probability of occurrence in percent */
+    DImg probability() const
+    {
+        DImg probability(occurrences_.rows(), occurrences_.cols());
+        for (int i = 0; i < occurrences_.rows(); i++)
+            for (int j = 0; j < occurrences_.cols(); j++)
+                probability(i, j) = 100. * occurrences_(i, j) / runs_;
+        return probability;
+    }
+
+    double average_area() const
+    {
+        return area_ / runs_;
+    }
+
+private:
+    DImg sum_;
+    DImg sum_of_squares_;
+    Img occurrences_;
+    double area_{0};
+    unsigned runs_{0};
+};
+
 inline Date treatment_date_from_string(const string& text)
 {
     try {
@@ -224,6 +302,8 @@ struct PoPSFlags
 {
     struct Flag *mortality;
     struct Flag *generate_seed;
+    struct Flag *cell_parallel;
+    struct Flag *discretize_kernels;
 };
 
 
@@ -683,6 +763,26 @@ int main(int argc, char *argv[])
     opt.threads->options = "1-";
     opt.threads->guisection = _("Randomness");
 
+    flg.cell_parallel = G_define_flag();
+    flg.cell_parallel->key = 'p';
+    flg.cell_parallel->label =
+        _("Use threads within each run instead of across runs");
+    flg.cell_parallel->description =
+        _("Cells of each simulation run are processed in parallel"
+          " and the results do not depend on the number of threads"
+          " (useful for large areas with only a few runs)");
+    flg.cell_parallel->guisection = _("Randomness");
+
+    flg.discretize_kernels = G_define_flag();
+    flg.discretize_kernels->key = 'd';
+    flg.discretize_kernels->label =
+        _("Use precomputed tables for radial dispersal kernels");
+    flg.discretize_kernels->description =
+        _("Probabilities of nearby cells are computed once and dispersers"
+          " are sampled from them (faster for many dispersers,"
+          " applies to Cauchy and exponential kernels)");
+    flg.discretize_kernels->guisection = _("Dispersal");
+
     G_option_required(opt.average, opt.average_series, opt.single_series, opt.probability, opt.probability_series,
                       opt.outside_spores, opt.stddev, opt.stddev_series, NULL);
     G_option_requires_all(opt.average_series, opt.output_frequency, NULL);
@@ -733,6 +833,16 @@ int main(int argc, char *argv[])
 
     // Start creating the configuration.
     Config config;
+    config.cell_parallel = flg.cell_parallel->answer;
+    config.discretize_kernels = flg.discretize_kernels->answer;
+    // rasters are modified only by the model, so only infested cells
+    // need to be visited in each step
+    config.track_active_cells = true;
+#ifdef _OPENMP
+    // threads are used by the Simulation class for the cells
+    if (config.cell_parallel)
+        omp_set_num_threads(threads);
+#endif
 
     // model type
     config.model_type = opt.model_type->answer;
@@ -924,6 +1034,9 @@ int main(int argc, char *argv[])
             G_fatal_error(_("Not enough temperatures"));
     }
 
+    // Weather coefficients are read once for each chunk of steps of each
+    // batch, shared by all runs of the batch, and released when the chunk
+    // is done, so only one chunk is in memory.
     std::vector<DImg> weather_coefficients;
     if (weather || moisture_temperature)
         weather_coefficients.resize(config.scheduler().get_num_steps());
@@ -948,43 +1061,36 @@ int main(int argc, char *argv[])
         }
     }
 
-    // build the Sporulation object
-    std::vector<Model<Img, DImg, int>> models;
-    std::vector<Img> dispersers;
-    std::vector<Img> sus_species_rasts(num_runs, S_species_rast);
-    std::vector<Img> inf_species_rasts(num_runs, I_species_rast);
-    std::vector<Img> resistant_rasts(num_runs, Img(S_species_rast, 0));
-
-    // We always create at least one exposed for simplicity, but we
-    // could also just leave it empty.
-    std::vector<std::vector<Img>> exposed_vectors(
-                num_runs,
-                std::vector<Img>(
-                    config.latency_period_steps + 1,
-                    Img(S_species_rast.rows(), S_species_rast.cols(), 0)
-                    )
-                );
-
-    // infected cohort for each year (index is cohort age)
-    // age starts with 0 (in year 1), 0 is oldest
-    std::vector<std::vector<Img> > mortality_tracker_vector(
-        num_runs, std::vector<Img>(config.num_mortality_years(), Img(S_species_rast, 0)));
-
-    // we are using only the first dead img for visualization, but for
-    // parallelization we need all allocated anyway
-    std::vector<Img> dead_in_current_year(num_runs, Img(S_species_rast, 0));
+    // Runs are computed in batches of as many runs as there are threads.
+    // Only the runs of the current batch have their state in memory and
+    // the results are accumulated for the outputs as soon as they are
+    // available, so memory use does not grow with the number of runs.
+    // With cell parallelism, the runs of a batch go through each chunk
+    // one after another, so the weather is still read once per batch.
+    // Host, total population, temperature, weather and treatment rasters are
+    // read-only and shared by all the runs.
+    unsigned batch_size = std::min(threads, num_runs);
+
+    const std::vector<bool>& output_schedule = config.output_schedule();
+    unsigned num_outputs = std::count(output_schedule.begin(), output_schedule.end(), true);
+    bool series_stats = opt.average_series->answer || opt.stddev_series->answer;
+    std::vector<RunsAggregate> series_aggregates;
+    if (series_stats || opt.probability_series->answer) {
+        series_aggregates.reserve(num_outputs);
+        for (unsigned i = 0; i < num_outputs; i++)
+            series_aggregates.emplace_back(
+                        I_species_rast.rows(), I_species_rast.cols(), series_stats,
+                        opt.stddev_series->answer, opt.probability_series->answer);
+    }
+    RunsAggregate final_aggregate(
+                I_species_rast.rows(), I_species_rast.cols(),
+                opt.average->answer || opt.stddev->answer,
+                opt.stddev->answer, opt.probability->answer);
+
     // dead trees accumulated over years
     // TODO: allow only when series as single run
     Img accumulated_dead(Img(S_species_rast, 0));
 
-    models.reserve(num_runs);
-    dispersers.reserve(num_runs);
-    for (unsigned i = 0; i < num_runs; ++i) {
-        Config config_copy = config;
-        config_copy.random_seed = seed_value++;
-        models.emplace_back(config_copy);
-        dispersers.emplace_back(I_species_rast.rows(), I_species_rast.cols());
-    }
     std::vector<std::vector<std::tuple<int, int> > > outside_spores(num_runs);
 
     // spread rate initialization
@@ -1000,166 +1106,207 @@ int main(int argc, char *argv[])
     std::vector<unsigned> unresolved_steps;
     unresolved_steps.reserve(config.scheduler().get_num_steps());
 
-    // main simulation loop
+    // precomputed kernel tables are the same for all runs
+    auto natural_discretized_kernel = create_natural_discretized_kernel(config);
+    auto anthro_discretized_kernel = create_anthro_discretized_kernel(config);
+
     unsigned current_index = 0;
-    for (; current_index < config.scheduler().get_num_steps(); ++current_index) {
-        unresolved_steps.push_back(current_index);
+    for (unsigned first_run = 0; first_run < num_runs; first_run += batch_size) {
+        unsigned batch_runs = std::min(batch_size, num_runs - first_run);
+        if (batch_runs < num_runs)
+            G_verbose_message(_("Computing runs %u-%u of %u"),
+                              first_run + 1, first_run + batch_runs, num_runs);
+
+        // build the Sporulation object
+        std::vector<Model<Img, DImg, int>> models;
+        std::vector<Img> dispersers;
+        std::vector<Img> sus_species_rasts(batch_runs, S_species_rast);
+        std::vector<Img> inf_species_rasts(batch_runs, I_species_rast);
+        std::vector<Img> resistant_rasts(batch_runs, Img(S_species_rast, 0));
+
+        // We always create at least one exposed for simplicity, but we
+        // could also just leave it empty.
+        std::vector<std::vector<Img>> exposed_vectors(
+                    batch_runs,
+                    std::vector<Img>(
+                        config.latency_period_steps + 1,
+                        Img(S_species_rast.rows(), S_species_rast.cols(), 0)
+                        )
+                    );
+
+        // infected cohort for each year (index is cohort age)
+        // age starts with 0 (in year 1), 0 is oldest
+        // Without mortality, the trackers are only written to, so all
+        // years of one run share one raster.
+        std::vector<Img> mortality_tracker_storage;
+        std::vector<std::vector<Img> > mortality_tracker_vector(batch_runs);
+        if (config.use_mortality) {
+            for (auto& trackers : mortality_tracker_vector)
+                trackers.assign(config.num_mortality_years(), Img(S_species_rast, 0));
+        }
+        else {
+            mortality_tracker_storage.assign(batch_runs, Img(S_species_rast, 0));
+            for (unsigned run = 0; run < batch_runs; run++) {
+                for (unsigned year = 0; year < config.num_mortality_years(); year++)
+                    mortality_tracker_vector[run].emplace_back(
+                                mortality_tracker_storage[run].data(),
+                                S_species_rast.rows(), S_species_rast.cols());
+            }
+        }
 
-        // if all the hosts are infected, then exit
-        if (all_infected(S_species_rast)) {
-            G_warning("In step %d all suspectible hosts are infected, ending simulation.", current_index);
-            break;
+        // we are using only the first dead img for visualization, but for
+        // parallelization we need all allocated anyway
+        std::vector<Img> dead_in_current_year(batch_runs, Img(S_species_rast, 0));
+
+        models.reserve(batch_runs);
+        dispersers.reserve(batch_runs);
+        for (unsigned i = 0; i < batch_runs; ++i) {
+            Config config_copy = config;
+            // with cell parallelism, run is part of the random number key
+            if (config.cell_parallel)
+                config_copy.run = first_run + i;
+            else
+                config_copy.random_seed = seed_value + first_run + i;
+            models.emplace_back(
+                config_copy, natural_discretized_kernel, anthro_discretized_kernel);
+            dispersers.emplace_back(I_species_rast.rows(), I_species_rast.cols());
         }
 
-        // check whether the spore occurs in the month
-        // At the end of the year, run simulation for all unresolved
-        // steps in one chunk.
-        if (config.output_schedule()[current_index] || current_index == config.scheduler().get_num_steps() - 1) {
-            unsigned step_in_chunk = 0;
-            // get weather for all the steps in chunk
-            for (auto step : unresolved_steps) {
-                if (moisture_temperature) {
-                    DImg moisture(raster_from_grass_float(moisture_names[step]));
-                    DImg temperature(raster_from_grass_float(temperature_names[step]));
-                    weather_coefficients[step_in_chunk] = moisture * temperature;
-                } else if (weather)
-                    weather_coefficients[step_in_chunk] = raster_from_grass_float(weather_names[step]);
-                ++step_in_chunk;
+        // main simulation loop
+        unresolved_steps.clear();
+        current_index = 0;
+        for (; current_index < config.scheduler().get_num_steps(); ++current_index) {
+            unresolved_steps.push_back(current_index);
+
+            // if all the hosts are infected, then exit
+            if (all_infected(S_species_rast)) {
+                G_warning("In step %d all suspectible hosts are infected, ending simulation.", current_index);
+                break;
             }
 
-            // stochastic simulation runs
-            #pragma omp parallel for num_threads(threads)
-            for (unsigned run = 0; run < num_runs; run++) {
-                // actual runs of the simulation for each step
-                int weather_step = 0;
+            // check whether the spore occurs in the month
+            // At the end of the year, run simulation for all unresolved
+            // steps in one chunk.
+            if (output_schedule[current_index] || current_index == config.scheduler().get_num_steps() - 1) {
+                // get weather for all the steps in chunk
                 for (auto step : unresolved_steps) {
-                    dead_in_current_year[run].zero();
-                    models[run].run_step(
-                                step,
-                                inf_species_rasts[run],
-                                sus_species_rasts[run],
-                                lvtree_rast,
-                                dispersers[run],
-                                exposed_vectors[run],
-                                mortality_tracker_vector[run],
-                                dead_in_current_year[run],
-                                actual_temperatures,
-                                weather_coefficients[weather_step],
-                                treatments,
-                                resistant_rasts[run],
-                                outside_spores[run],
-                                spread_rates[run],
-                                quarantine,
-                                empty,
-                                movements
-                                );
-                    ++weather_step;
+                    if (moisture_temperature) {
+                        DImg moisture(raster_from_grass_float(moisture_names[step]));
+                        DImg temperature(raster_from_grass_float(temperature_names[step]));
+                        weather_coefficients[step] = moisture * temperature;
+                    } else if (weather)
+                        weather_coefficients[step] = raster_from_grass_float(weather_names[step]);
                 }
-            }
 
-            unresolved_steps.clear();
-            if (config.output_schedule()[current_index]) {
-                // output
-                Step interval = config.scheduler().get_step(current_index);
-                if (opt.single_series->answer) {
-                    string name = generate_name(opt.single_series->answer, interval.end_date());
-                    raster_to_grass(inf_species_rasts[0], name,
-                            "Occurrence from a single stochastic run",
-                            interval.end_date());
-                }
-                if ((opt.average_series->answer) || opt.stddev_series->answer) {
-                    // aggregate in the series
-                    DImg average_raster(I_species_rast.rows(), I_species_rast.cols(), 0);
-                    average_raster.zero();
-                    for (unsigned i = 0; i < num_runs; i++)
-                        average_raster += inf_species_rasts[i];
-                    average_raster /= num_runs;
-                    if (opt.average_series->answer) {
-                        // write result
-                        // date is always end of the year, even for seasonal spread
-                        string name = generate_name(opt.average_series->answer, interval.end_date());
-                        raster_to_grass(average_raster, name,
-                                        "Average occurrence from all stochastic runs",
-                                        interval.end_date());
-                        write_average_area(inf_species_rasts, name.c_str(),
-                                           window.ew_res, window.ns_res);
-                    }
-                    if (opt.stddev_series->answer) {
-                        DImg stddev(I_species_rast.rows(), I_species_rast.cols(), 0);
-                        for (unsigned i = 0; i < num_runs; i++) {
-                            auto tmp = inf_species_rasts[i] - average_raster;
-                            stddev += tmp * tmp;
-                        }
-                        stddev /= num_runs;
-                        stddev.for_each([](Float& a){a = std::sqrt(a);});
-                        string name = generate_name(opt.stddev_series->answer, interval.end_date());
-                        string title = "Standard deviation of average"
-                                       " occurrence from all stochastic runs";
-                        raster_to_grass(stddev, name, title, interval.end_date());
+                // stochastic simulation runs
+                // (with cell parallelism, the threads are used inside of each run
+                // and the runs of the batch are computed one after another)
+                #pragma omp parallel for num_threads(threads) if(!config.cell_parallel)
+                for (unsigned run = 0; run < batch_runs; run++) {
+                    // actual runs of the simulation for each step
+                    for (auto step : unresolved_steps) {
+                        dead_in_current_year[run].zero();
+                        models[run].run_step(
+                                    step,
+                                    inf_species_rasts[run],
+                                    sus_species_rasts[run],
+                                    lvtree_rast,
+                                    dispersers[run],
+                                    exposed_vectors[run],
+                                    mortality_tracker_vector[run],
+                                    dead_in_current_year[run],
+                                    actual_temperatures,
+                                    weather_coefficients[step],
+                                    treatments,
+                                    resistant_rasts[run],
+                                    outside_spores[first_run + run],
+                                    spread_rates[first_run + run],
+                                    quarantine,
+                                    empty,
+                                    movements
+                                    );
                     }
                 }
-                if (opt.probability_series->answer) {
-                    DImg probability(I_species_rast.rows(), I_species_rast.cols(), 0);
-                    for (unsigned i = 0; i < num_runs; i++) {
-                        Img tmp = inf_species_rasts[i];
-                        tmp.for_each([](Integer& a){a = bool(a);});
-                        probability += tmp;
-                    }
-                    probability *= 100;  // prob from 0 to 100
-                    probability /= num_runs;
-                    string name = generate_name(opt.probability_series->answer, interval.end_date());
-                    string title = "Probability of occurrence";
-                    raster_to_grass(probability, name, title, interval.end_date());
+                // release the weather of the chunk
+                if (config.weather) {
+                    for (auto step : unresolved_steps)
+                        weather_coefficients[step] = DImg();
                 }
-                if (config.use_mortality && opt.dead_series->answer) {
-                    accumulated_dead += dead_in_current_year[0];
-                    if (opt.dead_series->answer) {
-                        string name = generate_name(opt.dead_series->answer, interval.end_date());
-                        raster_to_grass(accumulated_dead, name,
-                                        "Number of dead hosts to date",
-                                        interval.end_date());
+
+                unresolved_steps.clear();
+                if (output_schedule[current_index]) {
+                    // output
+                    Step interval = config.scheduler().get_step(current_index);
+                    if (opt.single_series->answer && first_run == 0) {
+                        string name = generate_name(opt.single_series->answer, interval.end_date());
+                        raster_to_grass(inf_species_rasts[0], name,
+                                "Occurrence from a single stochastic run",
+                                interval.end_date());
+                    }
+                    if (!series_aggregates.empty()) {
+                        // aggregate in the series (written when all runs are done)
+                        unsigned output_index = simulation_step_to_action_step(output_schedule, current_index);
+                        for (unsigned run = 0; run < batch_runs; run++)
+                            series_aggregates[output_index].add(
+                                        inf_species_rasts[run], window.ew_res, window.ns_res);
+                    }
+                    if (config.use_mortality && opt.dead_series->answer && first_run == 0) {
+                        accumulated_dead += dead_in_current_year[0];
+                        if (opt.dead_series->answer) {
+                            string name = generate_name(opt.dead_series->answer, interval.end_date());
+                            raster_to_grass(accumulated_dead, name,
+                                            "Number of dead hosts to date",
+                                            interval.end_date());
+                        }
                     }
                 }
             }
         }
+        for (unsigned run = 0; run < batch_runs; run++)
+            final_aggregate.add(inf_species_rasts[run], window.ew_res, window.ns_res);
     }
-    Step interval = config.scheduler().get_step(--current_index);
-    if (opt.average->answer || opt.stddev->answer) {
-        // aggregate
-        DImg average_raster(I_species_rast.rows(), I_species_rast.cols(), 0);
-        for (unsigned i = 0; i < num_runs; i++)
-            average_raster += inf_species_rasts[i];
-        average_raster /= num_runs;
-        if (opt.average->answer) {
-            // write final result
-            raster_to_grass(average_raster, opt.average->answer,
+    // write the series aggregated from all runs
+    for (unsigned step = 0; step < current_index && !series_aggregates.empty(); step++) {
+        if (!output_schedule[step])
+            continue;
+        Step interval = config.scheduler().get_step(step);
+        const RunsAggregate& aggregate =
+                series_aggregates[simulation_step_to_action_step(output_schedule, step)];
+        if (opt.average_series->answer) {
+            // write result
+            // date is always end of the year, even for seasonal spread
+            string name = generate_name(opt.average_series->answer, interval.end_date());
+            raster_to_grass(aggregate.average(), name,
                             "Average occurrence from all stochastic runs",
                             interval.end_date());
-            write_average_area(inf_species_rasts, opt.average->answer,
-                               window.ew_res, window.ns_res);
+            write_average_area(aggregate.average_area(), name.c_str());
         }
-        if (opt.stddev->answer) {
-            DImg stddev(average_raster.rows(), average_raster.cols(), 0);
-            for (unsigned i = 0; i < num_runs; i++) {
-                auto tmp = inf_species_rasts[i] - average_raster;
-                stddev += tmp * tmp;
-            }
-            stddev /= num_runs;
-            stddev.for_each([](Float& a){a = std::sqrt(a);});
-            raster_to_grass(stddev, opt.stddev->answer,
-                            opt.stddev->description, interval.end_date());
+        if (opt.stddev_series->answer) {
+            string name = generate_name(opt.stddev_series->answer, interval.end_date());
+            string title = "Standard deviation of average"
+                           " occurrence from all stochastic runs";
+            raster_to_grass(aggregate.stddev(), name, title, interval.end_date());
         }
+        if (opt.probability_series->answer) {
+            string name = generate_name(opt.probability_series->answer, interval.end_date());
+            string title = "Probability of occurrence";
+            raster_to_grass(aggregate.probability(), name, title, interval.end_date());
+        }
+    }
+    Step interval = config.scheduler().get_step(--current_index);
+    if (opt.average->answer) {
+        // write final result
+        raster_to_grass(final_aggregate.average(), opt.average->answer,
+                        "Average occurrence from all stochastic runs",
+                        interval.end_date());
+        write_average_area(final_aggregate.average_area(), opt.average->answer);
+    }
+    if (opt.stddev->answer) {
+        raster_to_grass(final_aggregate.stddev(), opt.stddev->answer,
+                        opt.stddev->description, interval.end_date());
     }
     if (opt.probability->answer) {
-        DImg probability(I_species_rast.rows(), I_species_rast.cols(), 0);
-        for (unsigned i = 0; i < num_runs; i++) {
-            Img tmp = inf_species_rasts[i];
-            tmp.for_each([](Integer& a){a = bool(a);});
-            probability += tmp;
-        }
-        probability *= 100;  // prob from 0 to 100
-        probability /= num_runs;
-        raster_to_grass(probability, opt.probability->answer,
+        raster_to_grass(final_aggregate.probability(), opt.probability->answer,
                         "Probability of occurrence", interval.end_date());
     }
     if (opt.outside_spores->answer) {
@@ -35,6 +35,12 @@ class Config
 public:
     // Seed
     int random_seed{0};
+    // Index of the stochastic run (used to key random numbers with cell_parallel)
+    unsigned run{0};
+    // Process cells of one run in parallel
+    bool cell_parallel{false};
+    // Visit only cells with infected or exposed hosts
+    bool track_active_cells{false};
     // Size
     int rows{0};
     int cols{0};
@@ -80,6 +86,8 @@ public:
     bool use_movements{false};
     std::vector<unsigned> movement_schedule;
     double dispersal_percentage{0.99};
+    // Sample radial kernels from precomputed cell offsets
+    bool discretize_kernels{false};
     std::string output_frequency;
     unsigned output_frequency_n;
     bool use_spreadrates{true};
@@ -0,0 +1,133 @@
+/*
+ * PoPS model - counter-based random number engine
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * This file is part of PoPS.
+
+ * PoPS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * PoPS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with PoPS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef POPS_COUNTER_BASED_ENGINE_HPP
+#define POPS_COUNTER_BASED_ENGINE_HPP
+
+#include <cstdint>
+#include <limits>
+
+namespace pops {
+
+/*! Independent random number streams used within one simulation step
+ *
+ * Each stream gives a different key to the CounterBasedEngine, so that
+ * the same cell and the same item (host or disperser) do not share
+ * random numbers between different parts of the simulation.
+ */
+enum class RandomStream : std::uint64_t
+{
+    Generate = 1,  ///< Generating dispersers from infected hosts
+    Disperse = 2  ///< Moving and establishing dispersers
+};
+
+/*! Counter-based random number engine
+ *
+ * The engine produces a stream of numbers which is a pure function
+ * of a key and a counter. The key is derived from the random seed,
+ * the simulation run, the simulation step, the random stream, the cell,
+ * and the item in the cell (e.g., a disperser). The counter is
+ * incremented with each generated number.
+ *
+ * Because there is no state shared between cells, each cell (or each
+ * disperser) can get its own engine and the results do not depend on
+ * the order in which the cells are processed. This is what makes
+ * the parallel processing of cells reproducible regardless of the
+ * number of threads.
+ *
+ * The mixing function is the finalizer of the SplitMix64 generator
+ * which is used both to combine the key components and to produce
+ * the output from the key and the counter.
+ *
+ * The class satisfies the UniformRandomBitGenerator requirements,
+ * so it can be used with the standard library distributions.
+ */
+class CounterBasedEngine
+{
+public:
+    using result_type = std::uint64_t;
+
+    /*! Create engine for a given key
+     *
+     * @param seed Random seed of the simulation
+     * @param run Index of the stochastic run
+     * @param step Simulation step
+     * @param stream Part of the simulation using the numbers
+     * @param cell Index of the cell in the raster (row * cols + col)
+     * @param item Index of the item in the cell (e.g., disperser)
+     */
+    CounterBasedEngine(
+        std::uint64_t seed,
+        std::uint64_t run,
+        std::uint64_t step,
+        RandomStream stream,
+        std::uint64_t cell,
+        std::uint64_t item = 0)
+        : counter_(0)
+    {
+        key_ = mix(seed);
+        key_ = mix(key_ ^ run);
+        key_ = mix(key_ ^ step);
+        key_ = mix(key_ ^ static_cast<std::uint64_t>(stream));
+        key_ = mix(key_ ^ cell);
+        key_ = mix(key_ ^ item);
+    }
+
+    static constexpr result_type min()
+    {
+        return std::numeric_limits<result_type>::min();
+    }
+
+    static constexpr result_type max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()()
+    {
+        ++counter_;
+        return mix(key_ + counter_ * golden_gamma);
+    }
+
+    /*! Advance the counter without generating the numbers */
+    void discard(unsigned long long count)
+    {
+        counter_ += count;
+    }
+
+private:
+    static constexpr std::uint64_t golden_gamma = 0x9E3779B97F4A7C15ULL;
+
+    static std::uint64_t mix(std::uint64_t value)
+    {
+        value += golden_gamma;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+        return value ^ (value >> 31);
+    }
+
+    std::uint64_t key_;
+    std::uint64_t counter_;
+};
+
+}  // namespace pops
+
+#endif  // POPS_COUNTER_BASED_ENGINE_HPP
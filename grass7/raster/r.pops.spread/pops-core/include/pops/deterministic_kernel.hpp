@@ -18,6 +18,7 @@
 
 #include <vector>
 #include <tuple>
+#include <limits>
 
 #include "raster.hpp"
 #include "kernel_types.hpp"
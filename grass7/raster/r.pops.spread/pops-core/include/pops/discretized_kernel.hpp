@@ -0,0 +1,379 @@
+/*
+ * PoPS model - discretized radial dispersal kernel
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * This file is part of PoPS.
+
+ * PoPS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * PoPS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with PoPS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef POPS_DISCRETIZED_KERNEL_HPP
+#define POPS_DISCRETIZED_KERNEL_HPP
+
+#include "kernel_types.hpp"
+
+#include <cmath>
+#include <tuple>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
+
+// PI is used in the code and M_PI is not guaranteed
+// fix it, but prefer the system definition
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#ifndef PI
+#define PI M_PI
+#endif
+
+namespace pops {
+
+/*! Walker's alias table for sampling from a discrete distribution
+ *
+ * The table is built in O(n) using Vose's method and each sample
+ * takes O(1) time and one uniform random number regardless of the
+ * number of items.
+ */
+class AliasTable
+{
+public:
+    AliasTable() = default;
+
+    /*! Build the table from (not necessarily normalized) weights */
+    explicit AliasTable(const std::vector<double>& weights)
+        : probability_(weights.size()), alias_(weights.size())
+    {
+        std::size_t size = weights.size();
+        if (!size)
+            throw std::invalid_argument("AliasTable: No weights provided");
+        double sum = 0;
+        for (double weight : weights)
+            sum += weight;
+        if (!(sum > 0))
+            throw std::invalid_argument("AliasTable: Sum of weights must be positive");
+        std::vector<double> scaled(size);
+        std::vector<std::size_t> small;
+        std::vector<std::size_t> large;
+        for (std::size_t i = 0; i < size; i++) {
+            scaled[i] = weights[i] * size / sum;
+            if (scaled[i] < 1)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            std::size_t less = small.back();
+            small.pop_back();
+            std::size_t more = large.back();
+            large.pop_back();
+            probability_[less] = scaled[less];
+            alias_[less] = more;
+            scaled[more] = (scaled[more] + scaled[less]) - 1;
+            if (scaled[more] < 1)
+                small.push_back(more);
+            else
+                large.push_back(more);
+        }
+        // remaining items are full (up to rounding errors)
+        for (std::size_t i : large) {
+            probability_[i] = 1;
+            alias_[i] = i;
+        }
+        for (std::size_t i : small) {
+            probability_[i] = 1;
+            alias_[i] = i;
+        }
+    }
+
+    /*! Return index of a randomly selected item */
+    template<typename Generator>
+    std::size_t operator()(Generator& generator) const
+    {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        // one number gives both the column and the coin flip
+        double value = uniform(generator) * probability_.size();
+        std::size_t index = std::min(
+            static_cast<std::size_t>(value), probability_.size() - 1);
+        if (value - index < probability_[index])
+            return index;
+        return alias_[index];
+    }
+
+    std::size_t size() const
+    {
+        return probability_.size();
+    }
+
+private:
+    std::vector<double> probability_;
+    std::vector<std::size_t> alias_;
+};
+
+/*! Radial dispersal kernel with precomputed cell offsets
+ *
+ * The kernel is a discretized version of RadialDispersalKernel.
+ * Probabilities of all cell offsets within the distance given by
+ * *dispersal_percentage* are computed once in the constructor by
+ * integrating the distance and direction distributions and the offsets
+ * are then sampled using an alias table, so each draw costs O(1)
+ * and involves no trigonometric functions.
+ *
+ * The window radius is also limited by *max_window_cells* to keep
+ * the table small for heavy-tailed kernels with large scales.
+ * Distances beyond the precomputed window (the remaining
+ * 1 - *dispersal_percentage* of dispersers or more) are drawn from the continuous
+ * distribution using its inverse CDF, so dispersers can still
+ * travel far and leave the modeled area.
+ *
+ * The object is read-only after construction, so it can be shared
+ * between threads and between kernel objects.
+ */
+class DiscretizedRadialDispersalKernel
+{
+public:
+    /*!
+     * @param ew_res East-west resolution
+     * @param ns_res North-south resolution
+     * @param dispersal_kernel Kernel type (Cauchy or exponential)
+     * @param distance_scale Scale of the distance distribution
+     * @param direction_mu Mean direction in radians (clockwise from north)
+     * @param direction_kappa Concentration of the direction (0 for none)
+     * @param dispersal_percentage Probability mass in the precomputed window
+     * @param samples_per_cell Number of integration samples per cell size
+     * @param max_window_cells Maximum radius of the window in cells
+     */
+    DiscretizedRadialDispersalKernel(
+        double ew_res,
+        double ns_res,
+        DispersalKernelType dispersal_kernel,
+        double distance_scale,
+        double direction_mu = 0,
+        double direction_kappa = 0,
+        double dispersal_percentage = 0.99,
+        unsigned samples_per_cell = 4,
+        unsigned max_window_cells = 250)
+        : east_west_resolution(ew_res),
+          north_south_resolution(ns_res),
+          kernel_type_(dispersal_kernel),
+          scale_(distance_scale),
+          window_probability_(dispersal_percentage),
+          direction_mu_(direction_mu),
+          direction_kappa_(direction_kappa)
+    {
+        if (kernel_type_ != DispersalKernelType::Cauchy
+            && kernel_type_ != DispersalKernelType::Exponential) {
+            throw std::invalid_argument(
+                "DiscretizedRadialDispersalKernel: Unsupported dispersal kernel type");
+        }
+        if (!(dispersal_percentage > 0 && dispersal_percentage < 1)) {
+            throw std::invalid_argument(
+                "DiscretizedRadialDispersalKernel: dispersal_percentage must be"
+                " between 0 and 1");
+        }
+        // heavy-tailed kernels would need a huge window, so the window
+        // is limited and the rest goes to the tail
+        double min_res = std::min(ew_res, ns_res);
+        max_distance_ = std::min(
+            distance_icdf(window_probability_), max_window_cells * min_res);
+        window_probability_ = distance_cdf(max_distance_);
+        build_direction_table(samples_per_cell);
+        build_offset_table(samples_per_cell);
+    }
+
+    /*! Generates a new position for the spread.
+     *
+     * \copydetails RadialDispersalKernel::operator()()
+     */
+    template<typename Generator>
+    std::tuple<int, int> operator()(Generator& generator, int row, int col) const
+    {
+        std::size_t index = offset_table_(generator);
+        if (index < row_offsets_.size())
+            return std::make_tuple(row + row_offsets_[index], col + col_offsets_[index]);
+        // the tail of the distance distribution outside of the window
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        double distance = distance_icdf(
+            window_probability_ + (1 - window_probability_) * uniform(generator));
+        double theta = direction_angles_[direction_table_(generator)];
+        row -= round(distance * cos(theta) / north_south_resolution);
+        col += round(distance * sin(theta) / east_west_resolution);
+        return std::make_tuple(row, col);
+    }
+
+    /*! Probability of moving by the given offset (0 if not in the window) */
+    double offset_probability(int row_offset, int col_offset) const
+    {
+        auto found = index_of_offset_.find(offset_key(row_offset, col_offset));
+        if (found == index_of_offset_.end())
+            return 0;
+        return offset_weights_[found->second];
+    }
+
+    /*! Number of precomputed offsets */
+    std::size_t num_offsets() const
+    {
+        return row_offsets_.size();
+    }
+
+    /*! Returns true if the kernel class support a given kernel type */
+    static bool supports_kernel(const DispersalKernelType type)
+    {
+        return type == DispersalKernelType::Cauchy
+               || type == DispersalKernelType::Exponential;
+    }
+
+private:
+    double east_west_resolution;
+    double north_south_resolution;
+    DispersalKernelType kernel_type_;
+    double scale_;
+    double window_probability_;
+    double direction_mu_;
+    double direction_kappa_;
+    std::vector<int> row_offsets_;
+    std::vector<int> col_offsets_;
+    std::vector<double> offset_weights_;
+    std::unordered_map<std::int64_t, std::size_t> index_of_offset_;
+    AliasTable offset_table_;
+    std::vector<double> direction_angles_;
+    std::vector<double> cumulative_direction_weights_;
+    AliasTable direction_table_;
+    double max_distance_;
+
+    /*! Distance (in cells) up to which the fine rings are used */
+    static constexpr double near_cells = 8;
+
+    static std::int64_t offset_key(int row, int col)
+    {
+        return (static_cast<std::int64_t>(row) << 32) ^ static_cast<std::uint32_t>(col);
+    }
+
+    /*! CDF of the absolute value of the distance distribution */
+    double distance_cdf(double distance) const
+    {
+        if (kernel_type_ == DispersalKernelType::Cauchy)
+            return 2 / PI * std::atan(distance / scale_);
+        return 1 - std::exp(-distance / scale_);
+    }
+
+    /*! Inverse CDF of the absolute value of the distance distribution */
+    double distance_icdf(double probability) const
+    {
+        if (kernel_type_ == DispersalKernelType::Cauchy)
+            return scale_ * std::tan(PI * probability / 2);
+        return -scale_ * std::log(1 - probability);
+    }
+
+    /*! Discretize the direction (von Mises) distribution
+     *
+     * The number of angles is high enough for the largest distance
+     * in the window to be sampled about *samples_per_cell* times
+     * per cell along the circle. Cumulative weights are kept so that
+     * a range of angles can be summed in constant time.
+     */
+    void build_direction_table(unsigned samples_per_cell)
+    {
+        double min_res = std::min(east_west_resolution, north_south_resolution);
+        std::size_t num_angles = std::max<std::size_t>(
+            64, std::ceil(2 * PI * max_distance_ / min_res * samples_per_cell));
+        direction_angles_.resize(num_angles);
+        std::vector<double> weights(num_angles);
+        cumulative_direction_weights_.assign(num_angles + 1, 0);
+        for (std::size_t i = 0; i < num_angles; i++) {
+            double theta = 2 * PI * (i + 0.5) / num_angles;
+            direction_angles_[i] = theta;
+            // von Mises density without the normalizing constant
+            weights[i] = std::exp(direction_kappa_ * (std::cos(theta - direction_mu_) - 1));
+            cumulative_direction_weights_[i + 1] =
+                cumulative_direction_weights_[i] + weights[i];
+        }
+        direction_table_ = AliasTable(weights);
+    }
+
+    /*! Integrate the kernel over distance rings and directions
+     *
+     * The distance is split into rings and the probability of each ring
+     * is distributed to the cells hit by the discretized directions
+     * in the same way as the continuous kernel rounds the position.
+     * Close to the source, where most of the mass is and where rounding
+     * to cells matters most, the rings are *samples_per_cell* times
+     * narrower than further away.
+     */
+    void build_offset_table(unsigned samples_per_cell)
+    {
+        double min_res = std::min(east_west_resolution, north_south_resolution);
+        double near_distance = std::min(max_distance_, near_cells * min_res);
+        double near_width = min_res / (samples_per_cell * samples_per_cell);
+        double far_width = min_res / samples_per_cell;
+        std::size_t num_near_rings =
+            std::max<std::size_t>(1, std::ceil(near_distance / near_width));
+        std::size_t num_far_rings = std::ceil((max_distance_ - near_distance) / far_width);
+        near_width = near_distance / num_near_rings;
+        if (num_far_rings)
+            far_width = (max_distance_ - near_distance) / num_far_rings;
+        std::size_t num_angles = direction_angles_.size();
+        double direction_sum = cumulative_direction_weights_.back();
+
+        for (std::size_t ring = 0; ring < num_near_rings + num_far_rings; ring++) {
+            double inner = ring < num_near_rings
+                               ? ring * near_width
+                               : near_distance + (ring - num_near_rings) * far_width;
+            double outer = ring < num_near_rings
+                               ? (ring + 1) * near_width
+                               : near_distance + (ring + 1 - num_near_rings) * far_width;
+            double ring_probability = distance_cdf(outer) - distance_cdf(inner);
+            double distance = (inner + outer) / 2;
+            // fewer directions are needed for the inner rings
+            std::size_t num_buckets = std::min<std::size_t>(
+                num_angles,
+                std::max<double>(64, 2 * PI * distance / min_res * samples_per_cell));
+            for (std::size_t bucket = 0; bucket < num_buckets; bucket++) {
+                std::size_t begin = bucket * num_angles / num_buckets;
+                std::size_t end = (bucket + 1) * num_angles / num_buckets;
+                double weight =
+                    cumulative_direction_weights_[end] - cumulative_direction_weights_[begin];
+                double theta = 2 * PI * (begin + end) / (2.0 * num_angles);
+                int row = -round(distance * cos(theta) / north_south_resolution);
+                int col = round(distance * sin(theta) / east_west_resolution);
+                std::int64_t key = offset_key(row, col);
+                auto found = index_of_offset_.find(key);
+                std::size_t index;
+                if (found == index_of_offset_.end()) {
+                    index = row_offsets_.size();
+                    index_of_offset_[key] = index;
+                    row_offsets_.push_back(row);
+                    col_offsets_.push_back(col);
+                    offset_weights_.push_back(0);
+                }
+                else {
+                    index = found->second;
+                }
+                offset_weights_[index] += ring_probability * weight / direction_sum;
+            }
+        }
+        // the last item represents the tail outside of the window
+        std::vector<double> weights(offset_weights_);
+        weights.push_back(1 - window_probability_);
+        offset_table_ = AliasTable(weights);
+    }
+};
+
+}  // namespace pops
+
+#endif  // POPS_DISCRETIZED_KERNEL_HPP
@@ -33,9 +33,70 @@
 #include "quarantine.hpp"
 
 #include <vector>
+#include <memory>
 
 namespace pops {
 
+/*! Create precomputed radial kernel if requested and applicable
+ *
+ * Returns nullptr when the kernel should not be discretized, i.e.,
+ * when it is not requested, the kernel is not radial, or the kernel is
+ * deterministic.
+ */
+inline std::shared_ptr<const DiscretizedRadialDispersalKernel> create_discretized_kernel(
+    const Config& config,
+    DispersalKernelType kernel_type,
+    double scale,
+    const std::string& direction_text,
+    double kappa)
+{
+    if (!config.discretize_kernels || config.deterministic
+        || !DiscretizedRadialDispersalKernel::supports_kernel(kernel_type))
+        return nullptr;
+    Direction direction = direction_from_string(direction_text);
+    return std::make_shared<const DiscretizedRadialDispersalKernel>(
+        config.ew_res,
+        config.ns_res,
+        kernel_type,
+        scale,
+        static_cast<int>(direction) * PI / 180,
+        direction == Direction::None ? 0 : kappa,
+        config.dispersal_percentage);
+}
+
+/*! Create precomputed natural radial kernel for the configuration
+ *
+ * The result can be shared by all models created with the same
+ * kernel parameters.
+ */
+inline std::shared_ptr<const DiscretizedRadialDispersalKernel>
+create_natural_discretized_kernel(const Config& config)
+{
+    return create_discretized_kernel(
+        config,
+        kernel_type_from_string(config.natural_kernel_type),
+        config.natural_scale,
+        config.natural_direction,
+        config.natural_kappa);
+}
+
+/*! Create precomputed anthropogenic radial kernel for the configuration
+ *
+ * Returns nullptr when the anthropogenic kernel is not used.
+ */
+inline std::shared_ptr<const DiscretizedRadialDispersalKernel>
+create_anthro_discretized_kernel(const Config& config)
+{
+    if (!config.use_anthropogenic_kernel)
+        return nullptr;
+    return create_discretized_kernel(
+        config,
+        kernel_type_from_string(config.anthro_kernel_type),
+        config.anthro_scale,
+        config.anthro_direction,
+        config.anthro_kappa);
+}
+
 template<typename IntegerRaster, typename FloatRaster, typename RasterIndex>
 class Model
 {
@@ -46,17 +107,39 @@ private:
     UniformDispersalKernel uniform_kernel;
     DeterministicNeighborDispersalKernel natural_neighbor_kernel;
     DeterministicNeighborDispersalKernel anthro_neighbor_kernel;
+    // precomputed (shared) tables for radial kernels if requested
+    std::shared_ptr<const DiscretizedRadialDispersalKernel> natural_discretized_kernel;
+    std::shared_ptr<const DiscretizedRadialDispersalKernel> anthro_discretized_kernel;
     Simulation<IntegerRaster, FloatRaster, RasterIndex> simulation_;
     unsigned last_index{0};
 
 public:
     Model(const Config& config)
+        : Model(
+            config,
+            create_natural_discretized_kernel(config),
+            create_anthro_discretized_kernel(config))
+    {}
+
+    /**
+     * @brief Create model with precomputed radial kernels
+     *
+     * The kernels are shared between models, so multiple models with the same
+     * kernel parameters (e.g., stochastic runs) do not need to compute them
+     * again. Use nullptr to sample the kernels directly.
+     */
+    Model(
+        const Config& config,
+        std::shared_ptr<const DiscretizedRadialDispersalKernel> natural_discretized,
+        std::shared_ptr<const DiscretizedRadialDispersalKernel> anthro_discretized)
         : config_(config),
           natural_kernel(kernel_type_from_string(config.natural_kernel_type)),
           anthro_kernel(kernel_type_from_string(config.anthro_kernel_type)),
           uniform_kernel(config.rows, config.cols),
           natural_neighbor_kernel(direction_from_string(config.natural_direction)),
           anthro_neighbor_kernel(direction_from_string(config.anthro_direction)),
+          natural_discretized_kernel(natural_discretized),
+          anthro_discretized_kernel(anthro_discretized),
           simulation_(
               config.random_seed,
               config.rows,
@@ -65,7 +148,9 @@ public:
               config.latency_period_steps,
               config.generate_stochasticity,
               config.establishment_stochasticity,
-              config.movement_stochasticity)
+              config.movement_stochasticity,
+              config.cell_parallel,
+              config.run)
     {}
 
     /**
@@ -109,6 +194,10 @@ public:
      * @param quarantine_areas[in] Quarantine areas
      * @param movements[in] Table of host movements
      *
+     * When *track_active_cells* is enabled in the configuration, the first
+     * call starts tracking of active cells in the simulation, so the rasters
+     * need to be the same for all calls (see Simulation::track_active_cells()).
+     *
      * @note The parameters roughly correspond to Simulation::disperse()
      * and Simulation::disperse_and_infect() functions, so these can be used
      * for further reference.
@@ -141,7 +230,8 @@ public:
             config_.natural_kappa,
             config_.deterministic,
             dispersers,
-            config_.dispersal_percentage);
+            config_.dispersal_percentage,
+            natural_discretized_kernel);
         RadialDispersalKernel<IntegerRaster> anthro_radial_kernel(
             config_.ew_res,
             config_.ns_res,
@@ -151,7 +241,8 @@ public:
             config_.anthro_kappa,
             config_.deterministic,
             dispersers,
-            config_.dispersal_percentage);
+            config_.dispersal_percentage,
+            anthro_discretized_kernel);
         SwitchDispersalKernel<IntegerRaster> natural_selectable_kernel(
             natural_kernel,
             natural_radial_kernel,
@@ -167,6 +258,8 @@ public:
             anthro_selectable_kernel,
             config_.use_anthropogenic_kernel,
             config_.percent_natural_dispersal);
+        if (config_.track_active_cells && !simulation_.tracks_active_cells())
+            simulation_.track_active_cells(infected, exposed, mortality_tracker);
         int mortality_simulation_year =
             simulation_step_to_action_step(config_.mortality_schedule(), step);
         // removal of dispersers due to lethal tempearture
@@ -186,7 +279,8 @@ public:
                 infected,
                 config_.weather,
                 weather_coefficient,
-                config_.reproductive_rate);
+                config_.reproductive_rate,
+                step);
 
             simulation_.disperse_and_infect(
                 step,
@@ -20,12 +20,14 @@
 #define POPS_RADIAL_KERNEL_HPP
 
 #include "deterministic_kernel.hpp"
+#include "discretized_kernel.hpp"
 #include "kernel_types.hpp"
 
 #include <cmath>
 #include <map>
 #include <tuple>
 #include <array>
+#include <memory>
 #include <random>
 #include <algorithm>
 #include <stdexcept>
@@ -178,6 +180,7 @@ protected:
     bool deterministic_;
     DeterministicDispersalKernel<IntegerRaster> deterministic_kernel;
     von_mises_distribution von_mises;
+    std::shared_ptr<const DiscretizedRadialDispersalKernel> discretized_kernel_;
 
 public:
     RadialDispersalKernel(
@@ -189,7 +192,9 @@ public:
         double dispersal_direction_kappa = 0,
         bool deterministic = false,
         const IntegerRaster& dispersers = {{0}},
-        double dispersal_percentage = 0.99)
+        double dispersal_percentage = 0.99,
+        std::shared_ptr<const DiscretizedRadialDispersalKernel> discretized_kernel =
+            nullptr)
         : east_west_resolution(ew_res),
           north_south_resolution(ns_res),
           dispersal_kernel_type_(dispersal_kernel),
@@ -212,7 +217,8 @@ public:
           // functions (dir to rad and adjust kappa)
           von_mises(
               static_cast<int>(dispersal_direction) * PI / 180,
-              dispersal_direction == Direction::None ? 0 : dispersal_direction_kappa)
+              dispersal_direction == Direction::None ? 0 : dispersal_direction_kappa),
+          discretized_kernel_(discretized_kernel)
     {}
 
     /*! Generates a new position for the spread.
@@ -229,6 +235,9 @@ public:
         if (deterministic_) {
             return deterministic_kernel(generator, row, col);
         }
+        if (discretized_kernel_) {
+            return (*discretized_kernel_)(generator, row, col);
+        }
         double distance = 0;
         double theta = 0;
         // switch between the supported kernels
@@ -22,11 +22,15 @@
 #include <cmath>
 #include <tuple>
 #include <vector>
+#include <algorithm>
 #include <random>
 #include <string>
+#include <numeric>
 #include <stdexcept>
+#include <type_traits>
 
 #include "utils.hpp"
+#include "counter_based_engine.hpp"
 
 namespace pops {
 
@@ -108,6 +112,21 @@ inline ModelType model_type_from_string(const char* text)
  * types are using. However, at the same time, comparison with signed
  * type are perfomed and a signed type might be required in the future.
  * A default is provided, but it can be changed in the future.
+ *
+ * By default, one random number generator is used for the whole
+ * simulation and the cells are processed serially. In the cell-parallel
+ * mode (see the constructor), generate() and disperse() process rows
+ * of the rasters in parallel using OpenMP (when enabled at compile time).
+ * In this mode, random numbers come from CounterBasedEngine keyed on
+ * the seed, run, step, cell, and disperser, so the results are
+ * identical regardless of the number of threads used.
+ *
+ * Optionally, the simulation can track active cells, i.e., cells which
+ * have or had infected or exposed hosts (see track_active_cells()).
+ * The functions then visit only these cells instead of the whole
+ * rasters, so the cost of a step is proportional to the infested area
+ * rather than to the study area. The cells are visited in the same
+ * order as without the tracking, so the results are the same.
  */
 template<typename IntegerRaster, typename FloatRaster, typename RasterIndex = int>
 class Simulation
@@ -120,7 +139,34 @@ private:
     bool movement_stochasticity_;
     ModelType model_type_;
     unsigned latency_period_;
+    unsigned random_seed_;
+    bool cell_parallel_;
+    unsigned run_;
     std::default_random_engine generator_;
+    bool active_cells_tracked_{false};
+    // sorted (row-major) list of active cells
+    std::vector<std::tuple<RasterIndex, RasterIndex>> active_cells_;
+    // index of the first active cell in each row (size is rows + 1)
+    std::vector<std::size_t> active_row_starts_;
+    // cells activated since the last update of the list (unsorted)
+    std::vector<std::tuple<RasterIndex, RasterIndex>> new_active_cells_;
+    // flag for each cell (char, not bool, to allow concurrent writes)
+    std::vector<char> is_active_;
+
+    /** A disperser which landed in a cell in the cell-parallel mode
+     *
+     * The establishment test value and weather coefficient are
+     * precomputed where the disperser originated, so that the arrivals
+     * can be later applied to the destination cell independently of
+     * the other cells.
+     */
+    struct DisperserArrival
+    {
+        RasterIndex row;
+        RasterIndex col;
+        double establishment_tester;
+        double weather_coefficient;
+    };
 
 public:
     /** Creates simulation object and seeds the internal random number generator.
@@ -140,6 +186,8 @@ public:
      * @param dispersers_stochasticity Enable stochasticity in generating of dispersers
      * @param establishment_stochasticity Enable stochasticity in establishment step
      * @param movement_stochasticity Enable stochasticity in movement of hosts
+     * @param cell_parallel Process cells in parallel with counter-based random numbers
+     * @param run Index of the stochastic run (used in the cell-parallel mode)
      */
     Simulation(
         unsigned random_seed,
@@ -149,14 +197,19 @@ public:
         unsigned latency_period = 0,
         bool dispersers_stochasticity = true,
         bool establishment_stochasticity = true,
-        bool movement_stochasticity = true)
+        bool movement_stochasticity = true,
+        bool cell_parallel = false,
+        unsigned run = 0)
         : rows_(rows),
           cols_(cols),
           dispersers_stochasticity_(dispersers_stochasticity),
           establishment_stochasticity_(establishment_stochasticity),
           movement_stochasticity_(movement_stochasticity),
           model_type_(model_type),
-          latency_period_(latency_period)
+          latency_period_(latency_period),
+          random_seed_(random_seed),
+          cell_parallel_(cell_parallel),
+          run_(run)
     {
         generator_.seed(random_seed);
     }
@@ -169,16 +222,14 @@ public:
         const FloatRaster& temperature,
         double lethal_temperature)
     {
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                if (temperature(i, j) < lethal_temperature) {
-                    // move infested/infected host back to susceptible pool
-                    susceptible(i, j) += infected(i, j);
-                    // remove all infestation/infection in the infected class
-                    infected(i, j) = 0;
-                }
+        for_each_cell([&](RasterIndex i, RasterIndex j) {
+            if (temperature(i, j) < lethal_temperature) {
+                // move infested/infected host back to susceptible pool
+                susceptible(i, j) += infected(i, j);
+                // remove all infestation/infection in the infected class
+                infected(i, j) = 0;
             }
-        }
+        });
     }
 
     void mortality(
@@ -193,26 +244,22 @@ public:
             int mortality_current_year = 0;
             int max_year_index = current_year - first_mortality_year;
 
-            for (int i = 0; i < rows_; i++) {
-                for (int j = 0; j < cols_; j++) {
-                    for (int year_index = 0; year_index <= max_year_index;
-                         year_index++) {
-                        int mortality_in_year_index = 0;
-                        if (mortality_tracker_vector[year_index](i, j) > 0) {
-                            mortality_in_year_index =
-                                mortality_rate
-                                * mortality_tracker_vector[year_index](i, j);
-                            mortality_tracker_vector[year_index](i, j) -=
-                                mortality_in_year_index;
-                            mortality(i, j) += mortality_in_year_index;
-                            mortality_current_year += mortality_in_year_index;
-                            if (infected(i, j) > 0) {
-                                infected(i, j) -= mortality_in_year_index;
-                            }
+            for_each_cell([&](RasterIndex i, RasterIndex j) {
+                for (int year_index = 0; year_index <= max_year_index; year_index++) {
+                    int mortality_in_year_index = 0;
+                    if (mortality_tracker_vector[year_index](i, j) > 0) {
+                        mortality_in_year_index =
+                            mortality_rate * mortality_tracker_vector[year_index](i, j);
+                        mortality_tracker_vector[year_index](i, j) -=
+                            mortality_in_year_index;
+                        mortality(i, j) += mortality_in_year_index;
+                        mortality_current_year += mortality_in_year_index;
+                        if (infected(i, j) > 0) {
+                            infected(i, j) -= mortality_in_year_index;
                         }
                     }
                 }
-            }
+            });
         }
     }
 
@@ -312,6 +359,8 @@ public:
             infected(row_to, col_to) += infected_moved;
             susceptible(row_to, col_to) += susceptible_moved;
             total_hosts(row_to, col_to) += total_hosts_moved;
+            if (infected_moved > 0)
+                activate_cell(row_to, col_to);
         }
         return movements.size();
     }
@@ -324,37 +373,48 @@ public:
      * @param weather_coefficient Spatially explicit weather coefficient
      * @param reproductive_rate reproductive rate (used unmodified when weather
      * coefficient is not used)
+     * @param step Simulation step (used to key random numbers in the
+     * cell-parallel mode)
      */
     void generate(
         IntegerRaster& dispersers,
         const IntegerRaster& infected,
         bool weather,
         const FloatRaster& weather_coefficient,
-        double reproductive_rate)
+        double reproductive_rate,
+        unsigned step = 0)
     {
+        if (cell_parallel_) {
+            generate_cell_parallel(
+                dispersers,
+                infected,
+                weather,
+                weather_coefficient,
+                reproductive_rate,
+                step);
+            return;
+        }
         double lambda = reproductive_rate;
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                if (infected(i, j) > 0) {
-                    if (weather)
-                        lambda = reproductive_rate * weather_coefficient(i, j);
-                    int dispersers_from_cell = 0;
-                    if (dispersers_stochasticity_) {
-                        std::poisson_distribution<int> distribution(lambda);
-                        for (int k = 0; k < infected(i, j); k++) {
-                            dispersers_from_cell += distribution(generator_);
-                        }
-                    }
-                    else {
-                        dispersers_from_cell = lambda * infected(i, j);
+        for_each_cell([&](RasterIndex i, RasterIndex j) {
+            if (infected(i, j) > 0) {
+                if (weather)
+                    lambda = reproductive_rate * weather_coefficient(i, j);
+                int dispersers_from_cell = 0;
+                if (dispersers_stochasticity_) {
+                    std::poisson_distribution<int> distribution(lambda);
+                    for (int k = 0; k < infected(i, j); k++) {
+                        dispersers_from_cell += distribution(generator_);
                     }
-                    dispersers(i, j) = dispersers_from_cell;
                 }
                 else {
-                    dispersers(i, j) = 0;
+                    dispersers_from_cell = lambda * infected(i, j);
                 }
+                dispersers(i, j) = dispersers_from_cell;
             }
-        }
+            else {
+                dispersers(i, j) = 0;
+            }
+        });
     }
 
     /** Creates dispersal locations for the dispersing individuals
@@ -396,6 +456,8 @@ public:
      * @param dispersal_kernel Dispersal kernel to move dispersers
      * @param establishment_probability Probability of establishment with no
      * stochasticity
+     * @param step Simulation step (used to key random numbers in the
+     * cell-parallel mode)
      *
      * @note If the parameters or their default values don't correspond
      * with the disperse_and_infect() function, it is a bug.
@@ -411,56 +473,69 @@ public:
         bool weather,
         const FloatRaster& weather_coefficient,
         DispersalKernel& dispersal_kernel,
-        double establishment_probability = 0.5)
+        double establishment_probability = 0.5,
+        unsigned step = 0)
     {
+        if (cell_parallel_) {
+            disperse_cell_parallel(
+                dispersers,
+                susceptible,
+                exposed_or_infected,
+                mortality_tracker,
+                total_populations,
+                outside_dispersers,
+                weather,
+                weather_coefficient,
+                dispersal_kernel,
+                establishment_probability,
+                step);
+            return;
+        }
         std::uniform_real_distribution<double> distribution_uniform(0.0, 1.0);
         int row;
         int col;
 
-        for (int i = 0; i < rows_; i++) {
-            for (int j = 0; j < cols_; j++) {
-                if (dispersers(i, j) > 0) {
-                    for (int k = 0; k < dispersers(i, j); k++) {
-                        std::tie(row, col) = dispersal_kernel(generator_, i, j);
+        for_each_cell([&](RasterIndex i, RasterIndex j) {
+            if (dispersers(i, j) > 0) {
+                for (int k = 0; k < dispersers(i, j); k++) {
+                    std::tie(row, col) = dispersal_kernel(generator_, i, j);
 
-                        if (row < 0 || row >= rows_ || col < 0 || col >= cols_) {
-                            // export dispersers dispersed outside of modeled area
-                            outside_dispersers.emplace_back(std::make_tuple(row, col));
-                            continue;
-                        }
-                        if (susceptible(row, col) > 0) {
-                            double probability_of_establishment =
-                                (double)(susceptible(row, col))
-                                / total_populations(row, col);
-                            double establishment_tester = 1 - establishment_probability;
-                            if (establishment_stochasticity_)
-                                establishment_tester = distribution_uniform(generator_);
-
-                            if (weather)
-                                probability_of_establishment *=
-                                    weather_coefficient(i, j);
-                            if (establishment_tester < probability_of_establishment) {
-                                exposed_or_infected(row, col) += 1;
-                                susceptible(row, col) -= 1;
-                                if (model_type_ == ModelType::SusceptibleInfected) {
-                                    mortality_tracker(row, col) += 1;
-                                }
-                                else if (
-                                    model_type_
-                                    == ModelType::SusceptibleExposedInfected) {
-                                    // no-op
-                                }
-                                else {
-                                    throw std::runtime_error(
-                                        "Unknown ModelType value in "
-                                        "Simulation::disperse()");
-                                }
+                    if (row < 0 || row >= rows_ || col < 0 || col >= cols_) {
+                        // export dispersers dispersed outside of modeled area
+                        outside_dispersers.emplace_back(std::make_tuple(row, col));
+                        continue;
+                    }
+                    if (susceptible(row, col) > 0) {
+                        double probability_of_establishment =
+                            (double)(susceptible(row, col))
+                            / total_populations(row, col);
+                        double establishment_tester = 1 - establishment_probability;
+                        if (establishment_stochasticity_)
+                            establishment_tester = distribution_uniform(generator_);
+
+                        if (weather)
+                            probability_of_establishment *= weather_coefficient(i, j);
+                        if (establishment_tester < probability_of_establishment) {
+                            exposed_or_infected(row, col) += 1;
+                            susceptible(row, col) -= 1;
+                            activate_cell(row, col);
+                            if (model_type_ == ModelType::SusceptibleInfected) {
+                                mortality_tracker(row, col) += 1;
+                            }
+                            else if (
+                                model_type_ == ModelType::SusceptibleExposedInfected) {
+                                // no-op
+                            }
+                            else {
+                                throw std::runtime_error(
+                                    "Unknown ModelType value in "
+                                    "Simulation::disperse()");
                             }
                         }
                     }
                 }
             }
-        }
+        });
     }
 
     /** Infect exposed hosts (E to I transition in the SEI model)
@@ -514,12 +589,22 @@ public:
             if (step >= latency_period_) {
                 // Oldest item needs to be in the front
                 auto& oldest = exposed.front();
-                // Move hosts to infected raster
-                infected += oldest;
-                mortality_tracker += oldest;
-                // Reset the raster
-                // (hosts moved from the raster)
-                oldest.fill(0);
+                if (active_cells_tracked_) {
+                    // exposed hosts can be only in the active cells
+                    for_each_cell([&](RasterIndex i, RasterIndex j) {
+                        infected(i, j) += oldest(i, j);
+                        mortality_tracker(i, j) += oldest(i, j);
+                        oldest(i, j) = 0;
+                    });
+                }
+                else {
+                    // Move hosts to infected raster
+                    infected += oldest;
+                    mortality_tracker += oldest;
+                    // Reset the raster
+                    // (hosts moved from the raster)
+                    oldest.fill(0);
+                }
             }
             // Age the items and the used one to the back
             // elements go one position to the left
@@ -593,11 +678,319 @@ public:
             weather,
             weather_coefficient,
             dispersal_kernel,
-            establishment_probability);
+            establishment_probability,
+            step);
         if (model_type_ == ModelType::SusceptibleExposedInfected) {
             this->infect_exposed(step, exposed, infected, mortality_tracker);
         }
     }
+
+    /** Start tracking active cells
+     *
+     * Active cells are cells with infected or exposed hosts or with
+     * hosts in a mortality tracker. The initial list is created from
+     * the provided rasters. Afterwards, the list is updated whenever
+     * the simulation infects or exposes hosts in a new cell.
+     *
+     * Cells are never removed from the list (the hosts in mortality
+     * trackers and exposed hosts may still be there even when the cell
+     * has no infected hosts), so the list contains the cells infested
+     * at any time since tracking started.
+     *
+     * When the tracking is active, generate() writes dispersers only
+     * for the active cells and disperse() reads only these.
+     * All rasters passed to the simulation functions need to
+     * be the same ones (or have non-zero values in the same cells)
+     * as the ones used to start the tracking. Infected or exposed hosts
+     * added outside of the simulation are not tracked, so the tracking
+     * needs to be restarted by calling this function again.
+     *
+     * @param infected Infected hosts
+     * @param exposed Exposed hosts (can be empty)
+     * @param mortality_tracker Mortality trackers (can be empty)
+     */
+    void track_active_cells(
+        const IntegerRaster& infected,
+        const std::vector<IntegerRaster>& exposed,
+        const std::vector<IntegerRaster>& mortality_tracker)
+    {
+        active_cells_.clear();
+        new_active_cells_.clear();
+        is_active_.assign(static_cast<std::size_t>(rows_) * cols_, false);
+        for (RasterIndex i = 0; i < rows_; i++) {
+            for (RasterIndex j = 0; j < cols_; j++) {
+                bool active = infected(i, j) > 0;
+                for (const auto& raster : exposed)
+                    active = active || raster(i, j) > 0;
+                for (const auto& raster : mortality_tracker)
+                    active = active || raster(i, j) > 0;
+                if (active) {
+                    is_active_[cell_index(i, j)] = true;
+                    new_active_cells_.emplace_back(i, j);
+                }
+            }
+        }
+        active_row_starts_.assign(rows_ + 1, 0);
+        active_cells_tracked_ = true;
+        update_active_cells();
+    }
+
+    /** Return true if active cells are tracked */
+    bool tracks_active_cells() const
+    {
+        return active_cells_tracked_;
+    }
+
+    /** Return number of active cells (zero when not tracked) */
+    std::size_t num_active_cells()
+    {
+        update_active_cells();
+        return active_cells_.size();
+    }
+
+private:
+    /** Add cell to active cells (if tracked and not active already) */
+    void activate_cell(RasterIndex row, RasterIndex col)
+    {
+        if (active_cells_tracked_ && !is_active_[cell_index(row, col)]) {
+            is_active_[cell_index(row, col)] = true;
+            new_active_cells_.emplace_back(row, col);
+        }
+    }
+
+    /** Merge newly activated cells into the sorted list of active cells
+     *
+     * Keeping the list sorted in the row-major order ensures that
+     * the cells are visited in the same order as without the tracking.
+     */
+    void update_active_cells()
+    {
+        if (!active_cells_tracked_ || new_active_cells_.empty())
+            return;
+        std::sort(new_active_cells_.begin(), new_active_cells_.end());
+        auto middle = active_cells_.insert(
+            active_cells_.end(), new_active_cells_.begin(), new_active_cells_.end());
+        std::inplace_merge(active_cells_.begin(), middle, active_cells_.end());
+        new_active_cells_.clear();
+        std::fill(active_row_starts_.begin(), active_row_starts_.end(), 0);
+        for (const auto& cell : active_cells_)
+            ++active_row_starts_[std::get<0>(cell) + 1];
+        std::partial_sum(
+            active_row_starts_.begin(),
+            active_row_starts_.end(),
+            active_row_starts_.begin());
+    }
+
+    /** Call function for each cell in a row (or each active cell if tracked)
+     *
+     * Function is called with row and column as parameters.
+     * The list of active cells needs to be up to date.
+     */
+    template<typename Function>
+    void for_each_cell_in_row(RasterIndex row, Function function) const
+    {
+        if (active_cells_tracked_) {
+            for (std::size_t n = active_row_starts_[row];
+                 n < active_row_starts_[row + 1];
+                 n++)
+                function(row, std::get<1>(active_cells_[n]));
+        }
+        else {
+            for (RasterIndex col = 0; col < cols_; col++)
+                function(row, col);
+        }
+    }
+
+    /** Call function for each cell (or each active cell if tracked)
+     *
+     * Cells are visited in the row-major order. Cells activated by
+     * the function are visited only in the next call.
+     */
+    template<typename Function>
+    void for_each_cell(Function function)
+    {
+        update_active_cells();
+        for (RasterIndex row = 0; row < rows_; row++)
+            for_each_cell_in_row(row, function);
+    }
+
+    /** Index of a cell used as part of the random number key */
+    std::uint64_t cell_index(RasterIndex row, RasterIndex col) const
+    {
+        return static_cast<std::uint64_t>(row) * cols_ + col;
+    }
+
+    /** Cell-parallel version of generate()
+     *
+     * Each cell uses its own random number engine, so rows can be
+     * processed in any order by any number of threads.
+     */
+    void generate_cell_parallel(
+        IntegerRaster& dispersers,
+        const IntegerRaster& infected,
+        bool weather,
+        const FloatRaster& weather_coefficient,
+        double reproductive_rate,
+        unsigned step)
+    {
+        update_active_cells();
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < rows_; i++) {
+            for_each_cell_in_row(i, [&](RasterIndex i, RasterIndex j) {
+                if (infected(i, j) > 0) {
+                    double lambda = reproductive_rate;
+                    if (weather)
+                        lambda = reproductive_rate * weather_coefficient(i, j);
+                    int dispersers_from_cell = 0;
+                    if (dispersers_stochasticity_) {
+                        CounterBasedEngine generator(
+                            random_seed_,
+                            run_,
+                            step,
+                            RandomStream::Generate,
+                            cell_index(i, j));
+                        std::poisson_distribution<int> distribution(lambda);
+                        for (int k = 0; k < infected(i, j); k++) {
+                            dispersers_from_cell += distribution(generator);
+                        }
+                    }
+                    else {
+                        dispersers_from_cell = lambda * infected(i, j);
+                    }
+                    dispersers(i, j) = dispersers_from_cell;
+                }
+                else {
+                    dispersers(i, j) = 0;
+                }
+            });
+        }
+    }
+
+    /** Cell-parallel version of disperse()
+     *
+     * The dispersal runs in two phases. First, source rows are processed
+     * in parallel and each disperser gets a destination and an establishment
+     * test value from its own random number engine. Second, the arrivals
+     * are grouped by destination row (keeping the order of the sources)
+     * and destination rows are processed in parallel. Each destination
+     * cell is modified only by one thread and its arrivals are always
+     * applied in the same order, so the result does not depend on
+     * the number of threads.
+     *
+     * The dispersal kernel is copied for each thread. Kernels keeping
+     * state between calls need to reset it when a new source cell is
+     * used (which is what the deterministic kernel does).
+     */
+    template<typename DispersalKernel>
+    void disperse_cell_parallel(
+        const IntegerRaster& dispersers,
+        IntegerRaster& susceptible,
+        IntegerRaster& exposed_or_infected,
+        IntegerRaster& mortality_tracker,
+        const IntegerRaster& total_populations,
+        std::vector<std::tuple<int, int>>& outside_dispersers,
+        bool weather,
+        const FloatRaster& weather_coefficient,
+        DispersalKernel& dispersal_kernel,
+        double establishment_probability,
+        unsigned step)
+    {
+        // check here because we can't throw inside of the parallel region
+        if (model_type_ != ModelType::SusceptibleInfected
+            && model_type_ != ModelType::SusceptibleExposedInfected) {
+            throw std::runtime_error(
+                "Unknown ModelType value in Simulation::disperse()");
+        }
+        std::vector<std::vector<DisperserArrival>> arrivals_by_source(rows_);
+        std::vector<std::vector<std::tuple<int, int>>> outside_by_source(rows_);
+        // newly infected cells in each destination row
+        std::vector<std::vector<RasterIndex>> activated_by_row(
+            active_cells_tracked_ ? rows_ : 0);
+
+        update_active_cells();
+#pragma omp parallel
+        {
+            typename std::decay<DispersalKernel>::type kernel(dispersal_kernel);
+            std::uniform_real_distribution<double> distribution_uniform(0.0, 1.0);
+            int row;
+            int col;
+#pragma omp for schedule(dynamic)
+            for (int i = 0; i < rows_; i++) {
+                for_each_cell_in_row(i, [&](RasterIndex i, RasterIndex j) {
+                    for (int k = 0; k < dispersers(i, j); k++) {
+                        CounterBasedEngine generator(
+                            random_seed_,
+                            run_,
+                            step,
+                            RandomStream::Disperse,
+                            cell_index(i, j),
+                            k);
+                        std::tie(row, col) = kernel(generator, i, j);
+                        if (row < 0 || row >= rows_ || col < 0 || col >= cols_) {
+                            outside_by_source[i].emplace_back(
+                                std::make_tuple(row, col));
+                            continue;
+                        }
+                        double establishment_tester = 1 - establishment_probability;
+                        if (establishment_stochasticity_)
+                            establishment_tester = distribution_uniform(generator);
+                        double coefficient = weather ? weather_coefficient(i, j) : 1;
+                        arrivals_by_source[i].push_back(
+                            {row, col, establishment_tester, coefficient});
+                    }
+                });
+            }
+        }
+
+        // counting sort of arrivals by destination row (stable)
+        std::vector<std::size_t> offsets(rows_ + 1, 0);
+        for (const auto& arrivals : arrivals_by_source)
+            for (const auto& arrival : arrivals)
+                ++offsets[arrival.row + 1];
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        std::vector<DisperserArrival> arrivals_by_destination(offsets.back());
+        std::vector<std::size_t> next(offsets.begin(), offsets.end() - 1);
+        for (auto& arrivals : arrivals_by_source) {
+            for (const auto& arrival : arrivals)
+                arrivals_by_destination[next[arrival.row]++] = arrival;
+            std::vector<DisperserArrival>().swap(arrivals);
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < rows_; i++) {
+            for (std::size_t n = offsets[i]; n < offsets[i + 1]; n++) {
+                const DisperserArrival& arrival = arrivals_by_destination[n];
+                RasterIndex col = arrival.col;
+                if (susceptible(i, col) > 0) {
+                    double probability_of_establishment =
+                        (double)(susceptible(i, col)) / total_populations(i, col);
+                    if (weather)
+                        probability_of_establishment *= arrival.weather_coefficient;
+                    if (arrival.establishment_tester < probability_of_establishment) {
+                        exposed_or_infected(i, col) += 1;
+                        susceptible(i, col) -= 1;
+                        // each row is handled by one thread, so the flag is safe
+                        if (active_cells_tracked_ && !is_active_[cell_index(i, col)]) {
+                            is_active_[cell_index(i, col)] = true;
+                            activated_by_row[i].push_back(col);
+                        }
+                        if (model_type_ == ModelType::SusceptibleInfected) {
+                            mortality_tracker(i, col) += 1;
+                        }
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < static_cast<int>(activated_by_row.size()); i++)
+            for (RasterIndex col : activated_by_row[i])
+                new_active_cells_.emplace_back(i, col);
+
+        // outside dispersers are reported in the order of the source cells
+        for (const auto& outside : outside_by_source)
+            outside_dispersers.insert(
+                outside_dispersers.end(), outside.begin(), outside.end());
+    }
 };
 
 }  // namespace pops
@@ -0,0 +1,235 @@
+#ifdef POPS_TEST
+
+/*
+ * Tests for the PoPS discretized radial kernel.
+ *
+ * Copyright (C) 2020 by the authors.
+ *
+ * This file is part of PoPS.
+
+ * PoPS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * PoPS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with PoPS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <pops/raster.hpp>
+#include <pops/radial_kernel.hpp>
+#include <pops/discretized_kernel.hpp>
+#include <pops/natural_anthropogenic_kernel.hpp>
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <memory>
+#include <iostream>
+
+using std::cout;
+
+using namespace pops;
+
+int test_alias_table()
+{
+    std::vector<double> weights = {1, 0, 3, 6};
+    AliasTable table(weights);
+    std::default_random_engine generator(42);
+    std::vector<int> counts(weights.size(), 0);
+    int num_samples = 100000;
+    for (int i = 0; i < num_samples; i++)
+        ++counts[table(generator)];
+    int ret = 0;
+    for (unsigned i = 0; i < weights.size(); i++) {
+        double expected = weights[i] / 10;
+        double actual = double(counts[i]) / num_samples;
+        if (std::abs(expected - actual) > 0.01) {
+            cout << "Alias table item " << i << " has frequency " << actual
+                 << " but " << expected << " was expected\n";
+            ret++;
+        }
+    }
+    return ret;
+}
+
+/** Fractions of dispersers ending in each distance band (in cells)
+ *
+ * The last band is for dispersers outside of the largest distance.
+ */
+template<typename Kernel>
+std::vector<double>
+distance_bands(Kernel& kernel, const std::vector<double>& limits, int num_samples)
+{
+    std::default_random_engine generator(7);
+    std::vector<double> bands(limits.size() + 1, 0);
+    int row;
+    int col;
+    for (int i = 0; i < num_samples; i++) {
+        std::tie(row, col) = kernel(generator, 0, 0);
+        double distance = std::sqrt(row * row + col * col);
+        unsigned band = 0;
+        while (band < limits.size() && distance > limits[band])
+            band++;
+        bands[band] += 1.0 / num_samples;
+    }
+    return bands;
+}
+
+/** Fraction of dispersers ending north (up) of the source */
+template<typename Kernel>
+double fraction_north(Kernel& kernel, int num_samples)
+{
+    std::default_random_engine generator(11);
+    int count = 0;
+    int row;
+    int col;
+    for (int i = 0; i < num_samples; i++) {
+        std::tie(row, col) = kernel(generator, 0, 0);
+        if (row < 0)
+            count++;
+    }
+    return double(count) / num_samples;
+}
+
+int compare_with_continuous(
+    DispersalKernelType type, double scale, Direction direction, double kappa)
+{
+    double res = 10;
+    RadialDispersalKernel<Raster<int>> continuous(
+        res, res, type, scale, direction, kappa);
+    auto discretized_kernel = std::make_shared<const DiscretizedRadialDispersalKernel>(
+        res,
+        res,
+        type,
+        scale,
+        static_cast<int>(direction) * PI / 180,
+        direction == Direction::None ? 0 : kappa);
+    RadialDispersalKernel<Raster<int>> discretized(
+        res, res, type, scale, direction, kappa, false, {{0}}, 0.99, discretized_kernel);
+
+    int ret = 0;
+    int num_samples = 200000;
+    std::vector<double> limits = {0.5, 1.5, 3, 6, 12, 25, 50, 100};
+    auto expected = distance_bands(continuous, limits, num_samples);
+    auto actual = distance_bands(discretized, limits, num_samples);
+    for (unsigned i = 0; i < expected.size(); i++) {
+        if (std::abs(expected[i] - actual[i]) > 0.01) {
+            cout << "Discretized kernel (" << static_cast<int>(type)
+                 << ", scale " << scale << ") has " << actual[i]
+                 << " dispersers in distance band " << i << " but continuous kernel has "
+                 << expected[i] << "\n";
+            ret++;
+        }
+    }
+    double expected_north = fraction_north(continuous, num_samples);
+    double actual_north = fraction_north(discretized, num_samples);
+    if (std::abs(expected_north - actual_north) > 0.01) {
+        cout << "Discretized kernel (" << static_cast<int>(type) << ", kappa "
+             << kappa << ") has " << actual_north
+             << " dispersers north but continuous kernel has " << expected_north
+             << "\n";
+        ret++;
+    }
+    return ret;
+}
+
+int test_natural_anthropogenic()
+{
+    double res = 10;
+    auto natural_table = std::make_shared<const DiscretizedRadialDispersalKernel>(
+        res, res, DispersalKernelType::Exponential, 20);
+    auto anthro_table = std::make_shared<const DiscretizedRadialDispersalKernel>(
+        res, res, DispersalKernelType::Cauchy, 200);
+    RadialDispersalKernel<Raster<int>> natural(
+        res,
+        res,
+        DispersalKernelType::Exponential,
+        20,
+        Direction::None,
+        0,
+        false,
+        {{0}},
+        0.99,
+        natural_table);
+    RadialDispersalKernel<Raster<int>> anthro(
+        res,
+        res,
+        DispersalKernelType::Cauchy,
+        200,
+        Direction::None,
+        0,
+        false,
+        {{0}},
+        0.99,
+        anthro_table);
+    NaturalAnthropogenicDispersalKernel<
+        RadialDispersalKernel<Raster<int>>,
+        RadialDispersalKernel<Raster<int>>>
+        discretized(natural, anthro, true, 0.8);
+    RadialDispersalKernel<Raster<int>> continuous_natural(
+        res, res, DispersalKernelType::Exponential, 20);
+    RadialDispersalKernel<Raster<int>> continuous_anthro(
+        res, res, DispersalKernelType::Cauchy, 200);
+    NaturalAnthropogenicDispersalKernel<
+        RadialDispersalKernel<Raster<int>>,
+        RadialDispersalKernel<Raster<int>>>
+        continuous(continuous_natural, continuous_anthro, true, 0.8);
+    int ret = 0;
+    std::vector<double> limits = {0.5, 1.5, 3, 6, 12, 25, 50};
+    auto expected = distance_bands(continuous, limits, 200000);
+    auto actual = distance_bands(discretized, limits, 200000);
+    for (unsigned i = 0; i < expected.size(); i++) {
+        if (std::abs(expected[i] - actual[i]) > 0.01) {
+            cout << "Discretized natural-anthropogenic kernel has " << actual[i]
+                 << " dispersers in distance band " << i
+                 << " but continuous kernel has " << expected[i] << "\n";
+            ret++;
+        }
+    }
+    return ret;
+}
+
+int test_probabilities_sum()
+{
+    DiscretizedRadialDispersalKernel kernel(
+        30, 30, DispersalKernelType::Cauchy, 50, 0, 0, 0.95);
+    double sum = 0;
+    for (int i = -100; i <= 100; i++)
+        for (int j = -100; j <= 100; j++)
+            sum += kernel.offset_probability(i, j);
+    if (std::abs(sum - 0.95) > 1e-6) {
+        cout << "Probabilities of offsets sum to " << sum << " instead of 0.95\n";
+        return 1;
+    }
+    if (kernel.offset_probability(0, 0) <= kernel.offset_probability(0, 1)) {
+        cout << "Probability of staying is not higher than moving to neighbor\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    int ret = 0;
+
+    ret += test_alias_table();
+    ret += test_probabilities_sum();
+    ret += compare_with_continuous(DispersalKernelType::Cauchy, 20, Direction::None, 0);
+    ret += compare_with_continuous(
+        DispersalKernelType::Exponential, 40, Direction::None, 0);
+    ret += compare_with_continuous(DispersalKernelType::Cauchy, 20, Direction::NE, 2);
+    ret += compare_with_continuous(
+        DispersalKernelType::Exponential, 40, Direction::S, 5);
+    ret += test_natural_anthropogenic();
+
+    std::cout << "Test discretized kernel: number of errors: " << ret << std::endl;
+    return ret;
+}
+
+#endif  // POPS_TEST
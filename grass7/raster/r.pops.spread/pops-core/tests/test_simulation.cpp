@@ -36,6 +36,10 @@
 #include <sstream>
 #include <string>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using std::string;
 using std::cout;
 using std::cerr;
@@ -601,6 +605,205 @@ int test_calling_all_functions()
     return 0;
 }
 
+/** Run generate and disperse in the cell-parallel mode
+ *
+ * Returns infected and susceptible after the step and the number
+ * of outside dispersers is stored in *outside*.
+ */
+std::tuple<Raster<int>, Raster<int>> run_cell_parallel_step(
+    int threads, unsigned run, unsigned step, size_t& outside)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#else
+    UNUSED(threads);
+#endif
+    Raster<int> infected(50, 40);
+    infected.zero();
+    infected(10, 10) = 20;
+    infected(25, 5) = 7;
+    infected(49, 39) = 3;
+    infected(30, 30) = 12;
+    Raster<int> susceptible(infected.rows(), infected.cols());
+    susceptible.fill(15);
+    Raster<int> total_hosts(infected.rows(), infected.cols());
+    total_hosts.fill(20);
+    Raster<int> mortality_tracker(infected.rows(), infected.cols());
+    mortality_tracker.zero();
+    Raster<double> weather_coefficient(infected.rows(), infected.cols());
+    weather_coefficient.fill(0.8);
+    Raster<int> dispersers(infected.rows(), infected.cols());
+    std::vector<std::tuple<int, int>> outside_dispersers;
+    Simulation<Raster<int>, Raster<double>> simulation(
+        42,
+        infected.rows(),
+        infected.cols(),
+        ModelType::SusceptibleInfected,
+        0,
+        true,
+        true,
+        true,
+        true,
+        run);
+    simulation.generate(dispersers, infected, true, weather_coefficient, 4.5, step);
+    RadialDispersalKernel<Raster<int>> kernel(30, 30, DispersalKernelType::Cauchy, 50);
+    simulation.disperse(
+        dispersers,
+        susceptible,
+        infected,
+        mortality_tracker,
+        total_hosts,
+        outside_dispersers,
+        true,
+        weather_coefficient,
+        kernel,
+        0.5,
+        step);
+    outside = outside_dispersers.size();
+    return std::make_tuple(infected, susceptible);
+}
+
+int test_cell_parallel_reproducible()
+{
+    int ret = 0;
+    Raster<int> infected;
+    Raster<int> susceptible;
+    size_t outside;
+    std::tie(infected, susceptible) = run_cell_parallel_step(1, 0, 3, outside);
+    if (infected(20, 20) + infected(0, 0) + infected(11, 11) == 0
+        && susceptible(11, 11) == 15) {
+        cout << "Cell-parallel step did not infect anything\n";
+        ret += 1;
+    }
+    for (int threads : {2, 3, 8}) {
+        Raster<int> other_infected;
+        Raster<int> other_susceptible;
+        size_t other_outside;
+        std::tie(other_infected, other_susceptible) =
+            run_cell_parallel_step(threads, 0, 3, other_outside);
+        if (infected != other_infected || susceptible != other_susceptible
+            || outside != other_outside) {
+            cout << "Cell-parallel results differ for 1 and " << threads
+                 << " threads\n";
+            ret += 1;
+        }
+    }
+    Raster<int> other_infected;
+    Raster<int> other_susceptible;
+    size_t other_outside;
+    std::tie(other_infected, other_susceptible) =
+        run_cell_parallel_step(1, 1, 3, other_outside);
+    if (infected == other_infected) {
+        cout << "Cell-parallel results are the same for different runs\n";
+        ret += 1;
+    }
+    std::tie(other_infected, other_susceptible) =
+        run_cell_parallel_step(1, 0, 4, other_outside);
+    if (infected == other_infected) {
+        cout << "Cell-parallel results are the same for different steps\n";
+        ret += 1;
+    }
+    // hosts are only moved from susceptible to infected
+    Raster<int> total = infected + susceptible;
+    for (int i = 0; i < total.rows(); i++) {
+        for (int j = 0; j < total.cols(); j++) {
+            if (total(i, j) != 15 && !(i == 10 && j == 10) && !(i == 25 && j == 5)
+                && !(i == 49 && j == 39) && !(i == 30 && j == 30)) {
+                cout << "Cell-parallel step changed number of hosts at " << i
+                     << ", " << j << "\n";
+                return ret + 1;
+            }
+        }
+    }
+    return ret;
+}
+
+/** Run a few SEI steps with or without tracking of active cells */
+std::tuple<Raster<int>, Raster<int>, Raster<int>, size_t>
+run_steps_with_active_cells(bool track, bool cell_parallel, size_t& num_active)
+{
+    Raster<int> infected(60, 50);
+    infected.zero();
+    infected(10, 10) = 20;
+    infected(40, 5) = 7;
+    Raster<int> susceptible(infected.rows(), infected.cols());
+    susceptible.fill(15);
+    Raster<int> total_hosts(infected.rows(), infected.cols());
+    total_hosts.fill(40);
+    Raster<double> weather_coefficient(infected.rows(), infected.cols());
+    weather_coefficient.fill(0.8);
+    Raster<double> temperature(infected.rows(), infected.cols());
+    temperature.fill(10);
+    temperature(10, 10) = -30;
+    Raster<int> zeros(infected.rows(), infected.cols());
+    zeros.zero();
+    std::vector<Raster<int>> exposed(3, zeros);
+    std::vector<Raster<int>> mortality_tracker(2, zeros);
+    Raster<int> died = zeros;
+    Raster<int> dispersers(infected.rows(), infected.cols());
+    std::vector<std::tuple<int, int>> outside_dispersers;
+    Simulation<Raster<int>, Raster<double>> simulation(
+        42,
+        infected.rows(),
+        infected.cols(),
+        ModelType::SusceptibleExposedInfected,
+        2,
+        true,
+        true,
+        true,
+        cell_parallel);
+    if (track)
+        simulation.track_active_cells(infected, exposed, mortality_tracker);
+    RadialDispersalKernel<Raster<int>> kernel(
+        30, 30, DispersalKernelType::Exponential, 20);
+    for (unsigned step = 0; step < 6; step++) {
+        if (step == 3)
+            simulation.remove(infected, susceptible, temperature, -20);
+        simulation.generate(
+            dispersers, infected, true, weather_coefficient, 1.5, step);
+        simulation.disperse_and_infect(
+            step,
+            dispersers,
+            susceptible,
+            exposed,
+            infected,
+            mortality_tracker[step % 2],
+            total_hosts,
+            outside_dispersers,
+            true,
+            weather_coefficient,
+            kernel);
+        if (step % 2)
+            simulation.mortality(infected, 0.5, 1, 0, died, mortality_tracker);
+    }
+    num_active = simulation.num_active_cells();
+    return std::make_tuple(infected, susceptible, died, outside_dispersers.size());
+}
+
+int test_active_cells_same_as_all_cells()
+{
+    int ret = 0;
+    for (bool cell_parallel : {false, true}) {
+        size_t num_active;
+        auto all_cells = run_steps_with_active_cells(false, cell_parallel, num_active);
+        if (num_active != 0) {
+            cout << "Active cells reported without tracking: " << num_active << "\n";
+            ret += 1;
+        }
+        auto active_cells = run_steps_with_active_cells(true, cell_parallel, num_active);
+        if (all_cells != active_cells) {
+            cout << "Results with active cells differ from results with all cells"
+                 << " (cell parallel: " << cell_parallel << ")\n";
+            ret += 1;
+        }
+        if (num_active <= 2 || num_active >= 60 * 50) {
+            cout << "Unexpected number of active cells: " << num_active << "\n";
+            ret += 1;
+        }
+    }
+    return ret;
+}
+
 int main()
 {
     int ret = 0;
@@ -614,6 +817,8 @@ int main()
     ret += test_with_reduced_stochasticity();
     ret += test_with_sei();
     ret += test_SI_versus_SEI0();
+    ret += test_cell_parallel_reproducible();
+    ret += test_active_cells_same_as_all_cells();
 
     return ret;
 }
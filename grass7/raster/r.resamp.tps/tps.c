@@ -6,6 +6,9 @@
 #include <grass/raster.h>
 #include <grass/segment.h>
 #include <grass/glocale.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include "cache.h"
 #include "tps.h"
 #include "flag.h"
@@ -562,6 +565,127 @@ static double lm_rsqr(struct cache *in_seg, int n_vars, struct Cell_head *src,
     return R2;
 }
 
+/* solutions of recently solved source cells
+ *
+ * The points used for an output cell depend only on the source cell
+ * it falls into, on the number of requested points (or the radius) and,
+ * with clustered points, on the quadrants searched around the output
+ * cell, so output cells sharing all of them can share the solved system
+ * of the first one instead of solving it again */
+
+#define SOL_CACHE_SIZE 16
+
+struct tps_sol
+{
+    int used;
+    int row, col, n;		/* source cell, number of points or radius */
+    int qrt;			/* quadrants searched for clustered points */
+    int pending;		/* TPS without covariables not yet tried */
+    int pfound, kdfound;
+    int rmin, rmax, cmin, cmax;
+    double distmax;
+    int solved_tps_lm, solved_tps;
+    int palloc;
+    double *r, *c;		/* point coordinates */
+    double *B, *Bpnts;		/* coefficients with and without covariables */
+    double *vmin, *vmax;
+};
+
+static struct tps_sol *sol_cache_create(int n_vars)
+{
+    int i;
+    struct tps_sol *sol;
+
+    sol = G_calloc(SOL_CACHE_SIZE, sizeof(struct tps_sol));
+    if (n_vars) {
+	for (i = 0; i < SOL_CACHE_SIZE; i++) {
+	    sol[i].vmin = G_malloc(n_vars * sizeof(double));
+	    sol[i].vmax = G_malloc(n_vars * sizeof(double));
+	}
+    }
+
+    return sol;
+}
+
+static void sol_cache_destroy(struct tps_sol *sol)
+{
+    int i;
+
+    for (i = 0; i < SOL_CACHE_SIZE; i++) {
+	if (sol[i].palloc) {
+	    G_free(sol[i].r);
+	    G_free(sol[i].c);
+	    G_free(sol[i].B);
+	    if (sol[i].Bpnts)
+		G_free(sol[i].Bpnts);
+	}
+	if (sol[i].vmin) {
+	    G_free(sol[i].vmin);
+	    G_free(sol[i].vmax);
+	}
+    }
+    G_free(sol);
+}
+
+static struct tps_sol *sol_cache_slot(struct tps_sol *sol, int row, int col)
+{
+    return &sol[((unsigned int)row * 31 + (unsigned int)col) % SOL_CACHE_SIZE];
+}
+
+static struct tps_sol *sol_cache_find(struct tps_sol *sol, int row, int col,
+                                      int n, int qrt)
+{
+    struct tps_sol *s = sol_cache_slot(sol, row, col);
+
+    if (s->used && !s->pending && s->row == row && s->col == col &&
+        s->n == n && s->qrt == qrt)
+	return s;
+
+    return NULL;
+}
+
+/* store the points of a solved system, the points must already be
+ * converted to coordinates, coefficients are copied by the caller */
+static struct tps_sol *sol_cache_put(struct tps_sol *sol, int row, int col,
+                                     int n, int qrt, struct tps_pnt *pnts,
+				     int pfound, int n_vars)
+{
+    int i;
+    struct tps_sol *s = sol_cache_slot(sol, row, col);
+
+    if (s->palloc < pfound) {
+	s->palloc = pfound;
+	s->r = G_realloc(s->r, s->palloc * sizeof(double));
+	s->c = G_realloc(s->c, s->palloc * sizeof(double));
+	s->B = G_realloc(s->B, (s->palloc + 1 + n_vars) * sizeof(double));
+	if (n_vars)
+	    s->Bpnts = G_realloc(s->Bpnts, (s->palloc + 1) * sizeof(double));
+    }
+
+    s->used = 1;
+    s->pending = 0;
+    s->row = row;
+    s->col = col;
+    s->n = n;
+    s->qrt = qrt;
+    s->pfound = pfound;
+    for (i = 0; i < pfound; i++) {
+	s->r[i] = pnts[i].r;
+	s->c[i] = pnts[i].c;
+    }
+
+    return s;
+}
+
+static void sol_cache_get_pnts(struct tps_sol *s, struct tps_pnt *pnts)
+{
+    int i;
+
+    for (i = 0; i < s->pfound; i++) {
+	pnts[i].r = s->r[i];
+	pnts[i].c = s->c[i];
+    }
+}
 
 int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
            struct cache *out_seg, int out_fd, char *mask_name,
@@ -587,7 +711,7 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
     double rsqr;
     int kdfound, bfsfound, pfound;
     double distmax, mindist;
-    int do_clustered;
+    int do_clustered, qrt;
     int mask_fd;
     FLAG *mask_flag, *pnt_flag;
     struct tps_out tps_out;
@@ -599,10 +723,19 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
     unsigned int cnt_wa, cnt_tps_lm, cnt_tps, cnt_efac;
     double i_n, i_e;
     double *vmin, *vmax;
+    struct tps_sol *sol_cache, *sol;
+    int tried_pnts, in_parallel, nthreads, rows_done;
+    unsigned int cnt_reuse;
+    DCELL *ivarbuf;
 
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
 
+    nthreads = 1;
+#if defined(_OPENMP)
+    nthreads = omp_get_max_threads();
+#endif
+
     kdalloc = palloc = min_points;
     a = G_malloc((palloc + 1 + n_vars) * sizeof(double));
     B = G_malloc((palloc + 1 + n_vars) * sizeof(double));
@@ -635,7 +768,8 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 	for (i = 1; i < palloc * 5; i++)
 	    cur_pnts[i].vars = cur_pnts[i - 1].vars + n_vars;
 
-	varbuf = G_malloc(n_vars * sizeof(DCELL));
+	/* one buffer for each thread */
+	varbuf = G_malloc(n_vars * nthreads * sizeof(DCELL));
 
 	avars = G_malloc((1 + n_vars) * sizeof(double));
 	Bvars = G_malloc((1 + n_vars) * sizeof(double));
@@ -728,6 +862,23 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
     cnt_tps_lm = 0;
     cnt_tps = 0;
     cnt_efac = 0;
+    cnt_reuse = 0;
+
+    sol_cache = sol_cache_create(n_vars);
+    sol = NULL;
+    tried_pnts = 0;
+
+    /* output cells of one interpolation window are independent of each
+     * other and can be processed in parallel, but only if the temporary
+     * data are kept in memory because the segment library is not
+     * thread-safe */
+    in_parallel = 0;
+    if (nthreads > 1) {
+	in_parallel = out_seg->r != NULL &&
+	              (n_vars == 0 || var_seg->r != NULL);
+	if (!in_parallel)
+	    G_verbose_message(_("Not enough memory for parallel interpolation"));
+    }
 
     if (overlap > 1.0)
 	overlap = 1.0;
@@ -781,6 +932,15 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 	    distmax = 0;
 	    n_vars_i = n_vars;
 
+	    /* quadrants of clustered points, they depend on the output cell */
+	    qrt = 0;
+	    if (clustered) {
+		qrt = (rminp <= row && cmaxp > col) |
+		      (rminp < row && cminp <= col) << 1 |
+		      (rmaxp >= row && cminp < col) << 2 |
+		      (rmaxp > row && cmaxp >= col) << 3;
+	    }
+
 	    while (!solved &&
 	           (max_points == 0 || n_cur_points < max_points)) {
 		
@@ -810,6 +970,52 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 		    }
 		}
 
+		sol = sol_cache_find(sol_cache, src_row, src_col,
+		                     n_cur_points, qrt);
+		if (sol) {
+		    /* same points as for an earlier output cell */
+		    pfound = sol->pfound;
+		    kdfound = sol->kdfound;
+		    rmin = sol->rmin;
+		    rmax = sol->rmax;
+		    cmin = sol->cmin;
+		    cmax = sol->cmax;
+		    distmax = sol->distmax;
+		    sol_cache_get_pnts(sol, cur_pnts);
+
+		    solved_tps_lm = sol->solved_tps_lm;
+		    solved_tps = sol->solved_tps;
+		    tried_pnts = 1;
+		    n_vars_i = n_vars;
+		    m = mfull;
+		    a = afull;
+		    B = Bfull;
+		    if (n_vars) {
+			if (solved_tps_lm)
+			    memcpy(B, sol->B,
+			           (pfound + 1 + n_vars) * sizeof(double));
+			if (solved_tps)
+			    memcpy(Bpnts, sol->Bpnts,
+			           (pfound + 1) * sizeof(double));
+			memcpy(vmin, sol->vmin, n_vars * sizeof(double));
+			memcpy(vmax, sol->vmax, n_vars * sizeof(double));
+
+			if (!solved_tps_lm) {
+			    n_vars_i = 0;
+			    m = mpnts;
+			    a = apnts;
+			    B = Bpnts;
+			}
+		    }
+		    else
+			memcpy(B, sol->B, (pfound + 1) * sizeof(double));
+
+		    solved = 1;
+		    cnt_reuse++;
+
+		    continue;
+		}
+
 		/* collect nearest neighbors */
 		rmin = src->rows;
 		rmax = 0;
@@ -1015,6 +1221,36 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 
 		if (!solved && n_cur_points == n_points)
 		    G_fatal_error(_("Matrix is unsolvable"));
+
+		if (solved) {
+		    tried_pnts = 0;
+		    sol = sol_cache_put(sol_cache, src_row, src_col,
+		                        n_cur_points, qrt, cur_pnts, pfound,
+					n_vars);
+		    sol->kdfound = kdfound;
+		    sol->rmin = rmin;
+		    sol->rmax = rmax;
+		    sol->cmin = cmin;
+		    sol->cmax = cmax;
+		    sol->distmax = distmax;
+		    sol->solved_tps_lm = solved_tps_lm;
+		    sol->solved_tps = solved_tps;
+		    if (n_vars) {
+			if (solved_tps_lm)
+			    memcpy(sol->B, Bfull,
+			           (pfound + 1 + n_vars) * sizeof(double));
+			if (solved_tps)
+			    memcpy(sol->Bpnts, Bpnts,
+			           (pfound + 1) * sizeof(double));
+			memcpy(sol->vmin, vmin, n_vars * sizeof(double));
+			memcpy(sol->vmax, vmax, n_vars * sizeof(double));
+			/* TPS without covariables might be needed to
+			 * avoid extrapolation */
+			sol->pending = efac && solved_tps_lm;
+		    }
+		    else
+			memcpy(sol->B, Bfull, (pfound + 1) * sizeof(double));
+		}
 	    }
 
 	    /* priorities for interpolation
@@ -1134,12 +1370,26 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 	    dxi = icol2 - icol1 + 1;
 	    dyi = irow2 - irow1 + 1;
 
+	    rows_done = 0;
+
+#pragma omp parallel for schedule(dynamic) if (in_parallel) \
+	private(icol, i, j, i_n, i_e, n_vars_ic, Bc, ivarbuf, tps_out, \
+	        result, dx, dy, dist, dist2, weight) \
+	reduction(min:wmin) reduction(max:wmax) reduction(+:cnt_efac)
 	    for (irow = irow1; irow <= irow2; irow++) {
-		if (pfound == n_points)
-		    G_percent(irow - irow1, irow2 - irow1, 1);
+		if (pfound == n_points) {
+#pragma omp critical (tps_progress)
+		    G_percent(rows_done++, irow2 - irow1, 1);
+		}
 
 		i_n = dst->north - (irow + 0.5) * dst->ns_res;
 
+		ivarbuf = varbuf;
+#if defined(_OPENMP)
+		if (n_vars)
+		    ivarbuf = varbuf + n_vars * omp_get_thread_num();
+#endif
+
 		for (icol = icol1; icol <= icol2; icol++) {
 		    if ((FLAG_GET(mask_flag, irow, icol))) {
 			continue;
@@ -1150,17 +1400,27 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 
 		    if (n_vars_i) {
 
-			cache_get(var_seg, (void *)varbuf, irow, icol);
-			if (Rast_is_d_null_value(varbuf)) {
+			cache_get(var_seg, (void *)ivarbuf, irow, icol);
+			if (Rast_is_d_null_value(ivarbuf)) {
 			    continue;
 			}
 
 			if (efac) {
 			    for (i = 0; i < n_vars_i; i++) {
-				if (varbuf[i] < vmin[i] || varbuf[i] > vmax[i]) {
-				    if (!solved_tps)
-					solved_tps = solvemat(mpnts, apnts, Bpnts, pfound + 1);
-				    if (solved_tps) {
+				if (ivarbuf[i] < vmin[i] || ivarbuf[i] > vmax[i]) {
+				    int use_pnts;
+
+				    /* solved only once for all threads */
+#pragma omp critical (tps_pnts)
+				    {
+					if (!tried_pnts) {
+					    if (!solved_tps)
+						solved_tps = solvemat(mpnts, apnts, Bpnts, pfound + 1);
+					    tried_pnts = 1;
+					}
+					use_pnts = solved_tps;
+				    }
+				    if (use_pnts) {
 					n_vars_ic = 0;
 					Bc = Bpnts;
 					cnt_efac++;
@@ -1178,7 +1438,7 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 		    result = Bc[0];
 		    if (n_vars_ic) {
 			for (j = 0; j < n_vars_ic; j++) {
-			    result += varbuf[j] * Bc[j + 1];
+			    result += ivarbuf[j] * Bc[j + 1];
 			}
 		    }
 
@@ -1214,6 +1474,13 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
 		    cache_put(out_seg, (void *)&tps_out, irow, icol);
 		}
 	    }
+
+	    if (sol && sol->pending && tried_pnts) {
+		sol->pending = 0;
+		sol->solved_tps = solved_tps;
+		if (solved_tps)
+		    memcpy(sol->Bpnts, Bpnts, (pfound + 1) * sizeof(double));
+	    }
 	}
     }
     G_percent(1, 1, 1);
@@ -1221,6 +1488,9 @@ int tps_nn(struct cache *in_seg, struct cache *var_seg, int n_vars,
     G_debug(1, "min weight: %g", wmin);
     G_debug(1, "max weight: %g", wmax);
     G_debug(1, "Weighted average count: %u", cnt_wa);
+    G_debug(1, "Reused solutions: %u", cnt_reuse);
+
+    sol_cache_destroy(sol_cache);
 
     if (n_vars > 0 && cnt_tps) {
 	double perc_no_vars;
@@ -1300,10 +1570,19 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
     int wsize;
     unsigned int wacnt;
     double i_n, i_e;
+    struct tps_sol *sol_cache, *sol;
+    int in_parallel, nthreads;
+    unsigned int cnt_reuse;
+    DCELL *ivarbuf;
 
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
 
+    nthreads = 1;
+#if defined(_OPENMP)
+    nthreads = omp_get_max_threads();
+#endif
+
     wsize = (radius * 2 + 1) * (radius * 2 + 1);
 
     palloc = wsize;
@@ -1325,7 +1604,8 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
 	for (i = 1; i < palloc; i++)
 	    cur_pnts[i].vars = cur_pnts[i - 1].vars + n_vars;
 
-	varbuf = G_malloc(n_vars * sizeof(DCELL));
+	/* one buffer for each thread */
+	varbuf = G_malloc(n_vars * nthreads * sizeof(DCELL));
 
 	avars = G_malloc((1 + n_vars) * sizeof(double));
 	Bvars = G_malloc((1 + n_vars) * sizeof(double));
@@ -1406,6 +1686,18 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
     wmin = 10;
     wmax = 0;
     wacnt = 0;
+    cnt_reuse = 0;
+
+    sol_cache = sol_cache_create(0);
+
+    /* see tps_nn() */
+    in_parallel = 0;
+    if (nthreads > 1) {
+	in_parallel = out_seg->r != NULL &&
+	              (n_vars == 0 || var_seg->r != NULL);
+	if (!in_parallel)
+	    G_verbose_message(_("Not enough memory for parallel interpolation"));
+    }
 
     if (overlap > 1.0)
 	overlap = 1.0;
@@ -1451,73 +1743,103 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
 	    src_col = col_src2dst(col, dst, src);
 	    
 	    /* collect points within moving window */
-	    rmin = src->rows;
-	    rmax = 0;
-	    cmin = src->cols;
-	    cmax = 0;
-	    pfound = window_pnts(pnt_flag, src, cur_pnts,
-				 radius,
-				 src_row, src_col, 
-				 &rmin, &rmax, &cmin, &cmax, 
-				 &distmax);
-
-	    /* sort points */
-	    qsort(cur_pnts, pfound, sizeof(struct tps_pnt), cmp_pnts);
+	    sol = sol_cache_find(sol_cache, src_row, src_col, radius, 0);
+	    if (sol) {
+		/* same points as for an earlier output cell */
+		pfound = sol->pfound;
+		rmin = sol->rmin;
+		rmax = sol->rmax;
+		cmin = sol->cmin;
+		cmax = sol->cmax;
+		distmax = sol->distmax;
+		sol_cache_get_pnts(sol, cur_pnts);
+
+		n_vars_i = sol->solved_tps_lm ? n_vars : 0;
+		memcpy(B, sol->B, (pfound + 1 + n_vars_i) * sizeof(double));
+		solved = 1;
+		cnt_reuse++;
+	    }
+	    else {
+		rmin = src->rows;
+		rmax = 0;
+		cmin = src->cols;
+		cmax = 0;
+		pfound = window_pnts(pnt_flag, src, cur_pnts,
+				     radius,
+				     src_row, src_col, 
+				     &rmin, &rmax, &cmin, &cmax, 
+				     &distmax);
 
-	    load_tps_pnts(in_seg, dval, n_vars, cur_pnts, pfound,
-			  src, dst, regularization, m, a, mvars, avars,
-			  NULL, NULL, NULL, NULL);
+		/* sort points */
+		qsort(cur_pnts, pfound, sizeof(struct tps_pnt), cmp_pnts);
 
-	    n_vars_i = n_vars;
-	    if (pfound > 2) {
-		/* solve */
-		solved_tps_lm = solved_tps = 0;
+		load_tps_pnts(in_seg, dval, n_vars, cur_pnts, pfound,
+			      src, dst, regularization, m, a, mvars, avars,
+			      NULL, NULL, NULL, NULL);
 
-		if (n_vars) {
+		n_vars_i = n_vars;
+		if (pfound > 2) {
+		    /* solve */
+		    solved_tps_lm = solved_tps = 0;
 
-		    solved_tps_lm = solvemat(m, a, B, pfound + 1 + n_vars);
+		    if (n_vars) {
 
-		    if (solved_tps_lm && lm_thresh > 0) {
+			solved_tps_lm = solvemat(m, a, B, pfound + 1 + n_vars);
 
-			solved_lm = solvemat(mvars, avars, Bvars, 1 + n_vars);
-			if (!solved_lm) {
-			    G_debug(1, "LM with covariables not working at row %d, col %d",
-				    row, col);
+			if (solved_tps_lm && lm_thresh > 0) {
 
-			    solved_tps_lm = 0;
-			}
-			else {
-			    rsqr = lm_rsqr(in_seg, n_vars, src, cur_pnts, pfound, B);
+			    solved_lm = solvemat(mvars, avars, Bvars, 1 + n_vars);
+			    if (!solved_lm) {
+				G_debug(1, "LM with covariables not working at row %d, col %d",
+					row, col);
 
-			    if (rsqr < lm_thresh) {
-				for (i = 1; i <= n_vars; i++) {
-				    if (fabs(B[i]) > fabs(5 * Bvars[i])) {
-					G_debug(0, "LM B%d is %g but TPS B%d is %g",
-						i, Bvars[i], i, B[i]);
-					solved_tps_lm = 0;
+				solved_tps_lm = 0;
+			    }
+			    else {
+				rsqr = lm_rsqr(in_seg, n_vars, src, cur_pnts, pfound, B);
+
+				if (rsqr < lm_thresh) {
+				    for (i = 1; i <= n_vars; i++) {
+					if (fabs(B[i]) > fabs(5 * Bvars[i])) {
+					    G_debug(0, "LM B%d is %g but TPS B%d is %g",
+						    i, Bvars[i], i, B[i]);
+					    solved_tps_lm = 0;
+					}
 				    }
 				}
 			    }
 			}
+
+			if (!solved_tps_lm) {
+			    n_vars_i = 0;
+			    for (i = 0; i < pfound; i++) {
+				cur_pnts[i].r = (int)((src->north - cur_pnts[i].r) / src->ns_res);
+				cur_pnts[i].c = (int)((cur_pnts[i].c - src->west) / src->ew_res);
+			    }
+			    load_tps_pnts(in_seg, dval, 0, cur_pnts, pfound,
+					  src, dst, regularization, m, a,
+					  NULL, NULL, NULL, NULL, NULL, NULL);
+			}
 		    }
 
 		    if (!solved_tps_lm) {
-			n_vars_i = 0;
-			for (i = 0; i < pfound; i++) {
-			    cur_pnts[i].r = (int)((src->north - cur_pnts[i].r) / src->ns_res);
-			    cur_pnts[i].c = (int)((cur_pnts[i].c - src->west) / src->ew_res);
-			}
-			load_tps_pnts(in_seg, dval, 0, cur_pnts, pfound,
-				      src, dst, regularization, m, a,
-				      NULL, NULL, NULL, NULL, NULL, NULL);
+			solved_tps = solvemat(m, a, B, pfound + 1);
 		    }
+		
+		    solved = (solved_tps_lm | solved_tps);
 		}
 
-		if (!solved_tps_lm) {
-		    solved_tps = solvemat(m, a, B, pfound + 1);
+		if (solved) {
+		    sol = sol_cache_put(sol_cache, src_row, src_col, radius, 0,
+					cur_pnts, pfound, n_vars);
+		    sol->rmin = rmin;
+		    sol->rmax = rmax;
+		    sol->cmin = cmin;
+		    sol->cmax = cmax;
+		    sol->distmax = distmax;
+		    sol->solved_tps_lm = solved_tps_lm;
+		    memcpy(sol->B, B, (pfound + 1 + n_vars_i) * sizeof(double));
 		}
-		
-		solved = (solved_tps_lm | solved_tps);
 	    }
 
 	    if (!solved) {
@@ -1599,10 +1921,20 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
 	    dxi = icol2 - icol1 + 1;
 	    dyi = irow2 - irow1 + 1;
 
+#pragma omp parallel for schedule(dynamic) if (in_parallel) \
+	private(icol, i, j, i_n, i_e, ivarbuf, tps_out, \
+	        result, dx, dy, dist, dist2, weight) \
+	reduction(min:wmin) reduction(max:wmax)
 	    for (irow = irow1; irow <= irow2; irow++) {
 
 		i_n = dst->north - (irow + 0.5) * dst->ns_res;
 
+		ivarbuf = varbuf;
+#if defined(_OPENMP)
+		if (n_vars)
+		    ivarbuf = varbuf + n_vars * omp_get_thread_num();
+#endif
+
 		for (icol = icol1; icol <= icol2; icol++) {
 		    if ((FLAG_GET(mask_flag, irow, icol))) {
 			continue;
@@ -1610,8 +1942,8 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
 
 		    if (n_vars_i) {
 
-			cache_get(var_seg, (void *)varbuf, irow, icol);
-			if (Rast_is_d_null_value(varbuf)) {
+			cache_get(var_seg, (void *)ivarbuf, irow, icol);
+			if (Rast_is_d_null_value(ivarbuf)) {
 			    continue;
 			}
 		    }
@@ -1625,7 +1957,7 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
 		    result = B[0];
 		    if (n_vars_i) {
 			for (j = 0; j < n_vars; j++) {
-			    result += varbuf[j] * B[j + 1];
+			    result += ivarbuf[j] * B[j + 1];
 			}
 		    }
 
@@ -1638,7 +1970,7 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
 			dist = 0;
 			if (dist2 > 0) {
 			    dist = dist2 * log(dist2) * 0.5;
-			    result += B[1 + n_vars + i] * dist;
+			    result += B[1 + n_vars_i + i] * dist;
 			}
 		    }
 
@@ -1669,6 +2001,9 @@ int tps_window(struct cache *in_seg, struct cache *var_seg, int n_vars,
     G_debug(1, "wmin: %g", wmin);
     G_debug(1, "wmax: %g", wmax);
     G_debug(1, "wacnt: %u", wacnt);
+    G_debug(1, "Reused solutions: %u", cnt_reuse);
+
+    sol_cache_destroy(sol_cache);
 
     flag_destroy(pnt_flag);
 
@@ -0,0 +1,176 @@
+/****************************************************************************
+ *
+ * MODULE:       simwe library
+ * PURPOSE:      Checkpoint and restart of the simulation
+ *
+ * COPYRIGHT:    (C) 2020 by the GRASS Development Team
+ *
+ *               This program is free software under the GNU General Public
+ *               License (>=v2). Read the file COPYING that comes with GRASS
+ *               for details.
+ *
+ *****************************************************************************/
+
+/* checkpoint.c (simlib) */
+
+#include <stdio.h>
+#include <string.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+
+#include "waterglobs.h"
+
+/*
+ * The checkpoint is a binary file in the native byte order with
+ * a header followed by the random streams, the walkers, and the grids:
+ *
+ *   magic, version, mx, my, iblock, iteration, nwalk, nwalka, nthreads,
+ *   has_inf, has_gammas
+ *   nthreads random stream states
+ *   nwalk values of x, y, weight, vx, vy (one array after another)
+ *   mx * my values of gama, inf (if has_inf), gammas (if has_gammas)
+ *
+ * It is meant for restarting on the same machine with the same inputs.
+ */
+
+#define CHECKPOINT_MAGIC "SIMWECP"
+#define CHECKPOINT_VERSION 1
+
+static void write_or_fail(const void *data, size_t size, size_t count,
+			  FILE *file, const char *name)
+{
+    if (count && fwrite(data, size, count, file) != count)
+	G_fatal_error(_("Unable to write checkpoint <%s>"), name);
+}
+
+static void read_or_fail(void *data, size_t size, size_t count,
+			 FILE *file, const char *name)
+{
+    if (count && fread(data, size, count, file) != count)
+	G_fatal_error(_("Unable to read checkpoint <%s>"), name);
+}
+
+/*!
+ * \brief Write the state of the simulation to a file
+ *
+ * The file is first written under a temporary name and then renamed,
+ * so an interrupted write does not destroy the previous checkpoint.
+ */
+void write_checkpoint(const char *name, const struct checkpoint *cp)
+{
+    char magic[8] = CHECKPOINT_MAGIC;
+    int header[10];
+    char *tmp_name;
+    size_t ncells = (size_t)mx * my;
+    FILE *file;
+
+    G_asprintf(&tmp_name, "%s.tmp", name);
+    file = fopen(tmp_name, "wb");
+    if (!file)
+	G_fatal_error(_("Unable to open checkpoint <%s> for writing"),
+		      tmp_name);
+
+    header[0] = CHECKPOINT_VERSION;
+    header[1] = mx;
+    header[2] = my;
+    header[3] = cp->iblock;
+    header[4] = cp->iteration;
+    header[5] = nwalk;
+    header[6] = nwalka;
+    header[7] = cp->nthreads;
+    header[8] = infil != NULL;
+    header[9] = gammas != NULL;
+    write_or_fail(magic, 1, sizeof(magic), file, tmp_name);
+    write_or_fail(header, sizeof(int), 10, file, tmp_name);
+    write_or_fail(cp->rngs, sizeof(struct simwe_rng), cp->nthreads, file,
+		  tmp_name);
+    write_or_fail(walkers.x, sizeof(double), nwalk, file, tmp_name);
+    write_or_fail(walkers.y, sizeof(double), nwalk, file, tmp_name);
+    write_or_fail(walkers.weight, sizeof(double), nwalk, file, tmp_name);
+    write_or_fail(walkers.vx, sizeof(double), nwalk, file, tmp_name);
+    write_or_fail(walkers.vy, sizeof(double), nwalk, file, tmp_name);
+    write_or_fail(gama[0], sizeof(double), ncells, file, tmp_name);
+    if (infil != NULL)
+	write_or_fail(inf[0], sizeof(double), ncells, file, tmp_name);
+    if (gammas != NULL)
+	write_or_fail(gammas[0], sizeof(double), ncells, file, tmp_name);
+    if (fclose(file) != 0)
+	G_fatal_error(_("Unable to write checkpoint <%s>"), tmp_name);
+
+    if (rename(tmp_name, name) != 0)
+	G_fatal_error(_("Unable to rename <%s> to <%s>"), tmp_name, name);
+    G_free(tmp_name);
+    G_debug(1, "checkpoint written at iteration %d", cp->iteration);
+}
+
+/*!
+ * \brief Read the state of the simulation from a file
+ *
+ * Walker arrays are allocated and the grids (which must be already
+ * allocated) are filled. The random streams in cp->rngs (allocated
+ * for cp->nthreads) are replaced only if the number of threads is
+ * the same as when the checkpoint was written.
+ *
+ * \return 1 if the random streams were restored, 0 otherwise
+ */
+int read_checkpoint(const char *name, struct checkpoint *cp)
+{
+    char magic[8];
+    int header[10];
+    size_t ncells = (size_t)mx * my;
+    int restored = 0;
+    FILE *file;
+
+    file = fopen(name, "rb");
+    if (!file)
+	G_fatal_error(_("Unable to open checkpoint <%s>"), name);
+
+    read_or_fail(magic, 1, sizeof(magic), file, name);
+    if (strncmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+	G_fatal_error(_("File <%s> is not a checkpoint"), name);
+    read_or_fail(header, sizeof(int), 10, file, name);
+    if (header[0] != CHECKPOINT_VERSION)
+	G_fatal_error(_("Unsupported checkpoint version %d in <%s>"),
+		      header[0], name);
+    if (header[1] != mx || header[2] != my)
+	G_fatal_error(_("Checkpoint <%s> is for a region with %d rows and"
+			" %d columns, current region has %d rows and"
+			" %d columns"), name, header[2], header[1], my, mx);
+    if (header[8] != (infil != NULL) || header[9] != (gammas != NULL))
+	G_fatal_error(_("Checkpoint <%s> was created with different"
+			" infiltration or error output settings"), name);
+    cp->iblock = header[3];
+    cp->iteration = header[4];
+    nwalk = header[5];
+    nwalka = header[6];
+
+    if (header[7] == cp->nthreads) {
+	read_or_fail(cp->rngs, sizeof(struct simwe_rng), cp->nthreads, file,
+		     name);
+	restored = 1;
+    }
+    else {
+	G_warning(_("Checkpoint <%s> was created with %d threads,"
+		    " random numbers will differ from the original run"),
+		  name, header[7]);
+	if (fseek(file, (long)header[7] * sizeof(struct simwe_rng),
+		  SEEK_CUR) != 0)
+	    G_fatal_error(_("Unable to read checkpoint <%s>"), name);
+    }
+
+    alloc_walkers(&walkers, nwalk);
+    read_or_fail(walkers.x, sizeof(double), nwalk, file, name);
+    read_or_fail(walkers.y, sizeof(double), nwalk, file, name);
+    read_or_fail(walkers.weight, sizeof(double), nwalk, file, name);
+    read_or_fail(walkers.vx, sizeof(double), nwalk, file, name);
+    read_or_fail(walkers.vy, sizeof(double), nwalk, file, name);
+    read_or_fail(gama[0], sizeof(double), ncells, file, name);
+    if (infil != NULL)
+	read_or_fail(inf[0], sizeof(double), ncells, file, name);
+    if (gammas != NULL)
+	read_or_fail(gammas[0], sizeof(double), ncells, file, name);
+    fclose(file);
+
+    G_message(_("Restarting from iteration %d"), cp->iteration);
+    return restored;
+}
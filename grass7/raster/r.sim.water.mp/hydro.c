@@ -51,6 +51,9 @@ char *logfile;
 char *mapset;
 char *mscale;
 char *tserie;
+char *checkpoint_file;
+char *restart_file;
+int checkpoint_step;
 
 char *wdepth;
 char *detin;
@@ -84,12 +87,9 @@ float **zz, **cchez;
 double **v1, **v2, **slope;
 double **gama, **gammas, **si, **inf, **sigma;
 float **dc, **tau, **er, **ct, **trap;
-float **dif;
 
-/* suspected BUG below: fist array subscripts go from 1 to MAXW
- * correct: from 0 to MAXW - 1, e.g for (lw = 0; lw < MAXW; lw++) */
-double vavg[MAXW][2], stack[MAXW][3], w[MAXW][3]; 
-int iflag[MAXW];
+double stack[MAXW][3];
+struct walkers walkers;
 
 double hbeta;
 double hhmax, sisum, vmean;
@@ -111,6 +111,312 @@ double infil_val;
 
 struct History history;	/* holds meta-data (title, comments,..) */
 
+/*!
+ * \brief Add per-thread walker contributions to the shared grids
+ *
+ * Contributions are added in thread order, so the sums are the same
+ * in each run with the same number of threads. The buffers are reset
+ * to zero for the next iteration.
+ *
+ * \param nthreads number of buffers
+ * \param gama_part per-thread increments of gama
+ * \param inf_part per-thread used infiltration (NULL if not used)
+ */
+static void merge_thread_buffers(int nthreads, double ***gama_part,
+				 double ***inf_part)
+{
+    int k;
+
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (k = 0; k < my; k++) {
+	int l, t;
+
+	for (l = 0; l < mx; l++) {
+	    for (t = 0; t < nthreads; t++) {
+		gama[k][l] += gama_part[t][k][l];
+		gama_part[t][k][l] = 0.;
+	    }
+	    if (inf_part) {
+		for (t = 0; t < nthreads; t++) {
+		    inf[k][l] -= inf_part[t][k][l];
+		    inf_part[t][k][l] = 0.;
+		}
+		/* threads may together use more than is available */
+		if (inf[k][l] < 0.)
+		    inf[k][l] = 0.;
+	    }
+	}
+    }
+}
+
+/*!
+ * \brief Allocate walker arrays for at least given number of walkers
+ *
+ * Arrays are allocated for both the walkers and the sorting buffer.
+ */
+void alloc_walkers(struct walkers *wk, int size)
+{
+    if (size <= wk->size)
+	return;
+    wk->x = (double *)G_realloc(wk->x, size * sizeof(double));
+    wk->y = (double *)G_realloc(wk->y, size * sizeof(double));
+    wk->weight = (double *)G_realloc(wk->weight, size * sizeof(double));
+    wk->vx = (double *)G_realloc(wk->vx, size * sizeof(double));
+    wk->vy = (double *)G_realloc(wk->vy, size * sizeof(double));
+    wk->size = size;
+}
+
+static void free_walkers(struct walkers *wk)
+{
+    G_free(wk->x);
+    G_free(wk->y);
+    G_free(wk->weight);
+    G_free(wk->vx);
+    G_free(wk->vy);
+    wk->x = wk->y = wk->weight = wk->vx = wk->vy = NULL;
+    wk->size = 0;
+}
+
+/*!
+ * \brief Index of the cell with the walker (k * mx + l)
+ *
+ * \return cell index or -1 if outside of the grid
+ */
+static inline int walker_cell(double x, double y, double stxm, double stym)
+{
+    int l = (int)((x + stxm) / stepx) - mx - 1;
+    int k = (int)((y + stym) / stepy) - my - 1;
+
+    if (l < 0 || l >= mx || k < 0 || k >= my)
+	return -1;
+    return k * mx + l;
+}
+
+/*!
+ * \brief Sort walkers by cell and drop the eliminated ones
+ *
+ * Walkers in the same cell end up next to each other, so the scattered
+ * reads of the grids in the step are mostly cache hits. Counting sort
+ * is stable, so the result depends only on the walker positions.
+ *
+ * \param sorted walker arrays used as the output buffer (swapped
+ *   with the global walkers)
+ * \param counts buffer for mx * my + 1 counts
+ *
+ * \return new number of walkers
+ */
+static int sort_walkers(int nwalk, double stxm, double stym,
+			struct walkers *sorted, int *cell, int *counts)
+{
+    int lw, c, n;
+    int ncells = mx * my;
+    struct walkers tmp;
+
+    for (c = 0; c <= ncells; c++)
+	counts[c] = 0;
+    for (lw = 0; lw < nwalk; lw++) {
+	cell[lw] = -1;
+	if (walkers.weight[lw] > EPS)
+	    cell[lw] = walker_cell(walkers.x[lw], walkers.y[lw], stxm, stym);
+	if (cell[lw] >= 0)
+	    counts[cell[lw] + 1]++;
+    }
+    for (c = 0; c < ncells; c++)
+	counts[c + 1] += counts[c];
+    n = counts[ncells];
+    alloc_walkers(sorted, walkers.size);
+    for (lw = 0; lw < nwalk; lw++) {
+	if (cell[lw] < 0)
+	    continue;
+	c = counts[cell[lw]]++;
+	sorted->x[c] = walkers.x[lw];
+	sorted->y[c] = walkers.y[lw];
+	sorted->weight[c] = walkers.weight[lw];
+	sorted->vx[c] = walkers.vx[lw];
+	sorted->vy[c] = walkers.vy[lw];
+    }
+    tmp = walkers;
+    walkers = *sorted;
+    *sorted = tmp;
+    return n;
+}
+
+/*!
+ * \brief Move walkers from begin to end by one step
+ *
+ * For each walker, the water is added to the grids, random numbers
+ * are drawn in walker order and the walker is moved.
+ *
+ * The grids are accessed as flat arrays (G_alloc_matrix keeps rows
+ * in one block).
+ *
+ * \return number of active walkers
+ */
+static int propagate_walkers(int begin, int end, double addac, double conn,
+			     double stxm, double stym, double **gama_own,
+			     double **inf_own, struct simwe_rng *rng)
+{
+    double *wx = walkers.x, *wy = walkers.y, *ww = walkers.weight;
+    double *vx = walkers.vx, *vy = walkers.vy;
+    const double *v1f = v1[0], *v2f = v2[0], *gamaf = gama[0];
+    const double *sif = si[0];
+    const float *zzf = zz[0];
+    double *gama_ownf = gama_own[0];
+    int lw, c;
+    int active = 0;
+
+    for (lw = begin; lw < end; lw++) {
+	double depth, gaux, gauy, velx, vely, difw;
+	int high, trapped;
+
+	if (ww[lw] <= EPS)	/* check the walker weight */
+	    continue;
+	++active;
+	c = walker_cell(wx[lw], wy[lw], stxm, stym);
+	if (c < 0 || zzf[c] == UNDEF) {
+	    ww[lw] = 1e-10;	/* eliminate walker if it is out of area */
+	    continue;
+	}
+
+	if (infil != NULL) {	/* infiltration part */
+	    /* infiltration left for this thread */
+	    double infw = inf[0][c] - inf_own[0][c];
+
+	    if (infw - sif[c] > 0.) {
+		double decr = pow(addac * ww[lw], 3. / 5.);	/* decreasing factor in m */
+
+		if (infw > decr) {
+		    inf_own[0][c] += decr;	/* decrease infilt. in cell and eliminate the walker */
+		    ww[lw] = 0.;
+		}
+		else {
+		    ww[lw] -= pow(infw, 5. / 3.) / addac;	/* use just proportional part of the walker weight */
+		    inf_own[0][c] += infw;
+		}
+	    }
+	}
+	gama_ownf[c] += addac * ww[lw];	/* add walker weigh to water depth or conc. */
+	depth = pow((gamaf[c] + gama_ownf[c]) * conn, 3. / 5.);
+	simwe_rng_gasdev(rng, &gaux, &gauy);
+	trapped = 0;
+	if (traps != NULL && trap[0][c] != 0.)	/* traps */
+	    trapped = simwe_rng_rand(rng) <= trap[0][c];
+
+	/* increased diffusion if w.depth > hhmax */
+	high = depth > hhmax && wdepth == NULL;
+	difw = high ? (halpha + 1) * deldif : deldif;
+	velx = high ? vx[lw] : v1f[c];
+	vely = high ? vy[lw] : v2f[c];
+	if (trapped) {
+	    velx = -0.1 * v1f[c];	/* move it slightly back */
+	    vely = -0.1 * v2f[c];
+	}
+	wx[lw] += velx + difw * gaux;	/* move the walker */
+	wy[lw] += vely + difw * gauy;
+	if (high) {
+	    vx[lw] = hbeta * (vx[lw] + v1f[c]);
+	    vy[lw] = hbeta * (vy[lw] + v2f[c]);
+	}
+	if (wx[lw] <= xmin || wy[lw] <= ymin || wx[lw] >= xmax ||
+	    wy[lw] >= ymax) {
+	    ww[lw] = 1e-10;	/* eliminate walker if it is out of area */
+	}
+	else if (wdepth != NULL) {
+	    c = walker_cell(wx[lw], wy[lw], stxm, stym);
+	    if (c >= 0)
+		ww[lw] *= sigma[0][c];
+	}
+    }
+    return active;
+}
+
+/*!
+ * \brief Create walkers representing the source (rainfall excess)
+ *
+ * The positions are drawn from a stream keyed on the block so that
+ * a restarted simulation creates the same walkers for later blocks.
+ *
+ * \param[out] walkwe total weight of the walkers
+ * \param seed seed of the random streams
+ * \param iblock block of walkers
+ *
+ * \return number of walkers
+ */
+static int create_walkers(double barea, double sarea, double *walkwe,
+			  unsigned long seed, int iblock)
+{
+    struct simwe_rng rng;
+    int k, l, lw, iw;
+    int mgen, mgen2, mgen3, nmult;
+    double x, y;
+    double gen, gen2, wei, wei2, wei3, weifac;
+
+    /* count the walkers first to allocate the arrays */
+    lw = 0;
+    for (k = 0; k < my; k++) {
+	for (l = 0; l < mx; l++) {
+	    if (zz[k][l] != UNDEF)
+		lw += (int)(rwalk * si[k][l] / sisum) + 1;
+	}
+    }
+    if (lw > MAXW)
+	G_fatal_error(_("nwalk (%d) > maxw (%d)!"), lw, MAXW);
+    alloc_walkers(&walkers, lw);
+
+    /* negative stream numbers do not collide with the thread streams */
+    simwe_rng_init(&rng, seed, -iblock);
+    lw = 0;
+    *walkwe = 0.;
+    for (k = 0; k < my; k++) {
+	for (l = 0; l < mx; l++) {	/* run thru the whole area */
+	    if (zz[k][l] != UNDEF) {
+
+		x = xp0 + stepx * (double)(l);
+		y = yp0 + stepy * (double)(k);
+
+		gen = rwalk * si[k][l] / sisum;
+		mgen = (int)gen;
+		wei = gen / (double)(mgen + 1);
+
+		/*if (si[k][l] != 0.) { */
+		/* this stuff later for multiscale */
+
+		gen2 =
+		    (double)maxwab *si[k][l] / (si0 *
+						(double)(mx2o * my2o));
+		gen2 = gen2 * (barea / sarea);
+		mgen2 = (int)gen2;
+		wei2 = gen2 / (double)(mgen2 + 1);
+		mgen3 =
+		    (int)((double)mgen2 * wei2 / ((double)mgen * wei));
+		nmult = mgen3 + 1;
+		wei3 = gen2 / (double)((mgen + 1) * (mgen2 + 1));
+		weifac = wei3 / wei;
+		/*              } else {
+		   nmult = 1;
+		   weifac = 1.;
+		   fprintf(stderr, "\n zero rainfall excess in cell"); 
+		   } */
+
+		/*G_debug(2, " gen,gen2,wei,wei2,mgen3,nmult: %f %f %f %f %d %d",gen,gen2,wei,wei2,mgen3,nmult);
+		 */
+		for (iw = 1; iw <= mgen + 1; iw++) {	/* assign walkers */
+
+		    walkers.x[lw] = x + stepx * (simwe_rng_rand(&rng) - 0.5);
+		    walkers.y[lw] = y + stepy * (simwe_rng_rand(&rng) - 0.5);
+		    walkers.weight[lw] = wei;
+
+		    *walkwe += walkers.weight[lw];
+		    walkers.vx[lw] = v1[k][l];
+		    walkers.vy[lw] = v2[k][l];
+		    lw++;
+		}
+	    }		/*DEFined area */
+	}
+    }
+    return lw;
+}
+
 /* **************************************************** */
 /*       create walker representation of si */
 /* ******************************************************** */
@@ -125,22 +431,26 @@ void main_loop(void)
 #endif
 
     int i, ii, l, k;
-    int icoub, nmult; 
-    int iw, iblock, lw;
+    int icoub;
+    int iblock, lw;
     int itime, iter1;
     int nfiterh, nfiterw;
-    int mgen, mgen2, mgen3;
     int nblock;
     int icfl;
     int mitfac;
 /*  int mitfac, p; */
-    double x, y;
-    double velx, vely, stxm, stym;
-    double factor, conn, gaux, gauy;
-    double d1, addac, decr;
+    double stxm, stym;
+    double factor, conn;
+    double d1, addac;
     double barea, sarea, walkwe;
-    double gen, gen2, wei2, wei3, wei, weifac;
-    float eff;
+    int first_iter, restored_block = 0;
+    struct checkpoint cp;
+    int t, nthreads;
+    double ***gama_part, ***inf_part;
+    struct simwe_rng *rngs;
+    unsigned long rng_seed;
+    struct walkers sorted = { 0 };
+    int *walker_cells = NULL, *cell_counts = NULL;
 
     nblock = 1;
     icoub = 0;
@@ -158,6 +468,37 @@ void main_loop(void)
 
     G_debug(2, " maxwa, nblock %d %d", maxwa, nblock);
 
+    /* per-thread random streams and accumulation buffers */
+    nthreads = omp_get_max_threads();
+    rng_seed = (unsigned long)G_lrand48();
+    rngs = (struct simwe_rng *)G_malloc(nthreads * sizeof(struct simwe_rng));
+    gama_part = (double ***)G_malloc(nthreads * sizeof(double **));
+    inf_part = NULL;
+    if (infil != NULL)
+	inf_part = (double ***)G_malloc(nthreads * sizeof(double **));
+    for (t = 0; t < nthreads; t++) {
+	simwe_rng_init(&rngs[t], rng_seed, t);
+	gama_part[t] = G_alloc_matrix(my, mx);
+	if (inf_part)
+	    inf_part[t] = G_alloc_matrix(my, mx);
+    }
+    cell_counts = (int *)G_malloc((mx * my + 1) * sizeof(int));
+
+    cp.nthreads = nthreads;
+    cp.rngs = rngs;
+    if (restart_file != NULL) {
+	if (!read_checkpoint(restart_file, &cp)) {
+	    /* different number of threads, new (reproducible) streams */
+	    for (t = 0; t < nthreads; t++)
+		simwe_rng_init(&rngs[t], rng_seed + cp.iteration, t);
+	}
+	restored_block = cp.iblock;
+    }
+
+    /* time series maps are written while the walkers are propagated */
+    if (ts == 1)
+	tserie_writer_start();
+
 //---------------------------------------------------------------------------------------------------------------    
     
 #ifdef PARALLEL
@@ -176,7 +517,8 @@ void main_loop(void)
 	
     }*/
     
-    for (iblock = 1; iblock <= nblock; iblock++) {
+    for (iblock = restored_block ? restored_block : 1; iblock <= nblock;
+	 iblock++) {
 	++icoub;
 
 	lw = 0;
@@ -232,76 +574,18 @@ void main_loop(void)
 #ifdef PARALLEL
     printTimeDiff("P0");  
 #endif
-    /* write hh.walkers0 */
-      //recalculate: lw
- //       #pragma omp parallel firstprivate(gen,mgen,wei,x,y,gen2,mgen2,wei2,mgen3,wei3,nmult,weifac,iw,walkwe) 
-        
-//{
-  //    #pragma omp for schedule(dynamic) reduction(max:lw)  
-	for (k = 0; k < my; k++) {
-	    for (l = 0; l < mx; l++) {	/* run thru the whole area */
-		if (zz[k][l] != UNDEF) {
-
-		    x = xp0 + stepx * (double)(l);
-		    y = yp0 + stepy * (double)(k);
-
-		    gen = rwalk * si[k][l] / sisum;
-		    mgen = (int)gen;
-		    wei = gen / (double)(mgen + 1);
-
-		    /*if (si[k][l] != 0.) { */
-		    /* this stuff later for multiscale */
-
-		    gen2 =
-			(double)maxwab *si[k][l] / (si0 *
-						    (double)(mx2o * my2o));
-		    gen2 = gen2 * (barea / sarea);
-		    mgen2 = (int)gen2;
-		    wei2 = gen2 / (double)(mgen2 + 1);
-		    mgen3 =
-			(int)((double)mgen2 * wei2 / ((double)mgen * wei));
-		    nmult = mgen3 + 1;
-		    wei3 = gen2 / (double)((mgen + 1) * (mgen2 + 1));
-		    weifac = wei3 / wei;
-		    /*              } else {
-		       nmult = 1;
-		       weifac = 1.;
-		       fprintf(stderr, "\n zero rainfall excess in cell"); 
-		       } */
-
-		    /*G_debug(2, " gen,gen2,wei,wei2,mgen3,nmult: %f %f %f %f %d %d",gen,gen2,wei,wei2,mgen3,nmult);
-		     */
-               //     lw = lw_start[k][l];
-               //if (lw != lw_start[k][l])
-               //
-                 //   G_message(_("lw %d lws %d k %d l %d"),lw,lw_start[k][l],k,l);
-               //}
-		    for (iw = 1; iw <= mgen + 1; iw++) {	/* assign walkers */
-
-			if (lw >= MAXW)  /* max valid value is MAXW - 1, not MAXW */
-			    G_fatal_error(_("nwalk (%d) > maxw (%d)!"), lw, MAXW);
-
-			w[lw][0] = x + stepx * (simwe_rand() - 0.5);
-			w[lw][1] = y + stepy * (simwe_rand() - 0.5);
-			w[lw][2] = wei;
-
-			walkwe += w[lw][2];
-			vavg[lw][0] = v1[k][l];
-			vavg[lw][1] = v2[k][l];
-			if (w[lw][0] >= xmin && w[lw][1] >= ymin &&
-			    w[lw][0] <= xmax && w[lw][1] <= ymax) {
-			    iflag[lw] = 0;
-			}
-			else {
-			    iflag[lw] = 1;
-			}
-			lw++;
-		    }
-		}		/*DEFined area */
-	    }
+	if (restored_block == iblock) {
+	    /* walkers and grids were read from the checkpoint */
+	    first_iter = cp.iteration + 1;
+	}
+	else {
+	    first_iter = 1;
+	    lw = create_walkers(barea, sarea, &walkwe, rng_seed, iblock);
+	    nwalka = 0;
 	}
-//}
-	nwalk = lw;
+	walker_cells = (int *)G_realloc(walker_cells, walkers.size * sizeof(int));
+	if (restored_block != iblock)
+	    nwalk = lw;
 	G_debug(2, " nwalk, maxw %d %d", nwalk, MAXW);
 	G_debug(2, " walkwe (walk weight),frac %f %f", walkwe, frac);
 #ifdef PARALLEL
@@ -312,7 +596,6 @@ void main_loop(void)
 #endif
 	stxm = stepx * (double)(mx + 1) - xmin;
 	stym = stepy * (double)(my + 1) - ymin;
-	nwalka = 0;
 	deldif = sqrt(deltap) * frac;	/* diffuse factor */
 
 
@@ -327,12 +610,8 @@ void main_loop(void)
 
 	G_debug(2, "main loop over the projection time... ");
 
-        
-        //double *gaux_arr = (double *)G_calloc((nwalk), sizeof(double *));;
-        //double *gauy_arr = (double *)G_calloc((nwalk), sizeof(double *));;
-       // int stop = -1;
 G_message("miter %d",miter);
-	for (i = 1; i <= miter; i++) {	/* iteration loop depending on simulation time and deltap */
+	for (i = first_iter; i <= miter; i++) {	/* iteration loop depending on simulation time and deltap */
  /*           #pragma omp critical STOP
 {
             if (stop != -1 && i >= stop)
@@ -373,128 +652,42 @@ G_message("miter %d",miter);
 	    }
 	    nwalka = 0;
 	    nstack = 0;
-            
-            /*for (lw = 0; lw < nwalk; lw++) {
-                if (w[lw][2] > EPS) {
-                    ++nwalka;
-                    gaux_arr[lw] = gasdev();
-                    gauy_arr[lw] = gasdev();
-                }
-            }*/
-            //int chunk_size = (int)nwalk/(4 * omp_get_thread_num());
-            
-            
-            
-#pragma omp parallel firstprivate(l,lw,k,decr,d1,hhc,velx,vely,eff,gaux,gauy)//nwalka
-{
-        int steps = (int)((((double)nwalk) / ((double) omp_get_num_threads())) + 0.5);
-        int tid = omp_get_thread_num();
-        int min_loop = tid * steps;
-        int max_loop = ((tid + 1) * steps) > nwalk ? nwalk : (tid + 1) * steps;
-/*#pragma omp critical
-        {
-        G_message("tid: %d min_loop: %d max_loop: %d nwalk: %d, steps: %d", tid, min_loop, max_loop, nwalk, steps);
-        }*/
-        //#pragma omp for schedule(static,1)
-	    for (lw = min_loop; lw < max_loop; lw++) {
-                //G_message(_("nthreads %d"),omp_get_num_threads());
-                //G_message("\n tid: %d", omp_get_thread_num());
-		if (w[lw][2] > EPS) {	/* check the walker weight */
-                   //#pragma omp atomic
-                    ++nwalka;
-		    l = (int)((w[lw][0] + stxm) / stepx) - mx - 1;
-		    k = (int)((w[lw][1] + stym) / stepy) - my - 1;
-//G_message("k_%d l_%d", k,l);
-		    if (l > mx - 1 || k > my - 1 || k < 0 || l < 0) {
-
-			G_debug(2, " k,l=%d,%d", k, l);
-			printf("    lw,w=%d %f %f", lw, w[lw][1], w[lw][2]);
-			G_debug(2, "    stxym=%f %f", stxm, stym);
-			printf("    step=%f %f", stepx, stepy);
-			G_debug(2, "    m=%d %d", my, mx);
-			printf("    nwalka,nwalk=%d %d", nwalka, nwalk);
-			G_debug(2, "  ");
-		    }
 
-		    if (zz[k][l] != UNDEF) {
-			if (infil != NULL) {	/* infiltration part */
-			    if (inf[k][l] - si[k][l] > 0.) {
-
-				decr = pow(addac * w[lw][2], 3. / 5.);	/* decreasing factor in m */
-//				#pragma omp critical
-//{
-                                if (inf[k][l] > decr) {
-				    inf[k][l] -= decr;	/* decrease infilt. in cell and eliminate the walker */
-				    w[lw][2] = 0.;
-				}
-				else {
-				    w[lw][2] -= pow(inf[k][l], 5. / 3.) / addac;	/* use just proportional part of the walker weight */
-				    inf[k][l] = 0.;
-
-				}
-//}
-			    }
-			}
-
-//#pragma omp critical
-//{
-                        gama[k][l] += (addac * w[lw][2]);	/* add walker weigh to water depth or conc. */
-                        d1 = gama[k][l] * conn;
-//                         
-//}
-                        gasdev_for_paralel(&gaux,&gauy);
-			hhc = pow(d1, 3. / 5.);
-
-			if (hhc > hhmax && wdepth == NULL) {	/* increased diffusion if w.depth > hhmax */
-			    dif[k][l] = (halpha + 1) * deldif;
-			    velx = vavg[lw][0];
-			    vely = vavg[lw][1];
-			}
-			else {
-			    dif[k][l] = deldif;
-			    velx = v1[k][l];
-			    vely = v2[k][l];
-			}
-
-
-			if (traps != NULL && trap[k][l] != 0.) {	/* traps */
-
-			    eff = simwe_rand();	/* random generator */
-
-			    if (eff <= trap[k][l]) {
-				velx = -0.1 * v1[k][l];	/* move it slightly back */
-				vely = -0.1 * v2[k][l];
-			    }
-			}
-
-
-			w[lw][0] += (velx + dif[k][l] * gaux);	/* move the walker */
-			w[lw][1] += (vely + dif[k][l] * gauy);
-
-			if (hhc > hhmax && wdepth == NULL) {
-			    vavg[lw][0] = hbeta * (vavg[lw][0] + v1[k][l]);
-			    vavg[lw][1] = hbeta * (vavg[lw][1] + v2[k][l]);
-			}
-
-			if (w[lw][0] <= xmin || w[lw][1] <= ymin || w[lw][0]
-			    >= xmax || w[lw][1] >= ymax) {
-			    w[lw][2] = 1e-10;	/* eliminate walker if it is out of area */
-			}
-			else {
-			    if (wdepth != NULL) {
-				l = (int)((w[lw][0] + stxm) / stepx) - mx - 1;
-				k = (int)((w[lw][1] + stym) / stepy) - my - 1;
-				w[lw][2] *= sigma[k][l];
-			    }
-
-			}	/* else */
-		    }		/*DEFined area */
-		    else {
-			w[lw][2] = 1e-10;	/* eliminate walker if it is out of area */
-		    }
+	    /* keep walkers in the same cell close in memory */
+	    if (i % WALKER_SORT_INTERVAL == 1)
+		nwalk = sort_walkers(nwalk, stxm, stym, &sorted,
+				     walker_cells, cell_counts);
+
+	    /* Walkers are split into fixed chunks, one per thread. Each
+	     * chunk adds walker weights (and used infiltration) to its own
+	     * buffer and sees the depth from the previous iteration plus
+	     * its own contributions. The buffers are merged in chunk order
+	     * after the loop, so the result depends only on the seed and
+	     * the number of chunks, even when the runtime grants a smaller
+	     * team than requested. */
+#pragma omp parallel num_threads(nthreads) reduction(+:nwalka)
+	    {
+		int chunk;
+
+		/* the main thread writes the pending time series maps while
+		 * the other threads propagate their walkers */
+#pragma omp master
+		tserie_writer_flush();
+
+#pragma omp for schedule(static, 1)
+		for (chunk = 0; chunk < nthreads; chunk++) {
+		    int begin = (int)((long long)nwalk * chunk / nthreads);
+		    int end = (int)((long long)nwalk * (chunk + 1) / nthreads);
+		    struct simwe_rng rng = rngs[chunk];
+
+		    nwalka += propagate_walkers(begin, end, addac, conn,
+						stxm, stym, gama_part[chunk],
+						inf_part ? inf_part[chunk] : NULL,
+						&rng);
+		    rngs[chunk] = rng;
 		}
-            } /* lw loop */
-}
+	    }
+	    merge_thread_buffers(nthreads, gama_part, inf_part);
             /* Changes made by Soeren 8. Mar 2011 to replace the site walker output implementation */
             /* Save all walkers located within the computational region and with valid 
                z coordinates */
@@ -503,18 +696,18 @@ G_message("miter %d",miter);
                 
                 for (lw = 0; lw < nwalk; lw++) {
                     /* Compute the  elevation raster map index */
-                    l = (int)((w[lw][0] + stxm) / stepx) - mx - 1;
-                    k = (int)((w[lw][1] + stym) / stepy) - my - 1;
+                    l = (int)((walkers.x[lw] + stxm) / stepx) - mx - 1;
+                    k = (int)((walkers.y[lw] + stym) / stepy) - my - 1;
                     
 		    /* Check for correct elevation raster map index */
 		    if(l < 0 || l >= mx || k < 0 || k >= my)
 			 continue;
 
-                    if (w[lw][2] > EPS && zz[k][l] != UNDEF) {
+                    if (walkers.weight[lw] > EPS && zz[k][l] != UNDEF) {
 
                         /* Save the 3d position of the walker */
-                        stack[nstack][0] = mixx / conv + w[lw][0] / conv;
-                        stack[nstack][1] = miyy / conv + w[lw][1] / conv;
+                        stack[nstack][0] = mixx / conv + walkers.x[lw] / conv;
+                        stack[nstack][1] = miyy / conv + walkers.y[lw] / conv;
                         stack[nstack][2] = zz[k][l];
 
                         nstack++;
@@ -529,9 +722,7 @@ G_message("miter %d",miter);
 
                 conn = (double)nblock / (double)iblock;
                 itime = (int)(i * deltap * timec);
-                ii = output_data(itime, conn);
-                if (ii != 1)
-                    G_fatal_error(_("Unable to write raster maps"));
+                tserie_writer_submit(itime, conn);
 	    }
             
             /* Write the water depth each time step at an observation point */
@@ -561,6 +752,17 @@ G_message("miter %d",miter);
                 }
                 fprintf(points.output, "\n");
             }
+
+	    /* save the state to be able to continue later */
+	    if (checkpoint_file != NULL &&
+		(i % checkpoint_step == 0 || i == miter)) {
+		/* time series maps up to this iteration must be on disk
+		 * before the checkpoint says the iteration is done */
+		tserie_writer_flush();
+		cp.iblock = iblock;
+		cp.iteration = i;
+		write_checkpoint(checkpoint_file, &cp);
+	    }
 	}			/* miter */
       L_800:
       /* Soeren 8. Mar 2011: Why is this commented out?*/
@@ -600,6 +802,8 @@ G_message("miter %d",miter);
 #ifdef PARALLEL
     printTimeDiff("L1");
 #endif
+    tserie_writer_finish();
+
     /* Write final maps here because we know the last time stamp here */
     if (ts == 0) {
         conn = (double)nblock / (double)iblock;
@@ -616,4 +820,17 @@ G_message("miter %d",miter);
 #endif 
     points.is_open = 0;
 
+    for (t = 0; t < nthreads; t++) {
+	G_free_matrix(gama_part[t]);
+	if (inf_part)
+	    G_free_matrix(inf_part[t]);
+    }
+    G_free(gama_part);
+    if (inf_part)
+	G_free(inf_part);
+    G_free(rngs);
+    free_walkers(&walkers);
+    free_walkers(&sorted);
+    G_free(walker_cells);
+    G_free(cell_counts);
 }
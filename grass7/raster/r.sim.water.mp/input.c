@@ -126,6 +126,10 @@ void WaterParams_init(struct WaterParams *wp)
     wp->rainval = NULL;
     wp->maninval = NULL;
     wp->infilval = NULL;
+
+    wp->checkpoint_file = NULL;
+    wp->restart_file = NULL;
+    wp->checkpoint_step = 0;
 }
 
 /*!
@@ -232,6 +236,10 @@ void init_library_globals(struct WaterParams *wp)
     rainval = wp->rainval;
     maninval = wp->maninval;
     infilval = wp->infilval;
+
+    checkpoint_file = wp->checkpoint_file;
+    restart_file = wp->restart_file;
+    checkpoint_step = wp->checkpoint_step;
 }
 
 /* we do the allocation inside because we anyway need to set the variables */
@@ -244,7 +252,6 @@ void alloc_grids_water()
     gama = G_alloc_matrix(my, mx);
     if (err != NULL)
         gammas = G_alloc_matrix(my, mx);
-    dif = G_alloc_fmatrix(my, mx);
 }
 
 void alloc_grids_sediment()
@@ -256,7 +263,6 @@ void alloc_grids_sediment()
 
     /* memory allocation for output grids */
 
-    dif = G_alloc_fmatrix(my, mx);
     if (erdep != NULL || et != NULL)
         er = G_alloc_fmatrix(my, mx);
 }
@@ -490,6 +496,13 @@ int grad_check(void)
 
     miter = (int)(timesec / (deltap * timec));	/* number of iterations = number of cells to pass */
     iterout = (int)(iterout / (deltap * timec));	/* number of cells to pass for time series output */
+    /* number of cells to pass between checkpoints */
+    if (checkpoint_step > 0)
+	checkpoint_step = (int)(checkpoint_step / (deltap * timec));
+    else
+	checkpoint_step = iterout;
+    if (checkpoint_step < 1)
+	checkpoint_step = 1;
 
     fprintf(stderr, "\n");
     G_message(_("Min elevation \t= %.2f m\nMax elevation \t= %.2f m\n"), zmin,
@@ -249,6 +249,28 @@ int main(int argc, char *argv[])
 	_("Name for sampling points output text file. For each observation vector point the time series of sediment transport is stored.");
     parm.logfile->guisection = _("Output");
 
+    parm.checkpoint = G_define_standard_option(G_OPT_F_OUTPUT);
+    parm.checkpoint->key = "checkpoint";
+    parm.checkpoint->required = NO;
+    parm.checkpoint->description =
+	_("Name for checkpoint file to be able to restart the simulation");
+    parm.checkpoint->guisection = _("Checkpoint");
+
+    parm.checkpoint_step = G_define_option();
+    parm.checkpoint_step->key = "checkpoint_step";
+    parm.checkpoint_step->type = TYPE_INTEGER;
+    parm.checkpoint_step->required = NO;
+    parm.checkpoint_step->description =
+	_("Time interval for writing the checkpoint [minutes], default is output_step");
+    parm.checkpoint_step->guisection = _("Checkpoint");
+
+    parm.restart = G_define_standard_option(G_OPT_F_INPUT);
+    parm.restart->key = "restart";
+    parm.restart->required = NO;
+    parm.restart->description =
+	_("Name of checkpoint file to restart the simulation from");
+    parm.restart->guisection = _("Checkpoint");
+
     parm.nwalk = G_define_option();
     parm.nwalk->key = "nwalkers";
     parm.nwalk->type = TYPE_INTEGER;
@@ -335,6 +357,8 @@ int main(int argc, char *argv[])
     flag.tserie->description = _("Time-series output");
     flag.tserie->guisection = _("Output");
 
+    G_option_requires(parm.checkpoint_step, parm.checkpoint, NULL);
+
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
 
@@ -393,11 +417,15 @@ int main(int argc, char *argv[])
     wp.disch = parm.disch->answer;
     wp.err = parm.err->answer;
     wp.outwalk = parm.outwalk->answer; 
+    wp.checkpoint_file = parm.checkpoint->answer;
+    wp.restart_file = parm.restart->answer;
 
     G_debug(3, "Parsing numeric parameters");
 
     sscanf(parm.niter->answer, "%d", &wp.timesec);
     sscanf(parm.outiter->answer, "%d", &wp.iterout);
+    if (parm.checkpoint_step->answer)
+	sscanf(parm.checkpoint_step->answer, "%d", &wp.checkpoint_step);
     sscanf(parm.diffc->answer, "%lf", &wp.frac);
     sscanf(parm.hmax->answer, "%lf", &wp.hhmax);
     sscanf(parm.halpha->answer, "%lf", &wp.halpha);
@@ -496,6 +524,7 @@ int main(int argc, char *argv[])
      * to real timesec in seconds */
     wp.timesec = wp.timesec * 60.0;
     wp.iterout = wp.iterout * 60.0;
+    wp.checkpoint_step = wp.checkpoint_step * 60.0;
     if ((wp.timesec / wp.iterout) > 100.0 && wp.ts == 1)
 	G_message(_("More than 100 files are going to be created !!!!!"));
 
@@ -13,12 +13,16 @@
 #include "waterglobs.h"
 
 
-static void output_walker_as_vector(int tt_minutes, int ndigit, struct TimeStamp *timestamp);
+static void output_walker_as_vector(int tt_minutes, int ndigit,
+				    struct TimeStamp *timestamp,
+				    double (*stack)[3], int nstack);
 
 /* This function was added by Soeren 8. Mar 2011     */
 /* It replaces the site walker output implementation */
 /* Only the 3d coordinates of the walker are stored. */
-void output_walker_as_vector(int tt_minutes, int ndigit, struct TimeStamp *timestamp)
+void output_walker_as_vector(int tt_minutes, int ndigit,
+			     struct TimeStamp *timestamp,
+			     double (*stack)[3], int nstack)
 {
     char buf[GNAME_MAX + 10];
     char *outwalk_time = NULL;
@@ -74,10 +78,42 @@ void output_walker_as_vector(int tt_minutes, int ndigit, struct TimeStamp *times
     return;
 }
 
+/*!
+ * \brief Write output maps for the current state of the simulation
+ *
+ * \param tt simulation time in seconds
+ * \param ft weight of the block (currently unused)
+ */
+int output_data(int tt, double ft)
+{
+    struct output_snapshot snapshot;
+
+    snapshot.tt = tt;
+    snapshot.ft = ft;
+    snapshot.gama = gama;
+    snapshot.gammas = gammas;
+    snapshot.er = er;
+    snapshot.stack = stack;
+    snapshot.nstack = nstack;
+    return output_snapshot_data(&snapshot);
+}
+
 /* Soeren 8. Mar 2011 TODO: 
  * This function needs to be refractured and splittet into smaller parts */
-int output_data(int tt, double ft)
+/*!
+ * \brief Write output maps from a snapshot of the grids and walkers
+ *
+ * The grids which change during the simulation are taken from
+ * the snapshot, so the maps can be written while the simulation
+ * continues (see tserie_writer_submit()).
+ */
+int output_snapshot_data(const struct output_snapshot *snapshot)
 {
+    /* shadow the global grids by the snapshot */
+    int tt = snapshot->tt;
+    double **gama = snapshot->gama;
+    double **gammas = snapshot->gammas;
+    float **er = snapshot->er;
 
     FCELL *depth_cell, *disch_cell, *err_cell;
     FCELL *conc_cell, *flux_cell, *erdep_cell;
@@ -120,7 +156,8 @@ int output_data(int tt, double ft)
     G_scan_timestamp(&timestamp, timestamp_buf);
 
     /* Write the output walkers */
-    output_walker_as_vector(tt_minutes, ndigit, &timestamp);
+    output_walker_as_vector(tt_minutes, ndigit, &timestamp, snapshot->stack,
+			    snapshot->nstack);
 
     /* we write in the same region as we used for reading */
 
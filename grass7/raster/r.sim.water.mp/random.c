@@ -46,13 +46,40 @@ double gasdev(void)
     return ret_val;
 }				/* gasdev */
 
-void gasdev_for_paralel(double *x, double *y )
+/*!
+ * \brief Initialize an independent random stream
+ *
+ * Streams with the same seed and a different stream number
+ * (e.g., thread number) give different sequences, so each thread
+ * can have its own generator and results are reproducible.
+ */
+void simwe_rng_init(struct simwe_rng *rng, unsigned long seed, int stream)
+{
+    rng->state = (uint64_t)seed * 0x9E3779B97F4A7C15ULL;
+    rng->state ^= ((uint64_t)stream + 1) * 0xBF58476D1CE4E5B9ULL;
+}
+
+/*! \brief Uniform random number in [0, 1) (SplitMix64) */
+double simwe_rng_rand(struct simwe_rng *rng)
+{
+    uint64_t z;
+
+    rng->state += 0x9E3779B97F4A7C15ULL;
+    z = rng->state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (double)(z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*! \brief Pair of normal random numbers (polar Box-Muller) */
+void simwe_rng_gasdev(struct simwe_rng *rng, double *x, double *y)
 {
     double r = 0., vv1, vv2, fac;
 
     while (r >= 1. || r == 0.) {
-        vv1 = simwe_rand() * 2. - 1.;
-        vv2 = simwe_rand() * 2. - 1.;
+        vv1 = simwe_rng_rand(rng) * 2. - 1.;
+        vv2 = simwe_rng_rand(rng) * 2. - 1.;
         r = vv1 * vv1 + vv2 * vv2;
     }
     fac = sqrt(log(r) * -2. / r);
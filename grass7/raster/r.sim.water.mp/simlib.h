@@ -73,6 +73,10 @@ struct WaterParams
     char *rainval;
     char *maninval;
     char *infilval;
+
+    char *checkpoint_file;
+    char *restart_file;
+    int checkpoint_step;
 };
 
 void WaterParams_init(struct WaterParams *wp);
@@ -93,7 +97,7 @@ struct options
 	*observation, *depth, *disch, *err, *outwalk, *nwalk, *niter, *outiter,
 	*density, *diffc, *hmax, *halpha, *hbeta, *wdepth, *detin, *tranin,
 	*tauin, *tc, *et, *conc, *flux, *erdep, *rainval, *maninval,
-	*infilval, *logfile;
+	*infilval, *logfile, *checkpoint, *checkpoint_step, *restart;
 };
 #endif
 
@@ -107,7 +111,8 @@ struct options
 	*observation, *depth, *disch, *err, *outwalk, *nwalk, *niter, *outiter,
 	*density, *diffc, *hmax, *halpha, *hbeta, *wdepth, *detin, *tranin,
 	*tauin, *tc, *et, *conc, *flux, *erdep, *rainval, *maninval,
-	*infilval, *logfile, *threads;
+	*infilval, *logfile, *checkpoint, *checkpoint_step, *restart,
+	*threads;
 };
 #endif
 
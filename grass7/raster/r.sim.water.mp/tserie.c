@@ -0,0 +1,138 @@
+/****************************************************************************
+ *
+ * MODULE:       simwe library
+ * PURPOSE:      Writing time series output from snapshots
+ *
+ * COPYRIGHT:    (C) 2020 by the GRASS Development Team
+ *
+ *               This program is free software under the GNU General Public
+ *               License (>=v2). Read the file COPYING that comes with GRASS
+ *               for details.
+ *
+ *****************************************************************************/
+
+/* tserie.c (simlib) */
+
+#include <string.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+
+#include "waterglobs.h"
+#include "simlib.h"
+
+/*
+ * The main loop puts a copy of the grids into a pending snapshot and
+ * the main thread writes it using output_snapshot_data() during the next
+ * walker propagation, while the other threads propagate their walkers
+ * (see tserie_writer_flush()). The raster and vector libraries are only
+ * called from the main thread and never while another thread could call
+ * them.
+ */
+
+static struct output_snapshot *pending;
+static int writer_running;
+
+static double **copy_matrix(double **matrix)
+{
+    double **copy;
+
+    if (matrix == NULL)
+	return NULL;
+    copy = G_alloc_matrix(my, mx);
+    memcpy(copy[0], matrix[0], (size_t)mx * my * sizeof(double));
+    return copy;
+}
+
+static float **copy_fmatrix(float **matrix)
+{
+    float **copy;
+
+    if (matrix == NULL)
+	return NULL;
+    copy = G_alloc_fmatrix(my, mx);
+    memcpy(copy[0], matrix[0], (size_t)mx * my * sizeof(float));
+    return copy;
+}
+
+static void free_snapshot(struct output_snapshot *snapshot)
+{
+    if (snapshot->gama)
+	G_free_matrix(snapshot->gama);
+    if (snapshot->gammas)
+	G_free_matrix(snapshot->gammas);
+    if (snapshot->er)
+	G_free_fmatrix(snapshot->er);
+    G_free(snapshot->stack);
+    G_free(snapshot);
+}
+
+/*!
+ * \brief Start writing the time series output from snapshots
+ */
+void tserie_writer_start(void)
+{
+    pending = NULL;
+    writer_running = 1;
+}
+
+/*!
+ * \brief Write the pending time series output, if any
+ *
+ * Must be called by the main thread. It may be called from within
+ * a parallel region as long as the other threads do not call the GRASS
+ * libraries meanwhile.
+ */
+void tserie_writer_flush(void)
+{
+    if (pending == NULL)
+	return;
+    if (output_snapshot_data(pending) != 1)
+	G_fatal_error(_("Unable to write raster maps"));
+    free_snapshot(pending);
+    pending = NULL;
+}
+
+/*!
+ * \brief Keep output maps for the current state of the simulation
+ *
+ * The grids and walkers are copied, so the simulation can continue
+ * right away. An output still pending from an earlier call is written
+ * first.
+ *
+ * \param tt simulation time in seconds
+ * \param ft weight of the block
+ */
+void tserie_writer_submit(int tt, double ft)
+{
+    struct output_snapshot *snapshot;
+
+    if (!writer_running) {
+	if (output_data(tt, ft) != 1)
+	    G_fatal_error(_("Unable to write raster maps"));
+	return;
+    }
+
+    tserie_writer_flush();
+
+    snapshot = (struct output_snapshot *)G_malloc(sizeof(*snapshot));
+    snapshot->tt = tt;
+    snapshot->ft = ft;
+    snapshot->gama = copy_matrix(gama);
+    snapshot->gammas = copy_matrix(gammas);
+    snapshot->er = copy_fmatrix(er);
+    snapshot->nstack = nstack;
+    snapshot->stack = G_malloc((nstack > 0 ? nstack : 1) * sizeof(double[3]));
+    memcpy(snapshot->stack, stack, nstack * sizeof(double[3]));
+    pending = snapshot;
+}
+
+/*!
+ * \brief Write the pending output and stop using snapshots
+ */
+void tserie_writer_finish(void)
+{
+    if (!writer_running)
+	return;
+    tserie_writer_flush();
+    writer_running = 0;
+}
@@ -4,7 +4,9 @@
 #define EPS     1.e-7
 #define MAXW    20000000
 #define UNDEF	-9999
+#define WALKER_SORT_INTERVAL 10	/* iterations between sorting walkers */
 
+#include <stdint.h>
 #include <grass/raster.h>
 
 extern char *elevin;
@@ -23,6 +25,9 @@ extern char *logfile;
 extern char *mapset;
 extern char *mscale;
 extern char *tserie;
+extern char *checkpoint_file;
+extern char *restart_file;
+extern int checkpoint_step;
 
 extern char *wdepth;
 extern char *detin;
@@ -45,6 +50,12 @@ struct seed
 
 extern struct seed seed;
 
+/* state of a per-thread random number stream */
+struct simwe_rng
+{
+    uint64_t state;
+};
+
 struct _points
 {
     double *x; /* x coor for each point */
@@ -61,7 +72,10 @@ extern void erod(double **);
 extern int output_et(void);
 extern double simwe_rand(void);
 extern double gasdev(void);
-extern void gasdev_for_paralel(double *x, double *y);
+extern void simwe_rng_init(struct simwe_rng *rng, unsigned long seed,
+			   int stream);
+extern double simwe_rng_rand(struct simwe_rng *rng);
+extern void simwe_rng_gasdev(struct simwe_rng *rng, double *x, double *y);
 extern double amax1(double, double);
 extern double amin1(double, double);
 extern int min(int, int);
@@ -84,10 +98,48 @@ extern float **zz, **cchez;
 extern double **v1, **v2, **slope;
 extern double **gama, **gammas, **si, **inf, **sigma;
 extern float **dc, **tau, **er, **ct, **trap;
-extern float **dif;
 
-extern double vavg[MAXW][2], stack[MAXW][3], w[MAXW][3]; 
-extern int iflag[MAXW];
+/* walker state as structure of arrays (one array per variable) */
+struct walkers
+{
+    int size;			/* allocated number of walkers */
+    double *x, *y;		/* position */
+    double *weight;		/* weight (water or sediment) */
+    double *vx, *vy;		/* velocity averaged along the path */
+};
+
+extern struct walkers walkers;
+extern double stack[MAXW][3];
+extern void alloc_walkers(struct walkers *wk, int size);
+
+/* position in the simulation stored in a checkpoint */
+struct checkpoint
+{
+    int iblock;			/* block of walkers */
+    int iteration;		/* last finished iteration */
+    int nthreads;		/* number of random streams */
+    struct simwe_rng *rngs;	/* random streams (one per thread) */
+};
+
+extern void write_checkpoint(const char *name, const struct checkpoint *cp);
+extern int read_checkpoint(const char *name, struct checkpoint *cp);
+
+/* grids and walkers for writing the output maps */
+struct output_snapshot
+{
+    int tt;			/* simulation time in seconds */
+    double ft;
+    double **gama, **gammas;
+    float **er;
+    double (*stack)[3];
+    int nstack;
+};
+
+extern int output_snapshot_data(const struct output_snapshot *snapshot);
+extern void tserie_writer_start(void);
+extern void tserie_writer_submit(int tt, double ft);
+extern void tserie_writer_flush(void);
+extern void tserie_writer_finish(void);
 
 extern double hbeta;
 extern double hhmax, sisum, vmean;
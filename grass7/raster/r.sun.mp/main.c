@@ -73,6 +73,9 @@ email: hofierka@geomodel.sk,marcel.suri@jrc.it,suri@geomodel.sk Thomas.Huld@jrc.
 #define DIST     "1.0"
 
 #define SCALING_FACTOR 150.
+/* size of the blocks of cells processed by one thread */
+#define TILE_ROWS 16
+#define TILE_COLS 64
 const double invScale = 1. / SCALING_FACTOR;
 
 #define AMAX1(arg1, arg2) ((arg1) >= (arg2) ? (arg1) : (arg2))
@@ -80,6 +83,15 @@ const double invScale = 1. / SCALING_FACTOR;
 #define DISTANCE1(x1, x2, y1, y2) (sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2)))
 #define DISTANCE2(x00, y00) ((xx0 - x00)*(xx0 - x00) + (yy0 - y00)*(yy0 - y00))
 
+/* geometry of a cell which does not change from day to day,
+ * kept between the days of a period */
+struct CellGeometry
+{
+    double latitude, longitude;	/* [rad] */
+    double longit_l;		/* longitude of the inclined plane */
+    double cos_latid_l, sin_latid_l;	/* latitude of the inclined plane */
+};
+
 const double pihalf = M_PI * 0.5;
 const double pi2 = M_PI * 2.;
 const double deg2rad = M_PI / 180.;
@@ -119,12 +131,16 @@ struct History hist;
 
 
 int INPUT_part(int offset, double *zmax);
-int OUTGR(void);
+int OUTGR(int);
+void history(int, struct SunGeometryConstDay *,
+	     struct SunGeometryVarDay *, struct SolarRadVar *);
 int min(int, int);
 int max(int, int);
 
 void cube(int, int);
 void (*func) (int, int);
+void compute_horizons(unsigned char *horizons, struct GridGeometry *gridGeom,
+		      double zmax);
 
 #ifdef PARALLEL
 
@@ -167,8 +183,9 @@ double com_declin(int);
 
 int n, m, ip, jp;
 int d, day;
+int startDay, endDay, dayStep = 1, numDays = 1;	/* period of days */
+int dailyMaps = FALSE;		/* write maps for each day of the period */
 int saveMemory, numPartitions = 1;
-long int shadowoffset = 0;
 int varCount_global = 0;
 int bitCount_global = 0;
 int arrayNumInt = 1;
@@ -180,6 +197,7 @@ double sunrise_min = 24., sunrise_max = 0., sunset_min = 24., sunset_max = 0.;
 
 float **lumcl, **beam, **insol, **diff, **refl, **globrad;
 unsigned char *horizonarray = NULL;
+int horizonCache = FALSE;	/* horizons computed in memory from elevation */
 double civilTime;
 
 /*
@@ -195,7 +213,6 @@ char *ttime;
 /*
  * double slope;
  */
-double o_orig, z1;
 
 /*
  * double lum_C11, lum_C13, lum_C22, lum_C31, lum_C33;
@@ -226,6 +243,7 @@ double TOLER;
 
 int ll_correction = FALSE;
 double coslatsq;
+#pragma omp threadprivate(coslatsq)
 
 /* why not use G_distance() here which switches to geodesic/great
   circle distace as needed? */
@@ -260,7 +278,8 @@ int main(int argc, char *argv[])
 	struct Option *elevin, *aspin, *aspect, *slopein, *slope, *linkein,
 	    *lin, *albedo, *longin, *alb, *latin, *coefbh, *coefdh,
 	    *incidout, *beam_rad, *insol_time, *diff_rad, *refl_rad,
-	    *glob_rad, *day, *step, *declin, *ltime, *dist, *horizon,
+	    *glob_rad, *day, *endday, *daystep, *step, *declin, *ltime,
+	    *dist, *horizon,
 	    *horizonstep, *numPartitions, *civilTime, *threads;
     }
     parm;
@@ -272,7 +291,8 @@ int main(int argc, char *argv[])
 	struct Option *elevin, *aspin, *aspect, *slopein, *slope, *linkein,
 	    *lin, *albedo, *longin, *alb, *latin, *coefbh, *coefdh,
 	    *incidout, *beam_rad, *insol_time, *diff_rad, *refl_rad,
-	    *glob_rad, *day, *step, *declin, *ltime, *dist, *horizon,
+	    *glob_rad, *day, *endday, *daystep, *step, *declin, *ltime,
+	    *dist, *horizon,
 	    *horizonstep, *numPartitions, *civilTime;
     }
     parm;
@@ -280,7 +300,7 @@ int main(int argc, char *argv[])
 
     struct
     {
-	struct Flag *noshade, *saveMemory;
+	struct Flag *noshade, *saveMemory, *daily;
     }
     flag;
 
@@ -432,7 +452,8 @@ int main(int argc, char *argv[])
     parm.horizonstep->type = TYPE_DOUBLE;
     parm.horizonstep->required = NO;
     parm.horizonstep->description =
-	_("Angle step size for multidirectional horizon [degrees]");
+	_("Angle step size for multidirectional horizon [degrees]"
+	  " (without horizon_basename horizons are computed in memory)");
     parm.horizonstep->guisection = _("Input");
 
     parm.incidout = G_define_option();
@@ -497,6 +518,25 @@ int main(int argc, char *argv[])
     parm.day->options = "1-365";
     parm.day->guisection = _("Time");
 
+    parm.endday = G_define_option();
+    parm.endday->key = "end_day";
+    parm.endday->type = TYPE_INTEGER;
+    parm.endday->required = NO;
+    parm.endday->description =
+	_("No. of the last day of a period starting at day (1-365)");
+    parm.endday->options = "1-365";
+    parm.endday->guisection = _("Time");
+
+    parm.daystep = G_define_option();
+    parm.daystep->key = "day_step";
+    parm.daystep->type = TYPE_INTEGER;
+    parm.daystep->answer = "1";
+    parm.daystep->required = NO;
+    parm.daystep->description =
+	_("Step between the days of the period [days]");
+    parm.daystep->options = "1-364";
+    parm.daystep->guisection = _("Time");
+
     parm.step = G_define_option();
     parm.step->key = "step";
     parm.step->type = TYPE_DOUBLE;
@@ -581,6 +621,12 @@ int main(int argc, char *argv[])
     flag.saveMemory->description =
 	_("Use the low-memory version of the program");
 
+    flag.daily = G_define_flag();
+    flag.daily->key = 'd';
+    flag.daily->description =
+	_("Write also maps for each day of the period (output_day)");
+    flag.daily->guisection = _("Output");
+
 
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
@@ -668,6 +714,27 @@ int main(int argc, char *argv[])
 	G_fatal_error(_("insol_time and incidout are incompatible options"));
 
     sscanf(parm.day->answer, "%d", &day);
+    startDay = endDay = day;
+    if (parm.endday->answer != NULL) {
+	sscanf(parm.endday->answer, "%d", &endDay);
+	sscanf(parm.daystep->answer, "%d", &dayStep);
+	if (endDay < startDay)
+	    G_fatal_error(_("The end day must not be before the start day"));
+	if (parm.ltime->answer != NULL)
+	    G_fatal_error(_("A period of days can be only used for"
+			    " integrated daily irradiation (without time)"));
+	if (parm.declin->answer != NULL)
+	    G_fatal_error(_("A period of days can not be used with a"
+			    " given declination"));
+	numDays = (endDay - startDay) / dayStep + 1;
+	endDay = startDay + (numDays - 1) * dayStep;
+	if (dayStep > 1)
+	    G_warning(_("The maps for the period are sums of every %d. day"),
+		      dayStep);
+    }
+    dailyMaps = flag.daily->answer;
+    if (dailyMaps && numDays == 1)
+	G_fatal_error(_("Flag -%c requires end_day"), flag.daily->key);
 
     if (sscanf(parm.step->answer, "%lf", &step) != 1)
 	G_fatal_error(_("Error reading time step size"));
@@ -687,6 +754,10 @@ int main(int argc, char *argv[])
 	G_fatal_error(_("If you use the horizon option you must also set the 'horizonstep' parameter."));
     }
 
+    /* horizon step without horizon rasters: compute horizons in memory */
+    horizonCache = useShadow() && !useHorizonData() &&
+	(parm.horizonstep->answer != NULL);
+
     ttime = parm.ltime->answer;
     if (parm.ltime->answer != NULL) {
 	if (insol_time != NULL)
@@ -764,6 +835,9 @@ int main(int argc, char *argv[])
 	     */
 	    G_fatal_error(_("If you use -s and no horizon rasters, numpartitions must be =1"));
 	}
+	/* all days of a period are computed from inputs read once */
+	if (numDays > 1 && numPartitions != 1)
+	    G_fatal_error(_("If you use end_day, numpartitions must be =1"));
     }
 
     gridGeom.stepxy = dist * 0.5 * (gridGeom.stepx + gridGeom.stepy);
@@ -800,6 +874,8 @@ int main(int argc, char *argv[])
 	    arrayNumInt = (int)(360. / horizonStep);
 	}
     }
+    if (horizonCache)
+	arrayNumInt = (int)(360. / horizonStep);
 
     if (ttime != NULL) {
 
@@ -858,7 +934,7 @@ int main(int argc, char *argv[])
     G_debug(3, "calculate() starts...");
     calculate(singleSlope, singleAspect, singleAlbedo, singleLinke, gridGeom);
     G_debug(3, "OUTGR() starts...");
-    OUTGR();
+    OUTGR(0);
 #ifdef PARALLEL
     printTimeDiff("M4");
 #endif
@@ -1287,41 +1363,62 @@ int INPUT_part(int offset, double *zmax)
     return 1;
 }
 
-int OUTGR(void)
+/* name of an output map, with the day appended for the maps of one day */
+static void output_name(char *buf, const char *name, int outDay)
+{
+    if (name == NULL)
+	return;
+    if (outDay > 0)
+	snprintf(buf, GNAME_MAX, "%s_%03d", name, outDay);
+    else
+	snprintf(buf, GNAME_MAX, "%s", name);
+}
+
+/* write the output maps, outDay > 0 for the maps of one day of a period */
+int OUTGR(int outDay)
 {
     FCELL *cell7 = NULL, *cell8 = NULL, *cell9 = NULL, *cell10 =
 	NULL, *cell11 = NULL, *cell12 = NULL;
     int fd7 = -1, fd8 = -1, fd9 = -1, fd10 = -1, fd11 = -1, fd12 = -1;
     int i, iarc, j;
+    char incid_name[GNAME_MAX], beam_name[GNAME_MAX], insol_name[GNAME_MAX],
+	diff_name[GNAME_MAX], refl_name[GNAME_MAX], glob_name[GNAME_MAX];
+
+    output_name(incid_name, incidout, outDay);
+    output_name(beam_name, beam_rad, outDay);
+    output_name(insol_name, insol_time, outDay);
+    output_name(diff_name, diff_rad, outDay);
+    output_name(refl_name, refl_rad, outDay);
+    output_name(glob_name, glob_rad, outDay);
 
     if (incidout != NULL) {
 	cell7 = Rast_allocate_f_buf();
-	fd7 = Rast_open_fp_new(incidout);
+	fd7 = Rast_open_fp_new(incid_name);
     }
 
     if (beam_rad != NULL) {
 	cell8 = Rast_allocate_f_buf();
-	fd8 = Rast_open_fp_new(beam_rad);
+	fd8 = Rast_open_fp_new(beam_name);
     }
 
     if (insol_time != NULL) {
 	cell11 = Rast_allocate_f_buf();
-	fd11 = Rast_open_fp_new(insol_time);
+	fd11 = Rast_open_fp_new(insol_name);
     }
 
     if (diff_rad != NULL) {
 	cell9 = Rast_allocate_f_buf();
-	fd9 = Rast_open_fp_new(diff_rad);
+	fd9 = Rast_open_fp_new(diff_name);
     }
 
     if (refl_rad != NULL) {
 	cell10 = Rast_allocate_f_buf();
-	fd10 = Rast_open_fp_new(refl_rad);
+	fd10 = Rast_open_fp_new(refl_name);
     }
 
     if (glob_rad != NULL) {
 	cell12 = Rast_allocate_f_buf();
-	fd12 = Rast_open_fp_new(glob_rad);
+	fd12 = Rast_open_fp_new(glob_name);
     }
 
     if (m != Rast_window_rows())
@@ -1397,29 +1494,36 @@ int OUTGR(void)
 
     if (incidout != NULL) {
 	Rast_close(fd7);
-	Rast_write_history(incidout, &hist);
+	Rast_write_history(incid_name, &hist);
     }
     if (beam_rad != NULL) {
 	Rast_close(fd8);
-	Rast_write_history(beam_rad, &hist);
+	Rast_write_history(beam_name, &hist);
     }
     if (diff_rad != NULL) {
 	Rast_close(fd9);
-	Rast_write_history(diff_rad, &hist);
+	Rast_write_history(diff_name, &hist);
     }
     if (refl_rad != NULL) {
 	Rast_close(fd10);
-	Rast_write_history(refl_rad, &hist);
+	Rast_write_history(refl_name, &hist);
     }
     if (insol_time != NULL) {
 	Rast_close(fd11);
-	Rast_write_history(insol_time, &hist);
+	Rast_write_history(insol_name, &hist);
     }
     if (glob_rad != NULL) {
 	Rast_close(fd12);
-	Rast_write_history(glob_rad, &hist);
+	Rast_write_history(glob_name, &hist);
     }
 
+    G_free(cell7);
+    G_free(cell8);
+    G_free(cell9);
+    G_free(cell10);
+    G_free(cell11);
+    G_free(cell12);
+
     return 1;
 }
 
@@ -1631,6 +1735,83 @@ void where_is_point(double *length, struct SunGeometryVarDay *sunVarGeom,
     }
 }
 
+/*
+ * Compute the horizon angle in all directions of the horizon step for all
+ * cells. The terrain is searched along the same lines as searching() does
+ * for each time step, but only once per direction, so shadows are then
+ * found by interpolation in the horizon array like with horizon rasters.
+ * Angles below the horizontal plane are stored as 0.
+ */
+void compute_horizons(unsigned char *horizons, struct GridGeometry *gridGeom,
+		      double zmax)
+{
+    int row;
+
+#pragma omp parallel for schedule(dynamic)
+    for (row = 0; row < m; row++) {
+	int col, k;
+
+	for (col = 0; col < n; col++) {
+	    unsigned char *horizonpointer =
+		horizons + (size_t)arrayNumInt * ((size_t)row * n + col);
+	    double xg0 = (double)col * gridGeom->stepx;
+	    double yg0 = (double)row * gridGeom->stepy;
+	    double z_orig = z[row][col];
+	    double cosl = 1.;
+
+	    if (ll_correction) {
+		double coslat = cos(deg2rad * (ymin + yg0));
+
+		cosl = coslat * coslat;
+	    }
+
+	    for (k = 0; k < arrayNumInt; k++) {
+		double angle = k * getHorizonInterval();
+		double stepcos = gridGeom->stepxy * cos(angle);
+		double stepsin = gridGeom->stepxy * sin(angle);
+		double xx0 = xg0, yy0 = yg0, zp = z_orig;
+		double length, dx, dy, curvature_diff, tanh = 0.;
+		int i, j;
+
+		while (zp != UNDEFZ) {
+		    xx0 += stepcos;
+		    yy0 += stepsin;
+		    if (((xx0 + (0.5 * gridGeom->stepx)) < 0)
+			|| ((xx0 + (0.5 * gridGeom->stepx)) > gridGeom->deltx)
+			|| ((yy0 + (0.5 * gridGeom->stepy)) < 0)
+			|| ((yy0 + (0.5 * gridGeom->stepy)) > gridGeom->delty))
+			break;
+
+		    i = (int)(xx0 * invstepx + offsetx);
+		    j = (int)(yy0 * invstepy + offsety);
+		    if (i > n - 1 || j > m - 1)
+			continue;
+
+		    /* dist from orig. grid point to the current grid point */
+		    dx = xg0 - (double)i * gridGeom->stepx;
+		    dy = yg0 - (double)j * gridGeom->stepy;
+		    if (ll_correction)
+			length = DEGREEINMETERS * sqrt(cosl * dx * dx + dy * dy);
+		    else
+			length = sqrt(dx * dx + dy * dy);
+		    zp = z[j][i];
+		    if (length <= 0.)
+			continue;
+
+		    curvature_diff = EARTHRADIUS * (1. - cos(length / EARTHRADIUS));
+		    if (zp != UNDEFZ)
+			tanh = AMAX1(tanh, (zp - z_orig - curvature_diff) / length);
+		    if (z_orig + curvature_diff + length * tanh > zmax)
+			break;	/* nothing further can be higher */
+		}
+		horizonpointer[k] =
+		    (unsigned char)rint(SCALING_FACTOR *
+					AMIN1(atan(tanh), 255 * invScale));
+	    }
+	}
+    }
+}
+
 /*
  * void vertex(jmin, imin)
  * int jmin, imin;
@@ -1781,6 +1962,28 @@ void cube(jmin, imin)
 
 /*////////////////////////////////////////////////////////////////////// */
 
+static float **alloc_undef_matrix(void)
+{
+    float **matrix = G_alloc_fmatrix(m, n);
+    int i, j;
+
+    for (j = 0; j < m; j++)
+	for (i = 0; i < n; i++)
+	    matrix[j][i] = UNDEFZ;
+
+    return matrix;
+}
+
+/* free a matrix allocated row by row in calculate() */
+static void free_day_matrix(float **matrix)
+{
+    int j;
+
+    for (j = 0; j < m; j++)
+	G_free(matrix[j]);
+    G_free(matrix);
+}
+
 void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 	       double singleLinke, struct GridGeometry gridGeom)
 {
@@ -1789,16 +1992,14 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
     /*                      double energy; */
     int someRadiation;
     int numRows;
-    int arrayOffset;
-    double lum, q1;
+    int j0, j1, tj, ti;
+    long cells_done = 0;
     double dayRad;
-    double latid_l, cos_u, cos_v, sin_u, sin_v;
-    double sin_phi_l, tan_lam_l;
-    double zmax;
-    double longitTime = 0.;
+    double zmax = UNDEFZ;
     double locTimeOffset;
-    double latitude, longitude;
-    double coslat;
+    float **beamSum = NULL, **insolSum = NULL, **diffSum = NULL,
+	**reflSum = NULL, **globSum = NULL;
+    struct CellGeometry *cellGeom = NULL;
 
 
     struct SunGeometryConstDay sunGeom;
@@ -1813,10 +2014,6 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
     sunRadVar.cbh = 1.0;
     sunRadVar.cdh = 1.0;
 
-    sunGeom.sindecl = sin(declination);
-    sunGeom.cosdecl = cos(declination);
-
-
     someRadiation = (beam_rad != NULL) || (insol_time != NULL) ||
 	(diff_rad != NULL) || (refl_rad != NULL) || (glob_rad != NULL);
 
@@ -1963,236 +2160,391 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
     }
 
 
-    sunRadVar.G_norm_extra = com_sol_const(day);
+    if (numDays > 1) {
+	/* sums over the period, the matrices above hold one day */
+	if (beam_rad != NULL)
+	    beamSum = alloc_undef_matrix();
+	if (insol_time != NULL)
+	    insolSum = alloc_undef_matrix();
+	if (diff_rad != NULL)
+	    diffSum = alloc_undef_matrix();
+	if (refl_rad != NULL)
+	    reflSum = alloc_undef_matrix();
+	if (glob_rad != NULL)
+	    globSum = alloc_undef_matrix();
+	cellGeom = (struct CellGeometry *)G_malloc((size_t)m * n *
+						  sizeof(struct CellGeometry));
+    }
 
     numRows = m / numPartitions;
 
-    if (useCivilTime()) {
-	/* We need to calculate the deviation of the local solar time from the 
-	 * "local clock time". */
-	dayRad = 2. * M_PI * day / 365.25;
-	locTimeOffset =
-	    +0.128 * sin(dayRad - 0.04887) + 0.165 * sin(2 * dayRad +
-							 0.34383);
-
-	/* Time offset due to timezone as input by user */
-
-	locTimeOffset += civilTime;
-	setTimeOffset(locTimeOffset);
-    }
-    else {
-	setTimeOffset(0.);
-    }
 #ifdef PARALLEL
     printTimeDiff("M2");
 #endif
-    int shadowoffset_base = shadowoffset;
-    for (j = 0; j < m; j++) {
-	G_percent(j, m - 1, 2);
-
-	if (j % (numRows) == 0) {
-	    INPUT_part(j, &zmax);
-	    arrayOffset = 0;
-	    shadowoffset = 0;
-	}
+    for (j0 = 0; j0 < m; j0 += numRows) {
+	/* rows of this partition */
+	j1 = AMIN1(j0 + numRows, m);
+	INPUT_part(j0, &zmax);
 	sunVarGeom.zmax = zmax;
-        shadowoffset_base = (j % (numRows)) * n * arrayNumInt;
-  #pragma omp parallel firstprivate(q1,tan_lam_l,z1,i,shadowoffset,longitTime,coslat,coslatsq,func,latitude,longitude,sin_phi_l,latid_l,sin_u,cos_u,sin_v,cos_v,lum, gridGeom,sunGeom,sunVarGeom,sunSlopeGeom,sunRadVar, elevin,aspin,slopein,civiltime,linkein,albedo,latin,coefbh,coefdh,incidout,longin,horizon,beam_rad,insol_time,diff_rad,refl_rad,glob_rad,mapset,per,decimals,str_step )
-{
-      #pragma omp for schedule(dynamic) 
-	for (i = 0; i < n; i++) {  
-            shadowoffset = shadowoffset_base + (arrayNumInt * i);
-    //G_message("\n tid: %d", omp_get_thread_num());
-	    if (useCivilTime()) {
-		/* sun travels 15deg per hour, so 1 TZ every 15 deg and 15 TZs * 24hrs = 360deg */
-		longitTime = -longitudeArray[arrayOffset][i] / 15.;
+
+	if (horizonCache && horizonarray == NULL) {
+	    /* one partition covers all rows when shadows are computed */
+	    horizonarray = (unsigned char *)G_malloc((size_t)arrayNumInt *
+						     m * n);
+	    G_message(_("Computing horizons..."));
+	    compute_horizons(horizonarray, &gridGeom, zmax);
+	    setUseHorizonData(1);
+	}
+
+	/* inputs and horizons are read once for all days of a period
+	 * (which has only one partition) */
+	for (day = startDay; day <= endDay; day += dayStep) {
+	    if (numDays > 1) {
+		declination = com_declin(day);
+		G_verbose_message(_("Day %d"), day);
 	    }
+	    sunGeom.sindecl = sin(declination);
+	    sunGeom.cosdecl = cos(declination);
+	    sunRadVar.G_norm_extra = com_sol_const(day);
 
-	    gridGeom.xg0 = gridGeom.xx0 = (double)i *gridGeom.stepx;
-	    gridGeom.yg0 = gridGeom.yy0 = (double)j *gridGeom.stepy;
+	    if (useCivilTime()) {
+		/* We need to calculate the deviation of the local solar time from the 
+		 * "local clock time". */
+		dayRad = 2. * M_PI * day / 365.25;
+		locTimeOffset =
+		    +0.128 * sin(dayRad - 0.04887) + 0.165 * sin(2 * dayRad +
+								 0.34383);
 
-	    gridGeom.xp = xmin + gridGeom.xx0;
-	    gridGeom.yp = ymin + gridGeom.yy0;
+		/* Time offset due to timezone as input by user */
 
-	    if (ll_correction) {
-		coslat = cos(deg2rad * gridGeom.yp);
-		coslatsq = coslat * coslat;
+		locTimeOffset += civilTime;
+		setTimeOffset(locTimeOffset);
+	    }
+	    else {
+		setTimeOffset(0.);
 	    }
 
-	    func = NULL;
-if (i >= n || arrayOffset >= m)
-{
-    G_message("i: %d, n: %d, arrayOffset: %d, m: %d", i,n,arrayOffset,m);
-}
+	    /* one parallel region per partition and day, each thread takes
+	     * whole tiles */
+#pragma omp parallel for collapse(2) schedule(dynamic) \
+	firstprivate(gridGeom, sunGeom, sunVarGeom, sunSlopeGeom, sunRadVar) \
+	reduction(min: linke_min, albedo_min, lat_min, sunrise_min, sunset_min) \
+	reduction(max: linke_max, albedo_max, lat_max, sunrise_max, sunset_max)
+	    for (tj = j0; tj < j1; tj += TILE_ROWS) {
+		for (ti = 0; ti < n; ti += TILE_COLS) {
+		    int tj1 = AMIN1(tj + TILE_ROWS, j1);
+		    int ti1 = AMIN1(ti + TILE_COLS, n);
+		    int ci, cj;
+
+		    for (cj = tj; cj < tj1; cj++) {
+			int arrayOffset = cj - j0;
+
+			for (ci = ti; ci < ti1; ci++) {
+			    long int shadowoffset = (long int)arrayNumInt *
+				(arrayOffset * n + ci);
+			    struct CellGeometry *cg = NULL;
+			    double longitTime = 0., latitude = 0., longitude = 0.;
+			    double lum, q1, latid_l, cos_u, cos_v, sin_u, sin_v;
+			    double sin_phi_l, tan_lam_l, cos_latid_l;
+
+			    if (cellGeom != NULL)
+				cg = cellGeom + (size_t)cj * n + ci;
+
+			    if (useCivilTime()) {
+				/* sun travels 15deg per hour, so 1 TZ every 15 deg and 15 TZs * 24hrs = 360deg */
+				longitTime =
+				    -longitudeArray[arrayOffset][ci] / 15.;
+			    }
+
+			    gridGeom.xg0 = gridGeom.xx0 =
+				(double)ci *gridGeom.stepx;
+			    gridGeom.yg0 = gridGeom.yy0 =
+				(double)cj *gridGeom.stepy;
+
+			    gridGeom.xp = xmin + gridGeom.xx0;
+			    gridGeom.yp = ymin + gridGeom.yy0;
+
+			    if (ll_correction) {
+				double coslat = cos(deg2rad * gridGeom.yp);
+
+				coslatsq = coslat * coslat;
+			    }
+
+			    func = NULL;
+
+			    sunVarGeom.z_orig = sunVarGeom.zp = z[arrayOffset][ci];
+
+			    if (sunVarGeom.z_orig == UNDEFZ)
+				continue;
+
+			    if (aspin != NULL) {
+				if (o[arrayOffset][ci] != 0.)
+				    sunSlopeGeom.aspect =
+					o[arrayOffset][ci] * deg2rad;
+				else
+				    sunSlopeGeom.aspect = UNDEF;
+			    }
+			    if (slopein != NULL) {
+				sunSlopeGeom.slope = s[arrayOffset][ci] * deg2rad;
+			    }
+			    if (linkein != NULL) {
+				sunRadVar.linke = li[arrayOffset][ci];
+				linke_max = AMAX1(linke_max, sunRadVar.linke);
+				linke_min = AMIN1(linke_min, sunRadVar.linke);
+			    }
+			    if (albedo != NULL) {
+				sunRadVar.alb = a[arrayOffset][ci];
+				albedo_max = AMAX1(albedo_max, sunRadVar.alb);
+				albedo_min = AMIN1(albedo_min, sunRadVar.alb);
+			    }
+			    if (coefbh != NULL) {
+				sunRadVar.cbh = cbhr[arrayOffset][ci];
+			    }
+			    if (coefdh != NULL) {
+				sunRadVar.cdh = cdhr[arrayOffset][ci];
+			    }
+
+			    /* the position and the inclined plane are the same for
+			     * all days, for a period they are computed on the first day */
+			    if (cg == NULL || day == startDay) {
+				if (latin != NULL) {
+				    latitude = latitudeArray[arrayOffset][ci];
+				    lat_max = AMAX1(lat_max, latitude);
+				    lat_min = AMIN1(lat_min, latitude);
+				    latitude *= deg2rad;
+				}
+				if (longin != NULL) {
+				    longitude = longitudeArray[arrayOffset][ci];
+				    /* lon_max = AMAX1(lon_max, longitude); */
+				    /* lon_min = AMIN1(lon_min, longitude); */
+				    longitude *= deg2rad;
+				}
+
+				if ((G_projection() != PROJECTION_LL)) {
+
+				    if (latin == NULL || longin == NULL) {
+					/* if either is missing we have to calc both from current projection */
+					longitude = gridGeom.xp;
+					latitude = gridGeom.yp;
+
+					if (pj_do_proj(&longitude, &latitude, &iproj,
+						       &oproj) < 0) {
+					    G_fatal_error("Error in pj_do_proj");
+					}
+
+					lat_max = AMAX1(lat_max, latitude);
+					lat_min = AMIN1(lat_min, latitude);
+					latitude *= deg2rad;
+					longitude *= deg2rad;
+				    }
+				}
+				else {	/* ll projection */
+				    latitude = gridGeom.yp;
+				    longitude = gridGeom.xp;
+				    lat_max = AMAX1(lat_max, latitude);
+				    lat_min = AMIN1(lat_min, latitude);
+				    latitude *= deg2rad;
+				    longitude *= deg2rad;
+				}
+
+				cos_u = cos(M_PI / 2 - sunSlopeGeom.slope);	/* = sin(slope) */
+				sin_u = sin(M_PI / 2 - sunSlopeGeom.slope);	/* = cos(slope) */
+				cos_v = cos(M_PI / 2 + sunSlopeGeom.aspect);
+				sin_v = sin(M_PI / 2 + sunSlopeGeom.aspect);
+
+				gridGeom.sinlat = sin(-latitude);
+				gridGeom.coslat = cos(-latitude);
+
+				sin_phi_l =
+				    -gridGeom.coslat * cos_u * sin_v +
+				    gridGeom.sinlat * sin_u;
+				latid_l = asin(sin_phi_l);
+				cos_latid_l = cos(latid_l);
+
+				q1 = gridGeom.sinlat * cos_u * sin_v +
+				    gridGeom.coslat * sin_u;
+				tan_lam_l = -cos_u * cos_v / q1;
+				sunSlopeGeom.longit_l = atan(tan_lam_l);
+				if (cg != NULL) {
+				    cg->latitude = latitude;
+				    cg->longitude = longitude;
+				    cg->longit_l = sunSlopeGeom.longit_l;
+				    cg->cos_latid_l = cos_latid_l;
+				    cg->sin_latid_l = sin_phi_l;
+				}
+			    }
+			    else {
+				latitude = cg->latitude;
+				longitude = cg->longitude;
+				sunSlopeGeom.longit_l = cg->longit_l;
+				cos_latid_l = cg->cos_latid_l;
+				sin_phi_l = cg->sin_latid_l;
+				gridGeom.sinlat = sin(-latitude);
+				gridGeom.coslat = cos(-latitude);
+			    }
+
+			    if (ttime != NULL)
+				sunGeom.timeAngle = tim;
+
+			    sunSlopeGeom.lum_C31_l = cos_latid_l * sunGeom.cosdecl;
+			    sunSlopeGeom.lum_C33_l = sin_phi_l * sunGeom.sindecl;
+
+			    if ((incidout != NULL) || someRadiation) {
+				com_par_const(longitTime, &sunGeom, &gridGeom);
+				sunrise_min = AMIN1(sunrise_min, sunGeom.sunrise_time);
+				sunrise_max = AMAX1(sunrise_max, sunGeom.sunrise_time);
+				sunset_min = AMIN1(sunset_min, sunGeom.sunset_time);
+				sunset_max = AMAX1(sunset_max, sunGeom.sunset_time);
+			    }
+
+			    if (incidout != NULL) {
+				com_par(&sunGeom, &sunVarGeom, &gridGeom, latitude,
+					longitude);
+				lum =
+				    lumcline2(&sunGeom, &sunVarGeom, &sunSlopeGeom,
+					      &gridGeom, horizonarray + shadowoffset);
+				if (lum > 0.) {
+				    lum = rad2deg * asin(lum);
+				    lumcl[cj][ci] = (float)lum;
+				}
+				else
+				    lumcl[cj][ci] = UNDEFZ;
+			    }
+
+			    if (someRadiation) {
+				double Pbeam_e = 0.;
+				double Pdiff_e = 0.;
+				double Prefl_e = 0.;
+				double Pinsol_t = 0.;
+
+				joules2(&sunGeom, &sunVarGeom, &sunSlopeGeom,
+					&sunRadVar, &gridGeom,
+					horizonarray + shadowoffset, latitude,
+					longitude, &Pbeam_e, &Pdiff_e, &Prefl_e,
+					&Pinsol_t);
+				if (beam_rad != NULL)
+				    beam[cj][ci] = (float)Pbeam_e;
+				if (insol_time != NULL)
+				    insol[cj][ci] = (float)Pinsol_t;
+				/*  G_debug(3,"\n %f",insol[cj][ci]); */
+				if (diff_rad != NULL)
+				    diff[cj][ci] = (float)Pdiff_e;
+				if (refl_rad != NULL)
+				    refl[cj][ci] = (float)Prefl_e;
+				if (glob_rad != NULL)
+				    globrad[cj][ci] =
+					(float)(Pbeam_e + Pdiff_e + Prefl_e);
+
+				if (numDays > 1) {
+				    int first = day == startDay;
+
+				    if (beam_rad != NULL)
+					beamSum[cj][ci] = (first ? 0. :
+							   beamSum[cj][ci]) +
+					    beam[cj][ci];
+				    if (insol_time != NULL)
+					insolSum[cj][ci] = (first ? 0. :
+							    insolSum[cj][ci]) +
+					    insol[cj][ci];
+				    if (diff_rad != NULL)
+					diffSum[cj][ci] = (first ? 0. :
+							   diffSum[cj][ci]) +
+					    diff[cj][ci];
+				    if (refl_rad != NULL)
+					reflSum[cj][ci] = (first ? 0. :
+							   reflSum[cj][ci]) +
+					    refl[cj][ci];
+				    if (glob_rad != NULL)
+					globSum[cj][ci] = (first ? 0. :
+							   globSum[cj][ci]) +
+					    globrad[cj][ci];
+				}
+			    }
+			}
+		    }
+#pragma omp critical (progress)
+		    {
+			cells_done += (long)(tj1 - tj) * (ti1 - ti);
+			G_percent(cells_done, (long)m * n * numDays, 2);
+		    }
+		}
+	    }
 
-	    sunVarGeom.z_orig = z1 = sunVarGeom.zp = z[arrayOffset][i];
-
- 	    if (sunVarGeom.z_orig != UNDEFZ) {
- 		if (aspin != NULL) {
- 		    o_orig = o[arrayOffset][i];
- 		    if (o[arrayOffset][i] != 0.)
- 			sunSlopeGeom.aspect = o[arrayOffset][i] * deg2rad;
- 		    else
- 			sunSlopeGeom.aspect = UNDEF;
- 		}
- 		if (slopein != NULL) {
- 		    sunSlopeGeom.slope = s[arrayOffset][i] * deg2rad;
- 		}
- 		if (linkein != NULL) {
- 		    sunRadVar.linke = li[arrayOffset][i];
- 		    linke_max = AMAX1(linke_max, sunRadVar.linke);
- 		    linke_min = AMIN1(linke_min, sunRadVar.linke);
- 		}
- 		if (albedo != NULL) {
- 		    sunRadVar.alb = a[arrayOffset][i];
- 		    albedo_max = AMAX1(albedo_max, sunRadVar.alb);
- 		    albedo_min = AMIN1(albedo_min, sunRadVar.alb);
- 		}
- 		if (latin != NULL) {
- 		    latitude = latitudeArray[arrayOffset][i];
- 		    lat_max = AMAX1(lat_max, latitude);
- 		    lat_min = AMIN1(lat_min, latitude);
- 		    latitude *= deg2rad;
- 		}
- 		if (longin != NULL) {
- 		    longitude = longitudeArray[arrayOffset][i];
- 		    /* lon_max = AMAX1(lon_max, longitude); */
- 		    /* lon_min = AMIN1(lon_min, longitude); */
- 		    longitude *= deg2rad;
- 		}
- 
- 		if ((G_projection() != PROJECTION_LL)) {
- 
- 		    if (latin == NULL || longin == NULL) {
- 			/* if either is missing we have to calc both from current projection */
- 			longitude = gridGeom.xp;
- 			latitude = gridGeom.yp;
- 
- 			if (pj_do_proj(&longitude, &latitude, &iproj, &oproj) < 0) {
- 			    G_fatal_error("Error in pj_do_proj");
- 			}
- 
- 			lat_max = AMAX1(lat_max, latitude);
- 			lat_min = AMIN1(lat_min, latitude);
- 			latitude *= deg2rad;
- 			longitude *= deg2rad;
- 		    }
- 		}
- 		else {		/* ll projection */
- 		    latitude = gridGeom.yp;
- 		    longitude = gridGeom.xp;
- 		    lat_max = AMAX1(lat_max, latitude);
- 		    lat_min = AMIN1(lat_min, latitude);
- 		    latitude *= deg2rad;
- 		    longitude *= deg2rad;
- 		}
- 
- 		if (coefbh != NULL) {
- 		    sunRadVar.cbh = cbhr[arrayOffset][i];
- 		}
- 		if (coefdh != NULL) {
- 		    sunRadVar.cdh = cdhr[arrayOffset][i];
- 		}
- 		cos_u = cos(M_PI / 2 - sunSlopeGeom.slope);	/* = sin(slope) */
- 		sin_u = sin(M_PI / 2 - sunSlopeGeom.slope);	/* = cos(slope) */
- 		cos_v = cos(M_PI / 2 + sunSlopeGeom.aspect);
- 		sin_v = sin(M_PI / 2 + sunSlopeGeom.aspect);
- 
- 		if (ttime != NULL)
- 		    sunGeom.timeAngle = tim;
- 
- 		gridGeom.sinlat = sin(-latitude);
- 		gridGeom.coslat = cos(-latitude);
- 
- 		sin_phi_l =
- 		    -gridGeom.coslat * cos_u * sin_v +
- 		    gridGeom.sinlat * sin_u;
- 		latid_l = asin(sin_phi_l);
- 
- 		q1 = gridGeom.sinlat * cos_u * sin_v +
- 		    gridGeom.coslat * sin_u;
- 		tan_lam_l = -cos_u * cos_v / q1;
- 		sunSlopeGeom.longit_l = atan(tan_lam_l);
- 		sunSlopeGeom.lum_C31_l = cos(latid_l) * sunGeom.cosdecl;
- 		sunSlopeGeom.lum_C33_l = sin_phi_l * sunGeom.sindecl;
- 
- 		if ((incidout != NULL) || someRadiation) {
-  		    com_par_const(longitTime, &sunGeom, &gridGeom);
- 		    sunrise_min = AMIN1(sunrise_min, sunGeom.sunrise_time);
- 		    sunrise_max = AMAX1(sunrise_max, sunGeom.sunrise_time);
- 		    sunset_min = AMIN1(sunset_min, sunGeom.sunset_time);
- 		    sunset_max = AMAX1(sunset_max, sunGeom.sunset_time);
- 
- 		}
- 
- 		if (incidout != NULL) {
-  		    com_par(&sunGeom, &sunVarGeom, &gridGeom, latitude,
-  			    longitude);
-  		    lum =
-  			lumcline2(&sunGeom, &sunVarGeom, &sunSlopeGeom,
-  				  &gridGeom, horizonarray + shadowoffset);
- 		    if (lum > 0.) {
- 			lum = rad2deg * asin(lum);
- 			lumcl[j][i] = (float)lum;
- 		    }
- 		    else lumcl[j][i] = UNDEFZ;
- 		}
- 
- 		double Pbeam_e = 0.;
-                 double Pdiff_e = 0.;
-                 double Prefl_e = 0.;
-                 double Pinsol_t = 0.;
- 		
- 		if (someRadiation) {
-  		    joules2(&sunGeom, &sunVarGeom, &sunSlopeGeom, &sunRadVar,
-  			    &gridGeom, horizonarray + shadowoffset, latitude,
-  			    longitude,                                        
-                          &Pbeam_e,
-                          &Pdiff_e,
-                          &Prefl_e,
-                          &Pinsol_t
-                             );
- 		    if (beam_rad != NULL)
- 			beam[j][i] = (float)Pbeam_e;
- 		    if (insol_time != NULL)
- 			insol[j][i] = (float)Pinsol_t;
- 		    /*  G_debug(3,"\n %f",insol[j][i]); */
- 		    if (diff_rad != NULL)
- 			diff[j][i] = (float)Pdiff_e;
- 		    if (refl_rad != NULL)
- 			refl[j][i] = (float)Prefl_e;
- 		    if (glob_rad != NULL)
- 			globrad[j][i] = (float)(Pbeam_e + Pdiff_e + Prefl_e);
- 		}
- 
- 	    }			/* undefs */
- 	    //shadowoffset += arrayNumInt;
+	    if (dailyMaps) {
+		history(day, &sunGeom, &sunVarGeom, &sunRadVar);
+		OUTGR(day);
+	    }
 	}
     }
-        arrayOffset++;
-}
 #ifdef PARALLEL
     printTimeDiff("M3");
 #endif
+    if (numDays > 1) {
+	/* the sums are written as the output maps and replace the
+	 * matrices of one day */
+	if (beam_rad != NULL) {
+	    free_day_matrix(beam);
+	    beam = beamSum;
+	}
+	if (insol_time != NULL) {
+	    free_day_matrix(insol);
+	    insol = insolSum;
+	}
+	if (diff_rad != NULL) {
+	    free_day_matrix(diff);
+	    diff = diffSum;
+	}
+	if (refl_rad != NULL) {
+	    free_day_matrix(refl);
+	    refl = reflSum;
+	}
+	if (glob_rad != NULL) {
+	    free_day_matrix(globrad);
+	    globrad = globSum;
+	}
+	G_free(cellGeom);
+    }
+
+    history(0, &sunGeom, &sunVarGeom, &sunRadVar);
+}				/* End of ) function */
+
+
+/*
+ * Initialize the history of the output maps, outDay > 0 for the maps of
+ * one day of a period. Values of the day are taken from the geometry and
+ * the global declination, so it is called right after the day is computed.
+ */
+void history(int outDay, struct SunGeometryConstDay *sunGeom,
+	     struct SunGeometryVarDay *sunVarGeom,
+	     struct SolarRadVar *sunRadVar)
+{
+    char name[GNAME_MAX];
+
     /* re-use &hist, but try all to initiate it for any case */
     /*   note this will result in incorrect map titles       */
     if (incidout != NULL) {
-	Rast_short_history(incidout, "raster", &hist);
+	output_name(name, incidout, outDay);
+	Rast_short_history(name, "raster", &hist);
     }
     else if (beam_rad != NULL) {
-	Rast_short_history(beam_rad, "raster", &hist);
+	output_name(name, beam_rad, outDay);
+	Rast_short_history(name, "raster", &hist);
     }
     else if (diff_rad != NULL) {
-	Rast_short_history(diff_rad, "raster", &hist);
+	output_name(name, diff_rad, outDay);
+	Rast_short_history(name, "raster", &hist);
     }
     else if (refl_rad != NULL) {
-	Rast_short_history(refl_rad, "raster", &hist);
+	output_name(name, refl_rad, outDay);
+	Rast_short_history(name, "raster", &hist);
     }
     else if (insol_time != NULL) {
-	Rast_short_history(insol_time, "raster", &hist);
+	output_name(name, insol_time, outDay);
+	Rast_short_history(name, "raster", &hist);
     }
     else if (glob_rad != NULL) {
-	Rast_short_history(glob_rad, "raster", &hist);
+	output_name(name, glob_rad, outDay);
+	Rast_short_history(name, "raster", &hist);
     }
     else
 	G_fatal_error
@@ -2201,10 +2553,16 @@ if (i >= n || arrayOffset >= m)
     Rast_append_format_history(
 	&hist,
 	" ----------------------------------------------------------------");
-    Rast_append_format_history(
-	&hist,
-	" Day [1-365]:                              %d",
-	day);
+    if (outDay > 0 || numDays == 1)
+	Rast_append_format_history(
+	    &hist,
+	    " Day [1-365]:                              %d",
+	    outDay > 0 ? outDay : startDay);
+    else
+	Rast_append_format_history(
+	    &hist,
+	    " Days [1-365]:                             %d - %d, step %d",
+	    startDay, endDay, dayStep);
 
     if (ttime != NULL)
 	Rast_append_format_history(
@@ -2214,13 +2572,15 @@ if (i >= n || arrayOffset >= m)
     Rast_append_format_history(
 	&hist,
 	" Solar constant (W/m^2):                   1367");
-    Rast_append_format_history(
-	&hist,
-	" Extraterrestrial irradiance (W/m^2):      %f",
-	sunRadVar.G_norm_extra);
-    Rast_append_format_history(
-	&hist,
-	" Declination (rad):                        %f", -declination);
+    if (outDay > 0 || numDays == 1) {
+	Rast_append_format_history(
+	    &hist,
+	    " Extraterrestrial irradiance (W/m^2):      %f",
+	    sunRadVar->G_norm_extra);
+	Rast_append_format_history(
+	    &hist,
+	    " Declination (rad):                        %f", -declination);
+    }
 
     Rast_append_format_history(
 	&hist,
@@ -2231,15 +2591,15 @@ if (i >= n || arrayOffset >= m)
 	Rast_append_format_history(
 	    &hist,
 	    " Sunrise time (hr.):                       %.2f",
-	    sunGeom.sunrise_time);
+	    sunGeom->sunrise_time);
 	Rast_append_format_history(
 	    &hist,
 	    " Sunset time (hr.):                        %.2f",
-	    sunGeom.sunset_time);
+	    sunGeom->sunset_time);
 	Rast_append_format_history(
 	    &hist,
 	    " Daylight time (hr.):                      %.2f",
-	    sunGeom.sunset_time - sunGeom.sunrise_time);
+	    sunGeom->sunset_time - sunGeom->sunrise_time);
     }
     else {
 	Rast_append_format_history(
@@ -2259,18 +2619,18 @@ if (i >= n || arrayOffset >= m)
 	Rast_append_format_history(
 	    &hist,
 	    " Solar altitude (deg):                     %.4f",
-	    sunVarGeom.solarAltitude * rad2deg);
+	    sunVarGeom->solarAltitude * rad2deg);
 	Rast_append_format_history(
 	    &hist,
 	    " Solar azimuth (deg):                      %.4f",
-	    sunVarGeom.solarAzimuth * rad2deg);
+	    sunVarGeom->solarAzimuth * rad2deg);
     }
 
     if (linkein == NULL)
 	Rast_append_format_history(
 	    &hist,
 	    " Linke turbidity factor:                   %.1f",
-	    sunRadVar.linke);
+	    sunRadVar->linke);
     else
 	Rast_append_format_history(
 	    &hist,
@@ -2281,7 +2641,7 @@ if (i >= n || arrayOffset >= m)
 	Rast_append_format_history(
 	    &hist,
 	    " Ground albedo:                            %.3f",
-	    sunRadVar.alb);
+	    sunRadVar->alb);
     else
 	Rast_append_format_history(
 	    &hist,
@@ -2294,8 +2654,7 @@ if (i >= n || arrayOffset >= m)
 
     Rast_command_history(&hist);
     /* don't call Rast_write_history() until after Rast_close() or it just gets overwritten */
-
-}				/* End of ) function */
+}
 
 
 
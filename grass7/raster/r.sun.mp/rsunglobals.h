@@ -59,3 +59,4 @@ extern struct pj_info oproj;
 
 
 extern void (*func) (int, int);
+#pragma omp threadprivate(func)
@@ -495,9 +495,22 @@ void T_variogram(int type, struct opts opt,
     }
 }
 
+// maximum # of cells/voxels of the output block along each axis
+#define KRIG_BLOCK 16
+// # of kriging systems kept by each thread
+#define KRIG_CACHE 32
+
+// block size: the block extends over half of the search distance at most
+static int block_size(double res, double max_dist)
+{
+    int size = res > 0. ? (int)(0.5 * max_dist / res) : 1;
+
+    return size < 1 ? 1 : (size > KRIG_BLOCK ? KRIG_BLOCK : size);
+}
+
 void ordinary_kriging(struct int_par *xD, struct reg_par *reg,
                       struct points *pnts, struct var_par *pars,
-                      struct output *out)
+                      struct output *out, struct output *var_out)
 {
     // Local variables
     int i3 = xD->i3;
@@ -508,36 +521,28 @@ void ordinary_kriging(struct int_par *xD, struct reg_par *reg,
     int type = var_par->type;
     double max_dist =
         type == 2 ? var_par->horizontal.max_dist : var_par->max_dist;
-    //max_dist = sqrt(0.5 * SQUARE(max_dist));
-
     double max_dist_vert =
         type == 2 ? var_par->vertical.max_dist : var_par->max_dist;
 
-    unsigned int percents = 50; // counter
-    unsigned int row, col, dep; // indices of cells/voxels
-    int resample;
     struct krig_pars krig;
     int add_trend = (out->trend[0] == 0. && out->trend[1] == 0. &&
                      out->trend[2] == 0. &&
                      out->trend[3] == 0.) ? FALSE : TRUE;
 
     pnts->max_dist = var_par->lag;
-    struct ilist *list, *list_new;
-
-    double *r0, rslt, trend_val;        // xyz coordinates of cell/voxel centre
 
-    // Cell/voxel center coords (location of interpolated value)
-    r0 = (double *)G_malloc(3 * sizeof(double));
-
-    int *row_init, *row0, count, next = 1, total, complete, new_matrix =
-        0, setup, mat_row;
-    row_init = (int *)G_malloc(reg->ncols * sizeof(int));
-    row0 = &row_init[0];
+    double r0[3], r1[3];        // xyz coordinates of neighbouring cell/voxel centres
 
     int i, ndeps = reg->ndeps, nrows = reg->nrows, ncols = reg->ncols;
+    int total = ndeps * nrows * ncols;
+    int bcols, brows, bdeps;    // # of cells/voxels of the block
+    int nbcols, nbrows, nbdeps; // # of blocks
+    int block, nblocks, new_matrix = 0;
+    struct ilist **lists;       // neighbours of the blocks
 
     krig.rslt = G_matrix_init(nrows * ndeps, ncols, nrows * ndeps);
-    krig.first = TRUE;
+    krig.var = var_out->name ?
+        G_matrix_init(nrows * ndeps, ncols, nrows * ndeps) : NULL;
 
     if (report->name) {         // report file available:
         time(&report->now);
@@ -546,256 +551,140 @@ void ordinary_kriging(struct int_par *xD, struct reg_par *reg,
         fflush(report->fp);
     }
 
-    if (percents) {
-        G_percent_reset();
-    }
-
     open_layer(xD, reg, out);   // open 2D/3D raster
+    if (var_out->name) {
+        open_layer(xD, reg, var_out);   // open 2D/3D raster of kriging variance
+    }
 
     if (var_par->const_val == 1) {      // input values are constant:
-        goto constant_voxel_centre;
+        for (i = 0; i < total; i++) {
+            krig.rslt->vals[i] = *pnts->invals; // setup input as output
+        }
+        goto accomplished;
     }
 
-    set_up_G(pnts, var_par, xD->report, &krig); // set up matrix of dissimilarities of input points
-    var_par->GM = G_matrix_copy(krig.GM);       // copy matrix because of cross validation
-
     // perform cross validation...
     if (crossvalid->name) {     // ... if desired
+        set_up_G(pnts, var_par, xD->report, &krig);     // set up matrix of dissimilarities of input points
+        var_par->GM = G_matrix_copy(krig.GM);   // copy matrix because of cross validation
         crossvalidation(xD, pnts, var_par, reg);
     }
 
-    G_message(_("Interpolating unknown values..."));
-  constant_voxel_centre:
-    count = 0;
-    col = row = dep = 0;
-    total = ndeps * nrows * ncols;
-
-    while (count <= total) {
-        if (percents) {
-            G_percent(count, total, 1);
+    // split the output into blocks of cells/voxels sharing one neighbour set
+    cell_centre(0, 0, 0, xD, reg, r0, var_par);
+    cell_centre(1, 1, 1, xD, reg, r1, var_par);
+    bcols = block_size(fabs(r1[0] - r0[0]), max_dist);
+    brows = block_size(fabs(r1[1] - r0[1]), max_dist);
+    bdeps = i3 == TRUE ? block_size(fabs(r1[2] - r0[2]), max_dist_vert) : 1;
+
+    nbcols = (ncols + bcols - 1) / bcols;
+    nbrows = (nrows + brows - 1) / brows;
+    nbdeps = (ndeps + bdeps - 1) / bdeps;
+    nblocks = nbcols * nbrows * nbdeps;
+
+    // search the neighbours of the blocks sequentially: the search stack of
+    // the R-tree is shared, so its searches must not run concurrently
+    G_message(_("Searching neighbours..."));
+    G_percent_reset();
+    lists = (struct ilist **)G_malloc(nblocks * sizeof(struct ilist *));
+    for (block = 0; block < nblocks; block++) {
+        int k;
+        int col0 = block % nbcols * bcols;
+        int row0 = block / nbcols % nbrows * brows;
+        int dep0 = block / (nbcols * nbrows) * bdeps;
+        int col1 = col0 + bcols < ncols ? col0 + bcols : ncols;
+        int row1 = row0 + brows < nrows ? row0 + brows : nrows;
+        int dep1 = dep0 + bdeps < ndeps ? dep0 + bdeps : ndeps;
+        double c0[3], c1[3], centre[3], half[3];
+
+        G_percent(block, nblocks, 1);
+
+        // the search box of the block centre enlarged by half of the block
+        // covers search boxes of all its cells/voxels
+        cell_centre(col0, row0, dep0, xD, reg, c0, var_par);
+        cell_centre(col1 - 1, row1 - 1, dep1 - 1, xD, reg, c1, var_par);
+        for (k = 0; k < 3; k++) {
+            centre[k] = 0.5 * (c0[k] + c1[k]);
+            half[k] = 0.5 * fabs(c1[k] - c0[k]);
         }
 
-        if (var_par->const_val == 1) {  // constant input values
-            goto constant_voxel_val;
+        lists[block] = list_NN(xD, centre, pnts,
+                               max_dist + (half[0] > half[1] ? half[0] :
+                                           half[1]), max_dist_vert + half[2]);
+        // the list is shared by all cells/voxels of the block: only shift
+        // the indices, the distance filter of correct_indices() is relative
+        // to one position and would use max_dist instead of the enlarged one
+        for (k = 0; k < lists[block]->n_values; k++)
+            lists[block]->value[k]--;
+        if (lists[block]->n_values == 0) {
+            report_error(report);
+            G_fatal_error(_("This point does not have neighbours in given radius..."));
         }
+        qsort(lists[block]->value, lists[block]->n_values, sizeof(int),
+              cmpVals);
+    }
+    G_percent(1, 1, 1);
 
-        // coordinates of output point (center of the pixel / voxel)
-        if (next < 2) {
-            cell_centre(col, row, dep, xD, reg, r0, var_par);
-
-            // initial subsample    
-            if (col == 0 && row == 0 && dep == 0) {
-                list = list_NN(xD, r0, pnts, max_dist, max_dist_vert);
-                make_subsamples(xD, list, r0, dep * nrows + row, col, pnts,
-                                var_par, &krig);
-            }
-            // lists to compare
-            else if (krig.new == FALSE) {
-                list_new = list_NN(xD, r0, pnts, max_dist, max_dist_vert);
-                next = compare_NN(list, list_new, krig.modified);
-            }
-        }
-
-        if (next > 0) {
-            rslt = interpolate(xD, list, r0, pnts, var_par, &krig);
-            if (add_trend == TRUE) {
-                trend_val = trend(r0, out, var_par->function, xD);
-                rslt += trend_val;
-            }
-            mat_row = dep * nrows + row;
-
-            setup = G_matrix_set_element(krig.rslt, mat_row, col, rslt);
-
-            if (G_matrix_get_element(krig.rslt, 0, 0) == 0. && (row != 0))
-                G_fatal_error(_("%d %d %d   %d %f %f"), dep, row, col,
-                              mat_row, G_matrix_get_element(krig.rslt, 0, 0),
-                              krig.rslt->vals[(dep * nrows + row) * ncols +
-                                              col]);
-
-            if (setup < 0) {
-                report_error(report);
-                G_fatal_error(_("The value %f was not written to the cell %d %d %d"),
-                              rslt, dep, row, col);
-            }
-            count++;
-            krig.new = FALSE;
-
-            next = next == 2 ? 1 : next;        // mark it as coincident
+    G_message(_("Interpolating unknown values..."));
 
-            // Create output
-          constant_voxel_val:
-            if (var_par->const_val == 1) {      // constant input values:
-                rslt = (double)*pnts->invals;   // setup input as output
-            }
-        }                       // end if next > 0
-
-        // go to the next cell point:
-        switch (next) {
-            // the cell was not interpolated:
-        case 0:
-            // new column:
-            if (row == 0 || row == *row0) {
-                Vect_reset_list(list);  // refresh list
-                Vect_list_append_list(list, list_new);  // add new list
-                G_free_ilist(list_new); // free list memory
-                krig.modified = 1;
-                krig.new = TRUE;
-                next = 2;       // interpolate using new subsample
-                G_matrix_free(krig.GM_Inv);     // free old matrix
-                new_matrix++;   // counter of skipped matrices
-                make_subsamples(xD, list, r0, dep * nrows + row, col, pnts,
-                                var_par, &krig);
-            }
-            // the same column:
-            else {
-                *row0 = row;    // save row index to continue
-
-                // general cells:
-                if (col < ncols - 1) {
-                    col++;      // go to the next row
-                    row0++;     // go to the col index in the next row
-                    while (*row0 == nrows) {
-                        if (col < ncols - 1) {
-                            col++;      // go to the next row
-                            row0++;     // go to the col index in the next row
-                        }
-                        else {
-                            krig.first = FALSE;
-                            col = 0;
-                            row0 = &row_init[0];
+#pragma omp parallel reduction(+:new_matrix)
+    {
+        struct krig_cache cache;        // recently used kriging systems of the thread
+
+        init_systems(&cache, KRIG_CACHE);
+
+#pragma omp for schedule(static)
+        for (block = 0; block < nblocks; block++) {
+            int col, row, dep;
+            int col0 = block % nbcols * bcols;
+            int row0 = block / nbcols % nbrows * brows;
+            int dep0 = block / (nbcols * nbrows) * bdeps;
+            int col1 = col0 + bcols < ncols ? col0 + bcols : ncols;
+            int row1 = row0 + brows < nrows ? row0 + brows : nrows;
+            int dep1 = dep0 + bdeps < ndeps ? dep0 + bdeps : ndeps;
+            double r[3], rslt, variance;
+            struct ilist *list = lists[block];
+            mat_struct *GM_Inv;
+
+            GM_Inv = get_system(&cache, list, pnts, var_par, report);
+
+            for (dep = dep0; dep < dep1; dep++) {
+                for (row = row0; row < row1; row++) {
+                    for (col = col0; col < col1; col++) {
+                        cell_centre(col, row, dep, xD, reg, r, var_par);
+                        rslt = interpolate(xD, list, r, pnts, var_par, GM_Inv,
+                                           krig.var ? &variance : NULL);
+                        if (add_trend == TRUE) {
+                            rslt += trend(r, out, var_par->function, xD);
                         }
-                    }
-                }
-                // last column:
-                else {
-                    krig.first = FALSE;
-                    col = 0;    // start new sampling
-                    row0 = &row_init[0];        // from the beginning;
-
-                    // skip full cols:
-                    while (*row0 == nrows) {    // full row
-                        if (col < ncols - 1) {
-                            col++;      // go to the next row
-                            row0++;     // to test if it is completed
-                        }
-                    }           // end while: full row
-                }               // end else: last column
-            }                   // end else: the same column
-
-            row = krig.first == TRUE ? 0 : *row0;       // setup starting cell
-            break;              // count does not rise 
-
-            // the cell was interpolated -> examine the next one
-        case 1:
-            // save index to continue:
-            row++;              // continue in the row
-
-            // last row (full column):
-            if (row == nrows) {
-                *row0 = row;    // save the number to distinguish full columns
-
-                // the last column
-                if (col == ncols - 1) {
-                    // start from the beginning
-                    krig.first = FALSE;
-                    col = 0;
-                    row0 = &row_init[0];
-
-                    // skip full columns
-                    while (*row0 == nrows) {
-                        if (col < ncols - 1) {
-                            col++;
-                            row0++;
-                        }
-                        else {
-                            if (i3 == FALSE || dep == ndeps - 1) {
-                                if (dep > 1) {
-                                    G_message(_("Vertical level %d has been processed..."),
-                                              dep + 1);
-                                }
-                                goto accomplished;
-                            }
-                            else {
-                                dep++;  // next vertical level
-                                col = 0;        // the first column
-
-                                // refresh rows
-                                new_vertical(row_init, ncols);  // row0 = 0
-                                row0 = &row_init[0];
-                                row = *row0;
-
-                                next =
-                                    new_sample(xD, list, list_new, pnts, dep,
-                                               row, col, r0, max_dist,
-                                               max_dist_vert, reg, var_par,
-                                               &krig, &new_matrix);
-                                goto new_dep;
-                            }   // end else: complete level
-                        }
-                    }           // end if: *row0 == nrows
-                }               // end if: last column
 
-                else {
-                    col++;
-                    row0++;     // read starting row
-                    complete = 0;
-
-                    while (*row0 == nrows) {
-                        if (col < ncols - 1) {
-                            col++;
-                            row0++;
-                            complete++;
-                        }
-                        else {
-                            krig.first = FALSE;
-                            col = 0;
-                            row0 = &row_init[0];
-                            complete = 0;
+                        G_matrix_set_element(krig.rslt, dep * nrows + row,
+                                             col, rslt);
+                        if (krig.var) {
+                            G_matrix_set_element(krig.var, dep * nrows + row,
+                                                 col, variance);
                         }
-                        if (complete == ncols - 1) {
-                            if (i3 == FALSE || dep == ndeps - 1) {
-                                if (dep > 1) {
-                                    G_message(_("Vertical level %d has been processed..."),
-                                              dep + 1);
-                                }
-                                goto accomplished;
-                            }
-                            else {
-                                dep++;  // next vertical level
-                                col = 0;        // the first column
-
-                                // refresh rows
-                                new_vertical(row_init, ncols);  // row0 = 0
-                                row0 = &row_init[0];
-                                row = *row0;
-
-                                next =
-                                    new_sample(xD, list, list_new, pnts, dep,
-                                               row, col, r0, max_dist,
-                                               max_dist_vert, reg, var_par,
-                                               &krig, &new_matrix);
-                                goto new_dep;
-                            }   // end else: complete level
-                        }       // if: complete == ncols - 1
-                    }           // while: *row0 == nrows
-                }               // else: general row 
-                row = krig.first == TRUE ? 0 : *row0;
-            }                   // end else: go to the new column
-
-            break;
-        }                       // end switch next
-      new_dep:
-        if (row == 0 && col == 0) {
-            G_message(_("Vertical level %d has been processed..."), dep);
-        }
-    }                           // end while
+                    }           // end col
+                }               // end row
+            }                   // end dep
+
+            G_free_ilist(list);
+        }                       // end block
+
+        new_matrix += cache.misses;
+        free_systems(&cache);
+    }
+    G_free(lists);
 
-  accomplished:
     G_message(_("# of points: %d   # of matrices: %d   diff: %d"), total,
               new_matrix, total - new_matrix);
 
+  accomplished:
     // write output to the (3D) raster layer
     write2layer(xD, reg, out, krig.rslt);
+    if (var_out->name) {
+        write2layer(xD, reg, var_out, krig.var);
+    }
 
     if (report->name) {
         fprintf(report->fp,
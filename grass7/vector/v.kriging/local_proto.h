@@ -45,7 +45,7 @@ struct opts
         *maxZ, *nL, *nZ, *td_hz, *td_vert, *nugget_hz, *nugget_vert,
         *nugget_final, *nugget_final_vert, *sill_hz, *sill_vert, *sill_final,
         *sill_final_vert, *range_hz, *range_vert, *range_final,
-        *range_final_vert;
+        *range_final_vert, *variance;
 };
 
 struct flgs
@@ -147,12 +147,27 @@ struct var_par                  // parameters of experimental variogram
 
 struct krig_pars                // parameters of ordinary kriging
 {
-    int new;
-    int first;
-    int modified;
     mat_struct *GM;
-    mat_struct *GM_Inv;         // inverted GM (GM_sub) matrix
     mat_struct *rslt;
+    mat_struct *var;            // kriging variance (if desired)
+};
+
+struct krig_system              // kriging system of one neighbour set
+{
+    int n;                      // # of selected points
+    int *index;                 // sorted indices of selected points
+    unsigned int hash;          // hash of the indices
+    unsigned int used;          // last use (LRU replacement)
+    mat_struct *GM_Inv;         // inverted GM (GM_sub) matrix
+};
+
+struct krig_cache               // recently used kriging systems
+{
+    int n;                      // # of cached systems
+    int max;                    // maximum # of cached systems
+    unsigned int clock;         // counter of requests
+    int misses;                 // # of systems set up
+    struct krig_system *sys;
 };
 
 struct write
@@ -251,7 +266,7 @@ mat_struct *nonlin_LMS(int, double *, double *);
 void E_variogram(int, struct int_par *, struct points *, struct var_par *);
 void T_variogram(int, struct opts, struct parameters *, struct int_par *);
 void ordinary_kriging(struct int_par *, struct reg_par *, struct points *,
-                      struct var_par *, struct output *);
+                      struct var_par *, struct output *, struct output *);
 
 void LMS_variogram(struct parameters *, struct write *);
 double bivar_sill(int, mat_struct *);
@@ -268,7 +283,6 @@ double variogram_fction(struct parameters *, double *);
 void set_gnuplot(char *, struct parameters *);
 void plot_experimental_variogram(struct int_par *, struct parameters *);
 void plot_var(struct int_par *, int, struct parameters *);
-void new_vertical(int *, int);
 
 void variogram_type(int, char *);
 void write2file_basics(struct int_par *, struct opts *);
@@ -298,17 +312,16 @@ void cell_centre(unsigned int, unsigned int, unsigned int, struct int_par *,
                  struct reg_par *, double *, struct parameters *);
 struct ilist *list_NN(struct int_par *, double *, struct points *, double,
                       double);
-int compare_NN(struct ilist *, struct ilist *, int);
-void make_subsamples(struct int_par *, struct ilist *, double *, int, int,
-                     struct points *, struct parameters *,
-                     struct krig_pars *);
+mat_struct *set_up_G_sub(struct ilist *, struct points *,
+                         struct parameters *, struct write *);
+void init_systems(struct krig_cache *, int);
+void free_systems(struct krig_cache *);
+mat_struct *get_system(struct krig_cache *, struct ilist *, struct points *,
+                       struct parameters *, struct write *);
 double interpolate(struct int_par *, struct ilist *, double *,
-                   struct points *, struct parameters *, struct krig_pars *);
+                   struct points *, struct parameters *, mat_struct *,
+                   double *);
 double trend(double *, struct output *, int, struct int_par *);
-int new_sample(struct int_par *, struct ilist *, struct ilist *,
-               struct points *, int, int, int, double *, double, double,
-               struct reg_par *, struct parameters *, struct krig_pars *,
-               int *);
 
 void get_region_pars(struct int_par *, struct reg_par *);
 void open_layer(struct int_par *, struct reg_par *, struct output *);
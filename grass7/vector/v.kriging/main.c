@@ -52,6 +52,7 @@ int main(int argc, char *argv[])
 
     // Outputs
     struct output out;          // Output layer properties
+    struct output var_out;      // Kriging variance layer properties
 
     // Settings
     int field;
@@ -102,6 +103,13 @@ int main(int argc, char *argv[])
     opt.output->description = _("Name for output 2D/3D raster map");
     opt.output->guisection = _("Final");
 
+    opt.variance = G_define_option();   // Kriging variance layer
+    opt.variance->key = "variance";
+    opt.variance->description =
+        _("Name for output 2D/3D raster map of kriging variance");
+    opt.variance->required = NO;
+    opt.variance->guisection = _("Final");
+
     opt.crossvalid = G_define_standard_option(G_OPT_F_OUTPUT);  // Report file
     opt.crossvalid->key = "crossvalid";
     opt.crossvalid->description =
@@ -729,6 +737,7 @@ int main(int argc, char *argv[])
         }                       // end if univariate variogram (2D or 3D)
 
         out.name = opt.output->answer;  // Output layer name
+        var_out.name = opt.variance->answer;    // Kriging variance layer name
 
         // if variogram is anisotropic:
         if (var_pars.fin.type == 3) {
@@ -741,7 +750,7 @@ int main(int argc, char *argv[])
     }
 
     /* Ordinary kriging (including 2D/3D raster creation) */
-    ordinary_kriging(&xD, &reg, &pnts, &var_pars, &out);
+    ordinary_kriging(&xD, &reg, &pnts, &var_pars, &out, &var_out);
     /* ---------------------------------------------------------- */
 
   end:
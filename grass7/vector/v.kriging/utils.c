@@ -983,16 +983,3 @@ void plot_var(struct int_par *xD, int bivar, struct parameters *var_pars)
     remove("dataE.dat");
     remove("dataT.dat");
 }
-
-void new_vertical(int *row0, int n)
-{
-    int i;
-    int *value;
-
-    value = &row0[0];
-
-    for (i = 0; i < n; i++) {
-        *value = 0;
-        value++;
-    }
-}
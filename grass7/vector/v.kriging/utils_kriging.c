@@ -557,6 +557,7 @@ double result(struct points *pnts, struct ilist *index, mat_struct * w0)
     n = n_ind == 0 ? pnts->n : n_ind;
 
     int i;
+    double rslt;
     mat_struct *ins, *w, *rslt_OK;
     doublereal *vt, *wo, *wt;
 
@@ -593,11 +594,13 @@ double result(struct points *pnts, struct ilist *index, mat_struct * w0)
     }                           // end i for loop
 
     rslt_OK = G_matrix_product(w, ins); // interpolated value
+    rslt = rslt_OK->vals[0];
 
     G_matrix_free(w);
     G_matrix_free(ins);
+    G_matrix_free(rslt_OK);
 
-    return rslt_OK->vals[0];
+    return rslt;
 }
 
 // find center
@@ -785,8 +788,6 @@ struct ilist *list_NN(struct int_par *xD, double *r0, struct points *pnts,
 
     struct ilist *list;
 
-    list = G_new_ilist();       // create list of overlapping rectangles
-
     if (i3 == TRUE) {           // 3D kriging:
         list = find_NNs_within(3, r0, pnts, max_dist, max_dist_vert);
     }
@@ -797,73 +798,162 @@ struct ilist *list_NN(struct int_par *xD, double *r0, struct points *pnts,
     return list;
 }
 
-int compare_NN(struct ilist *list, struct ilist *list_new, int modified)
+// set up G submatrix for selected points directly from their coordinates
+mat_struct *set_up_G_sub(struct ilist *index, struct points *pnts,
+                         struct parameters *var_par, struct write *report)
 {
-    // local variables
-    int n = list->n_values, n_new = list_new->n_values;
-    double *list_value = list->value;
-    double *list_new_value = list_new->value;
+    // Local variables
+    int n = index->n_values;    // # of selected points
+    int *ind = index->value;    // indices of selected points
+    double *r = pnts->r;        // xyz coordinates of input points
+    int type = var_par->type;   // hz / vert / aniso / bivar
 
-    int i, next = 0;            // the samples are different
+    int i, j;                   // indices of matrix rows/cols
+    int n1 = n + 1;             // # of matrix rows/cols
+    double theor_var;           // GM element = theor_var(distance)
+    double dr[3];               // dx, dy, dz between point couples
+    mat_struct *sub;            // new submatrix
 
-    if (n == n_new) {
-        for (i = 0; i < n; i++) {
-            if (list_value[i] != list_new_value[i] - modified) {
-                goto change;    // they are indeed
-            }
-        }
-        next = 1;               // they are identical
+    sub = G_matrix_init(n1, n1, n1);
+
+    if (sub == NULL) {
+        report_error(report);
+        G_fatal_error(_("Unable to initialize G-submatrix..."));
     }
 
-  change:
-    return next;
+    for (i = 0; i < n; i++) {
+        sub->vals[i * n1 + i] = 0.0;    // diagonal
+        for (j = i + 1; j < n; j++) {   // symmetric elements
+            coord_diff(ind[i], ind[j], r, dr);  // compute coordinate differences
+            if (type == 2) {    // bivariate variogram
+                dr[0] = sqrt(radius_hz_diff(dr));
+                dr[1] = dr[2];
+            }
+            theor_var = variogram_fction(var_par, dr);  // compute GM element
+
+            if (isnan(theor_var)) {     // not a number:
+                report_error(report);
+                G_fatal_error(_("Theoretical variogram is NAN..."));
+            }
+
+            sub->vals[i * n1 + j] = sub->vals[j * n1 + i] =
+                (doublereal) theor_var;
+        }                       // end j loop
+
+        // condition: sum of weights = 1
+        sub->vals[i * n1 + n] = sub->vals[n * n1 + i] = 1.0;
+    }                           // end i loop
+    sub->vals[n * n1 + n] = 0.0;
+
+    return sub;
 }
 
-void make_subsamples(struct int_par *xD, struct ilist *list, double *r0,
-                     int row, int col, struct points *pnts,
-                     struct parameters *var_par, struct krig_pars *krig)
+// initialize cache of kriging systems
+void init_systems(struct krig_cache *cache, int max)
+{
+    cache->n = 0;
+    cache->max = max;
+    cache->clock = 0;
+    cache->misses = 0;
+    cache->sys =
+        (struct krig_system *)G_malloc(max * sizeof(struct krig_system));
+}
+
+// free cache of kriging systems
+void free_systems(struct krig_cache *cache)
+{
+    int i;
+
+    for (i = 0; i < cache->n; i++) {
+        G_free(cache->sys[i].index);
+        G_matrix_free(cache->sys[i].GM_Inv);
+    }
+    G_free(cache->sys);
+    cache->n = 0;
+}
+
+// find inverted kriging system of the neighbour set (sorted indices)
+// in the cache; if missing, set it up in place of the least recently used
+mat_struct *get_system(struct krig_cache *cache, struct ilist *list,
+                       struct points *pnts, struct parameters *var_par,
+                       struct write *report)
 {
     // Local variables
-    int i3 = xD->i3;
-    double *vals = pnts->invals;
-    struct write *report = &xD->report;
+    int n = list->n_values;     // # of selected points
+    unsigned int hash = 2166136261u;    // FNV-1a hash of the indices
 
-    int direction;
+    int i, oldest = 0;
+    struct krig_system *sys;
     mat_struct *GM_sub;
 
-    direction = i3 == TRUE ? 0 : 12;
+    for (i = 0; i < n; i++) {
+        hash = (hash ^ (unsigned int)list->value[i]) * 16777619u;
+    }
 
-    if (list->n_values > 1) {   // positive # of selected points: 
-        correct_indices(direction, list, r0, pnts, var_par);
+    cache->clock++;
+    for (i = 0; i < cache->n; i++) {
+        sys = &cache->sys[i];
+        if (sys->hash == hash && sys->n == n &&
+            memcmp(sys->index, list->value, n * sizeof(int)) == 0) {
+            sys->used = cache->clock;   // the same neighbour set
+            return sys->GM_Inv;
+        }
+        if (sys->used < cache->sys[oldest].used) {
+            oldest = i;
+        }
+    }
 
-        GM_sub = submatrix(list, krig->GM, report);     // make submatrix for selected points
-        krig->GM_Inv = G_matrix_inverse(GM_sub);        // invert submatrix
-        G_matrix_free(GM_sub);
+    // new neighbour set
+    if (cache->n < cache->max) {
+        sys = &cache->sys[cache->n++];
     }
-    else if (list->n_values == 1) {
-        G_matrix_set_element(krig->rslt, row, col, vals[list->value[0] - 1]);   // Estimated cell/voxel value rslt_OK = w x inputs
+    else {                      // replace the least recently used system
+        sys = &cache->sys[oldest];
+        G_free(sys->index);
+        G_matrix_free(sys->GM_Inv);
     }
-    else if (list->n_values == 0) {
+
+    sys->n = n;
+    sys->hash = hash;
+    sys->used = cache->clock;
+    sys->index = (int *)G_malloc(n * sizeof(int));
+    memcpy(sys->index, list->value, n * sizeof(int));
+
+    GM_sub = set_up_G_sub(list, pnts, var_par, report); // make submatrix for selected points
+    sys->GM_Inv = G_matrix_inverse(GM_sub);     // invert submatrix
+    G_matrix_free(GM_sub);
+
+    if (sys->GM_Inv == NULL) {
         report_error(report);
-        G_fatal_error(_("This point does not have neighbours in given radius..."));
-    }                           // end else: error
+        G_fatal_error(_("Unable to invert G-submatrix..."));
+    }
+    cache->misses++;
 
-    //G_free_ilist(list);     // free list memory 
+    return sys->GM_Inv;
 }
 
 double interpolate(struct int_par *xD, struct ilist *list, double *r0,
                    struct points *pnts, struct parameters *var_par,
-                   struct krig_pars *krig)
+                   mat_struct * GM_Inv, double *variance)
 {
+    int i;
     double rslt;
     mat_struct *g0, *w0;
 
     g0 = set_up_g0(xD, pnts, list, r0, var_par);        // Diffs inputs - unknowns (incl. cond. 1))
-    w0 = G_matrix_product(krig->GM_Inv, g0);    // Vector of weights, condition SUM(w) = 1 in last row
-
-    G_matrix_free(g0);
+    w0 = G_matrix_product(GM_Inv, g0);  // Vector of weights, condition SUM(w) = 1 in last row
 
     rslt = result(pnts, list, w0);      // Estimated cell/voxel value rslt_OK = w x inputs
+
+    // kriging variance = w x g0 (incl. Lagrange multiplier in the last row)
+    if (variance) {
+        *variance = 0.;
+        for (i = 0; i < g0->rows; i++) {
+            *variance += w0->vals[i] * g0->vals[i];
+        }
+    }
+
+    G_matrix_free(g0);
     G_matrix_free(w0);
 
     return rslt;
@@ -885,33 +975,3 @@ double trend(double *r0, struct output *out, int function, struct int_par *xD)
 
     return value;
 }
-
-int new_sample(struct int_par *xD, struct ilist *list, struct ilist *list_new,
-               struct points *pnts, int dep, int row, int col, double *r0,
-               double max_dist, double max_dist_vert, struct reg_par *reg,
-               struct parameters *var_par, struct krig_pars *krig,
-               int *new_matrix)
-{
-    int next;
-
-    // free memory
-    if (krig->modified == 0) {
-        G_free_ilist(list_new); // new list
-    }
-    G_matrix_free(krig->GM_Inv);        // old inverse matrix
-
-    // make new...
-    list = list_NN(xD, r0, pnts, max_dist, max_dist_vert);      //... list
-    cell_centre(col, row, dep, xD, reg, r0, var_par);
-    make_subsamples(xD, list, r0, dep * reg->nrows + row, col, pnts, var_par,
-                    krig);
-
-    // options:
-    krig->modified = 0;         // indices are not corrected
-    krig->new = TRUE;           //
-    krig->first = TRUE;         // new sample is being processed
-    *new_matrix++;              // counter of skipped matrices
-    next = 2;                   // interpolate using new subsample
-
-    return next;
-}
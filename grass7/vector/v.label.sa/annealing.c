@@ -13,12 +13,8 @@
  *****************************************************************************/
 
 #include "labels.h"
-#ifndef M_E
-
-/**
- * This is simply Euler's number
- */
-# define M_E 2.7182818284590452353602874713526625L
+#ifdef _OPENMP
+#include <omp.h>
 #endif
 
 /**
@@ -26,97 +22,250 @@
  */
 #define TEMP_DECS 50
 
-static double calc_label_overlap(label_t * label, int cc, int nc);
-static void do_label_overlap(label_t * label, int cc, int nc);
-
 /**
- * This is just a variable used to show statistics in the end.
+ * The label candidate overlaps in a compact form shared by all chains.
+ * Candidates are numbered globally, label after label.
  */
-static unsigned int overlaps_created = 0;
+struct overlap_table
+{
+    int *first;	   /**< The number of the first candidate of each label
+		     *  (n_labels + 1 values) */
+    int *start;	   /**< Index of the first overlap of each candidate in
+		     *  others (one more value than there are candidates) */
+    int *others;   /**< Numbers of the overlapping candidates */
+};
 
 /**
- * This is just a variable used to show statistics in the end.
+ * The state of one annealing chain.
  */
-static unsigned int overlaps_removed = 0;
+struct chain
+{
+    int *current;	       /**< The current candidate of each label */
+    int *conflicts;	       /**< The number of current candidates of other
+				 *  labels overlapping each candidate */
+    double energy;	       /**< The total energy of the placement */
+    unsigned long long rng;    /**< The state of the random numbers */
+};
+
+static void overlap_table_init(label_t * labels, int n_labels,
+			       struct overlap_table *table);
+static void chain_init(struct chain *chain, label_t * labels, int n_labels,
+		       struct overlap_table *table, int random_start);
+static void chain_anneal(struct chain *chain, label_t * labels, int n_labels,
+			 struct overlap_table *table, int *progress, int total);
+static void chain_move(struct chain *chain, struct overlap_table *table,
+		       int l, int c);
+static double chain_random(struct chain *chain);
 
 /**
  * This funxtion does the actual sumulated annealing process. Each round 30 x
  * n (the number of labels) a label is picked at random, and placed in a random
  * new position. Then the dE is calculated, and if dE is > 0 the new position is
  * reversed with the probablility 1 - e^(-dE / T).
+ *
+ * Several independent chains can be run in parallel, each starting from
+ * a different placement, and the placement with the lowest energy is used.
  @param labels The array of all labels.
  @param n_labels The size of the labels array.
  @params The commandline parameters.
  */
 void simulate_annealing(label_t * labels, int n_labels, struct params *p)
+{
+    struct overlap_table table;
+    struct chain *chains;
+    int n_chains, i, best = 0, progress = 0;
+
+    n_chains = atoi(p->chains->answer);
+    if (n_chains < 1)
+	G_fatal_error(_("The number of chains must be positive"));
+
+    fprintf(stderr, "Optimizing label positions: ...");
+    overlap_table_init(labels, n_labels, &table);
+
+    chains = G_calloc(n_chains, sizeof(struct chain));
+    for (i = 0; i < n_chains; i++) {
+	/* seed the chains one after another, so the result does not
+	 * depend on the number of threads */
+	chains[i].rng = ((unsigned long long)rand() << 32) ^
+	    (unsigned long long)rand() ^ ((unsigned long long)i << 48);
+	chain_init(&chains[i], labels, n_labels, &table, i > 0);
+    }
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (i = 0; i < n_chains; i++)
+	chain_anneal(&chains[i], labels, n_labels, &table, &progress,
+		     n_chains * TEMP_DECS);
+    G_percent(TEMP_DECS, TEMP_DECS, 1);
+
+    for (i = 1; i < n_chains; i++) {
+	if (chains[i].energy < chains[best].energy)
+	    best = i;
+    }
+    G_debug(1, "Best chain %d with energy %f", best, chains[best].energy);
+
+    for (i = 0; i < n_labels; i++) {
+	int c;
+
+	if (labels[i].n_candidates < 1)
+	    continue;
+	c = chains[best].current[i];
+	labels[i].current_candidate = c;
+	labels[i].current_score = labels[i].candidates[c].score +
+	    chains[best].conflicts[table.first[i] + c] * LABEL_OVERLAP_WEIGHT;
+    }
+
+    for (i = 0; i < n_chains; i++) {
+	G_free(chains[i].current);
+	G_free(chains[i].conflicts);
+    }
+    G_free(chains);
+    G_free(table.first);
+    G_free(table.start);
+    G_free(table.others);
+}
+
+/**
+ * This function copies the intersection lists of all candidates into
+ * a table which refers to the candidates by their numbers.
+ * @param labels The array of all labels.
+ * @param n_labels The size of the labels array.
+ * @param table The table to fill
+ */
+static void overlap_table_init(label_t * labels, int n_labels,
+			       struct overlap_table *table)
+{
+    int i, j, k, n = 0;
+
+    table->first = G_malloc((n_labels + 1) * sizeof(int));
+    table->first[0] = 0;
+    for (i = 0; i < n_labels; i++)
+	table->first[i + 1] = table->first[i] + labels[i].n_candidates;
+
+    table->start = G_malloc((table->first[n_labels] + 1) * sizeof(int));
+    for (i = 0; i < n_labels; i++) {
+	for (j = 0; j < labels[i].n_candidates; j++) {
+	    table->start[table->first[i] + j] = n;
+	    n += labels[i].candidates[j].n_intersections;
+	}
+    }
+    table->start[table->first[n_labels]] = n;
+
+    table->others = G_malloc((n > 0 ? n : 1) * sizeof(int));
+    for (i = 0; i < n_labels; i++) {
+	for (j = 0; j < labels[i].n_candidates; j++) {
+	    label_candidate_t *cand = &labels[i].candidates[j];
+	    int *others = &table->others[table->start[table->first[i] + j]];
+
+	    for (k = 0; k < cand->n_intersections; k++) {
+		int ol = (int)(cand->intersections[k].label - labels);
+
+		others[k] = table->first[ol] + cand->intersections[k].candidate;
+	    }
+	}
+    }
+}
+
+/**
+ * This function sets up the starting placement of a chain and the
+ * overlap counts of all candidates.
+ * @param chain The chain to initialize
+ * @param labels The array of all labels.
+ * @param n_labels The size of the labels array.
+ * @param table The overlaps of the candidates
+ * @param random_start If non-zero, the labels are placed randomly,
+ * otherwise the current candidates of the labels are used.
+ */
+static void chain_init(struct chain *chain, label_t * labels, int n_labels,
+		       struct overlap_table *table, int random_start)
+{
+    int i, k;
+
+    chain->current = G_malloc((n_labels > 0 ? n_labels : 1) * sizeof(int));
+    chain->conflicts = G_calloc(table->first[n_labels] + 1, sizeof(int));
+    chain->energy = 0.0;
+
+    for (i = 0; i < n_labels; i++) {
+	int c = labels[i].current_candidate, g;
+
+	if (labels[i].n_candidates < 1)
+	    continue;
+	if (random_start)
+	    c = (int)((double)(labels[i].n_candidates) * chain_random(chain));
+	chain->current[i] = c;
+	chain->energy += labels[i].candidates[c].score;
+	g = table->first[i] + c;
+	for (k = table->start[g]; k < table->start[g + 1]; k++)
+	    chain->conflicts[table->others[k]]++;
+    }
+    /* each overlap is counted from both sides */
+    for (i = 0; i < n_labels; i++) {
+	if (labels[i].n_candidates < 1)
+	    continue;
+	chain->energy += 0.5 * LABEL_OVERLAP_WEIGHT *
+	    chain->conflicts[table->first[i] + chain->current[i]];
+    }
+}
+
+/**
+ * This function runs the annealing schedule on one chain.
+ * @param chain The chain
+ * @param labels The array of all labels.
+ * @param n_labels The size of the labels array.
+ * @param table The overlaps of the candidates
+ * @param progress The number of temperature steps done by all chains
+ * @param total The maximum number of temperature steps of all chains
+ */
+static void chain_anneal(struct chain *chain, label_t * labels, int n_labels,
+			 struct overlap_table *table, int *progress, int total)
 {
     /* The temperature of the system */
     double T;
 
     /* The change in energy */
     double dE;
+    unsigned int t;
 
     T = -1.0 / log(1.0 / 3.0);
-    unsigned int t, tot_better = 0, tot_worse = 0, tot_ign = 0;
-
-    fprintf(stderr, "Optimizing label positions: ...");
     for (t = 0; t < TEMP_DECS; t++) {
-	int i;
+	int i, done;
 	unsigned int successes = 0, consec_successes = 0;
 
 	for (i = 0; i < (n_labels * 30); i++) {
-	    int l, c, cc, r;
+	    int l, c, cc;
 	    label_t *lp;
 
 	    /* pick a random label */
-	    r = rand();
-	    l = (int)((double)(n_labels) * (r / (RAND_MAX + 1.0)));
+	    l = (int)((double)(n_labels) * chain_random(chain));
 	    lp = &labels[l];
 	    /* skip labels without sufficient number of candidates */
 	    if (lp->n_candidates < 2)
 		continue;
 
-	    cc = lp->current_candidate;
+	    cc = chain->current[l];
 	    /*and a random new candidate place */
-	    c = (int)((double)(lp->n_candidates) *
-		      (rand() / (RAND_MAX + 1.0)));
+	    c = (int)((double)(lp->n_candidates) * chain_random(chain));
 	    if (c == cc) {
 		if (c == 0)
 		    c++;
 		else
 		    c--;
 	    }
-	    /* calc dE */
+	    /* calc dE, the overlap counts are kept up to date, so it is
+	     * the difference of the overlaps of the two candidates */
 	    dE = lp->candidates[c].score - lp->candidates[cc].score;
-	    dE += calc_label_overlap(lp, cc, c);
+	    dE += LABEL_OVERLAP_WEIGHT *
+		(chain->conflicts[table->first[l] + c] -
+		 chain->conflicts[table->first[l] + cc]);
 
-	    /* if dE < 0 accept */
-	    if (dE < 0.0) {
-		lp->current_score = lp->candidates[c].score;
-		do_label_overlap(lp, cc, c);
-		lp->current_candidate = c;
+	    /* if dE < 0 accept, else apply with probability p=e^(-dE/T) */
+	    if (dE < 0.0 || chain_random(chain) <= exp(-dE / T)) {
+		chain_move(chain, table, l, c);
+		chain->energy += dE;
 		successes++;
 		consec_successes++;
-		tot_better++;
 	    }
-	    /* else apply with probability p=e^(-dE/T) */
 	    else {
-		double dp, dr;
-
-		dp = pow(M_E, -dE / T);
-		dr = (double)rand() / RAND_MAX;
-		if (dr <= dp) {
-		    do_label_overlap(lp, cc, c);
-		    lp->current_score += lp->candidates[c].score;
-		    lp->current_candidate = c;
-		    successes++;
-		    consec_successes++;
-		    tot_worse++;
-		}
-		else {
-		    tot_ign++;
-		    consec_successes = 0;
-		}
+		consec_successes = 0;
 	    }
 	    /* decrease immediately */
 	    if (consec_successes > (5 * n_labels)) {
@@ -124,96 +273,60 @@ void simulate_annealing(label_t * labels, int n_labels, struct params *p)
 		break;
 	    }
 	}
-	G_percent(t, TEMP_DECS, 1);
+#pragma omp atomic capture
+	done = ++(*progress);
+#ifdef _OPENMP
+	if (omp_get_thread_num() == 0)
+#endif
+	    G_percent(done, total, 1);
 	/* we have found an optimal solution */
 	if (successes == 0) {
 	    break;
 	}
 	T -= 0.1 * T;
     }
-    G_percent(TEMP_DECS, TEMP_DECS, 1);
 }
 
 /**
- * This function calculates the change in E (dE) if the given label would
- * be moved to the new place. Contrary to the original algorithm this function
- * requires twice as much energy to overlap two labels then is released by
- * resolving an overlap. I don't have and scientific fact but it seems to
- * improve the result.
- * @param label The label in question
- * @param cc The current candidate
- * @param nc The new potential candidate location
- * @return The dE value.
+ * This function moves a label of a chain to a new candidate and updates
+ * the overlap counts.
+ * @param chain The chain
+ * @param table The overlaps of the candidates
+ * @param l The label to move
+ * @param c The new candidate of the label
  */
-static double calc_label_overlap(label_t * label, int cc, int nc)
+static void chain_move(struct chain *chain, struct overlap_table *table,
+		       int l, int c)
 {
-    int i;
-    double dE = 0.0;
-
-    /* calculate the overlaps removed */
-    for (i = 0; i < label->candidates[cc].n_intersections; i++) {
-	label_t *ol;
-	int oc;
-
-	ol = label->candidates[cc].intersections[i].label;
-	oc = label->candidates[cc].intersections[i].candidate;
-	if (ol->current_candidate == oc) {
-	    dE -= LABEL_OVERLAP_WEIGHT;
-	}
-    }
+    int g, k;
 
-    /* calculate the overlaps created */
-    for (i = 0; i < label->candidates[nc].n_intersections; i++) {
-	label_t *ol;
-	int oc;
+    /* remove the current label overlaps */
+    g = table->first[l] + chain->current[l];
+    for (k = table->start[g]; k < table->start[g + 1]; k++)
+	chain->conflicts[table->others[k]]--;
 
-	ol = label->candidates[nc].intersections[i].label;
-	oc = label->candidates[nc].intersections[i].candidate;
-	if (ol->current_candidate == oc) {
-	    dE += LABEL_OVERLAP_WEIGHT;
-	}
-    }
+    /* create new overlaps */
+    g = table->first[l] + c;
+    for (k = table->start[g]; k < table->start[g + 1]; k++)
+	chain->conflicts[table->others[k]]++;
 
-    return dE;
+    chain->current[l] = c;
 }
 
 /**
- * This function commits the label change to the new location.
- * @param label The label to move
- * @param cc The current candidate
- * @param nc The new potential candidate location
+ * This function returns a random number from [0, 1) using the SplitMix64
+ * generator. Each chain has its own state, so the chains can run in
+ * parallel.
+ * @param chain The chain
+ * @return The random number
  */
-static void do_label_overlap(label_t * label, int cc, int nc)
+static double chain_random(struct chain *chain)
 {
-    int i;
-
-    /* remove the current label overlaps */
-    for (i = 0; i < label->candidates[cc].n_intersections; i++) {
-	label_t *ol;
-	int oc;
-
-	ol = label->candidates[cc].intersections[i].label;
-	oc = label->candidates[cc].intersections[i].candidate;
-	if (ol->current_candidate == oc) {
-	    ol->current_score -= LABEL_OVERLAP_WEIGHT;
-	    label->current_score -= LABEL_OVERLAP_WEIGHT;
-	    /* ol->candidates[oc].score -= LABEL_OVERLAP_WEIGHT; */
-	    overlaps_removed++;
-	}
-    }
+    unsigned long long z;
 
-    /* create new overlaps */
-    for (i = 0; i < label->candidates[nc].n_intersections; i++) {
-	label_t *ol;
-	int oc;
-
-	ol = label->candidates[nc].intersections[i].label;
-	oc = label->candidates[nc].intersections[i].candidate;
-	if (ol->current_candidate == oc) {
-	    ol->current_score += LABEL_OVERLAP_WEIGHT;
-	    label->current_score += LABEL_OVERLAP_WEIGHT;
-	    /* ol->candidates[oc]->score += 40; */
-	    overlaps_created++;
-	}
-    }
+    z = (chain->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (double)(z >> 11) * (1.0 / 9007199254740992.0);
 }
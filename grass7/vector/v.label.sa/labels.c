@@ -4,6 +4,9 @@
  * This file contains functions for label and label candidate manipulation
 */
 #include "labels.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 static int label_skyline(FT_Face face, const char *charset, label_t * label);
 static struct line_pnts *box_trans_rot(struct bound_box * bb, label_point_t * p,
 				       double angle);
@@ -19,7 +22,8 @@ static double min_dist_2_lines(struct line_pnts *skyline,
 			       struct line_pnts *swathline,
 			       label_point_t * p);
 static int box_overlap(struct bound_box * a, struct bound_box * b);
-static int box_overlap2(struct line_pnts *a, struct line_pnts *b);
+static int box_overlap2(const double *ax, const double *ay,
+			const double *bx, const double *by);
 
 /**
  * The font size in map units. A global variable because I'm lazy :P
@@ -1137,97 +1141,321 @@ static double min_dist_2_lines(struct line_pnts *skyline,
     return dist;
 }
 
+/**
+ * A label candidate prepared for the overlap tests.
+ */
+typedef struct
+{
+    struct bound_box bb;  /**< The extent of the (rotated) label box */
+    double x[5];	  /**< X coordinates of the box as a closed polygon */
+    double y[5];	  /**< Y coordinates of the box as a closed polygon */
+    int rotated;	  /**< Non-zero if the label is rotated */
+    int label;		  /**< Index of the label */
+    int candidate;	  /**< Index of the candidate in the label */
+} candidate_box_t;
+
+/**
+ * A uniform grid of label candidate boxes. Each box is listed in all
+ * cells which it covers.
+ */
+typedef struct
+{
+    double west;     /**< The west edge of the grid */
+    double south;    /**< The south edge of the grid */
+    double cell;     /**< The size of a grid cell */
+    int nx;	     /**< The number of columns */
+    int ny;	     /**< The number of rows */
+    int *start;	     /**< Index of the first item of each cell in items
+		       *  (nx * ny + 1 values) */
+    int *items;	     /**< Indices of boxes in the cells */
+} candidate_grid_t;
+
+/**
+ * This function computes the polygon and the extent of a label candidate,
+ * the same way as box_trans_rot() does.
+ * @param label The label
+ * @param c The index of the candidate
+ * @param box The box to fill
+ */
+static void candidate_box(label_t * label, int c, candidate_box_t * box)
+{
+    label_candidate_t *cand = &label->candidates[c];
+    double x0, y0, x1, y1, x2, y2;
+    int i;
+
+    x0 = cand->point.x + label->bb.W;
+    y0 = cand->point.y + label->bb.S;
+    x1 = (label->bb.E - label->bb.W) * cos(cand->rotation);
+    y1 = (label->bb.E - label->bb.W) * sin(cand->rotation);
+    x2 = (label->bb.N - label->bb.S) * sin(cand->rotation);
+    y2 = (label->bb.N - label->bb.S) * cos(cand->rotation);
+    box->x[0] = x0;
+    box->y[0] = y0;
+    box->x[1] = x0 + x1;
+    box->y[1] = y0 + y1;
+    box->x[2] = x0 + x1 - x2;
+    box->y[2] = y0 + y1 + y2;
+    box->x[3] = x0 - x2;
+    box->y[3] = y0 + y2;
+    box->x[4] = x0;
+    box->y[4] = y0;
+    box->rotated = (cand->rotation != 0);
+
+    if (!box->rotated) {
+	box->bb.N = label->bb.N + cand->point.y;
+	box->bb.E = label->bb.E + cand->point.x;
+	box->bb.W = label->bb.W + cand->point.x;
+	box->bb.S = label->bb.S + cand->point.y;
+	return;
+    }
+    box->bb.W = box->bb.E = box->x[0];
+    box->bb.S = box->bb.N = box->y[0];
+    for (i = 1; i < 4; i++) {
+	if (box->x[i] < box->bb.W)
+	    box->bb.W = box->x[i];
+	if (box->x[i] > box->bb.E)
+	    box->bb.E = box->x[i];
+	if (box->y[i] < box->bb.S)
+	    box->bb.S = box->y[i];
+	if (box->y[i] > box->bb.N)
+	    box->bb.N = box->y[i];
+    }
+}
+
+/**
+ * This function returns the grid column (or row) of a coordinate.
+ */
+static int grid_index(double value, double origin, double cell, int n)
+{
+    int i = (int)floor((value - origin) / cell);
+
+    if (i < 0)
+	return 0;
+    if (i >= n)
+	return n - 1;
+    return i;
+}
+
+/**
+ * This function puts the candidate boxes into a uniform grid. The cell
+ * size is the average size of the boxes, so each box is usually in a few
+ * cells and each cell contains only a few boxes.
+ * @param boxes The candidate boxes
+ * @param n_boxes The number of boxes
+ * @param grid The grid to create
+ */
+static void candidate_grid_init(candidate_box_t * boxes, int n_boxes,
+				candidate_grid_t * grid)
+{
+    double east, north, size = 0;
+    long n_cells;
+    int i, x, y;
+
+    grid->west = boxes[0].bb.W;
+    grid->south = boxes[0].bb.S;
+    east = boxes[0].bb.E;
+    north = boxes[0].bb.N;
+    for (i = 0; i < n_boxes; i++) {
+	if (boxes[i].bb.W < grid->west)
+	    grid->west = boxes[i].bb.W;
+	if (boxes[i].bb.S < grid->south)
+	    grid->south = boxes[i].bb.S;
+	if (boxes[i].bb.E > east)
+	    east = boxes[i].bb.E;
+	if (boxes[i].bb.N > north)
+	    north = boxes[i].bb.N;
+	size += (boxes[i].bb.E - boxes[i].bb.W) + (boxes[i].bb.N - boxes[i].bb.S);
+    }
+    grid->cell = size / (2 * n_boxes);
+    if (grid->cell <= 0)
+	grid->cell = 1;
+    /* limit the number of cells to a few per box */
+    n_cells = (long)((east - grid->west) / grid->cell + 1) *
+	(long)((north - grid->south) / grid->cell + 1);
+    if (n_cells > 4L * n_boxes)
+	grid->cell *= sqrt((double)n_cells / (4.0 * n_boxes));
+    grid->nx = (int)((east - grid->west) / grid->cell) + 1;
+    grid->ny = (int)((north - grid->south) / grid->cell) + 1;
+
+    grid->start = G_calloc((size_t)grid->nx * grid->ny + 1, sizeof(int));
+    for (i = 0; i < n_boxes; i++) {
+	int x0 = grid_index(boxes[i].bb.W, grid->west, grid->cell, grid->nx);
+	int x1 = grid_index(boxes[i].bb.E, grid->west, grid->cell, grid->nx);
+	int y0 = grid_index(boxes[i].bb.S, grid->south, grid->cell, grid->ny);
+	int y1 = grid_index(boxes[i].bb.N, grid->south, grid->cell, grid->ny);
+
+	for (y = y0; y <= y1; y++)
+	    for (x = x0; x <= x1; x++)
+		grid->start[y * grid->nx + x + 1]++;
+    }
+    for (i = 0; i < grid->nx * grid->ny; i++)
+	grid->start[i + 1] += grid->start[i];
+    grid->items = G_malloc((size_t)grid->start[grid->nx * grid->ny] *
+			   sizeof(int));
+    for (i = 0; i < n_boxes; i++) {
+	int x0 = grid_index(boxes[i].bb.W, grid->west, grid->cell, grid->nx);
+	int x1 = grid_index(boxes[i].bb.E, grid->west, grid->cell, grid->nx);
+	int y0 = grid_index(boxes[i].bb.S, grid->south, grid->cell, grid->ny);
+	int y1 = grid_index(boxes[i].bb.N, grid->south, grid->cell, grid->ny);
+
+	for (y = y0; y <= y1; y++)
+	    for (x = x0; x <= x1; x++)
+		grid->items[grid->start[y * grid->nx + x]++] = i;
+    }
+    /* the fill moved each start to the start of the next cell */
+    for (i = grid->nx * grid->ny; i > 0; i--)
+	grid->start[i] = grid->start[i - 1];
+    grid->start[0] = 0;
+}
+
+/**
+ * This function compares two intersections by label and candidate, so the
+ * intersection lists are in the same order as when found by the
+ * label-by-label search.
+ */
+static int intersection_compare(const void *a, const void *b)
+{
+    const label_intersection_t *ia = a, *ib = b;
+
+    if (ia->label != ib->label)
+	return ia->label < ib->label ? -1 : 1;
+    return ia->candidate - ib->candidate;
+}
+
 /**
  * This function finds label -label overlaps.
+ *
+ * The candidate boxes are put into a uniform grid and only the candidates
+ * sharing a grid cell are tested. Each pair is tested in only one cell
+ * (the one with the lower left corner of the overlap of the extents).
+ * The labels are processed in parallel and each candidate gets the list of
+ * all candidates of other labels which it overlaps.
  * @param labels The array of labels
  * @param n_labels The size of the array
  */
 void label_candidate_overlap(label_t * labels, int n_labels)
 {
-    int i;
+    candidate_box_t *boxes;
+    candidate_grid_t grid;
+    int *first_box;
+    int i, n_boxes, done = 0;
 
     fprintf(stderr, "Finding label overlap: ...");
+
+    first_box = G_malloc((n_labels + 1) * sizeof(int));
+    first_box[0] = 0;
+    for (i = 0; i < n_labels; i++)
+	first_box[i + 1] = first_box[i] + labels[i].n_candidates;
+    n_boxes = first_box[n_labels];
+    if (n_boxes == 0) {
+	G_free(first_box);
+	G_percent(n_labels, n_labels, 1);
+	return;
+    }
+    boxes = G_malloc(n_boxes * sizeof(candidate_box_t));
+
+#pragma omp parallel for schedule(dynamic, 64)
     for (i = 0; i < n_labels; i++) {
 	int j;
 
 	for (j = 0; j < labels[i].n_candidates; j++) {
-	    int k;
+	    candidate_box_t *box = &boxes[first_box[i] + j];
 
-	    for (k = i + 1; k < n_labels; k++) {
-		int l;
-
-		for (l = 0; l < labels[k].n_candidates; l++) {
-		    int overlap = 0;
-
-		    if ((labels[i].candidates[j].rotation == 0) &&
-			(labels[k].candidates[l].rotation == 0)) {
-			struct bound_box a, b;
-
-			a.N =
-			    labels[i].bb.N + labels[i].candidates[j].point.y;
-			a.E =
-			    labels[i].bb.E + labels[i].candidates[j].point.x;
-			a.W =
-			    labels[i].bb.W + labels[i].candidates[j].point.x;
-			a.S =
-			    labels[i].bb.S + labels[i].candidates[j].point.y;
-
-			b.N =
-			    labels[k].bb.N + labels[k].candidates[l].point.y;
-			b.E =
-			    labels[k].bb.E + labels[k].candidates[l].point.x;
-			b.W =
-			    labels[k].bb.W + labels[k].candidates[l].point.x;
-			b.S =
-			    labels[k].bb.S + labels[k].candidates[l].point.y;
-			overlap = box_overlap(&a, &b);
-		    }
-		    else {
-			struct line_pnts *a = NULL, *b = NULL;
-
-			a = box_trans_rot(&labels[i].bb,
-					  &labels[i].candidates[j].point,
-					  labels[i].candidates[j].rotation);
-			b = box_trans_rot(&labels[k].bb,
-					  &labels[k].candidates[l].point,
-					  labels[k].candidates[l].rotation);
-			overlap = box_overlap2(a, b);
-			Vect_destroy_line_struct(a);
-			Vect_destroy_line_struct(b);
-		    }
-		    if (overlap) {
-			int n;
-			label_intersection_t *li;
-
-			n = ++(labels[i].candidates[j].n_intersections);
-			li = G_realloc(labels[i].candidates[j].intersections,
-				     n * sizeof(label_intersection_t));
-			if (li == NULL)
-			    G_fatal_error("\nUnable to allocate memory\n");
-			li[n - 1].label = &labels[k];
-			li[n - 1].candidate = l;
-			if ((labels[k].current_candidate == l) &&
-			    (labels[i].current_candidate == j)) {
-			    labels[i].current_score += LABEL_OVERLAP_WEIGHT;
-			    labels[k].current_score += LABEL_OVERLAP_WEIGHT;
+	    candidate_box(&labels[i], j, box);
+	    box->label = i;
+	    box->candidate = j;
+	}
+    }
+    candidate_grid_init(boxes, n_boxes, &grid);
+
+#pragma omp parallel
+    {
+	label_intersection_t *found = NULL;
+	int n_alloc = 0;
+
+#pragma omp for schedule(dynamic, 16)
+	for (i = 0; i < n_labels; i++) {
+	    int j, n_done;
+
+	    for (j = 0; j < labels[i].n_candidates; j++) {
+		candidate_box_t *a = &boxes[first_box[i] + j];
+		int n_found = 0;
+		int x, y;
+		int x0 = grid_index(a->bb.W, grid.west, grid.cell, grid.nx);
+		int x1 = grid_index(a->bb.E, grid.west, grid.cell, grid.nx);
+		int y0 = grid_index(a->bb.S, grid.south, grid.cell, grid.ny);
+		int y1 = grid_index(a->bb.N, grid.south, grid.cell, grid.ny);
+
+		for (y = y0; y <= y1; y++) {
+		    for (x = x0; x <= x1; x++) {
+			int c = y * grid.nx + x;
+			int m;
+
+			for (m = grid.start[c]; m < grid.start[c + 1]; m++) {
+			    candidate_box_t *b = &boxes[grid.items[m]];
+			    int overlap;
+
+			    if (b->label == i)
+				continue;
+			    /* extents must overlap */
+			    if (a->bb.E < b->bb.W || b->bb.E < a->bb.W ||
+				a->bb.N < b->bb.S || b->bb.N < a->bb.S)
+				continue;
+			    /* test the pair only in one of the shared cells */
+			    if (grid_index(a->bb.W > b->bb.W ? a->bb.W : b->bb.W,
+					   grid.west, grid.cell, grid.nx) != x ||
+				grid_index(a->bb.S > b->bb.S ? a->bb.S : b->bb.S,
+					   grid.south, grid.cell, grid.ny) != y)
+				continue;
+
+			    if (!a->rotated && !b->rotated)
+				overlap = box_overlap(&a->bb, &b->bb);
+			    else
+				overlap = box_overlap2(a->x, a->y, b->x, b->y);
+			    if (!overlap)
+				continue;
+
+			    if (n_found == n_alloc) {
+				n_alloc = n_alloc ? 2 * n_alloc : 64;
+				found = G_realloc(found, n_alloc *
+						  sizeof(label_intersection_t));
+			    }
+			    found[n_found].label = &labels[b->label];
+			    found[n_found].candidate = b->candidate;
+			    n_found++;
+			    if ((labels[i].current_candidate == j) &&
+				(labels[b->label].current_candidate ==
+				 b->candidate))
+				labels[i].current_score += LABEL_OVERLAP_WEIGHT;
 			}
-			labels[i].candidates[j].intersections = li;
-			n = ++(labels[k].candidates[l].n_intersections);
-			li = G_realloc(labels[k].candidates[l].intersections,
-				     n * sizeof(label_intersection_t));
-			if (li == NULL)
-			    G_fatal_error("\nUnable to allocate memory\n");
-			li[n - 1].label = &labels[i];
-			li[n - 1].candidate = j;
-
-			labels[k].candidates[l].intersections = li;
 		    }
 		}
+		if (n_found) {
+		    label_intersection_t *li;
+
+		    qsort(found, n_found, sizeof(label_intersection_t),
+			  intersection_compare);
+		    li = G_malloc(n_found * sizeof(label_intersection_t));
+		    memcpy(li, found, n_found * sizeof(label_intersection_t));
+		    labels[i].candidates[j].intersections = li;
+		    labels[i].candidates[j].n_intersections = n_found;
+		}
 	    }
+#pragma omp atomic capture
+	    n_done = ++done;
+#ifdef _OPENMP
+	    if (omp_get_thread_num() == 0)
+#endif
+		G_percent(n_done, n_labels, 1);
 	}
-	G_percent(i, n_labels, 1);
+	G_free(found);
     }
     G_percent(n_labels, n_labels, 1);
+
+    G_free(grid.start);
+    G_free(grid.items);
+    G_free(boxes);
+    G_free(first_box);
 }
 
 /**
@@ -1255,25 +1483,28 @@ static int box_overlap(struct bound_box * a, struct bound_box * b)
 
 /**
  * This function checks if two rotated boxes overlap. The boxes are stored
- * as polygons and the function assumes that each box has exactly 4 sides.
- * @param a Bounding box A
- * @param b Bounding box B
+ * as closed polygons with exactly 4 sides.
+ * @param ax X coordinates of box A
+ * @param ay Y coordinates of box A
+ * @param bx X coordinates of box B
+ * @param by Y coordinates of box B
  * @return returns 1 if the given boxes overlap. 0 if not.
  */
-static int box_overlap2(struct line_pnts *a, struct line_pnts *b)
+static int box_overlap2(const double *ax, const double *ay,
+			const double *bx, const double *by)
 {
     int i, r = 0;
 
-    for (i = 0; i < (a->n_points - 1); i++) {
+    for (i = 0; i < 4; i++) {
 	int j;
 
-	for (j = 0; j < (b->n_points - 1); j++) {
+	for (j = 0; j < 4; j++) {
 	    double d[6];
 
-	    r += Vect_segment_intersection(a->x[i], a->y[i], 0,
-					   a->x[i + 1], a->y[i + 1], 0,
-					   b->x[j], b->y[j], 0,
-					   b->x[j + 1], a->y[j + 1], 0,
+	    r += Vect_segment_intersection(ax[i], ay[i], 0,
+					   ax[i + 1], ay[i + 1], 0,
+					   bx[j], by[j], 0,
+					   bx[j + 1], by[j + 1], 0,
 					   &d[0], &d[1], &d[2],
 					   &d[3], &d[4], &d[5], 0);
 	}
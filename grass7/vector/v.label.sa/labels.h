@@ -124,6 +124,7 @@ struct params
     struct Option *opaque;
     struct Option *bocolor;
     struct Option *bowidth;
+    struct Option *chains;
 
     /*    struct Option */
     /*      struct Option *where; *//* later */
@@ -156,6 +156,13 @@ int main(int argc, char *argv[])
     p.bowidth->answer = "0";
     p.bowidth->guisection = _("Colors");
 
+    p.chains = G_define_option();
+    p.chains->key = "chains";
+    p.chains->description =
+	_("Number of independent annealing runs, the best placement is used");
+    p.chains->type = TYPE_INTEGER;
+    p.chains->answer = "1";
+
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
 
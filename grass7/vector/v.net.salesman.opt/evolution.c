@@ -88,7 +88,7 @@ int ga_opt(int ntours, int nelim, int nopt, int ngen, int *best_cycle)
 	tp->cycle[ncities] = tp->cycle[0];
 	tp->cost = 0;
 	for (j = 0; j < ncities; j++)
-	    tp->cost += cost_cache[tp->cycle[j]][tp->cycle[j + 1]];
+	    tp->cost += COST_CACHE(tp->cycle[j], tp->cycle[j + 1]);
 
 	tc[i].cost = tp->cost;
 	tc[i].t = i;
@@ -274,7 +274,7 @@ int ga_opt(int ntours, int nelim, int nopt, int ngen, int *best_cycle)
 	    tp->cycle[ncities] = tp->cycle[0];
 	    tp->cost = 0;
 	    for (j = 0; j < ncities; j++)
-		tp->cost += cost_cache[tp->cycle[j]][tp->cycle[j + 1]];
+		tp->cost += COST_CACHE(tp->cycle[j], tp->cycle[j + 1]);
 	    
 	    tour[i].opt_done = 1;
 	}
@@ -870,7 +870,7 @@ int ga_subtour(struct tsp_tour *tour, int p1, int p2, int c,
     child->cost = 0;
     child->cycle[ncities] = child->cycle[0];
     for (i = 0; i < ncities; i++)
-	child->cost +=cost_cache[child->cycle[i]][child->cycle[i + 1]];
+	child->cost +=COST_CACHE(child->cycle[i], child->cycle[i + 1]);
 
     child->used = 1;
 
@@ -927,8 +927,8 @@ int ga_recombine2(struct tsp_tour *tour, int p1, int p2, int c)
 	    picked = parent1->cycle[nxt1];
 	}
 	else {
-	    if (cost_cache[last][parent1->cycle[nxt1]] <
-	        cost_cache[last][parent2->cycle[nxt2]]) {
+	    if (COST_CACHE(last, parent1->cycle[nxt1]) <
+	        COST_CACHE(last, parent2->cycle[nxt2])) {
 
 		picked = parent1->cycle[nxt1];
 	    }
@@ -945,7 +945,7 @@ int ga_recombine2(struct tsp_tour *tour, int p1, int p2, int c)
     child->cycle[ncities] = child->cycle[0];
     child->cost = 0;
     for (i = 0; i < ncities; i++)
-	child->cost += cost_cache[child->cycle[i]][child->cycle[i + 1]];
+	child->cost += COST_CACHE(child->cycle[i], child->cycle[i + 1]);
 
     if (child->cost < parent1->cost && child->cost < parent2->cost)
 	child->used = 1;
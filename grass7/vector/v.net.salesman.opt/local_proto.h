@@ -5,7 +5,7 @@
 typedef struct
 {
     int city;
-    double cost;
+    float cost;
 } COST;
 
 
@@ -14,9 +14,22 @@ extern int nnodes;			/* number of nodes */
 extern int *cities;			/* array of cities */
 extern COST **costs;			/* pointer to array of pointers to arrays of sorted forward costs */
 extern COST **bcosts;			/* pointer to array of pointers to arrays of sorted backward costs */
-extern double **cost_cache;		/* pointer to array of pointers to arrays of cached costs */
+extern float *cost_cache;		/* cached costs, see COST_CACHE() */
+extern int cost_symmetric;		/* only lower triangle of costs is cached */
 extern int debug_level;
 
+/* index of the cost from city to city in the cost cache */
+#define COST_INDEX(from, to) (cost_symmetric ? \
+    ((from) >= (to) ? (size_t)(from) * ((from) + 1) / 2 + (to) : \
+                      (size_t)(to) * ((to) + 1) / 2 + (from)) : \
+    (size_t)(from) * ncities + (to))
+
+/* cached cost from city to city */
+#define COST_CACHE(from, to) cost_cache[COST_INDEX(from, to)]
+
+
+/* netcosts.c */
+void net_cost_cache(struct Map_info *);
 
 /* tour.c */
 void add_city(int, int, int *, int *, int *);
@@ -35,7 +35,8 @@ int *cities;			/* array of cities */
 int *cused;			/* city is in cycle */
 COST **costs;			/* pointer to array of pointers to arrays of sorted forward costs */
 COST **bcosts;			/* pointer to array of pointers to arrays of sorted backward costs */
-double **cost_cache;		/* pointer to array of pointers to arrays of cached costs */
+float *cost_cache;		/* cached costs, see COST_CACHE() */
+int cost_symmetric;		/* only lower triangle of costs is cached */
 int *cycle;			/* path */
 int ncyc = 0;			/* number of cities in cycle */
 int debug_level;
@@ -258,10 +259,14 @@ int main(int argc, char **argv)
     for (i = 0; i < ncities; i++) {
 	costs[i] = (COST *) G_malloc(ncities * sizeof(COST));
     }
-    cost_cache = (double **) G_malloc(ncities * sizeof(double *));
-    for (i = 0; i < ncities; i++) {
-	cost_cache[i] = (double *) G_malloc(ncities * sizeof(double));
-    }
+    /* without backward costs, the costs are the same in both directions */
+    cost_symmetric = (abcol->answer == NULL);
+    if (cost_symmetric)
+	cost_cache = (float *)G_malloc((size_t)ncities * (ncities + 1) / 2 *
+				       sizeof(float));
+    else
+	cost_cache = (float *)G_malloc((size_t)ncities * ncities *
+				       sizeof(float));
     if (abcol->answer) {
 	bcosts = (COST **) G_malloc(ncities * sizeof(COST *));
 	for (i = 0; i < ncities; i++) {
@@ -278,32 +283,19 @@ int main(int argc, char **argv)
 			 geo, 0);
 
     /* Create sorted lists of costs */
-    /* for a large number of cities this will become very slow, can not be fixed */
     G_message(_("Creating cost cache..."));
-    G_begin_distance_calculations();
-    for (i = 0; i < ncities; i++) {
-	G_percent(i, ncities, 2);
-	k = 0;
-	for (j = 0; j < ncities; j++) {
-	    cost_cache[i][j] = 0.0;
-	    if (i == j)
-		continue;
-
-	    if (!TSP_TEST) {
-		ret =
-		    Vect_net_shortest_path(&Map, cities[i], cities[j], NULL,
-					   &cost);
-
-		if (ret == -1)
-		    G_fatal_error(_("Destination node [%d] is unreachable "
-				    "from node [%d]"), cities[i], cities[j]);
-	    }
-	    else {
+    if (!TSP_TEST) {
+	net_cost_cache(&Map);
+    }
+    else {
+	G_begin_distance_calculations();
+	for (i = 0; i < ncities; i++) {
+	    for (j = 0; j <= i; j++) {
 		double x1, y1, z1, x2, y2, z2, dx, dy;
-		
+
 		Vect_get_node_coor(&Map, cities[i], &x1, &y1, &z1);
 		Vect_get_node_coor(&Map, cities[j], &x2, &y2, &z2);
-		
+
 		if (geo) {
 		    cost = G_distance(x1, y1, x2, y2);
 		}
@@ -312,20 +304,31 @@ int main(int argc, char **argv)
 		    dy = y1 - y2;
 		    cost = sqrt(dx * dx + dy * dy);
 		}
+		COST_CACHE(i, j) = cost;
+		COST_CACHE(j, i) = cost;
 	    }
+	}
+    }
+    G_percent(1, 1, 2);
+
+#pragma omp parallel for private(j, k)
+    for (i = 0; i < ncities; i++) {
+	k = 0;
+	for (j = 0; j < ncities; j++) {
+	    if (i == j)
+		continue;
 
 	    /* add to directional cost cache: from, to, cost */
 	    costs[i][k].city = j;
-	    costs[i][k].cost = cost;
-	    cost_cache[i][j] = cost;
+	    costs[i][k].cost = COST_CACHE(i, j);
 
 	    k++;
 	}
 	qsort((void *)costs[i], k, sizeof(COST), cmp);
     }
-    G_percent(1, 1, 2);
     
     if (bcosts) {
+#pragma omp parallel for private(j, k)
 	for (i = 0; i < ncities; i++) {
 	    /* this should be fast, no need for G_percent() */
 	    k = 0;
@@ -334,7 +337,7 @@ int main(int argc, char **argv)
 		    continue;
 		    
 		bcosts[i][k].city = j;
-		bcosts[i][k].cost = cost_cache[j][i];
+		bcosts[i][k].cost = COST_CACHE(j, i);
 
 		k++;
 	    }
@@ -427,18 +430,18 @@ int main(int argc, char **argv)
 	    for (j = 0; j < ncyc; j++) {
 		/* cost from j to j + 1 (directional) */
 		/* get cost from directional cost cache */
-		tcost = cost_cache[cycle[j]][cycle[j + 1]];
+		tcost = COST_CACHE(cycle[j], cycle[j + 1]);
 		tmpcost = -tcost;
 
 		/* check insertion of city between j and j + 1 */
 
 		/* cost from j to city (directional) */
 		/* get cost from directional cost cache */
-		tcost = cost_cache[cycle[j]][city];
+		tcost = COST_CACHE(cycle[j], city);
 		tmpcost += tcost;
 		/* cost from city to j + 1 (directional) */
 		/* get cost from directional cost cache */
-		tcost = cost_cache[city][cycle[j + 1]];
+		tcost = COST_CACHE(city, cycle[j + 1]);
 		tmpcost += tcost;
 		
 		/* tmpcost must always be > 0 */
@@ -506,7 +509,7 @@ int main(int argc, char **argv)
 	    ocost = 0.;
 	    cycle[ncyc] = cycle[0];
 	    for (j = 0; j < ncyc; j++) {
-		ocost += cost_cache[cycle[j]][cycle[j + 1]];
+		ocost += COST_CACHE(cycle[j], cycle[j + 1]);
 	    }
 	    G_verbose_message(_("Current total cost: %.3f"), ocost);
 
@@ -545,7 +548,7 @@ int main(int argc, char **argv)
 	    ocost1 = 0.;
 	    cycle[ncyc] = cycle[0];
 	    for (j = 0; j < ncyc; j++) {
-		ocost1 += cost_cache[cycle[j]][cycle[j + 1]];
+		ocost1 += COST_CACHE(cycle[j], cycle[j + 1]);
 	    }
 	    G_verbose_message(_("Optimized total cost: %.3f, gain %.3f%%"),
 			      ocost1, ocost / ocost1 * 100 - 100);
@@ -586,7 +589,7 @@ int main(int argc, char **argv)
 	node2 = cities[cycle[i + 1]];
 	G_debug(2, " %d -> %d", node1, node2);
 	ret = Vect_net_shortest_path(&Map, node1, node2, List, NULL);
-	cost += cost_cache[cycle[i]][cycle[i + 1]];
+	cost += COST_CACHE(cycle[i], cycle[i + 1]);
 	for (j = 0; j < List->n_values; j++) {
 	    line = abs(List->value[j]);
 	    /* Vect_list_append() appends only if value not yet present !!! 
@@ -656,7 +659,7 @@ int main(int argc, char **argv)
 	Vect_write_line(&Out, ltype, Points, Cats);
 	k++;
 	if (fp) {
-	    fprintf(fp, "%d;%d;%.3f\n", k, cat, cost_cache[cycle[i]][cycle[i + 1]]);
+	    fprintf(fp, "%d;%d;%.3f\n", k, cat, COST_CACHE(cycle[i], cycle[i + 1]));
 	}
 
 	G_debug(2, "%d. node: cat %d", k, cat);
@@ -0,0 +1,250 @@
+/****************************************************************
+ *
+ *  MODULE:       v.net.salesman
+ *
+ *  AUTHOR(S):    Radim Blazek, Markus Metz
+ *
+ *  PURPOSE:      Costs between all pairs of cities
+ *
+ *  COPYRIGHT:    (C) 2001-2011 by the GRASS Development Team
+ *
+ *                This program is free software under the
+ *                GNU General Public License (>=v2).
+ *                Read the file COPYING that comes with GRASS
+ *                for details.
+ *
+ **************************************************************/
+#include <stdlib.h>
+#include <grass/gis.h>
+#include <grass/vector.h>
+#include <grass/glocale.h>
+#include "local_proto.h"
+
+/* network as adjacency lists of nodes */
+struct net
+{
+    int nnodes;
+    int *first;			/* first arc of each node, nnodes + 2 values */
+    int *to;			/* end node of each arc */
+    double *cost;		/* cost of each arc */
+};
+
+struct heap_item
+{
+    double dist;
+    int node;
+};
+
+/* search state of one thread */
+struct search
+{
+    double *dist;		/* distance of reached nodes */
+    int *reached;		/* node is reached in search reached[node] */
+    int *done;			/* node is settled in search done[node] */
+    int *target;		/* node is a target in search target[node] */
+    struct heap_item *heap;	/* queue of reached nodes */
+    int nheap, aheap;
+};
+
+/* build adjacency lists from the costs of the network graph */
+static void net_init(struct Map_info *Map, struct net *net)
+{
+    int nlines, line, node1, node2, narcs, i;
+    double cost;
+
+    net->nnodes = Vect_get_num_nodes(Map);
+    nlines = Vect_get_num_lines(Map);
+    net->first = (int *)G_calloc(net->nnodes + 2, sizeof(int));
+
+    /* count arcs leaving each node */
+    for (line = 1; line <= nlines; line++) {
+	if (!(Vect_get_line_type(Map, line) & GV_LINES))
+	    continue;
+	Vect_get_line_nodes(Map, line, &node1, &node2);
+	if (Vect_net_get_line_cost(Map, line, GV_FORWARD, &cost))
+	    net->first[node1 + 1]++;
+	if (Vect_net_get_line_cost(Map, line, GV_BACKWARD, &cost))
+	    net->first[node2 + 1]++;
+    }
+    for (i = 0; i <= net->nnodes; i++)
+	net->first[i + 1] += net->first[i];
+    narcs = net->first[net->nnodes + 1];
+    net->to = (int *)G_malloc((narcs > 0 ? narcs : 1) * sizeof(int));
+    net->cost = (double *)G_malloc((narcs > 0 ? narcs : 1) * sizeof(double));
+
+    /* fill arcs, first[] is moved to the next node on the way */
+    for (line = 1; line <= nlines; line++) {
+	if (!(Vect_get_line_type(Map, line) & GV_LINES))
+	    continue;
+	Vect_get_line_nodes(Map, line, &node1, &node2);
+	if (Vect_net_get_line_cost(Map, line, GV_FORWARD, &cost)) {
+	    net->to[net->first[node1]] = node2;
+	    net->cost[net->first[node1]++] = cost;
+	}
+	if (Vect_net_get_line_cost(Map, line, GV_BACKWARD, &cost)) {
+	    net->to[net->first[node2]] = node1;
+	    net->cost[net->first[node2]++] = cost;
+	}
+    }
+    for (i = net->nnodes + 1; i > 0; i--)
+	net->first[i] = net->first[i - 1];
+    net->first[0] = 0;
+}
+
+static void heap_push(struct search *s, double dist, int node)
+{
+    int i, parent;
+
+    if (s->nheap == s->aheap) {
+	s->aheap = s->aheap ? 2 * s->aheap : 1024;
+	s->heap = (struct heap_item *)G_realloc(s->heap,
+					       s->aheap *
+					       sizeof(struct heap_item));
+    }
+    i = s->nheap++;
+    while (i > 0) {
+	parent = (i - 1) / 2;
+	if (s->heap[parent].dist <= dist)
+	    break;
+	s->heap[i] = s->heap[parent];
+	i = parent;
+    }
+    s->heap[i].dist = dist;
+    s->heap[i].node = node;
+}
+
+static struct heap_item heap_pop(struct search *s)
+{
+    struct heap_item top = s->heap[0], last;
+    int i = 0, child;
+
+    last = s->heap[--s->nheap];
+    while ((child = 2 * i + 1) < s->nheap) {
+	if (child + 1 < s->nheap &&
+	    s->heap[child + 1].dist < s->heap[child].dist)
+	    child++;
+	if (last.dist <= s->heap[child].dist)
+	    break;
+	s->heap[i] = s->heap[child];
+	i = child;
+    }
+    s->heap[i] = last;
+
+    return top;
+}
+
+/* Dijkstra search from one city, stops when all targets are settled
+ *
+ * id must be unique for each search, it is used to tell apart
+ * nodes reached in earlier searches without clearing the arrays
+ */
+static void search_from(struct net *net, struct search *s, int id,
+			int from, int ntargets)
+{
+    int i, node;
+
+    s->nheap = 0;
+    s->reached[from] = id;
+    s->dist[from] = 0;
+    heap_push(s, 0, from);
+
+    while (ntargets > 0 && s->nheap > 0) {
+	struct heap_item item = heap_pop(s);
+
+	node = item.node;
+	if (s->done[node] == id)
+	    continue;		/* already settled with a lower cost */
+	s->done[node] = id;
+	if (s->target[node] == id)
+	    ntargets--;
+
+	for (i = net->first[node]; i < net->first[node + 1]; i++) {
+	    int to = net->to[i];
+	    double dist = item.dist + net->cost[i];
+
+	    if (s->reached[to] != id || dist < s->dist[to]) {
+		s->reached[to] = id;
+		s->dist[to] = dist;
+		heap_push(s, dist, to);
+	    }
+	}
+    }
+}
+
+/*!
+ * \brief Fill the cost cache with network costs between all cities
+ *
+ * Each row of the cost cache is computed by one search from the city
+ * which stops as soon as all other cities are reached. Rows are computed
+ * in parallel. If the costs are symmetric, only costs to cities with
+ * a lower index are searched for.
+ */
+void net_cost_cache(struct Map_info *Map)
+{
+    struct net net;
+    int i, unreachable = 0, from_node = 0, to_node = 0, ndone = 0;
+
+    net_init(Map, &net);
+
+#pragma omp parallel
+    {
+	struct search s;
+	int j;
+
+	s.dist = (double *)G_malloc((net.nnodes + 1) * sizeof(double));
+	s.reached = (int *)G_calloc(net.nnodes + 1, sizeof(int));
+	s.done = (int *)G_calloc(net.nnodes + 1, sizeof(int));
+	s.target = (int *)G_calloc(net.nnodes + 1, sizeof(int));
+	s.heap = NULL;
+	s.nheap = s.aheap = 0;
+
+#pragma omp for schedule(dynamic)
+	for (i = 0; i < ncities; i++) {
+	    int id = i + 1, ntargets = 0, last;
+
+	    last = cost_symmetric ? i : ncities;
+	    for (j = 0; j < last; j++) {
+		if (s.target[cities[j]] != id) {
+		    s.target[cities[j]] = id;
+		    ntargets++;
+		}
+	    }
+	    search_from(&net, &s, id, cities[i], ntargets);
+
+	    for (j = 0; j < last; j++) {
+		if (s.reached[cities[j]] == id) {
+		    COST_CACHE(i, j) = s.dist[cities[j]];
+		}
+		else {
+#pragma omp critical (unreachable)
+		    {
+			if (!unreachable) {
+			    from_node = cities[i];
+			    to_node = cities[j];
+			}
+			unreachable = 1;
+		    }
+		    COST_CACHE(i, j) = 0;
+		}
+	    }
+	    COST_CACHE(i, i) = 0;
+
+#pragma omp critical (progress)
+	    G_percent(++ndone, ncities, 2);
+	}
+
+	G_free(s.dist);
+	G_free(s.reached);
+	G_free(s.done);
+	G_free(s.target);
+	G_free(s.heap);
+    }
+
+    G_free(net.first);
+    G_free(net.to);
+    G_free(net.cost);
+
+    if (unreachable)
+	G_fatal_error(_("Destination node [%d] is unreachable "
+			"from node [%d]"), from_node, to_node);
+}
@@ -43,8 +43,8 @@ int optimize_nbrs(int city1, int tncyc, int *tcycle)
 	city = wrap_into(j, tncyc);
 	prev = wrap_into(city - 1, tncyc);
 	nxt = wrap_into(city + 1, tncyc);
-	ocost1 = cost_cache[tcycle[prev]][tcycle[city]] +
-		 cost_cache[tcycle[city]][tcycle[nxt]];
+	ocost1 = COST_CACHE(tcycle[prev], tcycle[city]) +
+		 COST_CACHE(tcycle[city], tcycle[nxt]);
 	gain = 0;
 	tmpcost = 0;
 	city2 = tcycle[city];
@@ -54,16 +54,16 @@ int optimize_nbrs(int city1, int tncyc, int *tcycle)
 	    nxtk = wrap_into(k + 1, tncyc);
 	    
 	    /* original costs */
-	    ocost2 = cost_cache[tcycle[prevk]][tcycle[k]] +
-		      cost_cache[tcycle[k]][tcycle[nxtk]];
+	    ocost2 = COST_CACHE(tcycle[prevk], tcycle[k]) +
+		      COST_CACHE(tcycle[k], tcycle[nxtk]);
 
 	    /* new costs:
 	     * (city1 - 1) -> k -> (city1 + 1)
 	     * (k - 1) -> city1 -> (k + 1) */
-	    tmpcost = cost_cache[tcycle[prev]][tcycle[k]] +
-		      cost_cache[tcycle[k]][tcycle[nxt]] +
-		      cost_cache[tcycle[prevk]][tcycle[city]] +
-		      cost_cache[tcycle[city]][tcycle[nxtk]];
+	    tmpcost = COST_CACHE(tcycle[prev], tcycle[k]) +
+		      COST_CACHE(tcycle[k], tcycle[nxt]) +
+		      COST_CACHE(tcycle[prevk], tcycle[city]) +
+		      COST_CACHE(tcycle[city], tcycle[nxtk]);
 
 	    if (ocost1 + ocost2 - tmpcost > gain) {
 		gain = ocost1 + ocost2 - tmpcost;
@@ -109,11 +109,11 @@ int opt_2opt(int *tcycle, int *tcused, int tncyc)
 	    if (nxt2 == i)
 		continue;
 
-	    cost = cost_cache[tcycle[i]][tcycle[i + 1]] + 
-	           cost_cache[tcycle[j]][tcycle[j + 1]];
+	    cost = COST_CACHE(tcycle[i], tcycle[i + 1]) + 
+	           COST_CACHE(tcycle[j], tcycle[j + 1]);
 		   
-	    new_cost = cost_cache[tcycle[i]][tcycle[j + 1]] + 
-	               cost_cache[tcycle[j]][tcycle[i + 1]];
+	    new_cost = COST_CACHE(tcycle[i], tcycle[j + 1]) + 
+	               COST_CACHE(tcycle[j], tcycle[i + 1]);
 
 	    if (new_cost > cost)
 		continue;
@@ -327,18 +327,18 @@ int optimize_tour(int *tcycle, int *tcused, int tncyc, int chain_length,
 	    for (j = 0; j < tncyc; j++) {
 		/* cost from j to j + 1 (directional) */
 		/* get cost from directional cost cache */
-		tcost = cost_cache[tcycle[j]][tcycle[j + 1]];
+		tcost = COST_CACHE(tcycle[j], tcycle[j + 1]);
 		tmpcost = -tcost;
 
 		/* check insertion of city between j and j + 1 */
 
 		/* cost from j to city (directional) */
 		/* get cost from directional cost cache */
-		tcost = cost_cache[tcycle[j]][city];
+		tcost = COST_CACHE(tcycle[j], city);
 		tmpcost += tcost;
 		/* cost from city to j + 1 (directional) */
 		/* get cost from directional cost cache */
-		tcost = cost_cache[city][tcycle[j + 1]];
+		tcost = COST_CACHE(city, tcycle[j + 1]);
 		tmpcost += tcost;
 		
 		/* tmpcost must always be > 0 */
@@ -365,8 +365,8 @@ int optimize_tour(int *tcycle, int *tcused, int tncyc, int chain_length,
 	tcycle[tncyc] = tcycle[0];
 	ccycle[tncyc] = ccycle[0];
 	for (j = 0; j < tncyc; j++) {
-	    ocost1 += cost_cache[ccycle[j]][ccycle[j + 1]];
-	    ocost2 += cost_cache[tcycle[j]][tcycle[j + 1]];
+	    ocost1 += COST_CACHE(ccycle[j], ccycle[j + 1]);
+	    ocost2 += COST_CACHE(tcycle[j], tcycle[j + 1]);
 	}
 	if (ocost1 - ocost2 > 0.001) {
 	    success = 1;
@@ -101,18 +101,18 @@ int build_tour(int *cycle, int *cused, int *tncyc, int optimize, int opt_high)
 	for (j = 0; j < ncyc; j++) {
 	    /* cost from j to j + 1 (directional) */
 	    /* get cost from directional cost cache */
-	    tcost = cost_cache[cycle[j]][cycle[j + 1]];
+	    tcost = COST_CACHE(cycle[j], cycle[j + 1]);
 	    tmpcost = -tcost;
 
 	    /* check insertion of city between j and j + 1 */
 
 	    /* cost from j to city (directional) */
 	    /* get cost from directional cost cache */
-	    tcost = cost_cache[cycle[j]][city];
+	    tcost = COST_CACHE(cycle[j], city);
 	    tmpcost += tcost;
 	    /* cost from city to j + 1 (directional) */
 	    /* get cost from directional cost cache */
-	    tcost = cost_cache[city][cycle[j + 1]];
+	    tcost = COST_CACHE(city, cycle[j + 1]);
 	    tmpcost += tcost;
 	    
 	    /* tmpcost must always be > 0 */